@@ -0,0 +1,75 @@
+#ifndef COMPRESSION_H_
+#define COMPRESSION_H_
+
+#include <string>
+#include "base.h"
+
+// Codecs of the SST DataBlocks. The codec of each block is recorded in the
+// block trailer, so that the blocks written by different codecs can be read
+// by the same database.
+class Compression {
+ public:
+  // The values are persisted in the SST files, DO NOT change them.
+  enum Type : uint8_t {
+    kNoCompression = 0,
+    kTCLZCompression = 1,  // Built-in TCLZ, always available
+    kZlibCompression = 2   // Available if built with TCDB_HAVE_ZLIB
+  };
+
+  Compression() = delete;
+  Compression(const Compression&) = delete;
+  Compression& operator=(const Compression&) = delete;
+  ~Compression() = default;
+
+  // Return the codec of the config value: "none", "lz" or "zlib". An unknown
+  // or unavailable codec falls back to kNoCompression.
+  static Type FromName(const std::string& name);
+
+  // Return true if the codec can be used in this build
+  static bool Supported(const Type type);
+
+  // Compress the input and return the output by reference. Return false if
+  // the codec is unavailable or the output does not save at least 1/8 of the
+  // input, in which case the caller stores the input uncompressed.
+  static bool Compress(const Type type, const char* input, const size_t size,
+                       std::string& output);
+
+  // Uncompress the input compressed by the codec and return the output by
+  // reference.
+  static Status Uncompress(const Type type, const char* input,
+                           const size_t size, std::string& output);
+};
+
+// TCLZ is a byte-oriented LZ77 codec in the spirit of LZ4. It trades ratio for
+// speed: matches are found by a single hash probe of 4 bytes, and the output
+// needs no entropy decoding.
+// Format:
+//   varint32 uncompressed size | sequence | ... | sequence
+// where each sequence is:
+//   token(1B) | [literal length extension] | literals |
+//   offset(2B, little endian) | [match length extension]
+// The high 4 bits of the token are the literal length and the low 4 bits are
+// the match length minus kMinMatch. A length of 15 is extended by the
+// following bytes, which are added up until a byte other than 255. The last
+// sequence has literals only and ends at the end of the input.
+class TCLZ {
+ public:
+  static constexpr int kMinMatch = 4;
+
+  static constexpr int kMaxOffset = 65535;
+
+  TCLZ() = delete;
+  TCLZ(const TCLZ&) = delete;
+  TCLZ& operator=(const TCLZ&) = delete;
+  ~TCLZ() = default;
+
+  // Append the compressed input to the output
+  static void Compress(const char* input, const size_t size,
+                       std::string& output);
+
+  // Return false if the input is corrupted
+  static bool Uncompress(const char* input, const size_t size,
+                         std::string& output);
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef CRC32C_H_
+#define CRC32C_H_
+
+#include "base.h"
+
+namespace crc32c {
+
+// CRC-32C (Castagnoli), the checksum of the SST blocks. It is computed by the
+// SSE4.2 crc32 instruction if the CPU supports it, otherwise by the portable
+// slicing-by-8 tables. Both give the same result.
+
+// Return the crc32c of concat(A, data[0, size - 1]) where init_crc is the
+// crc32c of some string A. Extend() is often used to maintain the crc32c of a
+// stream of data.
+uint32_t Extend(const uint32_t init_crc, const char* data, const size_t size);
+
+// Return the crc32c of data[0, size - 1]
+inline uint32_t Value(const char* data, const size_t size) {
+  return Extend(0, data, size);
+}
+
+// Return true if Extend() runs on the SSE4.2 crc32 instruction
+bool IsHardwareAccelerated();
+
+static const uint32_t kMaskDelta = 0xa282ead8ul;
+
+// Return a masked representation of the crc. The CRC of a string that
+// contains embedded CRCs is weak, so the stored CRCs are masked.
+inline uint32_t Mask(const uint32_t crc) {
+  // Rotate right by 15 bits and add a constant
+  return ((crc >> 15) | (crc << 17)) + kMaskDelta;
+}
+
+// Return the crc whose masked representation is masked_crc
+inline uint32_t Unmask(const uint32_t masked_crc) {
+  uint32_t rot = masked_crc - kMaskDelta;
+  return ((rot >> 17) | (rot << 15));
+}
+
+}  // namespace crc32c
+
+#endif
@@ -31,6 +31,16 @@ class Filter {
   virtual Status CreateFilter(const std::vector<Sequence>& entry_set,
                               std::string& filter_content) const = 0;
 
+  // Build a filter incrementally, for the entries that are streamed rather
+  // than collected in a vector: StartFilter() sizes an empty filter for at
+  // most num_entries entries, and AddEntry() adds the key of an
+  // InternalEntry.
+  virtual void StartFilter(const size_t num_entries,
+                           std::string& filter_content) const = 0;
+
+  virtual void AddEntry(const char* internal_entry,
+                        std::string& filter_content) const = 0;
+
   virtual bool ContainsKey(const Sequence& key,
                              std::string& filter_content) const = 0;
 
@@ -53,6 +63,12 @@ class TCBloomFilter : public Filter {
   virtual Status CreateFilter(const std::vector<Sequence>& entry_set,
                               std::string& filter_content) const override;
 
+  virtual void StartFilter(const size_t num_entries,
+                           std::string& filter_content) const override;
+
+  virtual void AddEntry(const char* internal_entry,
+                        std::string& filter_content) const override;
+
   virtual bool ContainsKey(const Sequence& key,
                              std::string& filter_content) const override;
 
@@ -66,4 +82,51 @@ class TCBloomFilter : public Filter {
   std::shared_ptr<Hasher> hasher_;
 };
 
+// Bloom filter for the in-memory TCTable.
+// Different from the TCBloomFilter, which builds a filter from a complete
+// entry set when an SST file is written, the keys of a TCTable arrive one by
+// one. The TCDynamicBloomFilter therefore has a fixed number of bits decided
+// at construction, and each AddKey() sets bits by atomic fetch_or() so that
+// writers never take a lock. A query may race with an insertion of the same
+// key, which is equivalent to the query being executed before the insertion.
+class TCDynamicBloomFilter {
+ public:
+  // 6 probes give a ~1% false positive rate at 10 bits per key, and stay
+  // below ~5% even when the TCTable holds twice the expected number of keys.
+  static const int kDefaultHashK = 6;
+
+  TCDynamicBloomFilter() = delete;
+  explicit TCDynamicBloomFilter(const uint32_t filter_bytes,
+                                const int hash_k = kDefaultHashK);
+
+  TCDynamicBloomFilter(const TCDynamicBloomFilter&) = delete;
+  TCDynamicBloomFilter& operator=(const TCDynamicBloomFilter&) = delete;
+
+  ~TCDynamicBloomFilter() = default;
+
+  // Add a raw key (not an InternalEntry) into the filter. Lock-free.
+  void AddKey(const Sequence& key);
+
+  // Return false if the key is definitely not in the filter.
+  bool MayContain(const Sequence& key) const;
+
+ private:
+  // Use one Murmur2 hash and derive the probes by double hashing:
+  //   probe(i) = h1 + i * h2
+  inline uint64_t Hash(const Sequence& key) const {
+    return hasher_.Hash(key.data(), key.size(), kSeed);
+  }
+
+  const uint64_t kSeed = 0x6fef439dc013aaa6;
+
+  const uint64_t kBitCount;
+
+  const int hash_k_;
+
+  std::unique_ptr<std::atomic<uint64_t>[]> bits_;
+
+  // Murmur2::Hash() is stateless but not declared as const
+  mutable Murmur2 hasher_;
+};
+
 #endif
\ No newline at end of file
@@ -1,6 +1,8 @@
 #ifndef FORMAT_H_
 #define FORMAT_H_
 
+#include <map>
+
 #include "tools.h"
 
 class FileFormat {
@@ -13,30 +15,104 @@ class FileFormat {
  private:
 };
 
-// Manifest file format as:
-// L1: path of the manifest file
-// L2: path of the log file
-// L3: level 0     file names, seperated by ";"
-// Li: level (i-3) file names, seperated by ";"
+// MANIFEST file format: a log of VersionEdits, each of them in a record as:
+//   uint32_t size of the payload | uint32_t masked crc32c of the payload |
+//   payload
+// The first record is a snapshot, i.e. a VersionEdit that adds all the live
+// files to an empty MANIFEST, and each record after it is appended on a
+// change of the version. A crash in the middle of an append leaves a torn
+// record at the end, which is ignored by the recovery. Once the appended
+// records outgrow the snapshot, a new snapshot is written to a temporary file
+// and renamed to the MANIFEST.
+// The payload of a VersionEdit is a sequence of tagged fields:
+//   kNextFileNumber: varint64 number
+//   kLastEntryID:    varint64 id
+//   kDeletedFile:    varint32 level | varint32 name size | name
+//   kNewFile:        varint32 level | varint32 index in the level |
+//                    varint32 name size | name | varint64 file size |
+//                    varint32 smallest size | smallest |
+//                    varint32 largest size | largest
+// The tags are persisted, DO NOT change them.
 class ManifestFormat : public FileFormat {
  public:
   struct ManifestData {
-    std::string path_to_manifest;
-    std::string path_to_log;
+    // File names of each level
     std::vector<std::vector<std::string>> data_files;
   };
 
+  // A file added to the MANIFEST, with the metadata that saves reading the
+  // file at the startup. The smallest and the largest are empty if unknown.
+  struct NewFile {
+    int level = 0;
+    // Position of the file in the level after the deleted files are removed.
+    // The files of an edit are inserted in order.
+    int index = 0;
+    std::string name;
+    uint64_t file_size = 0;
+    std::string smallest;
+    std::string largest;
+  };
+
+  // Changes from one version of the MANIFEST to the next one
+  struct VersionEdit {
+    bool has_next_file_number = false;
+    uint64_t next_file_number = 0;
+
+    // Largest entry id persisted in the SST files
+    bool has_last_entry_id = false;
+    uint64_t last_entry_id = 0;
+
+    // Pairs of <level, name>
+    std::vector<std::pair<int, std::string>> deleted_files;
+
+    std::vector<NewFile> new_files;
+
+    void SetNextFileNumber(const uint64_t number) {
+      has_next_file_number = true;
+      next_file_number = number;
+    }
+
+    void SetLastEntryID(const uint64_t id) {
+      has_last_entry_id = true;
+      last_entry_id = id;
+    }
+
+    void DeleteFile(const int level, const std::string& name) {
+      deleted_files.emplace_back(level, name);
+    }
+
+    void AddFile(const int level, const int index, const std::string& name,
+                 const uint64_t file_size, const std::string& smallest,
+                 const std::string& largest);
+  };
+
+  enum Tag : uint32_t {
+    kNextFileNumber = 1,
+    kLastEntryID = 2,
+    kDeletedFile = 3,
+    kNewFile = 4
+  };
+
+  // Size of the record header: payload size and crc
+  static constexpr int kRecordHeaderSize = 8;
+
   ManifestFormat() = delete;
   ManifestFormat(const ManifestFormat&) = delete;
   ManifestFormat& operator=(const ManifestFormat&) = delete;
   ~ManifestFormat() = default;
 
-  // Decode std::string to ManifestData. DO NOT check legality.
-  static ManifestData Decode(const std::string& manifest_str);
+  // Encode the edit into a record
+  static std::string EncodeRecord(const VersionEdit& edit);
 
-  // Encode ManifestData to std::string. The content of the std::string is the
-  // same as the MANIFEST text file.
-  static std::string Encode(const ManifestData& manifest);
+  // Decode the record at src and advance src past it. Return Corruption if
+  // the record is truncated, its checksum mismatches or it has an unknown
+  // tag.
+  static Status DecodeRecord(const char*& src, const char* end,
+                             VersionEdit& edit);
+
+  // Apply the edit to the manifest: remove the deleted files, then insert the
+  // new files at their indexes.
+  static void Apply(const VersionEdit& edit, ManifestData& manifest);
 
  private:
 };
@@ -57,60 +133,149 @@ class LogFormat : public FileFormat {
  private:
 };
 
+// SST file format as:
+//   DataBlock | ... | DataBlock | IndexBlock | [meta block | ...] |
+//   smallest entry | largest entry | MetaindexBlock | Footer
+// The optional meta blocks (e.g. the bloom filter) are found by their names
+// in the MetaindexBlock, so that new kinds of blocks can be added without
+// changing the Footer. A reader skips the meta blocks it does not know.
+// The boundary entries, the MetaindexBlock and the Footer are at the tail of
+// the file, so that they are usually read by a single IO.
 class DataFileFormat : public FileFormat {
  public:
-  struct DataBlock {
-    ;
+  // Written in every Footer. Increase it on incompatible changes of the
+  // format; a reader rejects the files of a newer version.
+  static const uint32_t kSSTFormatVersion = 1;
+
+  // "tcdbsst\x01" in little endian, the last 8 bytes of every SST file
+  static const uint64_t kSSTMagicNumber = 0x0174737362646374ull;
+
+  // Name of the bloom filter block in the MetaindexBlock
+  static const char* const kFilterBlockName;
+
+  // Name of the TableProperties block in the MetaindexBlock
+  static const char* const kPropertiesBlockName;
+
+  // The position of a block in the SST file, including its checksum
+  struct BlockHandle {
+    BlockHandle() = default;
+    BlockHandle(const uint64_t o, const uint64_t s) : offset(o), size(s) {}
+
+    uint64_t end() const { return offset + size; }
+
+    uint64_t offset = 0;
+    uint64_t size = 0;
   };
 
+  static const int kBlockHandleSize = 2 * sizeof(uint64_t);
+
+  // IndexBlock: uint64_t count | uint64_t offset of each DataBlock | crc
   struct IndexBlock {
-    uint32_t data_blk_count;
-    uint32_t* data_blk_offset;
+    uint64_t data_blk_count;
+    uint64_t* data_blk_offset;
   };
 
-  // TODO: Unimplemented
-  struct FlexibleBlock {
-    uint32_t crc;
-  };
+  // The DataBlocks, the IndexBlock, the meta blocks and the MetaindexBlock
+  // end with the masked crc32c of the rest of the block, see crc32c::Mask()
+  static const int kChecksumSize = sizeof(uint32_t);
 
+  // Footer (kSSTFooterSize bytes) as:
+  //   uint64_t data_blk_size | 4 BlockHandles: smallest entry, largest
+  //   entry, IndexBlock, MetaindexBlock | uint32_t format version |
+  //   uint32_t masked crc32c of the preceding bytes | uint64_t magic number
+  // The DataBlocks start at offset 0.
   struct Footer {
-    Footer() = default;
-    explicit Footer(const char* footer_str) {
-      min_key_size = *reinterpret_cast<const uint32_t*>(footer_str);
-      max_key_offset = *reinterpret_cast<const uint32_t*>(footer_str + 4);
-      max_key_size = *reinterpret_cast<const uint32_t*>(footer_str + 8);
-      data_blk_size = *reinterpret_cast<const uint32_t*>(footer_str + 12);
-      index_blk_size = *reinterpret_cast<const uint32_t*>(footer_str + 16);
-      flexible_blk_size = *reinterpret_cast<const uint32_t*>(footer_str + 20);
+    uint64_t data_blk_size = 0;
+    BlockHandle min_key;
+    BlockHandle max_key;
+    BlockHandle index;
+    BlockHandle metaindex;
+    uint32_t format_version = kSSTFormatVersion;
+
+    // Handles of the meta blocks by name, decoded from the MetaindexBlock by
+    // TCIO::ReadSSTFooter(). Not a part of the encoded Footer.
+    std::map<std::string, BlockHandle> meta_blocks;
+  };
+
+  // Statistics of an SST file collected by the writer, so that the
+  // compactions and the stats know the content of the file without reading
+  // its DataBlocks
+  struct TableProperties {
+    uint64_t num_entries = 0;
+
+    // Number of the kDelete entries
+    uint64_t num_deletions = 0;
+
+    // Bytes of the keys and the values (or merge operands), uncompressed
+    // and without the InternalEntry headers
+    uint64_t raw_key_size = 0;
+    uint64_t raw_value_size = 0;
+
+    uint64_t min_entry_id = 0;
+    uint64_t max_entry_id = 0;
+
+    // Seconds since the epoch when the file was written
+    uint64_t creation_time = 0;
+
+    // Count the InternalEntry in the statistics
+    void AddEntry(const char* internal_entry);
+
+    // Aggregate the statistics of another file. The creation_time is the
+    // oldest one.
+    void Add(const TableProperties& other);
+
+    double DeletionRatio() const {
+      return num_entries == 0
+                 ? 0
+                 : static_cast<double>(num_deletions) / num_entries;
     }
-    Footer(const uint32_t minks, const uint32_t maxko, const uint32_t maxks,
-           const uint32_t dbs, const uint32_t ibs, const uint32_t fbs)
-        : min_key_size(minks),
-          max_key_offset(maxko),
-          max_key_size(maxks),
-          data_blk_size(dbs),
-          index_blk_size(ibs),
-          flexible_blk_size(fbs) {}
-
-    // uint32_t min_key_offset = 0;
-    uint32_t min_key_size;
-    uint32_t max_key_offset;
-    uint32_t max_key_size;
-    uint32_t data_blk_size;
-    uint32_t index_blk_size;
-    uint32_t flexible_blk_size;
   };
 
-  static const int kSSTFooterSize = 6 * sizeof(uint32_t);
+  static const int kSSTFooterSize = sizeof(uint64_t) + 4 * kBlockHandleSize +
+                                    2 * sizeof(uint32_t) + sizeof(uint64_t);
+
+  // Bytes read from the end of an SST file at once by TCIO::ReadSSTFooter()
+  static const int kSSTTailReadSize = 4096;
+
+  // Each DataBlock is followed by a trailer of 1 byte recording the
+  // Compression::Type of the block and the checksum of the block and the type
+  static const int kBlockTrailerSize = 1 + kChecksumSize;
 
   // When the current data block size > kDefaultDataBlkSize, the writer
   // writes the current data block into the SST file at once.
-  // The real size of a data block can be calculated by the start address
-  // of the next block minus the start address of the current block.
+  // The real size of a data block on disk, including the compression and the
+  // trailer, can be calculated by the start address of the next block minus
+  // the start address of the current block.
   static const int kDefaultDataBlkSize = 4096;
 
   static const int kApproximateSSTFileSize = 1 << 21;
 
+  // Encode the Footer except the meta_blocks
+  static std::string EncodeFooter(const Footer& footer);
+
+  // Decode kSSTFooterSize bytes to the Footer. Return Corruption if it is not
+  // a Footer, or BadArgumentError if the format version is unknown.
+  static Status DecodeFooter(const char* footer_str, Footer& footer);
+
+  // MetaindexBlock: [varint32 name size | name | BlockHandle] ... | crc
+  // Encode the meta_blocks without the checksum
+  static std::string EncodeMetaindex(
+      const std::map<std::string, BlockHandle>& meta_blocks);
+
+  // Decode the MetaindexBlock without the checksum
+  static Status DecodeMetaindex(const std::string& metaindex,
+                                std::map<std::string, BlockHandle>& meta_blocks);
+
+  // Properties block: [varint32 name size | name | varint64 value] ... | crc
+  // A reader skips the unknown names and leaves the missing properties 0, so
+  // that properties can be added without a new format version.
+  // Encode the TableProperties without the checksum
+  static std::string EncodeProperties(const TableProperties& props);
+
+  // Decode the properties block without the checksum
+  static Status DecodeProperties(const std::string& contents,
+                                 TableProperties& props);
+
   DataFileFormat() = delete;
   DataFileFormat(const DataFileFormat&) = delete;
   DataFileFormat& operator=(const DataFileFormat&) = delete;
@@ -119,4 +284,6 @@ class DataFileFormat : public FileFormat {
  private:
 };
 
+using TableProperties = DataFileFormat::TableProperties;
+
 #endif
\ No newline at end of file
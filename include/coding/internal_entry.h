@@ -12,12 +12,15 @@
 // +---------------------------------------------------------------+
 // |  Key Sequence  |  ID(uint64_t)  |  OpType  |  Value Sequence  |
 // +---------------------------------------------------------------+
-// OpType denotes current operation type, either 1 for insert or 0 for delete.
+// OpType denotes current operation type, 1 for insert, 0 for delete or 2 for
+// merge. A delete has no Value Sequence, and the value of a merge is an
+// operand of the MergeOperator.
 class InternalEntry {
  public:
   enum OpType {
     kDelete = 0,
-    kInsert = 1
+    kInsert = 1,
+    kMerge = 2
   };
 
   ~InternalEntry() = default;
@@ -33,6 +36,9 @@ class InternalEntry {
   // Return the key of the given InternalEntry by Sequence
   static Sequence EntryKey(const char* internal_entry);
 
+  // Return the ID of the given InternalEntry
+  static uint64_t EntryID(const char* internal_entry);
+
   // Return the key of the given InternalEntry by Sequence
   // ASSERT: the value exists
   static Sequence EntryValue(const char* internal_entry);
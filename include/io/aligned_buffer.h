@@ -0,0 +1,66 @@
+#ifndef ALIGNED_BUFFER_H_
+#define ALIGNED_BUFFER_H_
+
+#include "base.h"
+
+// A buffer for the direct I/O. The address, the capacity and the offsets and
+// sizes of the reads and the writes through it must be multiples of
+// kAlignment, the logical block size of most devices.
+class AlignedBuffer {
+ public:
+  static constexpr size_t kAlignment = 4096;
+
+  AlignedBuffer() = delete;
+
+  // The capacity is rounded up to a multiple of kAlignment. data() is
+  // nullptr and capacity() is 0 if the memory is not allocated.
+  explicit AlignedBuffer(const size_t capacity);
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  ~AlignedBuffer() { free(data_); }
+
+  char* data() { return data_; }
+  size_t capacity() const { return capacity_; }
+
+  static uint64_t RoundDown(const uint64_t n) { return n & ~(kAlignment - 1); }
+  static uint64_t RoundUp(const uint64_t n) {
+    return RoundDown(n + kAlignment - 1);
+  }
+
+ private:
+  char* data_ = nullptr;
+  size_t capacity_;
+};
+
+// Keep the released AlignedBuffers for reuse, so that the files written and
+// read by the direct I/O do not allocate and fault in a new buffer each time.
+// Thread-safe.
+class AlignedBufferPool {
+ public:
+  static constexpr size_t kDefaultMaxFreeBuffers = 8;
+
+  explicit AlignedBufferPool(
+      const size_t max_free_buffers = kDefaultMaxFreeBuffers)
+      : kMaxFreeBuffers(max_free_buffers) {}
+
+  AlignedBufferPool(const AlignedBufferPool&) = delete;
+  AlignedBufferPool& operator=(const AlignedBufferPool&) = delete;
+
+  // Return a free buffer of at least the size, or a new one if there is
+  // none. Return nullptr if the memory is not allocated.
+  std::unique_ptr<AlignedBuffer> Acquire(const size_t size);
+
+  // Keep the buffer for reuse, or drop it if kMaxFreeBuffers are kept
+  void Release(std::unique_ptr<AlignedBuffer> buffer);
+
+ private:
+  const size_t kMaxFreeBuffers;
+
+  std::vector<std::unique_ptr<AlignedBuffer>> free_buffers_;
+
+  std::mutex pool_mutex_;
+};
+
+#endif
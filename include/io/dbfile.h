@@ -27,15 +27,22 @@ class DBFile final {
   bool Open();
   bool Close();
 
+  // Read and write the opened file by the direct I/O (O_DIRECT), bypassing
+  // the page cache, or stop it. Return false if the file is not opened or
+  // the file system does not support it, and the mode is unchanged.
+  bool SetDirectIO(const bool direct_io);
+
   bool IsOpened() const { return fd_ >= 0; }
   void set_mode(Mode new_mode) { mode_ = new_mode; }
   int fd() const { return fd_; }
   Mode mode() const { return mode_; }
+  bool direct_io() const { return direct_io_; }
   const std::string& file_name() const { return file_name_; }
 
  private:
   int fd_ = -1;
   Mode mode_ = Mode::kReadOnly;
+  bool direct_io_ = false;
   std::string file_name_;
 };
 
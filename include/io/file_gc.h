@@ -0,0 +1,65 @@
+#ifndef FILE_GC_H_
+#define FILE_GC_H_
+
+#include <condition_variable>
+#include <functional>
+#include <set>
+#include <thread>
+#include <vector>
+#include "io.h"
+
+// TCFileGC deletes the obsolete SST files in a background thread.
+// The files removed from the latest version (e.g. the compaction inputs) are
+// added as candidates. A candidate is deleted once no live version
+// references it, otherwise it is retried later, because a reader may still
+// hold an older version that includes the file.
+// The deletion is rate-limited by bytes, so that a mass deletion after a
+// large compaction does not stall the foreground IOs.
+class TCFileGC {
+ public:
+  // Interval to retry the candidates still referenced by live versions
+  static constexpr int kRetryIntervalMs = 1000;
+
+  TCFileGC() = delete;
+
+  // Params:
+  //   live_files: return the names of the SST files referenced by any live
+  //               version by reference;
+  //   rate_bytes_per_sec: max bytes deleted per second, 0 if unlimited.
+  TCFileGC(TCIO& io,
+           const std::function<void(std::set<std::string>&)>& live_files,
+           const uint64_t rate_bytes_per_sec);
+
+  TCFileGC(const TCFileGC&) = delete;
+  TCFileGC& operator=(const TCFileGC&) = delete;
+
+  // Stop the background thread. The candidates left are not deleted.
+  ~TCFileGC();
+
+  // Add the files that are no longer in the latest version
+  void AddCandidates(const std::vector<std::string>& file_basenames);
+
+  // Number of the files waiting for deletion
+  int PendingFiles();
+
+ private:
+  void BackgroundGC();
+
+  TCIO& io_;
+
+  std::function<void(std::set<std::string>&)> live_files_;
+
+  const uint64_t rate_bytes_per_sec_;
+
+  std::mutex mutex_;
+
+  std::condition_variable cv_;
+
+  std::set<std::string> candidates_;
+
+  bool shutting_down_ = false;
+
+  std::thread gc_thread_;
+};
+
+#endif
@@ -1,8 +1,16 @@
+#ifndef IO_H_
+#define IO_H_
+
+#include "cache.h"
+#include "compression.h"
+#include "crc32c.h"
 #include "db_table.h"
 #include "filter.h"
 #include "format.h"
 #include "logger.h"
+#include "rate_limiter.h"
 #include "reader.h"
+#include "table_builder.h"
 #include "tools.h"
 #include "writer.h"
 
@@ -12,19 +20,30 @@ class TCIO {
  public:
   const int kDefaultReaderBufferSize = 4096;
 
-  // kDefaultWriterBufferSize is for SequentialWriter that writes data blocks into
-  // the SST file. Default writer buffer size should be equal to default block
-  // size:
-  // TCIO::kDefaultWriterBufferSize == DataFileFormat::kDefaultDataBlkSize
+  // kDefaultWriterBufferSize is for the SequentialWriters of the small
+  // metadata files
   const int kDefaultWriterBufferSize = 4096;
 
   // Construct kDefaultReaderNum SequentialReader object in readers_ vector
   const int kDefaultReaderNum = 4;
 
+  // Max readahead of each input file of a compaction. The memory of a
+  // compaction grows by this per input file and subcompaction.
+  const uint64_t kCompactionReadaheadSize = 1 << 20;  // 1MB
+
   const std::string kDatabaseDir;
 
   const std::string kManifestFilename = "MANIFEST";
 
+  // A new snapshot of the MANIFEST is written to the temporary file first,
+  // and renamed to the MANIFEST once it is synced
+  const std::string kManifestTempFilename = "MANIFEST.tmp";
+
+  // The MANIFEST is snapshotted once the records appended after the last
+  // snapshot exceed both the size of the snapshot and this size, so that
+  // the cost of the snapshots is amortized into the appends
+  const uint64_t kManifestSnapshotMinLogSize = 64 * 1024;
+
   const std::string kLogFilename = "LOG";
 
   const std::string kSSTFilePostfix = ".tdb";
@@ -39,7 +58,10 @@ class TCIO {
 
   ~TCIO();
 
-  Status WriteLevel0File(const TCTable* immutable, Manifest& manifest,
+  // Write the immutable table to a new SST file and return the file name by
+  // reference. The caller is responsible for installing the file in level 0
+  // of the MANIFEST.
+  Status WriteLevel0File(const TCTable* immutable, std::string& file_basename,
                          const std::shared_ptr<Filter>& filter);
 
   // Different from the implementation of WriteLevel0File(), the caller
@@ -69,31 +91,41 @@ class TCIO {
       std::shared_ptr<MemAllocator>& merge_allocator,
       const std::shared_ptr<Filter>& filter);
 
-  // Update the Manifest file after merging.
-  // Params:
-  //   old_manifest: it it what it is;
-  //   compact_file_index: the element of the std::vector is of type
-  //                       std::pair<int, int>, the first element denotes the
-  //                       level of the compact file, and the second denotes
-  //                       the number of it in its level;
-  //   new_files: vector of std::string, basename only;
-  //   current_level: the lowest level among the compact files.
-  //   insert_index: new files will be inserted on the insert_index. Files
-  //                 smaller than the new files are at [0, insert_index).
-  Status UpdateManifest(
-      Manifest& old_manifest,
-      const std::vector<std::pair<int, int>>& compact_file_index,
-      const std::vector<std::string>& new_files, const int current_level,
-      const int insert_index);
-
-  // Read MANIFEST file at kDatabaseDir/kManifestFilename
-  Status ReadManifest(Manifest& read_status);
-
-  // Read the Footer of the SST file and store it in the memory
+  // Delete the SST file and return its size by reference
+  Status DeleteSSTFile(const std::string& file_basename, uint64_t& file_size);
+
+  // Return the basenames of all the SST files in the kDatabaseDir by
+  // reference, whether a version references them or not
+  Status ListSSTFiles(std::vector<std::string>& file_basenames);
+
+  // Replay the MANIFEST file and return the result as a snapshot, i.e. an
+  // edit adding all the live files with their metadata, by reference. A torn
+  // record at the end is truncated. The file numbers allocated afterwards
+  // are larger than the recorded next file number and all the SST files in
+  // the kDatabaseDir.
+  Status RecoverManifest(ManifestFormat::VersionEdit& snapshot);
+
+  // Append the edit to the MANIFEST and sync it. The next file number, and
+  // the last entry id if the edit has none, are filled in.
+  Status LogManifestEdit(ManifestFormat::VersionEdit& edit);
+
+  // Return true if the MANIFEST should be replaced by a snapshot instead of
+  // appending the next edit
+  bool ManifestSnapshotDue();
+
+  // Replace the MANIFEST by the snapshot atomically: the snapshot is written
+  // and synced to kManifestTempFilename, which is then renamed to the
+  // MANIFEST. The next file number and the last entry id are filled in.
+  Status WriteManifest(ManifestFormat::VersionEdit& snapshot);
+
+  // Read the Footer and the MetaindexBlock of the SST file and store them in
+  // the memory. Return Corruption if it is not an SST file.
   Status ReadSSTFooter(const std::string& file_abs_path,
                        DataFileFormat::Footer& footer_content);
 
-  // Read the Footer of the SST file and return min/max keys by reference
+  // Read the Footer of the SST file and return min/max keys by reference.
+  // The tail of the file is read by a single IO, which usually covers the
+  // min/max keys and the MetaindexBlock as well.
   Status ReadSSTFooter(const std::string& file_abs_path,
                        DataFileFormat::Footer& footer_content,
                        std::string& min_key, std::string& max_key);
@@ -115,84 +147,210 @@ class TCIO {
       const std::vector<std::string>& file_abs_path,
       std::vector<std::pair<std::string, std::string>>& min_max_keys);
 
-  // Read the FlexibleBlock of the SST file and return it by reference
-  Status ReadSSTFlexible(const std::string& file_abs_path,
-                         const DataFileFormat::Footer& footer_content,
-                         std::string& flexible_content);
+  // Read the bloom filter block of the SST file and return it by reference.
+  // The filter_content is empty if the file has no filter.
+  Status ReadSSTFilter(const std::string& file_abs_path,
+                       const DataFileFormat::Footer& footer_content,
+                       std::string& filter_content);
+
+  // Read the TableProperties of the SST file and return them by reference.
+  // The properties are all 0 if the file has none.
+  Status ReadSSTProperties(const std::string& file_abs_path,
+                           const DataFileFormat::Footer& footer_content,
+                           TableProperties& props);
 
   // Read the IndexBlock of the SST file and store it in the memory
   Status ReadSSTIndex(const std::string& file_abs_path,
                       const DataFileFormat::Footer& footer_content,
-                      std::vector<uint32_t>& data_blk_offset);
-
-  Status ReadSSTDataBlock(const std::string& file_abs_path,
-                          std::shared_ptr<MemAllocator>& merge_allocator,
-                          std::vector<Sequence>& entry_set, const uint64_t size,
-                          const ::ssize_t offset,
-                          const int reuse_block_id = -1);
-
+                      std::vector<uint64_t>& data_blk_offset);
+
+  // Read the DataBlock at the offset, uncompress it and copy the entries into
+  // the merge_allocator. The uncompressed block is taken from the
+  // block_cache_ if it is there, otherwise it is added to the block_cache_
+  // unless fill_cache is false (e.g. the compactions, which read each block
+  // only once). The block is read through the input if it is not nullptr,
+  // see NewCompactionInput().
+  Status ReadSSTDataBlock(
+      const std::string& file_abs_path,
+      std::shared_ptr<MemAllocator>& merge_allocator,
+      std::vector<Sequence>& entry_set, const uint64_t size,
+      const ::ssize_t offset, const int reuse_block_id = -1,
+      const bool fill_cache = true,
+      const std::shared_ptr<ReadaheadReader>& input = nullptr);
+
+  // Open the SST file for the sequential reads of a compaction. The reads
+  // are served from windows of up to kCompactionReadaheadSize, read by the
+  // direct I/O if it is enabled by SetUseDirectIO().
+  std::shared_ptr<ReadaheadReader> NewCompactionInput(
+      const std::string& file_abs_path);
+
+  // Read all the DataBlocks listed in data_blk_offset, which ends with the
+  // size of the DataBlocks
   Status ReadSSTDataAll(const std::string& file_abs_path,
-                     std::shared_ptr<MemAllocator>& merge_allocator,
-                     std::vector<Sequence>& entry_set, const uint64_t size,
-                     const ::ssize_t offset);
+                        std::shared_ptr<MemAllocator>& merge_allocator,
+                        std::vector<Sequence>& entry_set,
+                        const std::vector<uint64_t>& data_blk_offset);
 
   // TODO: Argument?
   // Status WriteSSTFile(const std::vector<const char*> entry_set);
 
-  Status Log(const std::string& msg) { return logger_->Debug(msg); }
+  Status Log(const std::string& msg,
+             const TCLogger::LogLevel level = TCLogger::kDebug) {
+    return logger_->Log(level, msg);
+  }
+
+  // Return false if the messages of the level are dropped by the logger, so
+  // that the callers on the hot paths can skip building them
+  bool LogEnabled(const TCLogger::LogLevel level = TCLogger::kDebug) const {
+    return logger_->Enabled(level);
+  }
+
+  // Drop the messages below the level before they are formatted
+  void SetLogLevel(const TCLogger::LogLevel level) { logger_->SetLevel(level); }
+
+  // Throttle the writes of the flushes and the compactions by the
+  // rate_limiter, nullptr if unlimited
+  void SetRateLimiter(const std::shared_ptr<TCRateLimiter>& rate_limiter) {
+    rate_limiter_ = rate_limiter;
+  }
+
+  // Codec of the DataBlocks written afterwards. The blocks already written
+  // keep their own codecs.
+  void SetCompression(const Compression::Type compression) {
+    compression_ = compression;
+  }
+
+  // Verify the checksums of the blocks read from the SST files. The blocks
+  // in the block_cache_ have been verified when they were read, and are never
+  // verified again.
+  void SetVerifyChecksums(const bool verify_checksums) {
+    verify_checksums_ = verify_checksums;
+  }
+
+  // Buffer size of the WritableFiles that write the SST files. A larger
+  // buffer makes fewer and larger writes.
+  void SetWriterBufferSize(const size_t writer_buffer_size) {
+    writer_buffer_size_ = writer_buffer_size;
+  }
+
+  // Write the SST files of the flushes and the compactions, and read the
+  // inputs of the compactions, by the direct I/O, so that the background IO
+  // does not evict the blocks of the queries from the page cache. The queries
+  // keep reading through the page cache. The file systems without O_DIRECT
+  // (e.g. tmpfs) stay buffered.
+  void SetUseDirectIO(const bool use_direct_io) {
+    use_direct_io_ = use_direct_io;
+  }
+
+  // Start the writeback of the SST files every bytes_per_sync bytes, so that
+  // the final sync of each file is cheap and the writes are smooth. 0 to
+  // leave the writeback to the final sync.
+  void SetBytesPerSync(const uint64_t bytes_per_sync) {
+    bytes_per_sync_ = bytes_per_sync;
+  }
+
+  // Cache of the uncompressed DataBlocks, nullptr if disabled
+  void SetBlockCache(const std::shared_ptr<TCBlockCache>& block_cache) {
+    block_cache_ = block_cache;
+  }
+
+  // Block until the bytes of a background IO at the priority are granted by
+  // the rate limiter (if any)
+  void RequestIO(const int64_t bytes, const TCRateLimiter::IOPriority pri) {
+    if (rate_limiter_ != nullptr)
+      rate_limiter_->Request(bytes, pri);
+  }
 
  private:
+  // Take a SequentialReader from readers_. If readers_ is empty, a new
+  // SequentialReader is built and returned.
+  std::shared_ptr<SequentialReader> AcquireReader();
+
+  // Push the SequentialReader back to readers_, or drop it if readers_
+  // already holds kDefaultReaderNum readers.
+  void ReleaseReader(const std::shared_ptr<SequentialReader>& reader);
+
   // Build log and manifest metadata file
   Status BuildMetadataFile();
 
-  // Write manifest content to MANIFEST file at kDatabaseDir/kManifestFilename
-  Status WriteManifest(const Manifest& read_status);
+  // Write the content to the file, or append it if append is true, and sync
+  // the file
+  Status WriteSyncedFile(const std::string& file_abs_path,
+                         const std::string& content, const bool append);
+
+  // Return 1 + the largest number of the SST files in the kDatabaseDir, 0 if
+  // there is none
+  uint64_t NextSSTFileNumberOnDisk();
 
   // Write entry_set to specified SST file. Call vector<Sequence> version.
-  Status WriteSSTFile(const std::string& file_name,
-                      const std::vector<const char*>& entry_set);
+  Status WriteSSTFile(
+      const std::string& file_name, const std::vector<const char*>& entry_set,
+      const TCRateLimiter::IOPriority pri = TCRateLimiter::kIOLow);
 
-  // Write entry_set to specified SST file.
-  Status WriteSSTFile(const std::string& file_name,
-                      const std::vector<Sequence>& entry_set);
+  // Write entry_set to specified SST file without a filter. Call the filter
+  // version.
+  Status WriteSSTFile(
+      const std::string& file_name, const std::vector<Sequence>& entry_set,
+      const TCRateLimiter::IOPriority pri = TCRateLimiter::kIOLow);
 
   // Write entry_set to specified SST file. Call vector<Sequence> version.
-  Status WriteSSTFile(const std::string& file_name,
-                      const std::vector<const char*>& entry_set,
-                      const std::shared_ptr<Filter>& filter);
-
-  // Write entry_set to specified SST file. This version implements a filter
-  // policy and the filter content will be written into the FlexibleBlock.
-  // Other parts of this version are the same as the vector<Sequence> version.
-  Status WriteSSTFile(const std::string& file_name,
-                      const std::vector<Sequence>& entry_set,
-                      const std::shared_ptr<Filter>& filter);
-
-  // Write data blocks to SST file. Called by WriteSSTFile()
-  Status WriteSSTData(std::shared_ptr<SequentialWriter>& sw_ptr,
-                      const std::vector<Sequence>& entry_set,
-                      std::vector<uint32_t>& data_blk_offset,
-                      uint32_t& data_block_size);
-
-  // Write data block offset to SST file. Called by WriteSSTFile()
-  Status WriteSSTIndex(std::shared_ptr<SequentialWriter>& sw_ptr,
-                       const std::vector<uint32_t>& data_blk_offset);
-
-  // Write flexible to SST file. Called by WriteSSTFile()
-  // TODO: crc-32?
-  Status WriteSSTFlexible(std::shared_ptr<SequentialWriter>& sw_ptr,
-                          const std::string& flexible_content);
-
-  // Deprecated
-  Status WriteSSTFileFooter(std::shared_ptr<SequentialWriter>& sw_ptr,
-                            const uint32_t max_key_offset,
-                            const uint32_t data_block_size,
-                            const uint32_t index_block_size,
-                            const uint32_t flexible_block_size);
-
-  // Write SST file footer
-  Status WriteSSTFileFooter(std::shared_ptr<SequentialWriter>& sw_ptr,
-                            const DataFileFormat::Footer& footer);
+  Status WriteSSTFile(
+      const std::string& file_name, const std::vector<const char*>& entry_set,
+      const std::shared_ptr<Filter>& filter,
+      const TCRateLimiter::IOPriority pri = TCRateLimiter::kIOLow);
+
+  // Write entry_set to specified SST file by a TCTableBuilder. The
+  // TableProperties of the entries and the filter content, if the filter is
+  // not nullptr, are written into the meta blocks. The writes are throttled
+  // by the rate_limiter_ at the priority pri: kIOHigh for flushes and kIOLow
+  // for compactions.
+  Status WriteSSTFile(
+      const std::string& file_name, const std::vector<Sequence>& entry_set,
+      const std::shared_ptr<Filter>& filter,
+      const TCRateLimiter::IOPriority pri = TCRateLimiter::kIOLow);
+
+  // Verify the checksum at the end of the block read from the file and strip
+  // it. Return Corruption if it does not match.
+  Status VerifyChecksum(std::string& block,
+                        const std::string& file_abs_path) const;
+
+  // Read a DataBlock with its trailer and return the uncompressed content by
+  // reference
+  Status ReadBlockContents(const std::shared_ptr<SequentialReader>& reader,
+                           const std::string& file_abs_path,
+                           const uint64_t block_size,
+                           const ::ssize_t block_offset,
+                           std::string& contents);
+
+  // Read a DataBlock with its trailer through the input of a compaction
+  Status ReadBlockContents(ReadaheadReader& input, const uint64_t block_size,
+                           const ::ssize_t block_offset,
+                           std::string& contents);
+
+  // Verify the checksum of the block read with its trailer, strip the
+  // trailer and return the uncompressed content by reference
+  Status DecodeBlockContents(std::string& block,
+                             const std::string& file_abs_path,
+                             std::string& contents);
+
+  // Return the block at the handle from the tail of the SST file, which has
+  // been read at tail_offset, or read the block if it is not in the tail
+  Status ReadTailBlock(const std::shared_ptr<SequentialReader>& reader,
+                       const std::string& file_abs_path,
+                       const std::string& tail, const uint64_t tail_offset,
+                       const DataFileFormat::BlockHandle& handle,
+                       std::string& block);
+
+  // Close and delete the SST file that failed to be written, so that no file
+  // without a footer is left in the kDatabaseDir. Return the error.
+  Status AbandonSSTFile(WritableFile* wf, const std::string& file_name,
+                        const Status& error);
+
+  // Open a new SST file to be built by a TCTableBuilder. The writes are
+  // throttled by the rate_limiter_ at the priority pri. The space of the file
+  // is preallocated in blocks of kApproximateSSTFileSize.
+  std::shared_ptr<WritableFile> NewSSTFile(
+      const std::string& file_name, const TCRateLimiter::IOPriority pri);
 
   // Reader workers for sequential reading
   // std::vector<SequentialReader*> readers_;
@@ -200,14 +358,44 @@ class TCIO {
 
   std::shared_ptr<TCLogger> logger_;
 
+  std::shared_ptr<TCRateLimiter> rate_limiter_;
+
+  Compression::Type compression_ = Compression::kNoCompression;
+
+  std::shared_ptr<TCBlockCache> block_cache_;
+
+  size_t writer_buffer_size_ = WritableFile::kDefaultBufferSize;
+
+  bool use_direct_io_ = false;
+
+  uint64_t bytes_per_sync_ = 0;
+
+  // AlignedBuffers of the direct I/O shared by the writers and the readers
+  std::shared_ptr<AlignedBufferPool> aligned_buffer_pool_;
+
+  bool verify_checksums_ = true;
+
   int file_levels_ = 0;
 
   // Use file id for .tdb file names.
   // For example, file_id_(0x35AC186F) refers to data file 0000000035AC186F.tdb
   uint64_t file_id_ = 0;
 
+  // Protect the MANIFEST states below
+  std::mutex manifest_mutex_;
+
+  // Sizes of the MANIFEST file and the snapshot at its beginning
+  uint64_t manifest_size_ = 0;
+  uint64_t snapshot_size_ = 0;
+
+  // Largest entry id recorded in the MANIFEST
+  bool has_last_entry_id_ = false;
+  uint64_t last_entry_id_ = 0;
+
   // Protect readers_ vector from concurrent unsafety
   RAIILock io_lock_;
 
   std::mutex io_mutex_;
-};
\ No newline at end of file
+};
+
+#endif
\ No newline at end of file
@@ -0,0 +1,137 @@
+#ifndef RATE_LIMITER_H_
+#define RATE_LIMITER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <random>
+
+// TCRateLimiter is a token bucket shared by all background IOs. The bucket is
+// refilled with rate_bytes_per_sec * refill_period_us / 1e6 bytes every
+// refill period, and the unused bytes are dropped, so that the bursts are
+// bounded by one period.
+// The flushes request at kIOHigh and the compactions at kIOLow. While a flush
+// is running, high_pri_reserve_percent of each refill is a budget of the
+// flushes that kIOLow can not take, which keeps the memtables from stalling
+// the writes. Otherwise the compactions can use the whole bucket.
+// The requests that can not be granted wait in a FIFO queue of each priority,
+// and kIOHigh is served first at the refill. To avoid starvation, kIOLow is
+// served first once every fairness refills on average.
+// The TCRateLimiter is thread-safe.
+class TCRateLimiter {
+ public:
+  enum IOPriority { kIOLow = 0, kIOHigh = 1, kIOTotal = 2 };
+
+  static constexpr int64_t kDefaultRefillPeriodUs = 100 * 1000;  // 100ms
+
+  static constexpr int kDefaultFairness = 10;
+
+  static constexpr int kDefaultHighPriReservePercent = 50;
+
+  TCRateLimiter() = delete;
+
+  TCRateLimiter(
+      const int64_t rate_bytes_per_sec,
+      const int64_t refill_period_us = kDefaultRefillPeriodUs,
+      const int fairness = kDefaultFairness,
+      const int high_pri_reserve_percent = kDefaultHighPriReservePercent);
+
+  TCRateLimiter(const TCRateLimiter&) = delete;
+  TCRateLimiter& operator=(const TCRateLimiter&) = delete;
+
+  ~TCRateLimiter() = default;
+
+  // Block until the bytes are granted. A request larger than one refill is
+  // split into several requests.
+  void Request(int64_t bytes, const IOPriority pri);
+
+  // Max bytes granted at a time
+  int64_t GetSingleBurstBytes() const { return refill_bytes_per_period_; }
+
+  // Total bytes granted at the priority
+  int64_t GetTotalBytesThrough(const IOPriority pri);
+
+ private:
+  struct Req {
+    Req(const int64_t _bytes) : bytes(_bytes) {}
+
+    int64_t bytes;
+    bool granted = false;
+  };
+
+  // Request at most MaxBurstBytes(pri) bytes
+  void RequestBurst(const int64_t bytes, const IOPriority pri);
+
+  int64_t MaxBurstBytes(const IOPriority pri) const {
+    return pri == kIOHigh ? refill_bytes_per_period_
+                          : refill_bytes_per_period_ - high_pri_reserve_bytes_;
+  }
+
+  // Bytes that must be left in the bucket after granting a request at the
+  // priority. REQUIRES: mutex_ held
+  int64_t ReservedBytes(const IOPriority pri, const int64_t now_us) const {
+    return pri == kIOLow && now_us - last_high_pri_us_ < refill_period_us_
+               ? high_pri_reserve_bytes_
+               : 0;
+  }
+
+  // Refill the bucket and grant the waiting requests in the order of the
+  // priorities. REQUIRES: mutex_ held
+  void RefillAndGrant(const int64_t now_us);
+
+  static int64_t NowMicros();
+
+  const int64_t refill_period_us_;
+
+  const int64_t refill_bytes_per_period_;
+
+  const int fairness_;
+
+  const int64_t high_pri_reserve_bytes_;
+
+  std::mutex mutex_;
+
+  // Signaled when some requests are granted
+  std::condition_variable cv_;
+
+  int64_t available_bytes_;
+
+  int64_t next_refill_us_;
+
+  // Time of the last kIOHigh request or grant, a flush is running if it is
+  // within a refill period
+  int64_t last_high_pri_us_;
+
+  std::deque<Req*> queue_[kIOTotal];
+
+  int64_t total_bytes_through_[kIOTotal] = {0, 0};
+
+  std::minstd_rand rnd_;
+};
+
+// Set the IO scheduling class of the calling thread through ioprio_set(2) in
+// the scope, and restore the previous one on destruction. It takes effect
+// only with the IO schedulers supporting priorities (e.g. BFQ), and does
+// nothing on other platforms.
+class ThreadIOPriority {
+ public:
+  enum IOClass { kNone = 0, kBestEffort = 2, kIdle = 3 };
+
+  // Lowest priority of the best effort class
+  static constexpr int kBestEffortLowest = 7;
+
+  ThreadIOPriority() = delete;
+  explicit ThreadIOPriority(const IOClass io_class);
+
+  ThreadIOPriority(const ThreadIOPriority&) = delete;
+  ThreadIOPriority& operator=(const ThreadIOPriority&) = delete;
+
+  ~ThreadIOPriority();
+
+ private:
+  // Previous ioprio of the thread, -1 if unchanged
+  int old_ioprio_ = -1;
+};
+
+#endif
@@ -6,6 +6,7 @@
 // #include <sys/types.h>
 #include <unistd.h>
 
+#include "aligned_buffer.h"
 #include "base.h"
 #include "dbfile.h"
 #include "sequence.h"
@@ -63,8 +64,13 @@ class SequentialReader : public BaseReader {
   SequentialReader(const SequentialReader&) = delete;
   SequentialReader& operator=(const SequentialReader&) = delete;
 
-  explicit SequentialReader(const int max_buffer_size = 1024)
-      : BaseReader(max_buffer_size) {}
+  // The files opened by the direct I/O are read through the AlignedBuffers
+  // taken from the aligned_buffer_pool, or new ones if it is nullptr
+  explicit SequentialReader(
+      const int max_buffer_size = 1024,
+      const std::shared_ptr<AlignedBufferPool>& aligned_buffer_pool = nullptr)
+      : BaseReader(max_buffer_size),
+        aligned_buffer_pool_(aligned_buffer_pool) {}
 
   ~SequentialReader();
 
@@ -78,6 +84,64 @@ class SequentialReader : public BaseReader {
   // Before calling this function, user should ensure the DBFile ptr is valid.
   virtual Status InternalRead(DBFile* file, std::string& ret,
                               const uint64_t size, const ::ssize_t offset);
+
+  // Read the aligned blocks covering the range by the direct I/O, and keep
+  // the range only
+  Status DirectRead(DBFile* file, std::string& ret, const uint64_t size,
+                    const ::ssize_t offset);
+
+  std::shared_ptr<AlignedBufferPool> aligned_buffer_pool_;
+};
+
+// Read a file in large chunks for the sequential reads of the compactions.
+// The file stays open for the lifetime of the reader, and each read is served
+// from a window of the file read ahead into an AlignedBuffer. The window
+// grows from kMinReadaheadSize to the max_readahead_size while the reads are
+// sequential, so that a few reads at random offsets stay cheap. The direct
+// I/O has no kernel readahead, this makes its reads large.
+// Not thread-safe.
+class ReadaheadReader {
+ public:
+  static constexpr uint64_t kMinReadaheadSize = 256 * 1024;  // 256KB
+
+  ReadaheadReader() = delete;
+
+  // The file is read by the direct I/O if direct_io is true and the file
+  // system supports it. The windows are taken from the aligned_buffer_pool,
+  // or new ones if it is nullptr.
+  ReadaheadReader(
+      const std::string& file_name, const uint64_t max_readahead_size,
+      const bool direct_io,
+      const std::shared_ptr<AlignedBufferPool>& aligned_buffer_pool = nullptr);
+
+  ReadaheadReader(const ReadaheadReader&) = delete;
+  ReadaheadReader& operator=(const ReadaheadReader&) = delete;
+
+  ~ReadaheadReader();
+
+  // Read size bytes at the offset of the file into ret
+  Status Read(std::string& ret, const uint64_t size, const ::ssize_t offset);
+
+  const std::string& file_name() const { return file_.file_name(); }
+
+ private:
+  // Read the window starting from the aligned block of the offset, which
+  // covers at least [offset, offset + size)
+  Status ReadWindow(const uint64_t size, const ::ssize_t offset);
+
+  DBFile file_;
+
+  const uint64_t max_readahead_size_;
+
+  uint64_t readahead_size_ = kMinReadaheadSize;
+
+  std::shared_ptr<AlignedBufferPool> aligned_buffer_pool_;
+
+  std::unique_ptr<AlignedBuffer> buffer_;
+
+  // Range of the file in the buffer_
+  uint64_t window_offset_ = 0;
+  uint64_t window_size_ = 0;
 };
 
 class RandomReader : public BaseReader {
@@ -0,0 +1,77 @@
+#ifndef TABLE_BUILDER_H_
+#define TABLE_BUILDER_H_
+
+#include "compression.h"
+#include "filter.h"
+#include "format.h"
+#include "writer.h"
+
+// Build an SST file from the entries added in ascending order, in a single
+// pass. Each DataBlock is written as soon as it is full, and the
+// TableProperties, the bloom filter and the IndexBlock are built along the
+// way, so that the entries are never collected in memory. An uncompressed
+// DataBlock is written from the memory of its entries by the WritableFile
+// without being assembled first.
+// NOT thread-safe.
+class TCTableBuilder {
+ public:
+  TCTableBuilder() = delete;
+
+  // The file must be empty. The filter, if not nullptr, is sized for at most
+  // max_entries entries.
+  TCTableBuilder(WritableFile* file, const Compression::Type compression,
+                 const std::shared_ptr<Filter>& filter,
+                 const size_t max_entries);
+
+  TCTableBuilder(const TCTableBuilder&) = delete;
+  TCTableBuilder& operator=(const TCTableBuilder&) = delete;
+
+  ~TCTableBuilder() = default;
+
+  // Add an InternalEntry larger than the added ones. The entry is referenced
+  // rather than copied, and must stay valid until Finish().
+  Status Add(const Sequence& entry);
+
+  // Write the last DataBlock, the IndexBlock, the meta blocks, the boundary
+  // entries, the MetaindexBlock and the Footer. The file is not closed.
+  Status Finish();
+
+  uint64_t num_entries() const { return props_.num_entries; }
+
+ private:
+  // Write the current DataBlock with its trailer
+  Status FlushDataBlock();
+
+  // Write a meta block or the MetaindexBlock with its checksum and return
+  // its handle by reference
+  Status WriteMetaBlock(const std::string& content,
+                        DataFileFormat::BlockHandle& handle);
+
+  // Append the masked crc32c of the block to the block
+  static void AppendChecksum(std::string& block);
+
+  WritableFile* file_;
+
+  const Compression::Type compression_;
+
+  std::shared_ptr<Filter> filter_;
+
+  std::string filter_content_;
+
+  TableProperties props_;
+
+  Sequence smallest_;
+  Sequence largest_;
+
+  std::vector<uint64_t> data_blk_offset_;
+
+  // Entries of the current DataBlock and their total size
+  std::vector<Sequence> block_entries_;
+  size_t block_size_ = 0;
+
+  // Buffers of the compression, reused for each DataBlock
+  std::string block_;
+  std::string compressed_;
+};
+
+#endif
@@ -4,11 +4,14 @@
 // #include <fcntl.h>
 // #include <sys/stat.h>
 // #include <sys/types.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "aligned_buffer.h"
 #include "base.h"
 #include "dbfile.h"
 #include "internal_entry.h"
+#include "rate_limiter.h"
 #include "sequence.h"
 #include "status.h"
 
@@ -44,11 +47,26 @@ class BaseWriter {
 
   const int pos() const { return pos_; }
 
+  // Draw the bytes of every write from the rate_limiter at the priority
+  void SetRateLimiter(const std::shared_ptr<TCRateLimiter>& rate_limiter,
+                      const TCRateLimiter::IOPriority pri) {
+    rate_limiter_ = rate_limiter;
+    io_priority_ = pri;
+  }
+
  private:
+  // Block until the bytes in buffer_ are granted by the rate_limiter_
+  void RateLimit() {
+    if (rate_limiter_ != nullptr)
+      rate_limiter_->Request(pos_, io_priority_);
+  }
+
   char* buffer_ = nullptr;
   int pos_ = 0;  // Points to the end of char sequence in buffer_
   bool required_sync_ = false;
   DBFile* dbfile_ = nullptr;
+  std::shared_ptr<TCRateLimiter> rate_limiter_;
+  TCRateLimiter::IOPriority io_priority_ = TCRateLimiter::kIOLow;
 };
 
 class SequentialWriter : private BaseWriter {
@@ -81,8 +99,132 @@ class SequentialWriter : private BaseWriter {
     return WriteFragment(fragment.c_str(), fragment.size());
   }
 
+  using BaseWriter::SetRateLimiter;
+
  private:
   // TODO: Any data members? Use static functions instead?
 };
 
+// A file written sequentially through a large buffer. Unlike the writers
+// above, the fd stays open for the lifetime of the object, so that a file is
+// written by a few large write() calls instead of an open(), a write() and a
+// close() for every small buffer. The data that does not fit in the buffer
+// is written by writev() directly from the caller's memory.
+// If the file is opened by the direct I/O, all data is copied into an
+// AlignedBuffer, which is written in whole blocks at aligned offsets. The
+// unaligned tail is written zero-padded by Sync() and Close(), and the
+// padding is truncated.
+// The file space can be preallocated ahead of the writes, and the writeback
+// of the written bytes can be started before the final sync, see
+// SetPreallocationBlockSize() and SetBytesPerSync().
+// NOT thread-safe.
+class WritableFile {
+ public:
+  static constexpr size_t kDefaultBufferSize = 1 << 20;  // 1MB
+
+  // Take the ownership of the dbf_ptr, which is opened by its mode. The
+  // buffer of the direct I/O is taken from the aligned_buffer_pool if it is
+  // not nullptr, and is rounded up to a multiple of AlignedBuffer::kAlignment.
+  explicit WritableFile(
+      DBFile* dbf_ptr, const size_t buffer_size = kDefaultBufferSize,
+      const std::shared_ptr<AlignedBufferPool>& aligned_buffer_pool = nullptr);
+
+  WritableFile(const WritableFile&) = delete;
+  WritableFile& operator=(const WritableFile&) = delete;
+
+  // Flush the buffer and close the file. Call Close() to check the errors.
+  ~WritableFile();
+
+  Status Append(const char* data, const size_t size);
+
+  Status Append(const std::string& data) {
+    return Append(data.data(), data.size());
+  }
+
+  // Append the entries in order. The entries are copied into the buffer
+  // while they fit, and written along with the buffer by a single writev()
+  // otherwise.
+  Status Append(const std::vector<Sequence>& entries);
+
+  // Write the buffer to the file. By the direct I/O, the unaligned tail stays
+  // in the buffer.
+  Status Flush();
+
+  // Flush the buffer and sync the file to the disk
+  Status Sync();
+
+  // Flush the buffer and close the file
+  Status Close();
+
+  // Bytes appended so far, including the buffered ones
+  uint64_t size() const { return size_; }
+
+  // Preallocate the file space by fallocate() in blocks of the size ahead of
+  // the writes, so that a file growing by appends is not fragmented. The
+  // preallocated space beyond the end of the file is released by Close().
+  // 0 to disable.
+  void SetPreallocationBlockSize(const uint64_t size) {
+    preallocation_block_size_ = size;
+  }
+
+  // Start the writeback of every bytes_per_sync bytes written by
+  // sync_file_range(), so that the dirty pages do not pile up until the
+  // final sync. 0 to disable.
+  void SetBytesPerSync(const uint64_t bytes_per_sync) {
+    bytes_per_sync_ = bytes_per_sync;
+  }
+
+  // Draw the bytes of every write from the rate_limiter at the priority
+  void SetRateLimiter(const std::shared_ptr<TCRateLimiter>& rate_limiter,
+                      const TCRateLimiter::IOPriority pri) {
+    rate_limiter_ = rate_limiter;
+    io_priority_ = pri;
+  }
+
+ private:
+  // Write the buffers by writev() until all bytes are written. The iovecs
+  // are modified.
+  Status WriteV(struct iovec* iov, int iovcnt);
+
+  // Write the size bytes of the aligned data at the aligned offset by the
+  // direct I/O
+  Status WriteDirect(const char* data, size_t size, uint64_t offset);
+
+  // Write the unaligned tail of the direct I/O zero-padded, and truncate the
+  // file to size_. The tail stays in the buffer.
+  Status WriteDirectTail();
+
+  // Preallocate the blocks covering [offset, offset + size) that are not
+  // preallocated yet
+  void PrepareWrite(const uint64_t offset, const size_t size);
+
+  // Start the writeback of the bytes before the end offset once
+  // bytes_per_sync_ bytes are written since the last one
+  void RangeSync(const uint64_t end);
+
+  // Block until the bytes are granted by the rate_limiter_ (if any)
+  void RateLimit(const int64_t bytes) {
+    if (rate_limiter_ != nullptr)
+      rate_limiter_->Request(bytes, io_priority_);
+  }
+
+  std::unique_ptr<DBFile> dbfile_;
+  bool direct_io_ = false;
+  const size_t buffer_size_;
+  std::shared_ptr<AlignedBufferPool> aligned_buffer_pool_;
+  std::unique_ptr<AlignedBuffer> aligned_buffer_;  // Owns buffer_ if direct_io_
+  std::unique_ptr<char[]> heap_buffer_;  // Owns buffer_ otherwise
+  char* buffer_ = nullptr;
+  size_t pos_ = 0;  // Bytes in the buffer_
+  uint64_t size_ = 0;
+  uint64_t direct_offset_ = 0;  // Aligned bytes written by the direct I/O
+  uint64_t file_offset_ = 0;    // End of the buffered writes in the file
+  uint64_t preallocation_block_size_ = 0;
+  uint64_t preallocated_end_ = 0;
+  uint64_t bytes_per_sync_ = 0;
+  uint64_t synced_end_ = 0;  // End of the last sync_file_range()
+  std::shared_ptr<TCRateLimiter> rate_limiter_;
+  TCRateLimiter::IOPriority io_priority_ = TCRateLimiter::kIOLow;
+};
+
 #endif
\ No newline at end of file
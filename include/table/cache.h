@@ -200,10 +200,10 @@ inline void LRUCache<Sequence, Sequence, SeqHash, SeqEqual>::Insert(
     std::memcpy(cache_k, key.data(), key.size());
     std::memcpy(cache_v, value.data(), value.size());
 
-    // Insert new record
+    // Insert new record, indexed by the copy of the key in the cache_pool_
     NodeData nd{Sequence(cache_k, key.size()), Sequence(cache_v, value.size()),
                 k_block_id, v_block_id};
-    index_[key] = data_.PushFront(nd);
+    index_[nd.key] = data_.PushFront(nd);
 
     ++this->size_;
   }
@@ -263,6 +263,42 @@ class TCCache {
   std::shared_ptr<Cache<Sequence, Sequence>> cache_;
 };
 
+// TCBlockCache holds the uncompressed DataBlocks read by the queries, so that
+// a hot block is neither read nor uncompressed again. A block is keyed by the
+// SST file and its offset in the file, since the SST files are immutable and
+// a running TCDB never reuses their names.
+// The capacity is counted in blocks of about DataFileFormat::
+// kDefaultDataBlkSize bytes. The TCBlockCache is thread-safe.
+class TCBlockCache {
+ public:
+  using Block = std::shared_ptr<const std::string>;
+
+  TCBlockCache() = delete;
+  explicit TCBlockCache(const uint32_t capacity);
+
+  TCBlockCache(const TCBlockCache&) = delete;
+  TCBlockCache& operator=(const TCBlockCache&) = delete;
+
+  ~TCBlockCache() = default;
+
+  // Return true and the block by reference if it is in the cache
+  bool Get(const std::string& file_abs_path, const uint64_t offset,
+           Block& block);
+
+  void Insert(const std::string& file_abs_path, const uint64_t offset,
+              const Block& block);
+
+ private:
+  static std::string BlockKey(const std::string& file_abs_path,
+                              const uint64_t offset) {
+    return file_abs_path + '#' + std::to_string(offset);
+  }
+
+  std::mutex mutex_;
+
+  LRUCache<std::string, Block> cache_;
+};
+
 struct SSTPage {
   uint64_t sst_id;
 };
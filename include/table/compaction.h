@@ -0,0 +1,354 @@
+#ifndef COMPACTION_H_
+#define COMPACTION_H_
+
+#include <set>
+#include <unordered_map>
+#include "comparator.h"
+#include "format.h"
+#include "io.h"
+
+// Metadata of an SST file, read from the Footer of the file only once, or
+// recorded in the MANIFEST
+struct FileMetaData {
+  uint64_t file_size = 0;
+
+  // Min/max InternalEntries of the file
+  std::string smallest;
+  std::string largest;
+
+  // Not read yet (the metaindex is empty) if the metadata is recorded in the
+  // MANIFEST
+  DataFileFormat::Footer footer;
+
+  // Loaded on the first TCCompactionPicker::GetFileProperties(), nullptr
+  // before
+  std::shared_ptr<const TableProperties> properties;
+};
+
+// A compaction that merges the inputs at <level> and the overlapped inputs
+// at the output level into new files at the output level, which is
+// <level + 1> except for level 0 (see LevelCompactionOptions). The files are
+// identified by names rather than positions, because other compactions and
+// flushes may change the MANIFEST between picking and installing.
+// A universal compaction merges several adjacent sorted runs instead: the
+// level_inputs are the level 0 files in the MANIFEST order and the
+// next_level_inputs are the files of the deeper levels, and the outputs
+// replace the oldest input run at a level above level 0, where they form a
+// single run however many files they are cut into.
+struct CompactionTask {
+  uint64_t id = 0;
+
+  int level = 0;
+
+  int output_level = 1;
+
+  double score = 0;
+
+  std::vector<std::string> level_inputs;
+
+  std::vector<std::string> next_level_inputs;
+
+  // Range of all inputs, which is also the range of the outputs
+  std::string smallest;
+  std::string largest;
+
+  // Min/max InternalEntries of the files overlapped with the range in each
+  // sorted run older than the outputs, ordered by key. Used for deciding
+  // whether a deletion can be dropped.
+  std::vector<std::vector<std::pair<std::string, std::string>>> deeper_ranges;
+
+  // Return true if no older sorted run may contain the key of the
+  // internal_entry, so that a deletion of the key is no longer needed.
+  bool IsBaseLevelForKey(const char* internal_entry) const;
+
+  // Return true if the single input file overlaps nothing at the output
+  // level, so that it can be moved to the output level by a MANIFEST-only
+  // edit instead of being rewritten
+  bool IsTrivialMove() const {
+    return level_inputs.size() == 1 && next_level_inputs.empty() &&
+           output_level > level;
+  }
+};
+
+// Statistics of one or more compactions
+struct CompactionStats {
+  int input_files = 0;
+  int output_files = 0;
+
+  // Files relinked by the trivial moves, not rewritten
+  int moved_files = 0;
+
+  uint64_t bytes_read = 0;
+  uint64_t bytes_written = 0;
+
+  void Add(const CompactionStats& other) {
+    input_files += other.input_files;
+    output_files += other.output_files;
+    moved_files += other.moved_files;
+    bytes_read += other.bytes_read;
+    bytes_written += other.bytes_written;
+  }
+};
+
+// Options of the leveled compaction. Level 0 is limited by the file number,
+// since every level 0 file may be searched by a read, and the deeper levels
+// are limited by bytes.
+struct LevelCompactionOptions {
+  // Number of levels, the last level is num_levels - 1
+  int num_levels = 12;
+
+  // Compact level 0 once it has this number of files
+  int level0_file_num_compaction_trigger = 4;
+
+  // Target bytes of level 1
+  uint64_t max_bytes_for_level_base = 20 * 1024 * 1024;
+
+  // Target bytes of level i + 1 / target bytes of level i
+  int max_bytes_for_level_multiplier = 10;
+
+  // Derive the targets backwards from the actual size of the largest level,
+  // which stays at the last level, instead of forwards from
+  // max_bytes_for_level_base. Level 0 is compacted into the first level whose
+  // target reaches max_bytes_for_level_base / multiplier (the base level),
+  // and the levels above it stay empty. This keeps the fanout of every level
+  // at the multiplier whatever the size of the data, which keeps the write
+  // amplification near the minimum.
+  bool dynamic_level_bytes = false;
+
+  // A file above level 0 whose fraction of deletions reaches this is picked
+  // first at its level, the densest first, whatever the CompactionPri. This
+  // drops the deleted data and stops the reads from skipping the deletions
+  // sooner. 0 disables it, which also saves reading the TableProperties.
+  double tombstone_ratio_threshold = 0.5;
+};
+
+// Options of the universal compaction. Every level 0 file and every
+// non-empty deeper level is a sorted run, newer runs at lower positions.
+struct UniversalCompactionOptions {
+  // Percentage of flexibility when comparing the run sizes. A run is merged
+  // with the newer candidates if its size <= the total size of the
+  // candidates * (100 + size_ratio) / 100.
+  int size_ratio = 1;
+
+  // Min number of runs merged by a size ratio compaction
+  int min_merge_width = 2;
+
+  // No compaction is picked unless the number of runs exceeds this. If no
+  // runs qualify by the size amplification or the size ratio, the newest
+  // runs are merged to reduce the number of runs to this.
+  int max_sorted_runs = 8;
+
+  // Merge all runs once the total size of the runs except the oldest exceeds
+  // this percentage of the oldest run
+  int max_size_amplification_percent = 200;
+};
+
+// TCCompactionPicker decides what to compact next. Each level is scored by
+// its size against its target, level 0 by the file number and other levels
+// by bytes (see LevelCompactionOptions). The level with the highest
+// score >= 1 is compacted first.
+//
+// The picker also tracks the running compactions, so that the compactions
+// on different levels or disjoint key ranges can run at the same time:
+//   1. A file can be the input of only one compaction;
+//   2. The key ranges of the compactions outputting to the same level must
+//      not overlap;
+//   3. Only one level 0 compaction runs at a time, since level 0 files
+//      overlap each other.
+// In the universal style, sorted runs of similar sizes are merged together
+// instead, which trades read amplification for much less write
+// amplification. Only one universal compaction runs at a time.
+// The TCCompactionPicker is thread-safe.
+class TCCompactionPicker {
+ public:
+  enum CompactionStyle {
+    kCompactionStyleLevel = 0,
+    kCompactionStyleUniversal = 1
+  };
+
+  // How to choose a file from a level above level 0
+  enum CompactionPri {
+    // Cycle through the key space, starting after the last compacted key
+    kRoundRobin = 0,
+    // The file with the least overlapped bytes at the next level relative to
+    // its own size, which minimizes the write amplification
+    kMinOverlappingRatio = 1
+  };
+
+  TCCompactionPicker() = delete;
+
+  // Params:
+  //   level: the number of levels is also used by the universal style;
+  //   sst_file_size: approximate size of an SST file;
+  //   universal: ignored unless the style is kCompactionStyleUniversal.
+  TCCompactionPicker(TCIO& io,
+                     const std::shared_ptr<InternalEntryComparator>& comparator,
+                     const LevelCompactionOptions& level,
+                     const uint64_t sst_file_size, const CompactionPri pri,
+                     const CompactionStyle style,
+                     const UniversalCompactionOptions& universal);
+
+  TCCompactionPicker(const TCCompactionPicker&) = delete;
+  TCCompactionPicker& operator=(const TCCompactionPicker&) = delete;
+
+  ~TCCompactionPicker() = default;
+
+  // Pick a compaction that does not conflict with the running ones, and
+  // register it as running. Return false if no level needs compaction.
+  bool PickCompaction(const Manifest& manifest, CompactionTask& task);
+
+  // Pick the compactions of all files at <level> overlapped with the range
+  // [smallest, largest] into <level + 1> (level 0 into the base level), split
+  // into tasks of disjoint key ranges that can run in parallel, and register
+  // them as running. An empty bound denotes an unbounded side of the range.
+  // In the universal style, a single task merges all sorted runs regardless
+  // of the level and the range.
+  // Return false if the inputs conflict with the running compactions. The
+  // tasks are empty if nothing at the level overlaps the range.
+  bool PickRangeCompaction(const Manifest& manifest, const int level,
+                           const std::string& smallest,
+                           const std::string& largest,
+                           std::vector<CompactionTask>& tasks);
+
+  // Unregister a finished (or failed) compaction
+  void ReleaseCompaction(const CompactionTask& task);
+
+  // Number of the running compactions
+  int RunningCompactions();
+
+  // Return the metadata of the file by reference
+  Status GetFileMeta(const std::string& file_basename, FileMetaData& meta);
+
+  // Return the TableProperties of the file by reference. They are read once
+  // and cached with the metadata of the file.
+  Status GetFileProperties(const std::string& file_basename,
+                           TableProperties& props);
+
+  // Cache the metadata of a file recorded in the MANIFEST, so that the file
+  // is not read until its footer is needed
+  void AddFileMeta(const std::string& file_basename, const FileMetaData& meta);
+
+  // Drop the cached metadata of a file that no longer exists in the MANIFEST
+  void EvictFileMeta(const std::string& file_basename);
+
+  CompactionStyle style() const { return style_; }
+
+  int num_levels() const { return level_.num_levels; }
+
+  // Score of the level. The level needs compaction if score >= 1.
+  // In the universal style, the score of the number of sorted runs.
+  double LevelScore(const Manifest& manifest, const int level);
+
+  // Target bytes of each level and the level that level 0 is compacted into,
+  // by reference
+  void LevelTargets(const Manifest& manifest,
+                    std::vector<uint64_t>& level_max_bytes, int& base_level);
+
+ private:
+  // Lock-free versions of the public functions. REQUIRES: mutex_ held
+  Status GetFileMetaLocked(const std::string& file_basename,
+                           FileMetaData*& meta);
+  Status GetFilePropertiesLocked(const std::string& file_basename,
+                                 const TableProperties*& props);
+  double LevelScoreLocked(const Manifest& manifest, const int level);
+
+  // Update the level_max_bytes_ and the base_level_ by the level sizes in the
+  // MANIFEST. Only the dynamic targets change.
+  void CalculateLevelTargets(const Manifest& manifest);
+
+  // Max input bytes of a task picked by PickRangeCompaction(), in files
+  static constexpr int kMaxRangeCompactionFiles = 25;
+
+  // Pick a level 0 compaction, starting from the oldest file
+  bool PickLevel0(const Manifest& manifest, CompactionTask& task);
+
+  // Add all level 0 files overlapped with the picked ones transitively, and
+  // fill the level_inputs and the range of the task. The range of the task
+  // should be set to the range of the picked files.
+  bool ExpandLevel0Inputs(const Manifest& manifest, std::vector<bool>& picked,
+                          CompactionTask& task);
+
+  // Pick a compaction of a level above level 0 by pri_, except that the
+  // tombstone-dense files go first
+  bool PickLevelN(const Manifest& manifest, const int level,
+                  CompactionTask& task);
+
+  // Find the files at <level> overlapped with [smallest, largest] and return
+  // their names and total size by reference
+  Status GetOverlappingInputs(const Manifest& manifest, const int level,
+                              const std::string& smallest,
+                              const std::string& largest,
+                              std::vector<std::string>& inputs,
+                              uint64_t& inputs_size);
+
+  // Fill the next_level_inputs and the range of the task, and check the
+  // conflicts with the running compactions
+  bool SetupOtherInputs(const Manifest& manifest, CompactionTask& task);
+
+  // A sorted run of the universal compaction: a level 0 file, or all files
+  // of a deeper level
+  struct SortedRun {
+    int level;
+    std::string file;  // Level 0 only
+    uint64_t size;
+  };
+
+  // Return the sorted runs from the newest to the oldest by reference
+  Status SortedRuns(const Manifest& manifest, std::vector<SortedRun>& runs);
+
+  // Pick a universal compaction by the size amplification, the size ratio or
+  // the number of runs, in that order
+  bool PickUniversal(const Manifest& manifest, CompactionTask& task);
+
+  // Fill the task with the runs [first, last] (newest first) and decide the
+  // output level, which is never level 0. The inputs may be extended to the
+  // older level 0 runs and the overlapped level 1 files.
+  bool SetupUniversalInputs(const Manifest& manifest,
+                            const std::vector<SortedRun>& runs,
+                            const int first, int last, CompactionTask& task);
+
+  // Assign an id to the task and register it as running
+  void RegisterTask(CompactionTask& task);
+
+  bool BeingCompacted(const std::vector<std::string>& files) const;
+
+  TCIO& io_;
+
+  std::shared_ptr<InternalEntryComparator> comparator_;
+
+  // Compare the keys only, for the overlaps of the files. The versions of a
+  // key in two files make them overlap, whatever their ids are.
+  QueryComparator key_comparator_;
+
+  const LevelCompactionOptions level_;
+
+  // Target bytes of each level, 0 for the levels above the base_level_
+  std::vector<uint64_t> level_max_bytes_;
+
+  // Output level of the level 0 compactions
+  int base_level_ = 1;
+
+  const uint64_t sst_file_size_;
+
+  const CompactionPri pri_;
+
+  const CompactionStyle style_;
+
+  const UniversalCompactionOptions universal_;
+
+  std::mutex mutex_;
+
+  std::unordered_map<std::string, FileMetaData> file_meta_;
+
+  // Names of the input files of the running compactions
+  std::set<std::string> being_compacted_;
+
+  std::vector<CompactionTask> running_;
+
+  // The largest key of the last compaction at each level, for kRoundRobin
+  std::vector<std::string> compact_pointer_;
+
+  uint64_t next_task_id_ = 0;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef COMPACTION_FILTER_H_
+#define COMPACTION_FILTER_H_
+
+#include <cstdint>
+#include <string>
+#include "sequence.h"
+
+// CompactionFilter is a user hook of the compactions. It is called for the
+// newest version of each key merged by a compaction, unless the version is a
+// deletion, and can keep, remove or rewrite the entry. A removed entry is
+// turned into a deletion if an older version of the key may exist in a deeper
+// level, so that the older version does not come back.
+// Several compactions call the filter at the same time, so the filter must
+// be thread-safe. The files moved by the trivial moves are not filtered.
+class CompactionFilter {
+ public:
+  enum Decision {
+    kKeep = 0,
+    kRemove = 1,
+    // Replace the value with new_value
+    kChangeValue = 2
+  };
+
+  virtual ~CompactionFilter() = default;
+
+  // Params:
+  //   level: output level of the compaction;
+  //   new_value: the new value if kChangeValue is returned, by reference.
+  virtual Decision Filter(const int level, const Sequence& key,
+                          const Sequence& value,
+                          std::string& new_value) const = 0;
+
+  virtual const char* Name() const = 0;
+};
+
+// TTLCompactionFilter removes the entries older than ttl_seconds. The value
+// of each entry must end with the write time in seconds since the epoch, as
+// appended by AppendTimestamp(). An expired entry is still returned by the
+// reads until a compaction removes it.
+class TTLCompactionFilter : public CompactionFilter {
+ public:
+  // Size of the timestamp suffix
+  static constexpr int kTimestampSize = 8;
+
+  TTLCompactionFilter() = delete;
+  explicit TTLCompactionFilter(const uint64_t ttl_seconds)
+      : ttl_seconds_(ttl_seconds) {}
+
+  TTLCompactionFilter(const TTLCompactionFilter&) = delete;
+  TTLCompactionFilter& operator=(const TTLCompactionFilter&) = delete;
+
+  ~TTLCompactionFilter() override = default;
+
+  Decision Filter(const int level, const Sequence& key, const Sequence& value,
+                  std::string& new_value) const override;
+
+  const char* Name() const override { return "TTLCompactionFilter"; }
+
+  // Return the value with the current time appended
+  static std::string AppendTimestamp(const Sequence& value);
+
+  // Return the value without the timestamp suffix
+  static Sequence StripTimestamp(const Sequence& value);
+
+ private:
+  static uint64_t NowSeconds();
+
+  const uint64_t ttl_seconds_;
+};
+
+#endif
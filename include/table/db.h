@@ -1,8 +1,13 @@
 #include "cache.h"
+#include "compaction.h"
+#include "compaction_filter.h"
 #include "config.h"
 #include "db_table.h"
+#include "file_gc.h"
 #include "io.h"
 #include "lock_util.h"
+#include "merge_iterator.h"
+#include "merge_operator.h"
 #include "thread_pool.h"
 #include "version.h"
 #include "writer.h"
@@ -15,29 +20,35 @@ class TCDB {
   const int kDefaultSSTFileSize =
       DataFileFormat::kApproximateSSTFileSize;  // 2MB
 
-  // const int kDefaultLevel0FileNum = 4;
-
-  // Max level for SST files. When kMaxLevel == 12, the max level number is 11.
-  const int kMaxLevel = 12;  // TODO: Construct by Config
-
-  // Default max files number at each level. This property should be constructed
-  // in the construction function. kDefaultLevelSize can be calculated by rules
-  // as follows: level 0 and level 1 size can be arbitrary, but level 0 should
-  // be smaller than level 1; from the third level, we have:
-  //                      level(i + 1) = level(i) * E
-  // where E is an exponential specified by the user. In the LevelDB, E = 10
-  // and level(0) = 4, level(1) = 10.
-  std::vector<long> kDefaultLevelSize{
-      4,           10,          100,      1000,      10000,
-      100000,      1000000,     10000000, 100000000, 1000000000,
-      10000000000, 100000000000};  // TODO:Construct by Config
-
-  TCDB(const Config& config);
+  // Interval for CompactRange() to retry when its inputs are being compacted
+  const int kCompactRangeRetryIntervalMs = 100;
+
+  // The compaction_filter is called by all compactions, see
+  // CompactionFilter. If it is null and the config "compaction_filter_ttl" is
+  // not "0", a TTLCompactionFilter is used.
+  // The merge_operator is required by Merge(). If it is null, the built-in
+  // one named by the config "merge_operator" is used, if any.
+  // Check status() before using a TCDB constructed directly, or use Open().
+  TCDB(const Config& config,
+       const std::shared_ptr<CompactionFilter>& compaction_filter = nullptr,
+       const std::shared_ptr<MergeOperator>& merge_operator = nullptr);
   TCDB(const TCDB&) = delete;
   TCDB& operator=(const TCDB&) = delete;
 
   ~TCDB();
 
+  // Open the database in the config and return it by reference. Return the
+  // error and a nullptr db if the database can not be opened, e.g. the
+  // MANIFEST is corrupted or unreadable.
+  static Status Open(
+      const Config& config, std::unique_ptr<TCDB>& db,
+      const std::shared_ptr<CompactionFilter>& compaction_filter = nullptr,
+      const std::shared_ptr<MergeOperator>& merge_operator = nullptr);
+
+  // Error of opening the database. A database that failed to open never
+  // touches its files, all operations fail with this error.
+  Status status() const { return open_status_; }
+
   std::string Get(const Sequence& key);
 
   Status Insert(const Sequence& key, const Sequence& value);
@@ -46,87 +57,153 @@ class TCDB {
 
   Status Delete(const Sequence& key);
 
-  bool ContainsKey(const Sequence& key);
-
-  Status Log(const std::string& msg) { return io_.Log(msg); }
-
-  // // For test
-  // const std::vector<const char*> EntrySet() {
-  //   return mem_table_->EntrySet();
-  // }
+  // Add a merge operand of the key without reading the value, see
+  // MergeOperator. Return BadArgumentError if there is no merge operator.
+  Status Merge(const Sequence& key, const Sequence& operand);
 
-  // For test: compactions, write files...
-  void TestEntryPoint() {
-    // WriteLevel0();  // Done
-
-    Manifest manifest;
-    io_.ReadManifest(manifest);
-
-    Status ret = BackgroundCompact(manifest);
+  bool ContainsKey(const Sequence& key);
 
-    // DataFileFormat::Footer footer;
-    // io_.ReadSSTFooter(manifest.data_files[0][0], footer);
+  // Compact all files overlapped with the key range [begin, end] down to the
+  // target_level, one level at a time. The mem_table_ is flushed first, so
+  // that the recent writes (e.g. bulk deletions) are compacted too. The files
+  // of a level are split into tasks of disjoint key ranges, which run on the
+  // thread pool in parallel.
+  // Params:
+  //   begin, end: an empty one denotes an unbounded side of the range;
+  //   target_level: <= 0 for the deepest non-empty level. Ignored in the
+  //                 universal style, where all sorted runs are merged;
+  //   stats: files and bytes read/written by the compactions, by reference;
+  //   progress: called with the level and the stats so far after each level.
+  Status CompactRange(
+      const Sequence& begin, const Sequence& end, const int target_level,
+      CompactionStats& stats,
+      const std::function<void(int, const CompactionStats&)>& progress =
+          nullptr);
+
+  // Return the TableProperties of the SST files aggregated by level, by
+  // reference. The properties of each file are read once and cached, the
+  // DataBlocks are never read.
+  Status GetLevelProperties(std::vector<TableProperties>& level_props);
+
+  Status Log(const std::string& msg,
+             const TCLogger::LogLevel level = TCLogger::kDebug) {
+    return io_.Log(msg, level);
   }
 
  private:
-  Status TransferTable(const TCTable** immutable);
+  // If the mem_table_ is full, transfer it to an immutable table and flush
+  // the immutable table in the background. Block until the previous flush
+  // finishes.
+  Status MakeRoomForWrite(const Sequence& key);
 
-  // This function is triggered when the mem_table_ reaches max size
-  Status WriteLevel0();
+  // Transfer the mem_table_ to an immutable table and flush it in the
+  // background. Block until the previous flush finishes.
+  // REQUIRES: mmt_trans_lock_ held for writing
+  Status SwitchMemTable();
 
-  // MVCCWriteLevel0 has similar behavior to the WriteLevel0,
-  // but this function is concurrently safe.
+  // Flush the mem_table_ if it is not empty, and block until the flush
+  // finishes and its file is installed in level 0
+  Status FlushMemTable();
+
+  // Flush the immutable table to a new level 0 file in the background.
   // This function is triggered when the mem_table_ reaches max size.
   Status MVCCWriteLevel0(const TCTable* immutable);
 
-  // Start background compaction, and return whether the compaction process was
-  // successfully started. The compaction process may take a lot of time, so
-  // any operation would be recorded in the LOG file and executed after the
-  // compaction is finished.
-  Status BackgroundCompact(Manifest& manifest);
-
-  // Compact the SST file. Find all overlapped SST files at current level (if
-  // current_level == 0) and the next level (current_level + 1), make a vector
-  // that includes all overlapped files, and then call MultiwayMerge().
-  Status CompactSST(Manifest& manifest, const int current_level,
-                    const int compact_file_num);
-
-  // Compact the SST file. Find all overlapped SST files at current level (if
-  // current_level == 0) and the next level (current_level + 1), make a vector
-  // that includes all overlapped files, and then call MultiwayMerge().
-  // Note: all files are at the same level and MUST be continuous!
-  Status CompactSST(Manifest& manifest, const int current_level,
-                    const std::vector<int>& compact_file_num);
-
-  // Called by BackgroundCompact(). This function initializes the multiway
-  // merge process by reading the index blocks of the compact files and pushing
-  // the first DataBlock of each file into the priority queue. The real merging
-  // process will be done in IterMerge().
+  // Pick compactions and submit them to the thread pool, until the number of
+  // running compactions reaches max_background_compactions_ or nothing is
+  // left to compact. Compactions on different levels or disjoint key ranges
+  // run concurrently.
+  void MaybeScheduleCompaction();
+
+  // Thread pool task of a scheduled compaction. Run the compaction, release
+  // it from the compaction_picker_ and schedule the following compactions.
+  Status ScheduledCompact(const CompactionTask& task);
+
+  // Merge the input files of the task and install the new files. A trivial
+  // move installs the input file at the output level without merging.
+  // The stats of the compaction are added to the stats if it is not nullptr.
+  Status CompactSST(const CompactionTask& task,
+                    CompactionStats* stats = nullptr);
+
+  // Apply the result of the compaction to the latest version: remove the
+  // input files by name and insert the new files at the output level by
+  // their key range. The output level is never level 0. The versions are
+  // installed one at a time.
+  Status InstallCompaction(const CompactionTask& task,
+                           const std::vector<std::string>& new_files);
+
+  // Apply the edit to the latest version, log it to the MANIFEST file (or
+  // write a snapshot of the new version instead if the MANIFEST has grown
+  // enough) and append the new version as the latest one.
+  // REQUIRES: version_mutex_ held
+  Status InstallVersion(ManifestFormat::VersionEdit& edit);
+
+  // Add the file to the edit with its metadata from the compaction_picker_
+  Status AddFileToEdit(const int level, const int index,
+                       const std::string& file_basename,
+                       ManifestFormat::VersionEdit& edit);
+
+  // Called by CompactSST(). Large compactions are split into several
+  // subcompactions of disjoint key ranges, which run on the thread pool in
+  // parallel. The new files are returned in ascending order, also the ones
+  // written before a failure, which the caller deletes.
+  Status MultiwayMerge(const std::vector<std::string>& compact_file_abs_path,
+                       const CompactionTask& task,
+                       std::vector<std::string>& new_files);
+
+  // Merge the entries in the range [lower_bound, upper_bound) of the compact
+  // files. This function builds an SSTBlockIterator for each compact file and
+  // a MergingIterator over them. The real merging process will be done in
+  // IterMerge(). An empty bound denotes an unbounded side of the range.
   Status MultiwayMerge(const std::vector<std::string>& compact_file_abs_path,
+                       const CompactionTask& task,
+                       const std::string& lower_bound,
+                       const std::string& upper_bound,
                        std::vector<std::string>& new_files);
 
-  // Iterately merge the files
+  // Split the compaction into subcompactions by the min/max keys of the
+  // compact files. Return the ascending boundaries between the
+  // subcompactions by reference, empty if the compaction should not be split.
+  Status SubcompactionBoundaries(
+      const std::vector<std::string>& compact_file_abs_path,
+      std::vector<std::string>& boundaries);
+
+  // Iterately merge the files. Only the newest version of each key is kept,
+  // and a deletion is dropped if no level deeper than the output level may
+  // contain its key. The merge operands are applied to the older version of
+  // the key, or resolved to an insertion if no deeper level may contain the
+  // key. The newest version of each key is passed to the compaction_filter_
+  // before the check. Each full SST file is written by a writer thread while
+  // the entries of the next one are being merged.
   // Params:
-  //   compact_files_abs_path: compaction files absolute path;
-  //   priority_queue: see the implementation of TCDB::MultiwayMerge();
+  //   merger: the MergingIterator that outputs the entries of all compaction
+  //           files in ascending order;
   //   merge_allocator: the mem pool that takes control of the real entry data;
-  //   file_entry_in_queue: file_entry_in_queue[i] denotes the number of
-  //                        entries from the i-th file in the queue;
-  //   index_list: IndexBlock info;
-  //   new_files: newly written SST files, basename only.
-  Status IterMerge(
-      const std::vector<std::string>& compact_files_abs_path,
-      std::priority_queue<std::tuple<Sequence, int, int>,
-                          std::vector<std::tuple<Sequence, int, int>>,
-                          MergeComparator>& priority_queue,
-      std::shared_ptr<MemAllocator>& merge_allocator,
-      std::vector<int>& file_entry_in_queue,
-      const std::vector<std::vector<uint32_t>>& index_list,
-      std::vector<std::string>& new_files);
-
-  // Search the query_key on the specified level
+  //   task: the compaction that the merge belongs to;
+  //   new_files: newly written SST files, basename only, also returned if
+  //              the merge fails.
+  Status IterMerge(MergingIterator& merger,
+                   std::shared_ptr<MemAllocator>& merge_allocator,
+                   const CompactionTask& task,
+                   std::vector<std::string>& new_files);
+
+  // Search the query_key on the specified level. The merge operands found
+  // before an insertion or a deletion are appended to the operands, from the
+  // newest to the oldest, and the ret_key is left empty so that the search
+  // goes on with the older data.
   Status SearchLevel(const Sequence& query_key, Sequence& ret_key,
-                     const Manifest& manifest, const int level);
+                     const Manifest& manifest, const int level,
+                     std::vector<std::string>& operands);
+
+  // If the entry found by SearchLevel() is a merge operand, append the operand
+  // to the operands, clear the entry and return true
+  bool TakeOperand(Sequence& entry, std::vector<std::string>& operands);
+
+  // Return the value of the key by applying the operands, from the newest to
+  // the oldest, to the base_entry, which is nullptr if the key has no older
+  // version
+  std::string ApplyOperands(const Sequence& key, const char* base_entry,
+                            const std::vector<std::string>& operands);
 
   // Get query_key and corresponding value from the SST file.
   // If the query_key exists, it should be unique and the searching process
@@ -146,7 +223,11 @@ class TCDB {
 
   std::mutex mutex_;  // Basic mutex
 
-  std::mutex compact_mutex_;  // Mutex for compaction
+  std::mutex compact_mutex_;  // Mutex for compaction scheduling
+
+  std::condition_variable compact_cv_;  // Signaled when a compaction finishes
+
+  std::mutex version_mutex_;  // Mutex for installing new versions
 
   std::mutex mmt_mutex_;  // Mutex for concurrently write the mem_table_
 
@@ -158,16 +239,46 @@ class TCDB {
 
   std::shared_ptr<InternalEntryComparator> comparator_;
 
-  TCTable* volatile mem_table_;
+  TCTable* volatile mem_table_ = nullptr;
+
+  // Size in bytes of the bloom filter of each TCTable, 0 if disabled
+  uint32_t mem_filter_size_;
+
+  // Max number of subcompactions that one compaction can be split into
+  int max_subcompactions_;
+
+  // Max number of compactions running at the same time
+  int max_background_compactions_;
+
+  // IO scheduling class of the threads running compactions
+  ThreadIOPriority::IOClass compaction_io_class_;
+
+  // Number of the scheduled compactions, protected by compact_mutex_
+  int scheduled_compactions_ = 0;
+
+  // Set by the destructor to stop scheduling compactions
+  bool shutting_down_ = false;
 
   std::shared_ptr<Filter> filter_;
 
+  std::shared_ptr<CompactionFilter> compaction_filter_;
+
+  std::shared_ptr<MergeOperator> merge_operator_;
+
+  // Set by the constructor if the database can not be opened
+  Status open_status_;
+
   TCIO io_;
 
   TCVersionCtrl version_ctrl_;
 
   std::shared_ptr<TCThreadPool> thread_pool_;
 
+  std::shared_ptr<TCCompactionPicker> compaction_picker_;
+
+  // Deletes the SST files that are not referenced by any version
+  std::shared_ptr<TCFileGC> file_gc_;
+
   // Cache module for the keys and values. Both key and value should be of type
   // Sequence, the Cache is in charge of underlying storage for the Sequence.
   std::shared_ptr<TCCache> query_cache_;
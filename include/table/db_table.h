@@ -2,9 +2,11 @@
 #define DB_TABLE_H_
 
 #include "comparator.h"
+#include "filter.h"
 #include "internal_entry.h"
 #include "mem_allocator.h"
 #include "lock_util.h"
+#include "merge_operator.h"
 #include "skiplist.h"
 #include "status.h"
 
@@ -13,9 +15,16 @@
 class TCTable {
  public:
   TCTable() = delete;
+
+  // If filter_bytes > 0, a TCDynamicBloomFilter of filter_bytes bytes is
+  // built for the table, and the lookups of absent keys return at once
+  // without traversing the skiplist.
+  // The merge_operator collapses the merge operands of each key in
+  // LatestEntrySet(), and is required by Merge().
   TCTable(RAIILock& lock,
           const std::shared_ptr<InternalEntryComparator>& comparator,
-          const uint64_t first_entry_id);
+          const uint64_t first_entry_id, const uint32_t filter_bytes = 0,
+          const std::shared_ptr<MergeOperator>& merge_operator = nullptr);
 
   TCTable(const TCTable&) = delete;
   TCTable& operator=(const TCTable&) = delete;
@@ -26,22 +35,86 @@ class TCTable {
 
   const Sequence Get(const char* internal_entry) const;
 
+  // Similar to Get(), but return the newest InternalEntry of the key, which
+  // may be a deletion. Return nullptr if the key is not in the table.
+  const char* GetEntry(const char* internal_entry) const;
+
+  // Return all versions of the key in the table by reference, from the oldest
+  // to the newest
+  void GetVersions(const Sequence& key,
+                   std::vector<const char*>& versions) const;
+
   Status Insert(const Sequence& key, const Sequence& value);
 
   Status Delete(const Sequence& key);
 
+  // Add a merge operand of the key, see MergeOperator
+  Status Merge(const Sequence& key, const Sequence& operand);
+
   // Similar to Get()
   bool ContainsKey(const Sequence& key) const;
 
   // Return read-only entry set for deserialization
   const std::vector<const char*> EntrySet() const { return table_.EntrySet(); }
 
+  // Return the newest version of each key only, in ascending order. The
+  // shadowed versions are obsolete once the table is flushed. If the newest
+  // versions are merge operands, they are collapsed into one entry together
+  // with the insertion or deletion below them, if any.
+  const std::vector<const char*> LatestEntrySet() const;
+
+  // Iterate the same entries as LatestEntrySet() in ascending order, by
+  // walking the skiplist without collecting the entries in a vector. The
+  // table must not be modified during the iteration.
+  class LatestIterator {
+   public:
+    explicit LatestIterator(const TCTable* table);
+
+    bool Valid() const { return entry_ != nullptr; }
+
+    // The InternalEntry, valid until the table is deleted
+    const char* entry() const { return entry_; }
+
+    void Next();
+
+   private:
+    const TCTable* table_;
+
+    // The first version of the next key, nullptr at the end
+    const SkipListNode<const char*>* node_;
+
+    const char* entry_ = nullptr;
+
+    // Versions of the current key, reused for each key
+    std::vector<const char*> versions_;
+  };
+
+  // Number of the entries in the table, including the shadowed versions
+  const int NumEntries() const { return table_.size(); }
+
   // Return current memory usage of the TCTable
   const uint32_t MemUsage() const { return mem_allocator_->MemUsage(); }
 
   const uint64_t GetNextEntryID() const { return entry_id_; }
 
  private:
+  // Return false if the key is definitely not in the table. Always return
+  // true if the table is built without a filter.
+  bool MayContain(const Sequence& key) const {
+    return mem_filter_ == nullptr || mem_filter_->MayContain(key);
+  }
+
+  // Encode a new entry of the op_type into the table_
+  Status Add(const Sequence& key, const Sequence& value,
+             const InternalEntry::OpType op_type);
+
+  // Collapse the versions [first, last] of a key into one entry, allocated
+  // by the mem_allocator_ if it is a new one
+  const char* CollapseVersions(const std::vector<const char*>& versions,
+                               const int first, const int last) const;
+
+  std::shared_ptr<InternalEntryComparator> comparator_;
+
   // Use invalid_key_ in the construction function of the SkipList
   char* invalid_key_;
 
@@ -56,6 +129,11 @@ class TCTable {
 //   MemAllocator* const query_allocator_;
   std::shared_ptr<MemAllocator> query_allocator_;
 
+  // Optional bloom filter of the keys in table_, nullptr if disabled
+  std::shared_ptr<TCDynamicBloomFilter> mem_filter_;
+
+  std::shared_ptr<MergeOperator> merge_operator_;
+
   // uint64_t entry_id_ = 0;  // TODO: The entry_id_ should be globally unique
   std::atomic<uint64_t> entry_id_;  // TODO: The entry_id_ should be globally unique
 
@@ -0,0 +1,155 @@
+#ifndef MERGE_ITERATOR_H_
+#define MERGE_ITERATOR_H_
+
+#include "comparator.h"
+#include "io.h"
+#include "loser_tree.h"
+#include "mem_allocator.h"
+
+// Iterate all entries of an SST file in ascending order. Only one DataBlock
+// is kept in the memory at a time, the file is read ahead in larger chunks
+// (see TCIO::NewCompactionInput()). Each DataBlock is allocated as a block of
+// the merge_allocator, and every entry of the DataBlock holds a reference of
+// the block. The consumer of the entries is responsible for unreferencing
+// the block (by block_id()) once the entry is written or dropped.
+// The iterator can be restricted to a range [lower_bound, upper_bound) of
+// InternalEntries, which is used by the subcompactions. The entries out of the
+// range are unreferenced by the iterator itself.
+class SSTBlockIterator {
+ public:
+  SSTBlockIterator() = delete;
+  SSTBlockIterator(TCIO& io, const std::string& file_abs_path,
+                   const std::shared_ptr<MemAllocator>& merge_allocator);
+
+  // An empty bound denotes an unbounded side of the range
+  SSTBlockIterator(TCIO& io, const std::string& file_abs_path,
+                   const std::shared_ptr<MemAllocator>& merge_allocator,
+                   const std::shared_ptr<InternalEntryComparator>& comparator,
+                   const std::string& lower_bound,
+                   const std::string& upper_bound);
+
+  SSTBlockIterator(const SSTBlockIterator&) = delete;
+  SSTBlockIterator& operator=(const SSTBlockIterator&) = delete;
+
+  ~SSTBlockIterator() = default;
+
+  // Read the Footer, the IndexBlock and the first DataBlock of the file.
+  // If a lower_bound is set, binary search the first DataBlock that may
+  // contain the lower_bound instead.
+  Status Init();
+
+  bool Valid() const { return pos_ < entry_set_.size(); }
+
+  // Current entry. REQUIRES: Valid()
+  const Sequence& entry() const { return entry_set_[pos_]; }
+
+  // Block id of the current entry in the merge_allocator
+  int block_id() const { return block_id_; }
+
+  // Move to the next entry, read the next DataBlock if necessary
+  Status Next();
+
+ private:
+  // Read the block_num-th DataBlock of the file into the merge_allocator_
+  Status ReadBlock(const int block_num);
+
+  // Position at the first entry >= lower_bound_
+  Status Seek();
+
+  // Unreference the entries [pos_, end) of the current DataBlock that will
+  // never be output, and exhaust the iterator
+  void Exhaust();
+
+  // Exhaust the iterator if the current entry reaches the upper_bound_
+  void CheckUpperBound() {
+    if (!upper_bound_.empty() && Valid() &&
+        !comparator_->Less(entry().data(), upper_bound_.c_str()))
+      Exhaust();
+  }
+
+  TCIO& io_;
+
+  const std::string file_abs_path_;
+
+  std::shared_ptr<MemAllocator> merge_allocator_;
+
+  std::shared_ptr<InternalEntryComparator> comparator_;
+
+  const std::string lower_bound_;
+
+  const std::string upper_bound_;
+
+  // The file opened for reading the DataBlocks
+  std::shared_ptr<ReadaheadReader> input_;
+
+  // Offsets of the DataBlocks, followed by the size of all DataBlocks
+  std::vector<uint64_t> index_block_;
+
+  int next_block_ = 0;
+
+  std::vector<Sequence> entry_set_;
+
+  std::vector<Sequence>::size_type pos_ = 0;
+
+  int block_id_ = -1;
+};
+
+// Merge the entries of several SSTBlockIterators in ascending order through
+// a LoserTree. Entries with the same key are NOT collapsed by the
+// MergingIterator, the shadowed versions are output before the newer ones.
+class MergingIterator {
+ public:
+  MergingIterator() = delete;
+  MergingIterator(std::vector<std::shared_ptr<SSTBlockIterator>>&& children,
+                  const std::shared_ptr<InternalEntryComparator>& comparator);
+
+  MergingIterator(const MergingIterator&) = delete;
+  MergingIterator& operator=(const MergingIterator&) = delete;
+
+  ~MergingIterator() = default;
+
+  // Init all children and play the first round of the tournament
+  Status Init();
+
+  bool Valid() const {
+    return !children_.empty() && children_[tree_.Winner()]->Valid();
+  }
+
+  // Current smallest entry. REQUIRES: Valid()
+  const Sequence& entry() const { return children_[tree_.Winner()]->entry(); }
+
+  // Block id of the current entry in the merge_allocator
+  int block_id() const { return children_[tree_.Winner()]->block_id(); }
+
+  // Number of the child that the current entry comes from
+  int source() const { return tree_.Winner(); }
+
+  Status Next();
+
+ private:
+  // Beats functor for the LoserTree. If two entries are equal, the child with
+  // the smaller number wins.
+  struct ChildBeats {
+    const MergingIterator* merger;
+
+    bool operator()(const int x, const int y) const {
+      const auto& children = merger->children_;
+      if (!children[x]->Valid())
+        return false;
+      if (!children[y]->Valid())
+        return true;
+      const char* x_entry = children[x]->entry().data();
+      const char* y_entry = children[y]->entry().data();
+      return x < y ? merger->comparator_->LessOrEquals(x_entry, y_entry)
+                   : merger->comparator_->Less(x_entry, y_entry);
+    }
+  };
+
+  std::vector<std::shared_ptr<SSTBlockIterator>> children_;
+
+  std::shared_ptr<InternalEntryComparator> comparator_;
+
+  LoserTree<ChildBeats> tree_;
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef MERGE_OPERATOR_H_
+#define MERGE_OPERATOR_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sequence.h"
+
+// MergeOperator defines a read-modify-write of the values. TCDB::Merge()
+// stores the operand blindly as a kMerge entry, without reading the old
+// value. The operands of a key are combined lazily: applied to the older
+// value by TCDB::Get(), and collapsed into one entry by the flushes and the
+// compactions.
+// The operator must be associative, that is, combining some adjacent
+// operands by PartialMerge() first does not change the result of
+// FullMerge(). A merge never fails: an invalid operand or existing value
+// should be handled by the operator itself, e.g. treated as empty.
+// Several threads call the operator at the same time, so the operator must
+// be thread-safe.
+class MergeOperator {
+ public:
+  virtual ~MergeOperator() = default;
+
+  // Apply the operands to the existing value, from the oldest to the newest.
+  // Params:
+  //   existing_value: nullptr if the key has no value;
+  //   new_value: the result, by reference.
+  virtual void FullMerge(const Sequence& key, const Sequence* existing_value,
+                         const std::vector<Sequence>& operands,
+                         std::string& new_value) const = 0;
+
+  // Combine two adjacent operands into one operand by reference
+  virtual void PartialMerge(const Sequence& key, const Sequence& older,
+                            const Sequence& newer,
+                            std::string& new_operand) const = 0;
+
+  virtual const char* Name() const = 0;
+};
+
+// UInt64AddOperator adds the operands to the value, for counters. The values
+// and the operands are uint64_t in the native byte order, see Encode(). An
+// invalid one is taken as 0.
+class UInt64AddOperator : public MergeOperator {
+ public:
+  UInt64AddOperator() = default;
+
+  void FullMerge(const Sequence& key, const Sequence* existing_value,
+                 const std::vector<Sequence>& operands,
+                 std::string& new_value) const override;
+
+  void PartialMerge(const Sequence& key, const Sequence& older,
+                    const Sequence& newer,
+                    std::string& new_operand) const override;
+
+  const char* Name() const override { return "UInt64AddOperator"; }
+
+  static std::string Encode(const uint64_t number);
+
+  static uint64_t Decode(const Sequence& value);
+};
+
+// StringAppendOperator appends the operands to the value, separated by the
+// delimiter, for lists
+class StringAppendOperator : public MergeOperator {
+ public:
+  explicit StringAppendOperator(const char delimiter = ',')
+      : delimiter_(delimiter) {}
+
+  void FullMerge(const Sequence& key, const Sequence* existing_value,
+                 const std::vector<Sequence>& operands,
+                 std::string& new_value) const override;
+
+  void PartialMerge(const Sequence& key, const Sequence& older,
+                    const Sequence& newer,
+                    std::string& new_operand) const override;
+
+  const char* Name() const override { return "StringAppendOperator"; }
+
+ private:
+  const char delimiter_;
+};
+
+#endif
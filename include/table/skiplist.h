@@ -42,6 +42,17 @@ class SkipList {
   // Get node by key
   const SkipListNode<K>* Get(const K& key) const;
 
+  // Return the first node >= key, nullptr if there is none. The following
+  // nodes can be visited through next_[0] until tail().
+  const SkipListNode<K>* Seek(const K& key) const;
+
+  // Return the first node, nullptr if the list is empty
+  const SkipListNode<K>* First() const {
+    return head_->next_[0] != tail_ ? head_->next_[0] : nullptr;
+  }
+
+  const SkipListNode<K>* tail() const { return tail_; }
+
   // Insert a key-value pair
   // Return:
   //   -1 : Not inserted caused by error
@@ -174,6 +185,20 @@ const SkipListNode<K>* SkipList<K, Cmp>::Get(const K& key) const {
   return nullptr;
 }
 
+template <typename K, class Cmp>
+const SkipListNode<K>* SkipList<K, Cmp>::Seek(const K& key) const {
+  SkipListNode<K>* before_node = head_;
+
+  for (int i = levels_; i >= 0; --i) {
+    while (before_node->next_[i] != tail_ &&
+           !(comparator_->GreaterOrEquals(before_node->next_[i]->key_, key))) {
+      before_node = before_node->next_[i];
+    }
+  }
+
+  return before_node->next_[0] != tail_ ? before_node->next_[0] : nullptr;
+}
+
 template <typename K, class Cmp>
 SkipListNode<K>* SkipList<K, Cmp>::Search(const K& key) const {
   SkipListNode<K>* before_node = head_;
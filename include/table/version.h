@@ -1,10 +1,16 @@
 #ifndef VERSION_H_
 #define VERSION_H_
 
+#include <set>
 #include "base.h"
 #include "dual_list.h"
 #include "format.h"
 
+// A TCVersion is a snapshot of the MANIFEST. Every TCVersion holds a ref_ for
+// each of its users. The latest version holds one more ref_ on behalf of the
+// TCVersionCtrl, which is dropped once a newer version is appended. A version
+// is evicted when its ref_ decreases to 0, and the SST files that are not
+// referenced by any version left are obsolete.
 class TCVersion {
  public:
   explicit TCVersion(const Manifest& manifest) : manifest_(manifest) {
@@ -23,18 +29,20 @@ class TCVersion {
 
   ~TCVersion() = default;
 
-  std::string ManifestStr() const { return ManifestFormat::Encode(manifest_); }
-
   void Ref() { ++ref_; }
 
   void UnRef() { --ref_; }
 
+  uint32_t refs() const { return ref_.load(); }
+
   bool Evictable() const { return ref_.load() <= 0; }
 
   void set_manifest(const Manifest& manifest) { manifest_ = manifest; }
 
   Manifest manifest() const { return manifest_; }
 
+  uint64_t version_id() const { return version_id_; }
+
  private:
   static std::atomic<uint64_t> inc_id_;
 
@@ -55,9 +63,11 @@ class TCVersionCtrl {
 
   ~TCVersionCtrl() {}
 
-  // Try appending a version to the version_list_.
+  // Try appending a version to the version_list_ as the latest version.
   // This function returns either true if the version does not exist in the
-  // version_list_, or false if the version already exists in the list.
+  // version_list_, or false if a version of the same version id already
+  // exists in the list. The previous latest version is unreferenced and may
+  // be evicted.
   bool AppendVersion(const TCVersion& version);
 
   // Ref a version in the version_list_. Usually, a version will be referenced
@@ -73,7 +83,11 @@ class TCVersionCtrl {
   // decreased to 0, evict it from the version_list_.
   Status UnrefVersion(const TCVersion& version);
 
-  // Return the latest version's const_iterator.
+  // Similar to the other version, but no need to look up the version id.
+  Status UnrefVersion(std::list<TCVersion>::const_iterator version_it);
+
+  // Return the latest version's const_iterator. The version is referenced,
+  // and the caller MUST call UnrefVersion() when it is no longer used.
   std::list<TCVersion>::const_iterator LatestVersion() {
     std::lock_guard<std::mutex> lock(v_mutex_);
     auto version = --version_list_.end();
@@ -81,18 +95,28 @@ class TCVersionCtrl {
     return version;
   }
 
-  bool ExistVersion(const TCVersion& version) const;
+  // Return a copy of the latest version's manifest without referencing it
+  Manifest LatestManifest() {
+    std::lock_guard<std::mutex> lock(v_mutex_);
+    return version_list_.back().manifest();
+  }
 
-  bool ExistVersion(const Manifest& manifest) const;
+  // Return the names of the SST files referenced by any version by reference
+  void LiveFiles(std::set<std::string>& live_files);
 
-  bool ExistVersion(const std::string& manifest) const {
-    return version_map_.find(manifest) != version_map_.end();
+  bool ExistVersion(const TCVersion& version) const {
+    return version_map_.find(version.version_id()) != version_map_.end();
   }
 
  private:
+  // Unref the version and evict it if the ref_ decreased to 0.
+  // REQUIRES: v_mutex_ held
+  void UnrefLocked(std::list<TCVersion>::iterator version_it);
+
   std::mutex v_mutex_;
 
-  std::unordered_map<std::string, std::list<TCVersion>::iterator> version_map_;
+  // Versions in the version_list_ by their version ids
+  std::unordered_map<uint64_t, std::list<TCVersion>::iterator> version_map_;
 
   // neko_base::DualList<TCVersion> version_list_;
   std::list<TCVersion> version_list_;
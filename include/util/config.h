@@ -2,6 +2,7 @@
 #define CONFIG_H_
 
 #include <unistd.h>  // For get_current_dir_name()
+#include <string>
 #include <unordered_map>
 
 class Config {
@@ -22,6 +23,97 @@ class Config {
 
   const std::string kDefaultMaxTaskQueueSize = "10";
 
+  // Size in bytes of the bloom filter built for each TCTable. About 10 bits
+  // per key for a 2MB table of small entries. Set to "0" to disable.
+  const std::string kDefaultMemTableFilterSize = "65536";
+
+  // Max number of parallel key-range subcompactions of one compaction. Set to
+  // "1" to disable subcompactions.
+  const std::string kDefaultMaxSubcompactions = "4";
+
+  // Max number of compactions running at the same time on disjoint levels or
+  // key ranges
+  const std::string kDefaultMaxBackgroundCompactions = "2";
+
+  // How to choose the file to compact from a level above level 0, either
+  // "min_overlapping_ratio" or "round_robin"
+  const std::string kDefaultCompactionPri = "min_overlapping_ratio";
+
+  // "level" for the leveled compaction, or "universal" for the tiered
+  // compaction that merges sorted runs of similar sizes. The universal style
+  // writes much less but reads more runs.
+  const std::string kDefaultCompactionStyle = "level";
+
+  // Options of the level style, see LevelCompactionOptions. Level i (i > 0)
+  // targets max_bytes_for_level_base * max_bytes_for_level_multiplier^(i - 1)
+  // bytes, or the targets are derived from the last level if
+  // level_compaction_dynamic_level_bytes is "true".
+  const std::string kDefaultNumLevels = "12";
+  const std::string kDefaultLevel0FileNumCompactionTrigger = "4";
+  const std::string kDefaultMaxBytesForLevelBase = "20971520";  // 20MB
+  const std::string kDefaultMaxBytesForLevelMultiplier = "10";
+  const std::string kDefaultLevelCompactionDynamicLevelBytes = "false";
+
+  // Files above level 0 with at least this fraction of deletions are
+  // compacted first at their levels, "0" to disable
+  const std::string kDefaultTombstoneRatioThreshold = "0.5";
+
+  // Options of the universal style, see UniversalCompactionOptions
+  const std::string kDefaultUniversalSizeRatio = "1";
+  const std::string kDefaultUniversalMinMergeWidth = "2";
+  const std::string kDefaultUniversalMaxSortedRuns = "8";
+  const std::string kDefaultUniversalMaxSizeAmplificationPercent = "200";
+
+  // Max bytes per second of the writes of the flushes and the compactions and
+  // the reads of the compactions, "0" if unlimited. The flushes are served
+  // before the compactions.
+  const std::string kDefaultRateLimiterBytesPerSec = "0";
+
+  // IO scheduling class of the compactions, "none" to leave it unchanged,
+  // "best_effort" for the lowest best effort priority, or "idle" to run only
+  // when the disk is idle
+  const std::string kDefaultCompactionIOPriority = "none";
+
+  // Max bytes of the obsolete SST files deleted per second, "0" if unlimited
+  const std::string kDefaultFileDeletionRate = "67108864";  // 64MB/s
+
+  // TTL in seconds of the TTLCompactionFilter, "0" to disable. The values
+  // must be written with TTLCompactionFilter::AppendTimestamp().
+  const std::string kDefaultCompactionFilterTTL = "0";
+
+  // Built-in MergeOperator of TCDB::Merge(), "none", "uint64_add" for the
+  // counters or "string_append" for the comma separated lists
+  const std::string kDefaultMergeOperator = "none";
+
+  // Codec of the SST DataBlocks, "none", "lz" for the built-in TCLZ or "zlib"
+  // if built with zlib. An unavailable codec falls back to "none".
+  const std::string kDefaultCompression = "lz";
+
+  // Bytes of the uncompressed DataBlocks cached for the queries, "0" to
+  // disable
+  const std::string kDefaultBlockCacheSize = "8388608";  // 8MB
+
+  // Verify the crc32c of the SST blocks read from the disk, "true" or
+  // "false". The hits of the block cache are never verified again.
+  const std::string kDefaultVerifyChecksums = "true";
+
+  // Buffer bytes of the writer of each SST file. The SST files are written
+  // by writes of this size.
+  const std::string kDefaultWriterBufferSize = "1048576";  // 1MB
+
+  // Messages below the level are not written to the LOG, "debug", "info",
+  // "warn", "error" or "fatal"
+  const std::string kDefaultLogLevel = "debug";
+
+  // Bytes of an SST file written between the starts of its writeback by
+  // sync_file_range(), "0" to leave the whole file to its final sync
+  const std::string kDefaultBytesPerSync = "1048576";  // 1MB
+
+  // Write the SST files and read the inputs of the compactions by O_DIRECT,
+  // "true" or "false", so that they do not evict the blocks of the queries
+  // from the page cache
+  const std::string kDefaultUseDirectIOForFlushAndCompaction = "false";
+
   std::unordered_map<std::string, std::string> config_;
 };
 
@@ -1,19 +1,34 @@
 #ifndef LOGGER_H_
 #define LOGGER_H_
 
+#include <condition_variable>
+
 #include "base.h"
+#include "mpsc_ring.h"
 #include "status.h"
 #include "writer.h"
 
+// The messages below the level of the logger are dropped before they are
+// formatted. By default, the messages are queued in a lock-free ring and
+// written to the LOG by a background thread, so that logging never waits for
+// the disk or a lock. The messages are dropped and counted if the ring is
+// full, and the count is written to the LOG later.
 class TCLogger {
  public:
+  enum LogLevel { kDebug, kInfo, kWarn, kError, kFatal };
+
+  static constexpr size_t kDefaultQueueCapacity = 4096;
+
   TCLogger() = delete;
   TCLogger(const TCLogger&) = delete;
   TCLogger& operator=(const TCLogger&) = delete;
 
-  TCLogger(const std::string& log_path);
+  // The messages are written at once by the caller if async_log is false
+  TCLogger(const std::string& log_path, const bool async_log = true,
+           const size_t queue_capacity = kDefaultQueueCapacity);
 
-  virtual ~TCLogger() = default;
+  // Write the queued messages and stop the background thread
+  virtual ~TCLogger();
 
   virtual Status Debug(const std::string& msg);
 
@@ -25,20 +40,72 @@ class TCLogger {
 
   virtual Status Fatal(const std::string& msg);
 
-  // virtual Status Log(const std::string& msg);
+  // Log the message at the level. The messages of kError and above are
+  // written at once after the queued ones, so that they are not lost if the
+  // process aborts right after.
+  Status Log(const LogLevel level, const std::string& msg);
+
+  // Return the level of the name, "debug", "info", "warn", "error" or
+  // "fatal", or kDebug if the name is unknown
+  static LogLevel LevelFromName(const std::string& name);
+
+  // Drop the messages below the level
+  void SetLevel(const LogLevel level) {
+    level_.store(level, std::memory_order_relaxed);
+  }
+
+  // Return false if the messages of the level are dropped, so that the
+  // callers can skip building them
+  bool Enabled(const LogLevel level) const {
+    return level >= level_.load(std::memory_order_relaxed);
+  }
+
+  // Number of the messages dropped by the full queue
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
 
  private:
-  enum LogLevel { kDebug, kInfo, kWarn, kError, kFatal };
+  // Interval of the background thread writing the queued messages
+  static constexpr int kFlushIntervalMs = 10;
 
   virtual std::string FormatMsg(const std::string& msg, const LogLevel& level);
 
-  std::shared_ptr<SequentialWriter> log_writer_;
+  // Loop of the background thread until stop_
+  void BackgroundFlush();
+
+  // Write all the queued messages and the count of the newly dropped ones.
+  // REQUIRES: log_mutex_ held
+  void Drain();
+
+  static constexpr size_t kLogBufferSize = 4096;
+
+  // The LOG grows by small messages, so its space is preallocated
+  static constexpr uint64_t kLogPreallocationBlockSize = 1 << 16;  // 64KB
+
+  // The LOG file stays open for the lifetime of the logger
+  std::shared_ptr<WritableFile> log_writer_;
+
+  // Serialize the writes to the log_writer_, and the Drain() of the queue
+  // by the background thread and by the messages of kError and above
+  std::mutex log_mutex_;
 
   std::string log_path_;
 
-  bool async_log_ = false;
+  const bool async_log_;
 
   bool log_time_ = true;
+
+  std::atomic<int> level_{kDebug};
+
+  // Formatted messages waiting for the background thread
+  MPSCRing<std::string> queue_;
+
+  std::atomic<uint64_t> dropped_{0};
+  uint64_t reported_dropped_ = 0;
+
+  std::thread flush_thread_;
+  std::mutex flush_mutex_;
+  std::condition_variable flush_cv_;
+  bool stop_ = false;
 };
 
-#endif
\ No newline at end of file
+#endif
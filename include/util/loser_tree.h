@@ -0,0 +1,70 @@
+#ifndef LOSER_TREE_H_
+#define LOSER_TREE_H_
+
+#include "base.h"
+
+// Tournament tree of losers for k-way merging.
+// The k sources are the leaves of the tree, numbered from 0 to k - 1. Each
+// internal node tree_[i] (1 <= i < k) records the loser of the match played
+// between its two subtrees, and tree_[0] records the overall winner. After
+// the winner's source moves forward, only the path from its leaf to the root
+// should be replayed, which costs exactly one comparison per level, instead
+// of the ~2*log(k) comparisons of a binary heap.
+//
+// Beats is a functor and Beats(x, y) returns true if the current element of
+// source x should be output before the current element of source y. An
+// exhausted source must lose to any source that is not exhausted.
+template <typename Beats>
+class LoserTree {
+ public:
+  LoserTree() = delete;
+  LoserTree(const int k, const Beats& beats)
+      : k_(k), beats_(beats), tree_(k > 0 ? k : 1, k) {}
+
+  LoserTree(const LoserTree&) = delete;
+  LoserTree& operator=(const LoserTree&) = delete;
+
+  ~LoserTree() = default;
+
+  // Play all matches from the beginning. Should be called once all sources
+  // are positioned at their first elements.
+  void Build() {
+    // A virtual source k_ that beats every real source is placed in all
+    // nodes, and is pushed out of the tree by the real sources.
+    std::fill(tree_.begin(), tree_.end(), k_);
+    for (int i = k_ - 1; i >= 0; --i)
+      Replay(i);
+  }
+
+  // The winner's source number. The source may be exhausted, in which case
+  // all sources are exhausted.
+  int Winner() const { return tree_[0]; }
+
+  // Replay the matches from the leaf to the root. Should be called after
+  // the current element of source <leaf> changed, usually the winner.
+  void Replay(int leaf) {
+    int winner = leaf;
+    for (int node = (leaf + k_) / 2; node > 0; node /= 2) {
+      if (Win(tree_[node], winner))
+        std::swap(tree_[node], winner);
+    }
+    tree_[0] = winner;
+  }
+
+ private:
+  inline bool Win(const int x, const int y) {
+    if (x == k_)
+      return true;
+    if (y == k_)
+      return false;
+    return beats_(x, y);
+  }
+
+  const int k_;
+
+  Beats beats_;
+
+  std::vector<int> tree_;
+};
+
+#endif
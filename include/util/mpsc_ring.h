@@ -0,0 +1,107 @@
+#ifndef MPSC_RING_H_
+#define MPSC_RING_H_
+
+#include "base.h"
+
+// A bounded lock-free queue of multiple producers and a single consumer. Each
+// slot carries a sequence number telling whether it is free for the producer
+// of a position or filled for the consumer, so that the producers only
+// contend on a compare-and-swap of the tail and never wait for each other.
+// A full queue fails the push instead of blocking the producer.
+template <typename T>
+class MPSCRing {
+ public:
+  MPSCRing() = delete;
+
+  // The capacity is rounded up to a power of 2
+  explicit MPSCRing(const size_t capacity);
+
+  MPSCRing(const MPSCRing&) = delete;
+  MPSCRing& operator=(const MPSCRing&) = delete;
+
+  // Move the value into the queue, and return its position by reference if
+  // position is not nullptr. Return false if the queue is full, and the value
+  // is untouched. Thread-safe.
+  bool TryPush(T&& value, size_t* position = nullptr);
+
+  // Move the oldest value out of the queue. Return false if the queue is
+  // empty. Only called by the consumer.
+  bool TryPop(T& value);
+
+  // Position of the next value to pop, the values at the positions before it
+  // have been popped. Only called by the consumer.
+  size_t head() const { return head_; }
+
+ private:
+  struct Slot {
+    // pos if the slot is free for the push at pos, pos + 1 if it is filled
+    // by the push at pos
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  static size_t RoundUpPowerOf2(size_t n) {
+    size_t ret = 1;
+    while (ret < n)
+      ret <<= 1;
+    return ret;
+  }
+
+  const size_t mask_;
+  std::unique_ptr<Slot[]> slots_;
+
+  // The producers and the consumer advance on separate cache lines
+  alignas(64) std::atomic<size_t> tail_;
+  alignas(64) size_t head_ = 0;
+};
+
+template <typename T>
+MPSCRing<T>::MPSCRing(const size_t capacity)
+    : mask_(RoundUpPowerOf2(std::max<size_t>(capacity, 2)) - 1),
+      slots_(new Slot[mask_ + 1]),
+      tail_(0) {
+  for (size_t i = 0; i <= mask_; ++i)
+    slots_[i].sequence.store(i, std::memory_order_relaxed);
+}
+
+template <typename T>
+bool MPSCRing<T>::TryPush(T&& value, size_t* position) {
+  size_t pos = tail_.load(std::memory_order_relaxed);
+  Slot* slot;
+  while (true) {
+    slot = &slots_[pos & mask_];
+    size_t seq = slot->sequence.load(std::memory_order_acquire);
+    intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      // The slot is free, claim the position
+      if (tail_.compare_exchange_weak(pos, pos + 1,
+                                      std::memory_order_relaxed))
+        break;
+    } else if (diff < 0) {
+      return false;  // Not consumed yet, the queue is full
+    } else {
+      pos = tail_.load(std::memory_order_relaxed);  // Claimed by others
+    }
+  }
+
+  slot->value = std::move(value);
+  slot->sequence.store(pos + 1, std::memory_order_release);
+  if (position != nullptr)
+    *position = pos;
+  return true;
+}
+
+template <typename T>
+bool MPSCRing<T>::TryPop(T& value) {
+  Slot* slot = &slots_[head_ & mask_];
+  if (slot->sequence.load(std::memory_order_acquire) != head_ + 1)
+    return false;  // Empty, or the producer has not finished the slot
+
+  value = std::move(slot->value);
+  // Free the slot for the push a round later
+  slot->sequence.store(head_ + mask_ + 1, std::memory_order_release);
+  ++head_;
+  return true;
+}
+
+#endif
@@ -25,6 +25,13 @@ class Status {
     return Status(Code::kBadArgumentError, "<ERROR>" + err_msg);
   }
 
+  // The persisted data does not match its checksum or can not be decoded
+  static Status Corruption(const std::string& err_msg = std::string()) {
+    return Status(Code::kCorruption, "<ERROR>" + err_msg);
+  }
+
+  bool IsCorruption() const { return err_type_ == kCorruption; }
+
   const std::string& ErrMsg() const { return err_msg_; }
 
  private:
@@ -32,7 +39,8 @@ class Status {
     kOk = 0,
     kUndefinedError = 1,
     kFileIOError = 2,
-    kBadArgumentError = 3
+    kBadArgumentError = 3,
+    kCorruption = 4
   };
 
   Status(Code err_type, const std::string& err_msg = std::string())
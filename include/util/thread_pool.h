@@ -2,9 +2,11 @@
 #define THREAD_POOL_H_
 
 #include <condition_variable>
+#include <cstddef>  // For std::max_align_t
 #include <functional>
 #include <future>
 #include <iostream>  // for test
+#include <type_traits>
 #include "base.h"
 #include "lock_util.h"
 
@@ -84,64 +86,281 @@ class ConcurrentQueue {
   RAIILock lock;
 };
 
+// A move-only callable without arguments. A callable of up to kInlineSize
+// bytes is stored inline, so that a task is moved between the queues of the
+// TCThreadPool without a heap allocation. A larger one is allocated once.
+class TCTask {
+ public:
+  static constexpr size_t kInlineSize = 48;
+
+  TCTask() = default;
+
+  template <typename F, typename = typename std::enable_if<!std::is_same<
+                            typename std::decay<F>::type, TCTask>::value>::type>
+  TCTask(F&& func) {
+    typedef typename std::decay<F>::type Func;
+    typedef std::integral_constant<
+        bool, sizeof(Func) <= kInlineSize &&
+                  alignof(Func) <= alignof(Storage) &&
+                  std::is_nothrow_move_constructible<Func>::value>
+        FitsInline;
+    Init<Func>(std::forward<F>(func), FitsInline());
+  }
+
+  TCTask(TCTask&& other) noexcept { MoveFrom(other); }
+
+  TCTask& operator=(TCTask&& other) noexcept {
+    if (this != &other) {
+      Reset();
+      MoveFrom(other);
+    }
+    return *this;
+  }
+
+  TCTask(const TCTask&) = delete;
+  TCTask& operator=(const TCTask&) = delete;
+
+  ~TCTask() { Reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  void operator()() { ops_->invoke(&storage_); }
+
+ private:
+  typedef typename std::aligned_storage<kInlineSize,
+                                        alignof(std::max_align_t)>::type
+      Storage;
+
+  // Type-erased operations of the callable in the storage_
+  struct Ops {
+    void (*invoke)(void* storage);
+    // Move the callable to the dst storage and destroy the src one
+    void (*move)(void* dst, void* src);
+    void (*destroy)(void* storage);
+  };
+
+  // The callable is constructed in the storage_
+  template <typename F>
+  struct InlineOps {
+    static void Invoke(void* storage) { (*static_cast<F*>(storage))(); }
+    static void Move(void* dst, void* src) {
+      new (dst) F(std::move(*static_cast<F*>(src)));
+      static_cast<F*>(src)->~F();
+    }
+    static void Destroy(void* storage) { static_cast<F*>(storage)->~F(); }
+    static const Ops kOps;
+  };
+
+  // The storage_ holds a pointer to the callable
+  template <typename F>
+  struct HeapOps {
+    static void Invoke(void* storage) { (**static_cast<F**>(storage))(); }
+    static void Move(void* dst, void* src) {
+      *static_cast<F**>(dst) = *static_cast<F**>(src);
+    }
+    static void Destroy(void* storage) { delete *static_cast<F**>(storage); }
+    static const Ops kOps;
+  };
+
+  template <typename F, typename G>
+  void Init(G&& func, std::true_type /* inline */) {
+    new (&storage_) F(std::forward<G>(func));
+    ops_ = &InlineOps<F>::kOps;
+  }
+
+  template <typename F, typename G>
+  void Init(G&& func, std::false_type /* inline */) {
+    *reinterpret_cast<F**>(&storage_) = new F(std::forward<G>(func));
+    ops_ = &HeapOps<F>::kOps;
+  }
+
+  void MoveFrom(TCTask& other) {
+    if (other.ops_ != nullptr) {
+      other.ops_->move(&storage_, &other.storage_);
+      ops_ = other.ops_;
+      other.ops_ = nullptr;
+    }
+  }
+
+  void Reset() {
+    if (ops_ != nullptr) {
+      ops_->destroy(&storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  Storage storage_;
+  const Ops* ops_ = nullptr;
+};
+
+template <typename F>
+const TCTask::Ops TCTask::InlineOps<F>::kOps = {
+    &TCTask::InlineOps<F>::Invoke, &TCTask::InlineOps<F>::Move,
+    &TCTask::InlineOps<F>::Destroy};
+
+template <typename F>
+const TCTask::Ops TCTask::HeapOps<F>::kOps = {&TCTask::HeapOps<F>::Invoke,
+                                              &TCTask::HeapOps<F>::Move,
+                                              &TCTask::HeapOps<F>::Destroy};
+
+// A work-stealing thread pool. Each thread owns a queue of tasks: it pushes
+// the tasks it submits and pops them at the back, and the idle threads steal
+// from the front of the others. The tasks from the outside are spread over
+// the queues in turn. Only the idle threads sleep, so that a submission to a
+// busy pool takes nothing but the lock of one queue.
+// At most about kMaxTaskQueueSize tasks wait to be started (unbounded if it
+// is not positive): a further submission blocks until a task is started, or
+// runs the task at once if it comes from a thread of the pool, which must
+// not wait for its own pool.
 class TCThreadPool {
  public:
   TCThreadPool();
   TCThreadPool(const int default_core_thread_num,
                const int max_task_queue_size);
 
+  TCThreadPool(const TCThreadPool&) = delete;
+  TCThreadPool& operator=(const TCThreadPool&) = delete;
+
   ~TCThreadPool();
 
   template <typename F, typename... Args>
   auto SubmitTask(F&& f, Args&&... args) -> std::future<
       decltype(std::forward<F>(f)(std::forward<Args>(args)...))> {
-
     typedef decltype(std::forward<F>(f)(std::forward<Args>(args)...)) func_type;
 
-    std::function<func_type()> task_func =
-        std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+    // The packaged_task fits in a TCTask, so that the bound function is the
+    // only allocation besides the shared state of the future
+    std::packaged_task<func_type()> task(
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    auto ret = task.get_future();
+    Schedule(TCTask(std::move(task)));
 
-    auto task_ptr =
-        std::make_shared<std::packaged_task<func_type()>>(task_func);
-    // Wrong. The task object will be deconstructed when SubmitTask() exits.
-    // std::packaged_task<func_type> task(task_func);
+    return ret;
+  }
 
-    // Wrap std::package_task into void function
-    std::function<void()> wrapped_func = [task_ptr]() {
-      (*task_ptr)();
-      // Equivalent to: task_func();
-    };
+  // Same as SubmitTask(), but never blocks for kMaxTaskQueueSize. For the
+  // tasks submitted under a lock that the running tasks may wait for, which
+  // would deadlock the back-pressure.
+  template <typename F, typename... Args>
+  auto SubmitTaskNoWait(F&& f, Args&&... args) -> std::future<
+      decltype(std::forward<F>(f)(std::forward<Args>(args)...))> {
+    typedef decltype(std::forward<F>(f)(std::forward<Args>(args)...)) func_type;
 
-    // Wrong. packaged_task forbids copy.
-    // std::function<void()> wrapped_func = [task]() {...}
-    // Wrong. packaged_task will be deconstructed.
-    // std::function<void()> wrapped_func = [&task]() {...}
+    std::packaged_task<func_type()> task(
+        std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+    auto ret = task.get_future();
+    Schedule(TCTask(std::move(task)), false);
 
-    task_queue_.Enqueue(wrapped_func);
+    return ret;
+  }
+
+  // Run the task on the thread pool without a future. The back-pressure of
+  // kMaxTaskQueueSize applies if wait_for_space is true. The task runs on
+  // the calling thread if the pool has been shut down.
+  void Schedule(TCTask&& task, const bool wait_for_space = true);
+
+  // Run func(0), func(1), ..., func(n - 1) on the thread pool and block until
+  // all of them finish. The calling thread also executes the functions, so
+  // ParallelFor() is safe to be called from a thread of the pool itself, even
+  // if all other threads are busy: the caller simply runs everything.
+  template <typename F>
+  void ParallelFor(const int n, F&& func) {
+    if (n <= 0)
+      return;
+
+    struct ParallelState {
+      std::atomic<int> next;
+      int done = 0;
+      std::mutex mtx;
+      std::condition_variable cv;
+    };
+    auto state = std::make_shared<ParallelState>();
+    state->next.store(0);
+
+    // A helper task that starts after all indices are claimed exits without
+    // touching func, so capturing func by reference is safe.
+    auto work = [state, n, &func]() {
+      int i;
+      while ((i = state->next.fetch_add(1)) < n) {
+        func(i);
+
+        std::lock_guard<std::mutex> lock(state->mtx);
+        if (++state->done == n)
+          state->cv.notify_all();
+      }
+    };
 
-    cv_.notify_one();
+    // The helpers are optional, none is added to a full pool
+    for (int i = 0; i < std::min(n - 1, kDefaultCoreThreadNum) && HasSpace();
+         ++i)
+      Schedule(TCTask(work), false);
+    work();
 
-    return task_ptr->get_future();
+    std::unique_lock<std::mutex> lock(state->mtx);
+    state->cv.wait(lock, [&state, n]() { return state->done == n; });
   }
 
   // Start the thread pool. Core threads are constructed and stored in queue.
   void Start();
 
-  // Stop the thread pool. Resources will be reclaimed after all thread tasks
-  // are done.
+  // Stop the thread pool. The threads run all the queued tasks and are
+  // joined before Shutdown() returns.
   void Shutdown();
 
  private:
+  // Tasks of a thread. The owner pushes and pops at the back, and the other
+  // threads steal from the front.
+  struct WorkerQueue {
+    std::mutex mtx;
+    std::deque<TCTask> tasks;
+  };
+
+  // Return the index of the queue of the calling thread, -1 if it is not a
+  // thread of the pool
+  int CurrentWorker() const {
+    return current_pool_ == this ? current_worker_ : -1;
+  }
+
+  // Return true if fewer than kMaxTaskQueueSize tasks wait to be started
+  bool HasSpace() const {
+    return kMaxTaskQueueSize <= 0 || pending_tasks_.load() < kMaxTaskQueueSize;
+  }
+
+  // Pop a task from the queue of the worker, or steal one from the others.
+  // Return false if all the queues are empty.
+  bool PopOrSteal(const int worker, TCTask& task);
+
+  void BackgroundThreadTask(const int worker);
+
+  // Rounds of an idle thread looking for a task before it sleeps
+  static constexpr int kSpinRounds = 16;
+
   const int kDefaultCoreThreadNum;
   const int kMaxTaskQueueSize;
 
-  void BackgroundThreadTask();
-
-  ConcurrentQueue<std::function<void()>> task_queue_;
+  std::vector<std::unique_ptr<WorkerQueue>> queues_;
   std::deque<std::thread> thread_queue_;
+
+  // Tasks queued but not started yet
+  std::atomic<int> pending_tasks_{0};
+
+  // Threads sleeping on cv_ and submitters blocked on space_cv_, so that
+  // mtx_ is only taken to wake them if there are any
+  std::atomic<int> idle_threads_{0};
+  std::atomic<int> blocked_submitters_{0};
+
+  // Queue of the next task from the outside
+  std::atomic<unsigned> next_queue_{0};
+
   std::mutex mtx_;
   std::condition_variable cv_;
+  std::condition_variable space_cv_;
   std::atomic<bool> is_thread_pool_running_;
+  std::atomic<bool> is_shut_down_{false};
+
+  // The pool and the queue of the calling thread, if it is a thread of a pool
+  static thread_local const TCThreadPool* current_pool_;
+  static thread_local int current_worker_;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,257 @@
+#include "compression.h"
+
+#include "varint.h"
+
+#ifdef TCDB_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+namespace {
+
+const int kHashBits = 12;
+
+inline uint32_t Load32(const char* p) {
+  uint32_t ret;
+  std::memcpy(&ret, p, sizeof(ret));
+  return ret;
+}
+
+inline uint32_t HashOf(const uint32_t v) {
+  return (v * 2654435761U) >> (32 - kHashBits);
+}
+
+// Append a length extension of a token field
+inline void PutLengthExtension(size_t len, std::string& output) {
+  while (len >= 255) {
+    output.push_back(static_cast<char>(255));
+    len -= 255;
+  }
+  output.push_back(static_cast<char>(len));
+}
+
+// Return false if the extension runs out of the input
+inline bool GetLengthExtension(const uint8_t*& ip, const uint8_t* end,
+                               size_t& len) {
+  uint8_t b;
+  do {
+    if (ip >= end)
+      return false;
+    b = *ip++;
+    len += b;
+  } while (b == 255);
+  return true;
+}
+
+void PutSequence(const char* literals, const size_t literal_len,
+                 const size_t offset, const size_t match_len,
+                 std::string& output) {
+  size_t ml = match_len == 0 ? 0 : match_len - TCLZ::kMinMatch;
+  uint8_t token = (std::min<size_t>(literal_len, 15) << 4) |
+                  std::min<size_t>(ml, 15);
+  output.push_back(static_cast<char>(token));
+  if (literal_len >= 15)
+    PutLengthExtension(literal_len - 15, output);
+  output.append(literals, literal_len);
+
+  if (match_len == 0)
+    return;  // The last sequence
+
+  output.push_back(static_cast<char>(offset & 0xff));
+  output.push_back(static_cast<char>(offset >> 8));
+  if (ml >= 15)
+    PutLengthExtension(ml - 15, output);
+}
+
+// Decode a varint32 without reading past the end
+bool GetVarint32(const uint8_t*& ip, const uint8_t* end, uint32_t& value) {
+  value = 0;
+  for (int shift = 0; shift <= 28 && ip < end; shift += 7) {
+    uint32_t b = *ip++;
+    value |= (b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+Compression::Type Compression::FromName(const std::string& name) {
+  Type ret = kNoCompression;
+  if (name == "lz")
+    ret = kTCLZCompression;
+  else if (name == "zlib")
+    ret = kZlibCompression;
+
+  return Supported(ret) ? ret : kNoCompression;
+}
+
+bool Compression::Supported(const Type type) {
+  switch (type) {
+    case kNoCompression:
+    case kTCLZCompression:
+      return true;
+    case kZlibCompression:
+#ifdef TCDB_HAVE_ZLIB
+      return true;
+#else
+      return false;
+#endif
+    default:
+      return false;
+  }
+}
+
+bool Compression::Compress(const Type type, const char* input,
+                           const size_t size, std::string& output) {
+  output.clear();
+
+  switch (type) {
+    case kTCLZCompression:
+      TCLZ::Compress(input, size, output);
+      break;
+#ifdef TCDB_HAVE_ZLIB
+    case kZlibCompression: {
+      // The uncompressed size is stored ahead for uncompress()
+      char size_buf[5];
+      output.assign(size_buf, coding::EncodeVarint32(size, size_buf));
+      uLongf dest_len = compressBound(size);
+      size_t header_size = output.size();
+      output.resize(header_size + dest_len);
+      if (compress2(reinterpret_cast<Bytef*>(&output[header_size]), &dest_len,
+                    reinterpret_cast<const Bytef*>(input), size,
+                    Z_BEST_SPEED) != Z_OK)
+        return false;
+      output.resize(header_size + dest_len);
+      break;
+    }
+#endif
+    default:
+      return false;
+  }
+
+  return output.size() < size - size / 8;
+}
+
+Status Compression::Uncompress(const Type type, const char* input,
+                               const size_t size, std::string& output) {
+  switch (type) {
+    case kNoCompression:
+      output.assign(input, size);
+      return Status::NoError();
+    case kTCLZCompression:
+      if (TCLZ::Uncompress(input, size, output))
+        return Status::NoError();
+      break;
+#ifdef TCDB_HAVE_ZLIB
+    case kZlibCompression: {
+      const uint8_t* ip = reinterpret_cast<const uint8_t*>(input);
+      const uint8_t* end = ip + size;
+      uint32_t raw_size;
+      if (!GetVarint32(ip, end, raw_size))
+        break;
+      output.resize(raw_size);
+      uLongf dest_len = raw_size;
+      if (uncompress(reinterpret_cast<Bytef*>(&output[0]), &dest_len, ip,
+                     end - ip) == Z_OK &&
+          dest_len == raw_size)
+        return Status::NoError();
+      break;
+    }
+#endif
+    default:
+      return Status::BadArgumentError("Unsupported compression type " +
+                                      std::to_string(type));
+  }
+
+  return Status::Corruption("Corrupted compressed block");
+}
+
+void TCLZ::Compress(const char* input, const size_t size,
+                    std::string& output) {
+  char size_buf[5];
+  output.append(size_buf, coding::EncodeVarint32(size, size_buf));
+  output.reserve(output.size() + size + size / 255 + 16);
+
+  // Positions of the last occurrences of the 4-byte hashes
+  uint32_t table[1 << kHashBits] = {};
+
+  size_t ip = 0, anchor = 0;
+  while (ip + kMinMatch <= size) {
+    uint32_t cur = Load32(input + ip);
+    uint32_t h = HashOf(cur);
+    size_t candidate = table[h];
+    table[h] = ip;
+
+    if (candidate < ip && ip - candidate <= kMaxOffset &&
+        Load32(input + candidate) == cur) {
+      size_t match_len = kMinMatch;
+      while (ip + match_len < size &&
+             input[candidate + match_len] == input[ip + match_len])
+        ++match_len;
+
+      PutSequence(input + anchor, ip - anchor, ip - candidate, match_len,
+                  output);
+      ip += match_len;
+      anchor = ip;
+    } else {
+      // Step faster over the incompressible data
+      ip += 1 + ((ip - anchor) >> 5);
+    }
+  }
+
+  PutSequence(input + anchor, size - anchor, 0, 0, output);
+}
+
+bool TCLZ::Uncompress(const char* input, const size_t size,
+                      std::string& output) {
+  const uint8_t* ip = reinterpret_cast<const uint8_t*>(input);
+  const uint8_t* end = ip + size;
+
+  uint32_t raw_size;
+  if (!GetVarint32(ip, end, raw_size))
+    return false;
+  output.resize(raw_size);
+  char* out = &output[0];
+  size_t op = 0;
+
+  while (ip < end) {
+    uint8_t token = *ip++;
+
+    size_t literal_len = token >> 4;
+    if (literal_len == 15 && !GetLengthExtension(ip, end, literal_len))
+      return false;
+    if (literal_len > static_cast<size_t>(end - ip) ||
+        literal_len > raw_size - op)
+      return false;
+    std::memcpy(out + op, ip, literal_len);
+    ip += literal_len;
+    op += literal_len;
+
+    if (ip == end)
+      break;  // The last sequence
+
+    if (end - ip < 2)
+      return false;
+    size_t offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    size_t match_len = token & 0x0f;
+    if (match_len == 15 && !GetLengthExtension(ip, end, match_len))
+      return false;
+    match_len += kMinMatch;
+    if (offset == 0 || offset > op || match_len > raw_size - op)
+      return false;
+
+    // The match may overlap the output being written
+    const char* match = out + op - offset;
+    if (offset >= match_len) {
+      std::memcpy(out + op, match, match_len);
+    } else {
+      for (size_t i = 0; i < match_len; ++i)
+        out[op + i] = match[i];
+    }
+    op += match_len;
+  }
+
+  return op == raw_size;
+}
@@ -0,0 +1,104 @@
+#include "crc32c.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define TCDB_CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+namespace crc32c {
+
+namespace {
+
+const uint32_t kPoly = 0x82f63b78;  // Reversed Castagnoli polynomial
+
+// tables[k][b] is the crc of byte b followed by k zero bytes
+struct SliceTables {
+  SliceTables() {
+    for (uint32_t b = 0; b < 256; ++b) {
+      uint32_t crc = b;
+      for (int i = 0; i < 8; ++i)
+        crc = (crc >> 1) ^ (kPoly & (0 - (crc & 1)));
+      tables[0][b] = crc;
+    }
+    for (int k = 1; k < 8; ++k) {
+      for (int b = 0; b < 256; ++b)
+        tables[k][b] =
+            (tables[k - 1][b] >> 8) ^ tables[0][tables[k - 1][b] & 0xff];
+    }
+  }
+
+  uint32_t tables[8][256];
+};
+
+inline uint32_t LoadLE32(const uint8_t* p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+// Slicing-by-8: 8 table lookups per 8 bytes
+uint32_t ExtendPortable(const uint32_t init_crc, const uint8_t* p,
+                        size_t size) {
+  static const SliceTables slice;
+  const uint32_t(*t)[256] = slice.tables;
+
+  uint32_t crc = ~init_crc;
+  while (size >= 8) {
+    uint32_t lo = LoadLE32(p) ^ crc;
+    uint32_t hi = LoadLE32(p + 4);
+    crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^
+          t[4][lo >> 24] ^ t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^
+          t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+    p += 8;
+    size -= 8;
+  }
+  while (size-- > 0)
+    crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+#ifdef TCDB_CRC32C_SSE42
+// Built for SSE4.2 regardless of the compiler flags, and only called if the
+// CPU supports it
+__attribute__((target("sse4.2"))) uint32_t ExtendSSE42(
+    const uint32_t init_crc, const uint8_t* p, size_t size) {
+  uint64_t crc = ~init_crc;
+  while (size >= 8) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    crc = _mm_crc32_u64(crc, v);
+    p += 8;
+    size -= 8;
+  }
+  uint32_t crc32 = static_cast<uint32_t>(crc);
+  while (size-- > 0)
+    crc32 = _mm_crc32_u8(crc32, *p++);
+
+  return ~crc32;
+}
+#endif
+
+using ExtendFunc = uint32_t (*)(const uint32_t, const uint8_t*, size_t);
+
+ExtendFunc ChooseExtend() {
+#ifdef TCDB_CRC32C_SSE42
+  if (__builtin_cpu_supports("sse4.2"))
+    return ExtendSSE42;
+#endif
+  return ExtendPortable;
+}
+
+// Chosen once, at the first call
+ExtendFunc Dispatch() {
+  static const ExtendFunc extend = ChooseExtend();
+  return extend;
+}
+
+}  // namespace
+
+uint32_t Extend(const uint32_t init_crc, const char* data, const size_t size) {
+  return Dispatch()(init_crc, reinterpret_cast<const uint8_t*>(data), size);
+}
+
+bool IsHardwareAccelerated() { return Dispatch() != ExtendPortable; }
+
+}  // namespace crc32c
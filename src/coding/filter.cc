@@ -19,28 +19,35 @@ Status TCBloomFilter::CreateFilter(const std::vector<Sequence>& entry_set,
                                    std::string& filter_content) const {
   Status ret;
 
+  StartFilter(entry_set.size(), filter_content);
+  for (auto& e : entry_set)
+    AddEntry(e.data(), filter_content);
+
+  return ret;
+}
+
+void TCBloomFilter::StartFilter(const size_t num_entries,
+                                std::string& filter_content) const {
   int bits =
-      -static_cast<int>(entry_set.size()) / (kLn2 * kLn2) * std::log(fp_rate());
+      -static_cast<int>(num_entries) / (kLn2 * kLn2) * std::log(fp_rate());
 
   int bytes = static_cast<int>(ceil(bits / 8.0));
-  bits = bytes * 8;
-  filter_content.resize(bytes, 0);
+  filter_content.assign(bytes, 0);
+}
+
+void TCBloomFilter::AddEntry(const char* internal_entry,
+                             std::string& filter_content) const {
+  auto key = InternalEntry::EntryKey(internal_entry);
 
   uint64_t hash_value;
   decltype(filter_content.size()) pos = 0;
-  for (auto& e : entry_set) {
-    auto key = InternalEntry::EntryKey(e.data());
-
-    for (int i = 0; i < hash_k_; ++i) {
-      hash_value = hasher_->Hash(key.data(), key.size(), seeds_[i]);
+  for (int i = 0; i < hash_k_; ++i) {
+    hash_value = hasher_->Hash(key.data(), key.size(), seeds_[i]);
 
-      pos = (hash_value / 8) % filter_content.size();
-      filter_content[pos] |=
-          static_cast<unsigned char>(0x80) >> (hash_value % 8);
-    }
+    pos = (hash_value / 8) % filter_content.size();
+    filter_content[pos] |=
+        static_cast<unsigned char>(0x80) >> (hash_value % 8);
   }
-
-  return ret;
 }
 
 bool TCBloomFilter::ContainsKey(const Sequence& key,
@@ -78,4 +85,40 @@ void TCBloomFilter::InitMembers() {
   }
 
   hasher_ = std::make_shared<Murmur2>();
+}
+
+TCDynamicBloomFilter::TCDynamicBloomFilter(const uint32_t filter_bytes,
+                                           const int hash_k)
+    : kBitCount(std::max<uint64_t>((filter_bytes + 7) / 8, 1) * 64),
+      hash_k_(hash_k),
+      bits_(new std::atomic<uint64_t>[kBitCount / 64]) {
+  for (uint64_t i = 0; i < kBitCount / 64; ++i)
+    bits_[i].store(0, std::memory_order_relaxed);
+}
+
+void TCDynamicBloomFilter::AddKey(const Sequence& key) {
+  uint64_t h = Hash(key);
+  const uint64_t delta = (h >> 33) | (h << 31);  // Rotate right 33 bits
+
+  for (int i = 0; i < hash_k_; ++i) {
+    uint64_t pos = h % kBitCount;
+    bits_[pos / 64].fetch_or(static_cast<uint64_t>(1) << (pos % 64),
+                             std::memory_order_relaxed);
+    h += delta;
+  }
+}
+
+bool TCDynamicBloomFilter::MayContain(const Sequence& key) const {
+  uint64_t h = Hash(key);
+  const uint64_t delta = (h >> 33) | (h << 31);  // Rotate right 33 bits
+
+  for (int i = 0; i < hash_k_; ++i) {
+    uint64_t pos = h % kBitCount;
+    if (!(bits_[pos / 64].load(std::memory_order_relaxed) &
+          (static_cast<uint64_t>(1) << (pos % 64))))
+      return false;
+    h += delta;
+  }
+
+  return true;
 }
\ No newline at end of file
@@ -1,35 +1,377 @@
 #include "format.h"
 
-ManifestFormat::ManifestData ManifestFormat::Decode(
-    const std::string& manifest_str) {
-  ManifestData ret;
+#include <algorithm>
+#include <limits>
 
-  std::vector<std::string> lines = neko_base::Split(manifest_str, '\n');
+#include "crc32c.h"
+#include "internal_entry.h"
+#include "varint.h"
 
-  ret.path_to_manifest = lines[0];
-  ret.path_to_log = lines[1];
+const char* const DataFileFormat::kFilterBlockName = "filter.bloom";
 
-  for (int i = 2; i < lines.size(); ++i) {
-    ret.data_files.push_back(neko_base::Split(lines[i], ';'));
+const char* const DataFileFormat::kPropertiesBlockName = "properties";
+
+namespace {
+
+inline void PutFixed32(char*& dst, const uint32_t value) {
+  std::memcpy(dst, &value, sizeof(value));
+  dst += sizeof(value);
+}
+
+inline void PutFixed64(char*& dst, const uint64_t value) {
+  std::memcpy(dst, &value, sizeof(value));
+  dst += sizeof(value);
+}
+
+inline uint32_t GetFixed32(const char*& src) {
+  uint32_t value;
+  std::memcpy(&value, src, sizeof(value));
+  src += sizeof(value);
+  return value;
+}
+
+inline uint64_t GetFixed64(const char*& src) {
+  uint64_t value;
+  std::memcpy(&value, src, sizeof(value));
+  src += sizeof(value);
+  return value;
+}
+
+// Decode a varint64 without reading past the end
+bool GetVarint64(const char*& src, const char* end, uint64_t& value) {
+  value = 0;
+  for (int shift = 0; shift <= 63 && src < end; shift += 7) {
+    uint64_t b = static_cast<uint8_t>(*src++);
+    value |= (b & 0x7f) << shift;
+    if ((b & 0x80) == 0)
+      return true;
+  }
+  return false;
+}
+
+// Names of the TableProperties in the properties block. The names are
+// persisted, DO NOT change them.
+const std::pair<const char*, uint64_t TableProperties::*> kPropertyNames[] = {
+    {"num_entries", &TableProperties::num_entries},
+    {"num_deletions", &TableProperties::num_deletions},
+    {"raw_key_size", &TableProperties::raw_key_size},
+    {"raw_value_size", &TableProperties::raw_value_size},
+    {"min_entry_id", &TableProperties::min_entry_id},
+    {"max_entry_id", &TableProperties::max_entry_id},
+    {"creation_time", &TableProperties::creation_time}};
+
+inline void PutHandle(char*& dst, const DataFileFormat::BlockHandle& handle) {
+  PutFixed64(dst, handle.offset);
+  PutFixed64(dst, handle.size);
+}
+
+inline DataFileFormat::BlockHandle GetHandle(const char*& src) {
+  uint64_t offset = GetFixed64(src);
+  return DataFileFormat::BlockHandle(offset, GetFixed64(src));
+}
+
+inline void PutVarint64(std::string& dst, const uint64_t value) {
+  char buf[10];
+  dst.append(buf, coding::EncodeVarint64(value, buf));
+}
+
+inline void PutLengthPrefixed(std::string& dst, const std::string& value) {
+  PutVarint64(dst, value.size());
+  dst += value;
+}
+
+// Decode a varint no larger than the limit without reading past the end
+template <typename T>
+bool GetVarint(const char*& src, const char* end, T& value,
+               const uint64_t limit = std::numeric_limits<T>::max()) {
+  uint64_t v;
+  if (!GetVarint64(src, end, v) || v > limit)
+    return false;
+  value = static_cast<T>(v);
+  return true;
+}
+
+bool GetLengthPrefixed(const char*& src, const char* end, std::string& value) {
+  uint64_t size;
+  if (!GetVarint64(src, end, size) || size > static_cast<uint64_t>(end - src))
+    return false;
+  value.assign(src, size);
+  src += size;
+  return true;
+}
+
+}  // namespace
+
+void ManifestFormat::VersionEdit::AddFile(const int level, const int index,
+                                          const std::string& name,
+                                          const uint64_t file_size,
+                                          const std::string& smallest,
+                                          const std::string& largest) {
+  NewFile file;
+  file.level = level;
+  file.index = index;
+  file.name = name;
+  file.file_size = file_size;
+  file.smallest = smallest;
+  file.largest = largest;
+  new_files.push_back(std::move(file));
+}
+
+std::string ManifestFormat::EncodeRecord(const VersionEdit& edit) {
+  std::string ret(kRecordHeaderSize, 0);
+  if (edit.has_next_file_number) {
+    PutVarint64(ret, kNextFileNumber);
+    PutVarint64(ret, edit.next_file_number);
+  }
+  if (edit.has_last_entry_id) {
+    PutVarint64(ret, kLastEntryID);
+    PutVarint64(ret, edit.last_entry_id);
   }
+  for (auto& file : edit.deleted_files) {
+    PutVarint64(ret, kDeletedFile);
+    PutVarint64(ret, file.first);
+    PutLengthPrefixed(ret, file.second);
+  }
+  for (auto& file : edit.new_files) {
+    PutVarint64(ret, kNewFile);
+    PutVarint64(ret, file.level);
+    PutVarint64(ret, file.index);
+    PutLengthPrefixed(ret, file.name);
+    PutVarint64(ret, file.file_size);
+    PutLengthPrefixed(ret, file.smallest);
+    PutLengthPrefixed(ret, file.largest);
+  }
+
+  const char* payload = ret.data() + kRecordHeaderSize;
+  uint32_t payload_size = ret.size() - kRecordHeaderSize;
+  char* dst = &ret[0];
+  PutFixed32(dst, payload_size);
+  PutFixed32(dst, crc32c::Mask(crc32c::Value(payload, payload_size)));
 
   return ret;
 }
 
-std::string ManifestFormat::Encode(const ManifestData& manifest) {
-  std::string ret;
-  char seperator = '\n';
-  ret = manifest.path_to_manifest + seperator + manifest.path_to_log + seperator;
-  for (auto& level : manifest.data_files) {
-    std::string line;
-    for (auto& f : level) {
-      line += f + ';';
+Status ManifestFormat::DecodeRecord(const char*& src, const char* end,
+                                    VersionEdit& edit) {
+  if (end - src < kRecordHeaderSize)
+    return Status::Corruption("Truncated MANIFEST record");
+  const char* header = src;
+  uint32_t payload_size = GetFixed32(header);
+  uint32_t crc = crc32c::Unmask(GetFixed32(header));
+  if (static_cast<uint64_t>(end - header) < payload_size)
+    return Status::Corruption("Truncated MANIFEST record");
+  if (crc32c::Value(header, payload_size) != crc)
+    return Status::Corruption("MANIFEST record checksum mismatch");
+
+  edit = VersionEdit();
+  const char* p = header;
+  const char* payload_end = header + payload_size;
+  const int kMaxLevel = std::numeric_limits<int>::max();
+  uint32_t tag;
+  bool ok = true;
+  while (ok && p < payload_end) {
+    if (!GetVarint(p, payload_end, tag))
+      break;
+    switch (tag) {
+      case kNextFileNumber:
+        ok = GetVarint(p, payload_end, edit.next_file_number);
+        edit.has_next_file_number = true;
+        break;
+      case kLastEntryID:
+        ok = GetVarint(p, payload_end, edit.last_entry_id);
+        edit.has_last_entry_id = true;
+        break;
+      case kDeletedFile: {
+        std::pair<int, std::string> file;
+        ok = GetVarint(p, payload_end, file.first, kMaxLevel) &&
+             GetLengthPrefixed(p, payload_end, file.second);
+        edit.deleted_files.push_back(std::move(file));
+        break;
+      }
+      case kNewFile: {
+        NewFile file;
+        ok = GetVarint(p, payload_end, file.level, kMaxLevel) &&
+             GetVarint(p, payload_end, file.index, kMaxLevel) &&
+             GetLengthPrefixed(p, payload_end, file.name) &&
+             GetVarint(p, payload_end, file.file_size) &&
+             GetLengthPrefixed(p, payload_end, file.smallest) &&
+             GetLengthPrefixed(p, payload_end, file.largest);
+        edit.new_files.push_back(std::move(file));
+        break;
+      }
+      default:
+        ok = false;
     }
-    if (line.empty())
-      line.push_back('\n');
-    else
-      line.back() = '\n';
-    ret += line;
   }
+  if (!ok || p != payload_end)
+    return Status::Corruption("Bad MANIFEST record");
+
+  src = payload_end;
+  return Status::NoError();
+}
+
+void ManifestFormat::Apply(const VersionEdit& edit, ManifestData& manifest) {
+  for (auto& file : edit.deleted_files) {
+    if (file.first >= manifest.data_files.size())
+      continue;
+    auto& files = manifest.data_files[file.first];
+    auto it = std::find(files.begin(), files.end(), file.second);
+    if (it != files.end())
+      files.erase(it);
+  }
+
+  for (auto& file : edit.new_files) {
+    while (manifest.data_files.size() <= file.level)
+      manifest.data_files.push_back(std::vector<std::string>());
+    auto& files = manifest.data_files[file.level];
+    files.insert(files.begin() + std::min<size_t>(file.index, files.size()),
+                 file.name);
+  }
+}
+
+std::string DataFileFormat::EncodeFooter(const Footer& footer) {
+  std::string ret(kSSTFooterSize, 0);
+  char* dst = &ret[0];
+  PutFixed64(dst, footer.data_blk_size);
+  PutHandle(dst, footer.min_key);
+  PutHandle(dst, footer.max_key);
+  PutHandle(dst, footer.index);
+  PutHandle(dst, footer.metaindex);
+  PutFixed32(dst, footer.format_version);
+  PutFixed32(dst, crc32c::Mask(crc32c::Value(&ret[0], dst - &ret[0])));
+  PutFixed64(dst, kSSTMagicNumber);
+
+  return ret;
+}
+
+Status DataFileFormat::DecodeFooter(const char* footer_str, Footer& footer) {
+  const char* src = footer_str + kSSTFooterSize - sizeof(uint64_t);
+  if (GetFixed64(src) != kSSTMagicNumber)
+    return Status::Corruption("Bad magic number, not an SST file");
+
+  src = footer_str;
+  footer.data_blk_size = GetFixed64(src);
+  footer.min_key = GetHandle(src);
+  footer.max_key = GetHandle(src);
+  footer.index = GetHandle(src);
+  footer.metaindex = GetHandle(src);
+  footer.format_version = GetFixed32(src);
+  uint32_t crc = crc32c::Value(footer_str, src - footer_str);
+  if (crc32c::Unmask(GetFixed32(src)) != crc)
+    return Status::Corruption("Footer checksum mismatch");
+  if (footer.format_version == 0 || footer.format_version > kSSTFormatVersion)
+    return Status::BadArgumentError("Unsupported SST format version " +
+                                    std::to_string(footer.format_version));
+
+  footer.meta_blocks.clear();
+  return Status::NoError();
+}
+
+std::string DataFileFormat::EncodeMetaindex(
+    const std::map<std::string, BlockHandle>& meta_blocks) {
+  std::string ret;
+  char buf[5 + kBlockHandleSize];
+  for (auto& meta : meta_blocks) {
+    char* dst = coding::EncodeVarint32(meta.first.size(), buf);
+    ret.append(buf, dst);
+    ret += meta.first;
+    dst = buf;
+    PutHandle(dst, meta.second);
+    ret.append(buf, dst);
+  }
+
   return ret;
-}
\ No newline at end of file
+}
+
+Status DataFileFormat::DecodeMetaindex(
+    const std::string& metaindex,
+    std::map<std::string, BlockHandle>& meta_blocks) {
+  const char* src = metaindex.data();
+  const char* end = src + metaindex.size();
+  while (src < end) {
+    // The varint32 is at most 5 bytes and always followed by a handle
+    if (end - src < 1 + kBlockHandleSize)
+      return Status::Corruption("Truncated MetaindexBlock");
+    uint32_t name_size = coding::DecodeVarint32(src);
+    src += coding::SizeOfVarint(name_size);
+    if (static_cast<uint64_t>(end - src) < name_size + kBlockHandleSize)
+      return Status::Corruption("Truncated MetaindexBlock");
+    std::string name(src, name_size);
+    src += name_size;
+    meta_blocks[name] = GetHandle(src);
+  }
+
+  return Status::NoError();
+}
+
+void DataFileFormat::TableProperties::AddEntry(const char* internal_entry) {
+  uint64_t id = InternalEntry::EntryID(internal_entry);
+  min_entry_id = num_entries == 0 ? id : std::min(min_entry_id, id);
+  max_entry_id = num_entries == 0 ? id : std::max(max_entry_id, id);
+  ++num_entries;
+
+  raw_key_size += InternalEntry::EntryKey(internal_entry).size();
+  if (InternalEntry::EntryOpType(internal_entry) == InternalEntry::kDelete)
+    ++num_deletions;
+  else
+    raw_value_size += InternalEntry::EntryValue(internal_entry).size();
+}
+
+void DataFileFormat::TableProperties::Add(const TableProperties& other) {
+  if (other.num_entries != 0) {
+    min_entry_id = num_entries == 0
+                       ? other.min_entry_id
+                       : std::min(min_entry_id, other.min_entry_id);
+    max_entry_id = num_entries == 0
+                       ? other.max_entry_id
+                       : std::max(max_entry_id, other.max_entry_id);
+  }
+  if (creation_time == 0 ||
+      (other.creation_time != 0 && other.creation_time < creation_time))
+    creation_time = other.creation_time;
+
+  num_entries += other.num_entries;
+  num_deletions += other.num_deletions;
+  raw_key_size += other.raw_key_size;
+  raw_value_size += other.raw_value_size;
+}
+
+std::string DataFileFormat::EncodeProperties(const TableProperties& props) {
+  std::string ret;
+  char buf[10];
+  for (auto& name : kPropertyNames) {
+    size_t name_size = std::strlen(name.first);
+    ret.append(buf, coding::EncodeVarint32(name_size, buf));
+    ret.append(name.first, name_size);
+    ret.append(buf, coding::EncodeVarint64(props.*name.second, buf));
+  }
+
+  return ret;
+}
+
+Status DataFileFormat::DecodeProperties(const std::string& contents,
+                                        TableProperties& props) {
+  props = TableProperties();
+
+  const char* src = contents.data();
+  const char* end = src + contents.size();
+  uint64_t name_size, value;
+  while (src < end) {
+    if (!GetVarint64(src, end, name_size) ||
+        name_size > static_cast<uint64_t>(end - src))
+      return Status::Corruption("Bad properties block");
+    std::string name(src, name_size);
+    src += name_size;
+    if (!GetVarint64(src, end, value))
+      return Status::Corruption("Bad properties block");
+
+    for (auto& known : kPropertyNames) {
+      if (name == known.first) {
+        props.*known.second = value;
+        break;
+      }
+    }
+  }
+
+  return Status::NoError();
+}
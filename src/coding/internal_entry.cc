@@ -18,7 +18,7 @@ Status InternalEntry::EncodeInternal(const Sequence& key, const Sequence& value,
   // Set OpType = 1(Insert) or 0(Delete)
   *intnl_ptr++ = op_type;
 
-  if (op_type == kInsert) {
+  if (op_type != kDelete) {
     intnl_ptr = coding::EncodeVarint64(value.size(), intnl_ptr);
     memcpy(intnl_ptr, value.data(), value.size());
   }
@@ -30,13 +30,15 @@ InternalEntry::OpType InternalEntry::EntryOpType(const char* internal_entry) {
   uint64_t key_size = coding::DecodeVarint64(internal_entry);
   internal_entry += coding::SizeOfVarint(key_size) + key_size + 8;
 
-  assert(*internal_entry == 0 || *internal_entry == 1);
+  assert(*internal_entry >= 0 && *internal_entry <= 2);
 
   switch (*internal_entry) {
     case 0:
       return kDelete;
     case 1:
       return kInsert;
+    case 2:
+      return kMerge;
   }
 
   // Should never reach
@@ -49,6 +51,15 @@ Sequence InternalEntry::EntryKey(const char* internal_entry) {
   return Sequence(internal_entry + coding::SizeOfVarint(internal_entry), size);
 }
 
+uint64_t InternalEntry::EntryID(const char* internal_entry) {
+  uint64_t size = coding::DecodeVarint64(internal_entry);
+  internal_entry += coding::SizeOfVarint(size) + size;
+
+  uint64_t id;
+  memcpy(&id, internal_entry, sizeof(id));
+  return id;
+}
+
 Sequence InternalEntry::EntryValue(const char* internal_entry) {
   uint64_t size = coding::DecodeVarint64(internal_entry);
   internal_entry += coding::SizeOfVarint(size) + size + 9;
@@ -0,0 +1,41 @@
+#include "aligned_buffer.h"
+
+#include <cstdlib>
+
+AlignedBuffer::AlignedBuffer(const size_t capacity)
+    : capacity_(RoundUp(std::max<size_t>(capacity, 1))) {
+  if (posix_memalign(reinterpret_cast<void**>(&data_), kAlignment,
+                     capacity_) != 0) {
+    data_ = nullptr;
+    capacity_ = 0;
+  }
+}
+
+std::unique_ptr<AlignedBuffer> AlignedBufferPool::Acquire(const size_t size) {
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    for (auto iter = free_buffers_.begin(); iter != free_buffers_.end();
+         ++iter) {
+      if ((*iter)->capacity() >= size) {
+        std::unique_ptr<AlignedBuffer> ret = std::move(*iter);
+        free_buffers_.erase(iter);
+        return ret;
+      }
+    }
+  }
+
+  std::unique_ptr<AlignedBuffer> ret(new AlignedBuffer(size));
+  if (ret->data() == nullptr)
+    ret.reset();
+
+  return ret;
+}
+
+void AlignedBufferPool::Release(std::unique_ptr<AlignedBuffer> buffer) {
+  if (buffer == nullptr)
+    return;
+
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+  if (free_buffers_.size() < kMaxFreeBuffers)
+    free_buffers_.push_back(std::move(buffer));
+}
@@ -40,5 +40,27 @@ bool DBFile::Close() {
     return false;
   }
   fd_ = -1;
+  direct_io_ = false;
   return true;
+}
+
+bool DBFile::SetDirectIO(const bool direct_io) {
+#ifdef O_DIRECT
+  if (!IsOpened())
+    return false;
+  if (direct_io == direct_io_)
+    return true;
+
+  int flags = fcntl(fd_, F_GETFL);
+  if (flags < 0)
+    return false;
+  flags = direct_io ? flags | O_DIRECT : flags & ~O_DIRECT;
+  if (fcntl(fd_, F_SETFL, flags) != 0)
+    return false;  // E.g. EINVAL on tmpfs
+
+  direct_io_ = direct_io;
+  return true;
+#else
+  return !direct_io;
+#endif
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "file_gc.h"
+
+TCFileGC::TCFileGC(
+    TCIO& io, const std::function<void(std::set<std::string>&)>& live_files,
+    const uint64_t rate_bytes_per_sec)
+    : io_(io),
+      live_files_(live_files),
+      rate_bytes_per_sec_(rate_bytes_per_sec),
+      gc_thread_(&TCFileGC::BackgroundGC, this) {}
+
+TCFileGC::~TCFileGC() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+  }
+  cv_.notify_all();
+
+  gc_thread_.join();
+}
+
+void TCFileGC::AddCandidates(const std::vector<std::string>& file_basenames) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    candidates_.insert(file_basenames.begin(), file_basenames.end());
+  }
+  cv_.notify_all();
+}
+
+int TCFileGC::PendingFiles() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return candidates_.size();
+}
+
+void TCFileGC::BackgroundGC() {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  while (!shutting_down_) {
+    if (candidates_.empty()) {
+      cv_.wait(lock);
+      continue;
+    }
+
+    // Find the candidates that no live version references. A file removed
+    // from the latest version never comes back, so a candidate absent from
+    // the live files is referenced by nobody and can be deleted safely.
+    std::vector<std::string> obsolete;
+    std::set<std::string> live_files;
+    lock.unlock();
+    live_files_(live_files);
+    lock.lock();
+    for (auto it = candidates_.begin(); it != candidates_.end();) {
+      if (live_files.count(*it) == 0) {
+        obsolete.push_back(*it);
+        it = candidates_.erase(it);
+      } else {
+        ++it;
+      }
+    }
+
+    lock.unlock();
+    for (auto& file_basename : obsolete) {
+      uint64_t file_size = 0;
+      Status ret = io_.DeleteSSTFile(file_basename, file_size);
+      if (!ret.StatusNoError()) {
+        io_.Log("Failed to delete obsolete file " + file_basename + ": " +
+                    ret.ErrMsg(),
+                TCLogger::kWarn);
+        continue;
+      }
+
+      // Pace the deletion by the file size
+      if (rate_bytes_per_sec_ > 0) {
+        std::unique_lock<std::mutex> pace_lock(mutex_);
+        cv_.wait_for(pace_lock,
+                     std::chrono::microseconds(file_size * 1000000 /
+                                               rate_bytes_per_sec_),
+                     [this]() { return shutting_down_; });
+        if (shutting_down_)
+          break;
+      }
+    }
+    lock.lock();
+
+    // The remaining candidates are still referenced by the readers of older
+    // versions, retry later
+    if (obsolete.empty() && !candidates_.empty())
+      cv_.wait_for(lock, std::chrono::milliseconds(kRetryIntervalMs));
+  }
+}
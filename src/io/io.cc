@@ -1,7 +1,11 @@
 #include "io.h"
 
+#include <dirent.h>
+
 TCIO::TCIO(const std::string& files_dir)
-    : kDatabaseDir(files_dir), io_lock_(io_mutex_) {
+    : kDatabaseDir(files_dir),
+      aligned_buffer_pool_(std::make_shared<AlignedBufferPool>()),
+      io_lock_(io_mutex_) {
   // If the kDatabaseDir does not exist or does not have rwx permissions
   int stat = access(kDatabaseDir.c_str(), F_OK | W_OK | X_OK);
   while (stat != 0) {
@@ -20,7 +24,8 @@ TCIO::TCIO(const std::string& files_dir)
 
   for (int i = 0; i < kDefaultReaderNum; ++i)
     readers_.push_back(
-        std::make_shared<SequentialReader>(kDefaultReaderBufferSize));
+        std::make_shared<SequentialReader>(kDefaultReaderBufferSize,
+                                           aligned_buffer_pool_));
 }
 
 TCIO::~TCIO() {
@@ -32,30 +37,45 @@ TCIO::~TCIO() {
   // don't need to delete.
 }
 
-Status TCIO::WriteLevel0File(const TCTable* immutable, Manifest& manifest,
+Status TCIO::WriteLevel0File(const TCTable* immutable,
+                             std::string& file_basename,
                              const std::shared_ptr<Filter>& filter) {
   Status ret;
 
-  // Write level0 file
   char file_basename_cstr[17] = {};
   io_lock_.Lock();  // Protect the file_id_
   sprintf(file_basename_cstr, "%016lX", file_id_++);
   io_lock_.Unlock();
-  std::string file_basename(file_basename_cstr);
+  file_basename = std::string(file_basename_cstr);
 
-  ret = WriteSSTFile(
-      neko_base::PathJoin(kDatabaseDir, file_basename + kSSTFilePostfix),
-      immutable->EntrySet(), filter);
-  if (!ret.StatusNoError()) {
-    return ret;
+  std::string file_name =
+      neko_base::PathJoin(kDatabaseDir, file_basename + kSSTFilePostfix);
+  std::shared_ptr<WritableFile> wf =
+      NewSSTFile(file_name, TCRateLimiter::kIOHigh);
+
+  // Stream the latest versions from the skiplist, the entries stay in the
+  // arena of the immutable table until the file is finished
+  TCTableBuilder builder(wf.get(), compression_, filter,
+                         immutable->NumEntries());
+  for (TCTable::LatestIterator iter(immutable); iter.Valid(); iter.Next()) {
+    ret = builder.Add(InternalEntry::EntryData(iter.entry()));
+    if (!ret.StatusNoError()) {
+      return AbandonSSTFile(wf.get(), file_name, ret);
+    }
   }
 
-  // Rewrite manifest file
-  if (manifest.data_files.empty())
-    manifest.data_files.push_back(std::vector<std::string>());
-  manifest.data_files[0].push_back(file_basename);
+  // The final sync only waits for the tail, the rest of the file has been
+  // written back along the way
+  ret = builder.Finish();
+  if (ret.StatusNoError())
+    ret = wf->Sync();
+  if (ret.StatusNoError())
+    ret = wf->Close();
+  if (!ret.StatusNoError()) {
+    return AbandonSSTFile(wf.get(), file_name, ret);
+  }
 
-  return WriteManifest(manifest);
+  return ret;
 }
 
 Status TCIO::WriteNewSSTFile(const std::vector<Sequence>& entry_set,
@@ -135,158 +155,211 @@ Status TCIO::WriteMergeSSTFile(
   return ret;
 }
 
-Status TCIO::UpdateManifest(
-    Manifest& old_manifest,
-    const std::vector<std::pair<int, int>>& compact_file_index,
-    const std::vector<std::string>& new_files, const int current_level,
-    const int insert_index) {
-  Status ret;
+Status TCIO::DeleteSSTFile(const std::string& file_basename,
+                           uint64_t& file_size) {
+  std::string file_abs_path =
+      neko_base::PathJoin(kDatabaseDir, file_basename + kSSTFilePostfix);
 
-  Manifest manifest = old_manifest;
-
-  // Delete the compacted files from the manifest
-  // Clean current level
-  auto it = compact_file_index.begin();
-  std::vector<std::vector<std::string>::size_type> remove_points;
-  while (it != compact_file_index.end() && it->first == current_level) {
-    // TODO: Time cost!
-    remove_points.push_back(it->second);
-    ++it;
-  }
-  // The std::vector remove_points MUST be ascending
-  neko_base::Remove(manifest.data_files[current_level], remove_points);
-
-  // Insert new SST files
-  if (manifest.data_files.size() <= current_level + 1) {
-    // Push an empty vector
-    manifest.data_files.push_back(std::vector<std::string>());
-  }
-
-  std::pair<int, int> boundary;
-  if (it == compact_file_index.end()) {
-    // Did not compact any files at level <current_level + 1>
-
-    // The insert_index has 3 conditions:
-    //   0: push front;
-    //   data_files.size(): push back;
-    //   others: insert at insert_index;
-    // Here, the insert_index can only be 0 or data_files.size()
-    assert(insert_index == 0 ||
-           insert_index == manifest.data_files[current_level + 1].size());
-    boundary = std::make_pair(insert_index, insert_index);
-  } else {
-    boundary = std::make_pair(it->second, compact_file_index.back().second + 1);
-  }
+  ::ssize_t size = BaseReader::FlieSize(file_abs_path.c_str());
+  file_size = size > 0 ? size : 0;
 
-  // Note: compact_file_index at level <current_level + 1> are consistent.
-  if (!neko_base::RearrangeFilesInManifest(
-          manifest.data_files[current_level + 1], boundary, new_files,
-          current_level + 1))
-    return Status::UndefinedError();
+  if (unlink(file_abs_path.c_str()) != 0)
+    return Status::FileIOError("Failed to delete " + file_abs_path);
 
-  ret = WriteManifest(manifest);
-  if (ret.StatusNoError()) {
-    old_manifest = manifest;
-  }
-  return ret;
+  return Status::NoError();
 }
 
-Status TCIO::ReadManifest(Manifest& manifest) {
+Status TCIO::RecoverManifest(ManifestFormat::VersionEdit& snapshot) {
   Status ret;
+  std::string manifest_path =
+      neko_base::PathJoin(kDatabaseDir, kManifestFilename);
 
-  io_lock_.Lock();  // TODO: Blocking queue?
-  if (readers_.empty()) {
-    io_lock_.Unlock();
-    return Status::FileIOError("No available Reader.");
-  }
-
-  auto manifest_reader = readers_.back();
-  readers_.pop_back();
-  io_lock_.Unlock();
-
+  auto manifest_reader = AcquireReader();
   std::string manifest_content;
   ret = manifest_reader->ReadEntire(
-      new DBFile(neko_base::PathJoin(kDatabaseDir, kManifestFilename),
-                 DBFile::Mode::kReadOnly),
-      manifest_content);
-  if (ret.StatusNoError()) {
-    manifest = ManifestFormat::Decode(manifest_content);
+      new DBFile(manifest_path, DBFile::Mode::kReadOnly), manifest_content);
+  ReleaseReader(manifest_reader);
+  if (!ret.StatusNoError())
+    return ret;
+
+  // Replay the edits. The metadata of the live files is kept by name.
+  Manifest manifest;
+  std::unordered_map<std::string, ManifestFormat::NewFile> live_files;
+  ManifestFormat::VersionEdit edit;
+  uint64_t next_file_number = 0;
+  bool has_last_entry_id = false;
+  uint64_t last_entry_id = 0;
+  uint64_t first_record_size = 0;
+
+  const char* begin = manifest_content.data();
+  const char* end = begin + manifest_content.size();
+  const char* src = begin;
+  while (src < end) {
+    const char* record = src;
+    ret = ManifestFormat::DecodeRecord(src, end, edit);
+    if (!ret.StatusNoError()) {
+      // Only the last record may be torn by a crash. The first one is a
+      // snapshot, which is written atomically.
+      uint32_t payload_size = 0;
+      if (end - record >= ManifestFormat::kRecordHeaderSize)
+        std::memcpy(&payload_size, record, sizeof(payload_size));
+      if (record == begin ||
+          (end - record >= ManifestFormat::kRecordHeaderSize &&
+           static_cast<uint64_t>(end - record) >
+               ManifestFormat::kRecordHeaderSize + payload_size))
+        return ret;
+
+      if (truncate(manifest_path.c_str(), record - begin) != 0)
+        return Status::FileIOError("Failed to truncate " + manifest_path);
+      Log("Truncated the torn MANIFEST record at offset " +
+              std::to_string(record - begin),
+          TCLogger::kWarn);
+      end = record;
+      ret = Status::NoError();
+      break;
+    }
+
+    ManifestFormat::Apply(edit, manifest);
+    for (auto& file : edit.deleted_files)
+      live_files.erase(file.second);
+    for (auto& file : edit.new_files)
+      live_files[file.name] = file;
+    if (edit.has_next_file_number)
+      next_file_number = std::max(next_file_number, edit.next_file_number);
+    if (edit.has_last_entry_id) {
+      last_entry_id = has_last_entry_id
+                          ? std::max(last_entry_id, edit.last_entry_id)
+                          : edit.last_entry_id;
+      has_last_entry_id = true;
+    }
+    if (record == begin)
+      first_record_size = src - begin;
+  }
+
+  snapshot = ManifestFormat::VersionEdit();
+  for (int level = 0; level < manifest.data_files.size(); ++level) {
+    const auto& files = manifest.data_files[level];
+    for (int i = 0; i < files.size(); ++i) {
+      ManifestFormat::NewFile file = live_files[files[i]];
+      file.level = level;
+      file.index = i;
+      file.name = files[i];
+      snapshot.new_files.push_back(std::move(file));
+    }
   }
 
-  // Push the SequentialReader object back to reader_ before return
-  io_lock_.Lock();
-  readers_.push_back(manifest_reader);
+  // The SST files written after the last edit, which are not in the
+  // MANIFEST, must not be overwritten
+  next_file_number = std::max(next_file_number, NextSSTFileNumberOnDisk());
+  io_lock_.Lock();  // Protect the file_id_
+  file_id_ = std::max(file_id_, next_file_number);
+  snapshot.SetNextFileNumber(file_id_);
   io_lock_.Unlock();
+  if (has_last_entry_id)
+    snapshot.SetLastEntryID(last_entry_id);
+
+  std::lock_guard<std::mutex> lock(manifest_mutex_);
+  manifest_size_ = end - begin;
+  snapshot_size_ = first_record_size;
+  has_last_entry_id_ = has_last_entry_id;
+  last_entry_id_ = last_entry_id;
 
   return ret;
 }
 
-// TODO: Reuse another version
-Status TCIO::ReadSSTFooter(const std::string& file_abs_path,
-                           DataFileFormat::Footer& footer) {
-  Status ret;
+Status TCIO::LogManifestEdit(ManifestFormat::VersionEdit& edit) {
+  std::lock_guard<std::mutex> lock(manifest_mutex_);
 
-  // Get a SequentialReader
-  io_lock_.Lock();
-  auto footer_reader = readers_.back();
-  readers_.pop_back();
+  io_lock_.Lock();  // Protect the file_id_
+  edit.SetNextFileNumber(file_id_);
   io_lock_.Unlock();
 
-  // Get file size
-  auto size = footer_reader->FlieSize(file_abs_path.c_str());
-
-  // Read Footer
-  std::string footer_content;
-  ret = footer_reader->Read(new DBFile(file_abs_path), footer_content,
-                            DataFileFormat::kSSTFooterSize,
-                            size - DataFileFormat::kSSTFooterSize);
-  if (ret.StatusNoError()) {
-    // Return values
-    footer = DataFileFormat::Footer(footer_content.c_str());
+  std::string manifest_path =
+      neko_base::PathJoin(kDatabaseDir, kManifestFilename);
+  std::string record = ManifestFormat::EncodeRecord(edit);
+  Status ret = WriteSyncedFile(manifest_path, record, true);
+  if (!ret.StatusNoError()) {
+    // Drop the partially appended record, so that the next edit is not
+    // appended after a torn one
+    truncate(manifest_path.c_str(), manifest_size_);
+    return ret;
   }
 
-  io_lock_.Lock();
-  readers_.push_back(footer_reader);
-  io_lock_.Unlock();
+  manifest_size_ += record.size();
+  if (edit.has_last_entry_id) {
+    last_entry_id_ = has_last_entry_id_
+                         ? std::max(last_entry_id_, edit.last_entry_id)
+                         : edit.last_entry_id;
+    has_last_entry_id_ = true;
+  }
 
   return ret;
 }
 
+bool TCIO::ManifestSnapshotDue() {
+  std::lock_guard<std::mutex> lock(manifest_mutex_);
+  return manifest_size_ - snapshot_size_ >
+         std::max(snapshot_size_, kManifestSnapshotMinLogSize);
+}
+
+Status TCIO::ReadSSTFooter(const std::string& file_abs_path,
+                           DataFileFormat::Footer& footer) {
+  std::string min_key, max_key;
+  return ReadSSTFooter(file_abs_path, footer, min_key, max_key);
+}
+
 Status TCIO::ReadSSTFooter(const std::string& file_abs_path,
                            DataFileFormat::Footer& footer, std::string& min_key,
                            std::string& max_key) {
   Status ret;
 
   // Get a SequentialReader
-  io_lock_.Lock();
-  auto footer_reader = readers_.back();
-  readers_.pop_back();
-  io_lock_.Unlock();
+  auto footer_reader = AcquireReader();
 
   // Get file size
   auto size = footer_reader->FlieSize(file_abs_path.c_str());
-
-  // Read Footer
-  std::string footer_content;
-  ret = footer_reader->Read(new DBFile(file_abs_path), footer_content,
-                            DataFileFormat::kSSTFooterSize,
-                            size - DataFileFormat::kSSTFooterSize);
-
-  if (ret.StatusNoError()) {
-    // Return values
-    footer = DataFileFormat::Footer(footer_content.c_str());
-    ret = footer_reader->Read(new DBFile(file_abs_path), min_key,
-                              footer.min_key_size, 0);
-  }
-
-  if (ret.StatusNoError()) {
-    ret = footer_reader->Read(new DBFile(file_abs_path), max_key,
-                              footer.max_key_size, footer.max_key_offset);
-  }
-
-  io_lock_.Lock();
-  readers_.push_back(footer_reader);
-  io_lock_.Unlock();
+  if (size < DataFileFormat::kSSTFooterSize) {
+    ReleaseReader(footer_reader);
+    return size < 0 ? Status::FileIOError("Unable to stat " + file_abs_path)
+                    : Status::Corruption("Truncated SST file " + file_abs_path);
+  }
+
+  // Read the tail of the file, which ends with the Footer
+  std::string tail;
+  uint64_t tail_size =
+      std::min<uint64_t>(size, DataFileFormat::kSSTTailReadSize);
+  uint64_t tail_offset = size - tail_size;
+  ret = footer_reader->Read(new DBFile(file_abs_path), tail, tail_size,
+                            tail_offset);
+  if (ret.StatusNoError())
+    ret = DataFileFormat::DecodeFooter(
+        tail.data() + tail_size - DataFileFormat::kSSTFooterSize, footer);
+
+  // All the blocks are ahead of the Footer
+  uint64_t footer_offset = size - DataFileFormat::kSSTFooterSize;
+  if (ret.StatusNoError() && (footer.metaindex.end() > footer_offset ||
+                              footer.index.end() > footer_offset ||
+                              footer.min_key.end() > footer_offset ||
+                              footer.max_key.end() > footer_offset))
+    ret = Status::Corruption("Bad Footer in " + file_abs_path);
+
+  std::string metaindex;
+  if (ret.StatusNoError())
+    ret = ReadTailBlock(footer_reader, file_abs_path, tail, tail_offset,
+                        footer.metaindex, metaindex);
+  if (ret.StatusNoError())
+    ret = VerifyChecksum(metaindex, file_abs_path);
+  if (ret.StatusNoError())
+    ret = DataFileFormat::DecodeMetaindex(metaindex, footer.meta_blocks);
+
+  if (ret.StatusNoError())
+    ret = ReadTailBlock(footer_reader, file_abs_path, tail, tail_offset,
+                        footer.min_key, min_key);
+  if (ret.StatusNoError())
+    ret = ReadTailBlock(footer_reader, file_abs_path, tail, tail_offset,
+                        footer.max_key, max_key);
+
+  ReleaseReader(footer_reader);
 
   return ret;
 }
@@ -338,57 +411,89 @@ Status TCIO::ReadSSTGroupBoundary(
   return ret;
 }
 
-Status TCIO::ReadSSTFlexible(const std::string& file_abs_path,
-                             const DataFileFormat::Footer& footer,
-                             std::string& flexible_content) {
-  Status ret;
+Status TCIO::ReadSSTFilter(const std::string& file_abs_path,
+                           const DataFileFormat::Footer& footer,
+                           std::string& filter_content) {
+  filter_content.clear();
+  auto filter_handle =
+      footer.meta_blocks.find(DataFileFormat::kFilterBlockName);
+  if (filter_handle == footer.meta_blocks.end())
+    return Status::NoError();  // Written without a filter
 
   // Get a SequentialReader
-  io_lock_.Lock();
-  auto flex_reader = readers_.back();
-  readers_.pop_back();
-  io_lock_.Unlock();
+  auto filter_reader = AcquireReader();
 
-  flexible_content.clear();
-  ret = flex_reader->Read(new DBFile(file_abs_path), flexible_content,
-                          footer.flexible_blk_size,
-                          footer.data_blk_size + footer.index_blk_size);
+  Status ret = filter_reader->Read(new DBFile(file_abs_path), filter_content,
+                                   filter_handle->second.size,
+                                   filter_handle->second.offset);
 
-  io_lock_.Lock();
-  readers_.push_back(flex_reader);
-  io_lock_.Unlock();
+  ReleaseReader(filter_reader);
+
+  if (ret.StatusNoError())
+    ret = VerifyChecksum(filter_content, file_abs_path);
+
+  return ret;
+}
+
+Status TCIO::ReadSSTProperties(const std::string& file_abs_path,
+                               const DataFileFormat::Footer& footer,
+                               TableProperties& props) {
+  props = TableProperties();
+  auto props_handle =
+      footer.meta_blocks.find(DataFileFormat::kPropertiesBlockName);
+  if (props_handle == footer.meta_blocks.end())
+    return Status::NoError();
+
+  // Get a SequentialReader
+  auto props_reader = AcquireReader();
+
+  std::string props_content;
+  Status ret = props_reader->Read(new DBFile(file_abs_path), props_content,
+                                  props_handle->second.size,
+                                  props_handle->second.offset);
+
+  ReleaseReader(props_reader);
+
+  if (ret.StatusNoError())
+    ret = VerifyChecksum(props_content, file_abs_path);
+  if (ret.StatusNoError())
+    ret = DataFileFormat::DecodeProperties(props_content, props);
 
   return ret;
 }
 
 Status TCIO::ReadSSTIndex(const std::string& file_abs_path,
                           const DataFileFormat::Footer& footer,
-                          std::vector<uint32_t>& data_blk_offset) {
+                          std::vector<uint64_t>& data_blk_offset) {
   Status ret;
 
   // Get a SequentialReader
-  io_lock_.Lock();
-  auto index_reader = readers_.back();
-  readers_.pop_back();
-  io_lock_.Unlock();
+  auto index_reader = AcquireReader();
 
   std::string index_content;
   ret = index_reader->Read(new DBFile(file_abs_path), index_content,
-                           footer.index_blk_size, footer.data_blk_size);
+                           footer.index.size, footer.index.offset);
+  if (ret.StatusNoError())
+    ret = VerifyChecksum(index_content, file_abs_path);
+  if (ret.StatusNoError() && index_content.size() < sizeof(uint64_t))
+    ret = Status::Corruption("Truncated IndexBlock in " + file_abs_path);
   if (ret.StatusNoError()) {
-    const uint32_t* index_ptr =
-        reinterpret_cast<const uint32_t*>(index_content.c_str());
-    uint32_t data_blk_count = *index_ptr;
-
-    ++index_ptr;
-    for (int i = 0; i < data_blk_count; ++i) {
-      data_blk_offset.push_back(*index_ptr++);
+    const char* index_ptr = index_content.data();
+    uint64_t data_blk_count;
+    std::memcpy(&data_blk_count, index_ptr, sizeof(data_blk_count));
+    if (data_blk_count != index_content.size() / sizeof(uint64_t) - 1) {
+      ReleaseReader(index_reader);
+      return Status::Corruption("Bad IndexBlock in " + file_abs_path);
     }
+
+    data_blk_offset.resize(data_blk_offset.size() + data_blk_count);
+    if (data_blk_count > 0)
+      std::memcpy(&data_blk_offset[data_blk_offset.size() - data_blk_count],
+                  index_ptr + sizeof(uint64_t),
+                  data_blk_count * sizeof(uint64_t));
   }
 
-  io_lock_.Lock();
-  readers_.push_back(index_reader);
-  io_lock_.Unlock();
+  ReleaseReader(index_reader);
 
   return ret;
 }
@@ -398,52 +503,59 @@ Status TCIO::ReadSSTDataBlock(const std::string& file_abs_path,
                               std::vector<Sequence>& entry_set,
                               const uint64_t block_size,
                               const ::ssize_t block_offset,
-                              const int reuse_block_id) {
+                              const int reuse_block_id, const bool fill_cache,
+                              const std::shared_ptr<ReadaheadReader>& input) {
   Status ret;
 
-  // Get a SequentialReader
-  io_lock_.Lock();
-  auto data_reader = readers_.back();
-  readers_.pop_back();
-  io_lock_.Unlock();
-
-  // Read DataBlock
+  // Take the uncompressed DataBlock from the block cache, or read it
+  TCBlockCache::Block cached;
   std::string data_content;
-  ret = data_reader->Read(new DBFile(file_abs_path), data_content, block_size,
-                          block_offset);
-
-  if (ret.StatusNoError()) {
-    // Copy the content of the DataBlock from the stack to the MemAllocator
-    char* data_block = nullptr;
-    if (reuse_block_id == -1) {
-      // Do not reallocate memory
-      data_block = merge_allocator->Allocate(data_content.size());
+  if (block_cache_ == nullptr ||
+      !block_cache_->Get(file_abs_path, block_offset, cached)) {
+    if (input != nullptr) {
+      ret = ReadBlockContents(*input, block_size, block_offset, data_content);
     } else {
-      data_block =
-          merge_allocator->Reallocate(data_content.size(), reuse_block_id);
-    }
-    if (!data_block)
-      return Status::FileIOError(
-          "Memory in MemAllocator/MergeAllocator not allocated.");
-    std::memcpy(data_block, data_content.c_str(), data_content.size());
-
-    auto data_offset = static_cast<std::string::size_type>(0);
-    while (data_offset < data_content.size()) {
-      entry_set.push_back(InternalEntry::EntryData(data_block + data_offset));
-      data_offset += entry_set.back().size();
+      auto data_reader = AcquireReader();
+      ret = ReadBlockContents(data_reader, file_abs_path, block_size,
+                              block_offset, data_content);
+      ReleaseReader(data_reader);
     }
+    if (!ret.StatusNoError())
+      return ret;
 
-    // Update reference counter at once
-    if (reuse_block_id == -1) {
-      merge_allocator->RefLast(entry_set.size() - 1);
-    } else {
-      merge_allocator->RefBlock(entry_set.size() - 1, reuse_block_id);
+    if (block_cache_ != nullptr && fill_cache) {
+      cached = std::make_shared<const std::string>(std::move(data_content));
+      block_cache_->Insert(file_abs_path, block_offset, cached);
     }
   }
+  const std::string& contents = cached != nullptr ? *cached : data_content;
 
-  io_lock_.Lock();
-  readers_.push_back(data_reader);
-  io_lock_.Unlock();
+  // Copy the content of the DataBlock to the MemAllocator
+  char* data_block = nullptr;
+  if (reuse_block_id == -1) {
+    // Do not reallocate memory
+    data_block = merge_allocator->Allocate(contents.size());
+  } else {
+    data_block = merge_allocator->Reallocate(contents.size(), reuse_block_id);
+  }
+  if (!data_block) {
+    return Status::FileIOError(
+        "Memory in MemAllocator/MergeAllocator not allocated.");
+  }
+  std::memcpy(data_block, contents.c_str(), contents.size());
+
+  auto data_offset = static_cast<std::string::size_type>(0);
+  while (data_offset < contents.size()) {
+    entry_set.push_back(InternalEntry::EntryData(data_block + data_offset));
+    data_offset += entry_set.back().size();
+  }
+
+  // Update reference counter at once
+  if (reuse_block_id == -1) {
+    merge_allocator->RefLast(entry_set.size() - 1);
+  } else {
+    merge_allocator->RefBlock(entry_set.size() - 1, reuse_block_id);
+  }
 
   return ret;
 }
@@ -451,61 +563,147 @@ Status TCIO::ReadSSTDataBlock(const std::string& file_abs_path,
 Status TCIO::ReadSSTDataAll(const std::string& file_abs_path,
                             std::shared_ptr<MemAllocator>& merge_allocator,
                             std::vector<Sequence>& entry_set,
-                            const uint64_t size, const ::ssize_t offset) {
+                            const std::vector<uint64_t>& data_blk_offset) {
   Status ret;
 
   // Get a SequentialReader
-  io_lock_.Lock();
-  auto data_reader = readers_.back();
-  readers_.pop_back();
-  io_lock_.Unlock();
+  auto data_reader = AcquireReader();
+
+  // Uncompress the DataBlocks one by one
+  std::string data_content, block_content;
+  for (int i = 0; i + 1 < data_blk_offset.size(); ++i) {
+    ret = ReadBlockContents(data_reader, file_abs_path,
+                            data_blk_offset[i + 1] - data_blk_offset[i],
+                            data_blk_offset[i], block_content);
+    if (!ret.StatusNoError()) {
+      ReleaseReader(data_reader);
+      return ret;
+    }
+    data_content += block_content;
+  }
+  ReleaseReader(data_reader);
 
-  // Read DataBlock
-  std::string data_content;
-  ret =
-      data_reader->Read(new DBFile(file_abs_path), data_content, size, offset);
+  // Copy the content of the DataBlocks from the stack to the MemAllocator
+  char* sst_data = nullptr;
+  sst_data = merge_allocator->Allocate(data_content.size());
+  if (!sst_data) {
+    return Status::FileIOError(
+        "Memory in MemAllocator/MergeAllocator not allocated.");
+  }
+  std::memcpy(sst_data, data_content.c_str(), data_content.size());
 
-  if (ret.StatusNoError()) {
-    // Copy the content of the DataBlock from the stack to the MemAllocator
-    char* sst_data = nullptr;
-    sst_data = merge_allocator->Allocate(data_content.size());
-    if (!sst_data)
-      return Status::FileIOError(
-          "Memory in MemAllocator/MergeAllocator not allocated.");
-    std::memcpy(sst_data, data_content.c_str(), data_content.size());
-
-    auto data_offset = static_cast<std::string::size_type>(0);
-    while (data_offset < data_content.size()) {
-      entry_set.push_back(InternalEntry::EntryData(sst_data + data_offset));
-      data_offset += entry_set.back().size();
-    }
+  auto data_offset = static_cast<std::string::size_type>(0);
+  while (data_offset < data_content.size()) {
+    entry_set.push_back(InternalEntry::EntryData(sst_data + data_offset));
+    data_offset += entry_set.back().size();
+  }
 
-    // Update reference counter at once
-    merge_allocator->RefLast(entry_set.size() - 1);
+  // Update reference counter at once
+  merge_allocator->RefLast(entry_set.size() - 1);
+
+  return ret;
+}
+
+Status TCIO::ReadBlockContents(const std::shared_ptr<SequentialReader>& reader,
+                               const std::string& file_abs_path,
+                               const uint64_t block_size,
+                               const ::ssize_t block_offset,
+                               std::string& contents) {
+  std::string block;
+  Status ret = reader->Read(new DBFile(file_abs_path), block, block_size,
+                            block_offset);
+  if (!ret.StatusNoError())
+    return ret;
+
+  return DecodeBlockContents(block, file_abs_path, contents);
+}
+
+Status TCIO::ReadBlockContents(ReadaheadReader& input,
+                               const uint64_t block_size,
+                               const ::ssize_t block_offset,
+                               std::string& contents) {
+  std::string block;
+  Status ret = input.Read(block, block_size, block_offset);
+  if (!ret.StatusNoError())
+    return ret;
+
+  return DecodeBlockContents(block, input.file_name(), contents);
+}
+
+Status TCIO::DecodeBlockContents(std::string& block,
+                                 const std::string& file_abs_path,
+                                 std::string& contents) {
+  if (block.size() < DataFileFormat::kBlockTrailerSize)
+    return Status::Corruption("Truncated DataBlock in " + file_abs_path);
+
+  // The checksum covers the compressed block and its type
+  Status ret = VerifyChecksum(block, file_abs_path);
+  if (!ret.StatusNoError())
+    return ret;
+
+  auto type = static_cast<Compression::Type>(block.back());
+  block.pop_back();
+  if (type == Compression::kNoCompression) {
+    contents.swap(block);
+    return ret;
+  }
+
+  return Compression::Uncompress(type, block.data(), block.size(), contents);
+}
+
+Status TCIO::ReadTailBlock(const std::shared_ptr<SequentialReader>& reader,
+                           const std::string& file_abs_path,
+                           const std::string& tail, const uint64_t tail_offset,
+                           const DataFileFormat::BlockHandle& handle,
+                           std::string& block) {
+  if (handle.offset >= tail_offset &&
+      handle.end() <= tail_offset + tail.size()) {
+    block.assign(tail, handle.offset - tail_offset, handle.size);
+    return Status::NoError();
   }
 
+  return reader->Read(new DBFile(file_abs_path), block, handle.size,
+                      handle.offset);
+}
+
+std::shared_ptr<ReadaheadReader> TCIO::NewCompactionInput(
+    const std::string& file_abs_path) {
+  return std::make_shared<ReadaheadReader>(file_abs_path,
+                                           kCompactionReadaheadSize,
+                                           use_direct_io_, aligned_buffer_pool_);
+}
+
+std::shared_ptr<SequentialReader> TCIO::AcquireReader() {
   io_lock_.Lock();
-  readers_.push_back(data_reader);
+  if (readers_.empty()) {
+    io_lock_.Unlock();
+    // All readers are in use by concurrent queries or compactions, build a
+    // temporary one instead of blocking.
+    return std::make_shared<SequentialReader>(kDefaultReaderBufferSize,
+                                              aligned_buffer_pool_);
+  }
+  auto reader = readers_.back();
+  readers_.pop_back();
   io_lock_.Unlock();
+  return reader;
+}
 
-  return ret;
+void TCIO::ReleaseReader(const std::shared_ptr<SequentialReader>& reader) {
+  io_lock_.Lock();
+  if (readers_.size() < kDefaultReaderNum)
+    readers_.push_back(reader);
+  io_lock_.Unlock();
 }
 
 Status TCIO::BuildMetadataFile() {
   Status ret = Status().NoError();
-  std::shared_ptr<SequentialWriter> writer;
 
   // If the manifest file does not exist or does not have rwx permissions
   if (access(neko_base::PathJoin(kDatabaseDir, kManifestFilename).c_str(),
              F_OK) != 0) {
-    // Write manifest
-    writer = std::make_shared<SequentialWriter>(
-        new DBFile(neko_base::PathJoin(kDatabaseDir, kManifestFilename),
-                   DBFile::Mode::kNewFile),
-        kDefaultWriterBufferSize);
-    ret = writer->WriteFragment(
-        neko_base::PathJoin(kDatabaseDir, kManifestFilename) + "\n" +
-        neko_base::PathJoin(kDatabaseDir, kLogFilename));
+    // Write an empty snapshot
+    ManifestFormat::VersionEdit snapshot;
+    ret = WriteManifest(snapshot);
     if (!ret.StatusNoError())
       return ret;
   }
@@ -513,227 +711,210 @@ Status TCIO::BuildMetadataFile() {
   if (access(neko_base::PathJoin(kDatabaseDir, kLogFilename).c_str(), F_OK) !=
       0) {
     // Write log
-    writer = std::make_shared<SequentialWriter>(
-        new DBFile(neko_base::PathJoin(kDatabaseDir, kLogFilename),
-                   DBFile::Mode::kNewFile),
-        kDefaultWriterBufferSize);
-    ret = writer->WriteFragment("Created new database.\n");
-    // writer->WriteFragment(neko_base::PathJoin(kDatabaseDir, kLogFilename));
+    WritableFile log(new DBFile(neko_base::PathJoin(kDatabaseDir, kLogFilename),
+                                DBFile::Mode::kNewFile),
+                     kDefaultWriterBufferSize);
+    ret = log.Append(std::string("Created new database.\n"));
+    if (ret.StatusNoError())
+      ret = log.Close();
   }
 
   return ret;
 }
 
-Status TCIO::WriteManifest(const Manifest& manifest) {
-  // TODO: File lock?
+Status TCIO::WriteManifest(ManifestFormat::VersionEdit& snapshot) {
+  std::lock_guard<std::mutex> lock(manifest_mutex_);
 
-  Status ret;
-  std::shared_ptr<SequentialWriter> sw = std::make_shared<SequentialWriter>(
-      new DBFile(neko_base::PathJoin(kDatabaseDir, kManifestFilename),
-                 DBFile::Mode::kNewFile),
-      kDefaultWriterBufferSize);
+  io_lock_.Lock();  // Protect the file_id_
+  snapshot.SetNextFileNumber(file_id_);
+  io_lock_.Unlock();
+  if (has_last_entry_id_ &&
+      (!snapshot.has_last_entry_id || snapshot.last_entry_id < last_entry_id_))
+    snapshot.SetLastEntryID(last_entry_id_);
+
+  std::string temp_path =
+      neko_base::PathJoin(kDatabaseDir, kManifestTempFilename);
+  std::string record = ManifestFormat::EncodeRecord(snapshot);
+  Status ret = WriteSyncedFile(temp_path, record, false);
+  if (!ret.StatusNoError())
+    return ret;
 
-  ret = sw->WriteFragment(ManifestFormat::Encode(manifest));
+  // The MANIFEST is either the old one or the new snapshot after a crash
+  if (rename(temp_path.c_str(),
+             neko_base::PathJoin(kDatabaseDir, kManifestFilename).c_str()) !=
+      0)
+    return Status::FileIOError("Failed to rename " + temp_path);
+
+  // Persist the rename
+  int dir_fd = open(kDatabaseDir.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+
+  manifest_size_ = snapshot_size_ = record.size();
+  if (snapshot.has_last_entry_id) {
+    has_last_entry_id_ = true;
+    last_entry_id_ = snapshot.last_entry_id;
+  }
 
   return ret;
 }
 
-Status TCIO::WriteSSTFile(const std::string& file_name,
-                          const std::vector<const char*>& entry_set) {
-  std::vector<Sequence> seq_entries;
-  for (const char* e : entry_set) {
-    seq_entries.push_back(InternalEntry::EntryData(e));
+Status TCIO::WriteSyncedFile(const std::string& file_abs_path,
+                             const std::string& content, const bool append) {
+  DBFile file(file_abs_path,
+              append ? DBFile::Mode::kAppend : DBFile::Mode::kNewFile);
+  if (!file.IsOpened())
+    return Status::FileIOError("Cannot open " + file_abs_path);
+
+  size_t written_bytes = 0;
+  while (written_bytes < content.size()) {
+    ::ssize_t ret = write(file.fd(), content.data() + written_bytes,
+                          content.size() - written_bytes);
+    if (ret < 0) {
+      if (errno == EINTR)
+        continue;
+      return Status::FileIOError("Failed to write " + file_abs_path);
+    }
+    written_bytes += ret;
   }
-  return WriteSSTFile(file_name, seq_entries);
-}
 
-Status TCIO::WriteSSTFile(const std::string& file_name,
-                          const std::vector<Sequence>& entry_set) {
-  Status ret;
-  std::vector<uint32_t> data_blk_offset;
+  if (fdatasync(file.fd()) != 0)
+    return Status::FileIOError("Failed to sync " + file_abs_path);
 
-  // Pre-allocate space for index block
-  data_blk_offset.reserve(DataFileFormat::kApproximateSSTFileSize /
-                          DataFileFormat::kDefaultDataBlkSize);
+  return Status::NoError();
+}
 
-  std::shared_ptr<SequentialWriter> sw = std::make_shared<SequentialWriter>(
-      new DBFile(file_name, DBFile::Mode::kAppend), kDefaultWriterBufferSize);
+Status TCIO::ListSSTFiles(std::vector<std::string>& file_basenames) {
+  file_basenames.clear();
 
-  // Write entries
-  uint32_t data_block_size = 0;
-  ret = WriteSSTData(sw, entry_set, data_blk_offset, data_block_size);
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
+  DIR* dir = opendir(kDatabaseDir.c_str());
+  if (dir == nullptr)
+    return Status::FileIOError("Cannot open " + kDatabaseDir);
 
-  // Write IndexBlock at once
-  uint32_t index_block_size = (data_blk_offset.size() + 1) * sizeof(uint32_t);
-  ret = WriteSSTIndex(sw, data_blk_offset);
-  if (!ret.StatusNoError()) {
-    return ret;
+  // File names as 0000000035AC186F.tdb
+  const size_t kNumberSize = 16;
+  while (struct dirent* entry = readdir(dir)) {
+    std::string name(entry->d_name);
+    if (name.size() != kNumberSize + kSSTFilePostfix.size() ||
+        name.compare(kNumberSize, std::string::npos, kSSTFilePostfix) != 0)
+      continue;
+    char* number_end = nullptr;
+    std::strtoull(name.c_str(), &number_end, 16);
+    if (number_end == name.c_str() + kNumberSize)
+      file_basenames.push_back(name.substr(0, kNumberSize));
   }
+  closedir(dir);
 
-  // Write FlexibleBlock
-  uint32_t flexible_block_size = sizeof(uint32_t);  // TODO: crc-32?
-  ret = WriteSSTFlexible(sw, "TODO");
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
+  return Status::NoError();
+}
 
-  // Write Footer
-  ret = WriteSSTFileFooter(
-      sw, DataFileFormat::Footer(entry_set.front().size(),
-                                 data_block_size - entry_set.back().size(),
-                                 entry_set.back().size(), data_block_size,
-                                 index_block_size, flexible_block_size));
+uint64_t TCIO::NextSSTFileNumberOnDisk() {
+  uint64_t ret = 0;
+
+  std::vector<std::string> file_basenames;
+  ListSSTFiles(file_basenames);
+  for (auto& file_basename : file_basenames)
+    ret = std::max<uint64_t>(
+        ret, std::strtoull(file_basename.c_str(), nullptr, 16) + 1);
 
   return ret;
 }
 
 Status TCIO::WriteSSTFile(const std::string& file_name,
                           const std::vector<const char*>& entry_set,
-                          const std::shared_ptr<Filter>& filter) {
+                          const TCRateLimiter::IOPriority pri) {
   std::vector<Sequence> seq_entries;
   for (const char* e : entry_set) {
     seq_entries.push_back(InternalEntry::EntryData(e));
   }
-  return WriteSSTFile(file_name, seq_entries, filter);
+  return WriteSSTFile(file_name, seq_entries, pri);
 }
 
 Status TCIO::WriteSSTFile(const std::string& file_name,
                           const std::vector<Sequence>& entry_set,
-                          const std::shared_ptr<Filter>& filter) {
-  Status ret;
-  std::vector<uint32_t> data_blk_offset;
-
-  // Pre-allocate space for index block
-  data_blk_offset.reserve(DataFileFormat::kApproximateSSTFileSize /
-                          DataFileFormat::kDefaultDataBlkSize);
-
-  std::shared_ptr<SequentialWriter> sw = std::make_shared<SequentialWriter>(
-      new DBFile(file_name, DBFile::Mode::kAppend), kDefaultWriterBufferSize);
-
-  // Write entries
-  uint32_t data_block_size = 0;
-  ret = WriteSSTData(sw, entry_set, data_blk_offset, data_block_size);
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
-
-  // Write IndexBlock at once
-  uint32_t index_block_size = (data_blk_offset.size() + 1) * sizeof(uint32_t);
-  ret = WriteSSTIndex(sw, data_blk_offset);
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
+                          const TCRateLimiter::IOPriority pri) {
+  return WriteSSTFile(file_name, entry_set, nullptr, pri);
+}
 
-  // Write FlexibleBlock
-  std::string filter_content;
-  ret = filter->CreateFilter(entry_set, filter_content);
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
-  uint32_t flexible_block_size = filter_content.size();
-  ret = WriteSSTFlexible(sw, filter_content);  // TODO: crc-32?
-  if (!ret.StatusNoError()) {
-    return ret;
+Status TCIO::WriteSSTFile(const std::string& file_name,
+                          const std::vector<const char*>& entry_set,
+                          const std::shared_ptr<Filter>& filter,
+                          const TCRateLimiter::IOPriority pri) {
+  std::vector<Sequence> seq_entries;
+  for (const char* e : entry_set) {
+    seq_entries.push_back(InternalEntry::EntryData(e));
   }
-
-  // Write Footer
-  ret = WriteSSTFileFooter(
-      sw, DataFileFormat::Footer(entry_set.front().size(),
-                                 data_block_size - entry_set.back().size(),
-                                 entry_set.back().size(), data_block_size,
-                                 index_block_size, flexible_block_size));
-
-  return ret;
+  return WriteSSTFile(file_name, seq_entries, filter, pri);
 }
 
-Status TCIO::WriteSSTData(std::shared_ptr<SequentialWriter>& sw_ptr,
+Status TCIO::WriteSSTFile(const std::string& file_name,
                           const std::vector<Sequence>& entry_set,
-                          std::vector<uint32_t>& data_blk_offset,
-                          uint32_t& data_block_size) {
+                          const std::shared_ptr<Filter>& filter,
+                          const TCRateLimiter::IOPriority pri) {
   Status ret;
-  uint32_t cur_blk_size = 0;        // Record current block size
-  uint32_t cur_offset = 0;          // Record current offset
-  uint32_t i = 0, start_point = 0;  // Subscript for iterating the entry_set
-
-  while (i < entry_set.size()) {
-    if (cur_blk_size + entry_set[i].size() >
-        DataFileFormat::kDefaultDataBlkSize) {
-      data_blk_offset.push_back(cur_offset);  // Record block start address
+  std::shared_ptr<WritableFile> wf = NewSSTFile(file_name, pri);
 
-      // Set cur_offset to next block start address
-      cur_offset += cur_blk_size + entry_set[i].size();
-
-      if (!(ret = sw_ptr->WriteBatch(entry_set, start_point, i + 1))
-               .StatusNoError())
-        return ret;
-      start_point = i + 1;  // Reset start_point
-      cur_blk_size = 0;     // Clear block size flag
-    } else {
-      cur_blk_size += entry_set[i].size();
+  TCTableBuilder builder(wf.get(), compression_, filter, entry_set.size());
+  for (auto& entry : entry_set) {
+    ret = builder.Add(entry);
+    if (!ret.StatusNoError()) {
+      return AbandonSSTFile(wf.get(), file_name, ret);
     }
-    ++i;
   }
 
-  // Write last EntryBlock
-  if (start_point != i) {
-    data_blk_offset.push_back(cur_offset);  // Record block start address
-    ret = sw_ptr->WriteBatch(entry_set, start_point, i);
-
-    // Calculate current offset.
-    // The following iteration will not cost too much time because the last
-    // block size <= kDefaultWriterBufferSize, there won't be many entries.
-    for (auto j = start_point; j < i; ++j)
-      cur_offset += entry_set[j].size();
+  // The final sync only waits for the tail, the rest of the file has been
+  // written back along the way
+  ret = builder.Finish();
+  if (ret.StatusNoError())
+    ret = wf->Sync();
+  if (ret.StatusNoError())
+    ret = wf->Close();
+  if (!ret.StatusNoError()) {
+    return AbandonSSTFile(wf.get(), file_name, ret);
   }
 
-  // Return data block size by reference
-  data_block_size = cur_offset;
-
   return ret;
 }
 
-Status TCIO::WriteSSTIndex(std::shared_ptr<SequentialWriter>& sw_ptr,
-                           const std::vector<uint32_t>& data_blk_offset) {
-  Status ret;
-  uint32_t* index_block = new uint32_t[data_blk_offset.size() + 1];
-  uint32_t* index_block_ptr = index_block;
+Status TCIO::AbandonSSTFile(WritableFile* wf, const std::string& file_name,
+                            const Status& error) {
+  wf->Close();  // The error of the write is returned instead
+  unlink(file_name.c_str());
 
-  // First byte in index block is the size of index block
-  *index_block_ptr++ = data_blk_offset.size();
+  return error;
+}
 
-  for (auto i = 0; i < data_blk_offset.size(); ++i) {
-    *index_block_ptr++ = data_blk_offset[i];
-  }
-  ret = sw_ptr->WriteFragment(reinterpret_cast<char*>(index_block),
-                              (data_blk_offset.size() + 1) * sizeof(uint32_t));
-  delete[] index_block;
+std::shared_ptr<WritableFile> TCIO::NewSSTFile(
+    const std::string& file_name, const TCRateLimiter::IOPriority pri) {
+  DBFile* file = new DBFile(file_name, DBFile::Mode::kNewFile);
+  if (use_direct_io_)
+    file->SetDirectIO(true);  // Stay buffered if not supported
 
-  return ret;
-}
+  std::shared_ptr<WritableFile> wf = std::make_shared<WritableFile>(
+      file, writer_buffer_size_, aligned_buffer_pool_);
+  wf->SetRateLimiter(rate_limiter_, pri);
+  wf->SetPreallocationBlockSize(DataFileFormat::kApproximateSSTFileSize);
+  wf->SetBytesPerSync(bytes_per_sync_);
 
-Status TCIO::WriteSSTFlexible(std::shared_ptr<SequentialWriter>& sw_ptr,
-                              const std::string& flexible_content) {
-  // TODO: crc-32
-  return sw_ptr->WriteFragment(flexible_content.c_str(),
-                               flexible_content.size());
+  return wf;
 }
 
-Status TCIO::WriteSSTFileFooter(std::shared_ptr<SequentialWriter>& sw_ptr,
-                                const DataFileFormat::Footer& footer) {
-  char* footer_cptr = new char[DataFileFormat::kSSTFooterSize];
-  uint32_t* footer_ptr = reinterpret_cast<uint32_t*>(footer_cptr);
-  *footer_ptr++ = footer.min_key_size;
-  *footer_ptr++ = footer.max_key_offset;
-  *footer_ptr++ = footer.max_key_size;
-  *footer_ptr++ = footer.data_blk_size;
-  *footer_ptr++ = footer.index_blk_size;
-  *footer_ptr = footer.flexible_blk_size;
+Status TCIO::VerifyChecksum(std::string& block,
+                            const std::string& file_abs_path) const {
+  if (block.size() < DataFileFormat::kChecksumSize)
+    return Status::Corruption("Truncated block in " + file_abs_path);
 
-  Status ret =
-      sw_ptr->WriteFragment(footer_cptr, DataFileFormat::kSSTFooterSize);
-  delete[] footer_cptr;
-  return ret;
+  auto content_size = block.size() - DataFileFormat::kChecksumSize;
+  if (verify_checksums_) {
+    uint32_t masked_crc;
+    std::memcpy(&masked_crc, block.data() + content_size, sizeof(masked_crc));
+    if (crc32c::Unmask(masked_crc) !=
+        crc32c::Value(block.data(), content_size))
+      return Status::Corruption("Block checksum mismatch in " + file_abs_path);
+  }
+  block.resize(content_size);
+
+  return Status::NoError();
 }
@@ -0,0 +1,137 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+TCRateLimiter::TCRateLimiter(const int64_t rate_bytes_per_sec,
+                             const int64_t refill_period_us,
+                             const int fairness,
+                             const int high_pri_reserve_percent)
+    : refill_period_us_(refill_period_us),
+      refill_bytes_per_period_(std::max<int64_t>(
+          rate_bytes_per_sec * refill_period_us / 1000000, 2)),
+      fairness_(std::max(fairness, 1)),
+      // Leave at least one byte per refill to kIOLow
+      high_pri_reserve_bytes_(std::min(
+          refill_bytes_per_period_ * std::max(high_pri_reserve_percent, 0) /
+              100,
+          refill_bytes_per_period_ - 1)),
+      available_bytes_(refill_bytes_per_period_),
+      next_refill_us_(NowMicros() + refill_period_us),
+      last_high_pri_us_(std::numeric_limits<int64_t>::min() / 2) {}
+
+void TCRateLimiter::Request(int64_t bytes, const IOPriority pri) {
+  while (bytes > 0) {
+    int64_t burst = std::min(bytes, MaxBurstBytes(pri));
+    RequestBurst(burst, pri);
+    bytes -= burst;
+  }
+}
+
+int64_t TCRateLimiter::GetTotalBytesThrough(const IOPriority pri) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return total_bytes_through_[pri];
+}
+
+void TCRateLimiter::RequestBurst(const int64_t bytes, const IOPriority pri) {
+  std::unique_lock<std::mutex> lock(mutex_);
+
+  int64_t now_us = NowMicros();
+  if (pri == kIOHigh)
+    last_high_pri_us_ = now_us;
+
+  // Nobody of the same or a higher priority is waiting and the bucket has
+  // enough bytes
+  if (queue_[kIOHigh].empty() && (pri == kIOHigh || queue_[kIOLow].empty()) &&
+      available_bytes_ - bytes >= ReservedBytes(pri, now_us)) {
+    available_bytes_ -= bytes;
+    total_bytes_through_[pri] += bytes;
+    return;
+  }
+
+  // Wait in the queue. Whichever waiter wakes up first after the refill time
+  // refills the bucket for all waiters.
+  Req req(bytes);
+  queue_[pri].push_back(&req);
+  while (!req.granted) {
+    now_us = NowMicros();
+    if (now_us >= next_refill_us_) {
+      RefillAndGrant(now_us);
+      continue;
+    }
+    cv_.wait_for(lock, std::chrono::microseconds(next_refill_us_ - now_us));
+  }
+}
+
+void TCRateLimiter::RefillAndGrant(const int64_t now_us) {
+  next_refill_us_ = now_us + refill_period_us_;
+  available_bytes_ = refill_bytes_per_period_;
+
+  IOPriority order[kIOTotal] = {kIOHigh, kIOLow};
+  if (rnd_() % fairness_ == 0)
+    std::swap(order[0], order[1]);
+
+  // A request never exceeds MaxBurstBytes(), so the first waiter is always
+  // granted. Stop at the first request that does not fit, so that a large
+  // request is not starved by the smaller ones behind it.
+  for (auto pri : order) {
+    auto& queue = queue_[pri];
+    while (!queue.empty() && queue.front()->bytes <= available_bytes_ -
+                                 ReservedBytes(pri, now_us)) {
+      Req* next = queue.front();
+      queue.pop_front();
+      available_bytes_ -= next->bytes;
+      total_bytes_through_[pri] += next->bytes;
+      next->granted = true;
+      if (pri == kIOHigh)
+        last_high_pri_us_ = now_us;  // The flush is still running
+    }
+    if (!queue.empty())
+      break;
+  }
+
+  cv_.notify_all();
+}
+
+int64_t TCRateLimiter::NowMicros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#ifdef __linux__
+namespace {
+// See linux/ioprio.h
+const int kIOPrioWhoProcess = 1;  // With who == 0, the calling thread
+const int kIOPrioClassShift = 13;
+}  // namespace
+#endif
+
+ThreadIOPriority::ThreadIOPriority(const IOClass io_class) {
+#ifdef __linux__
+  if (io_class == kNone)
+    return;
+
+  int old_ioprio = syscall(SYS_ioprio_get, kIOPrioWhoProcess, 0);
+  if (old_ioprio < 0)
+    return;
+
+  int data = io_class == kBestEffort ? kBestEffortLowest : 0;
+  if (syscall(SYS_ioprio_set, kIOPrioWhoProcess, 0,
+              (io_class << kIOPrioClassShift) | data) == 0)
+    old_ioprio_ = old_ioprio;
+#endif
+}
+
+ThreadIOPriority::~ThreadIOPriority() {
+#ifdef __linux__
+  if (old_ioprio_ >= 0)
+    syscall(SYS_ioprio_set, kIOPrioWhoProcess, 0, old_ioprio_);
+#endif
+}
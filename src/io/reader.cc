@@ -63,6 +63,9 @@ Status SequentialReader::ReadEntire(DBFile* file, std::string& ret) {
 Status SequentialReader::InternalRead(DBFile* file, std::string& ret,
                                       const uint64_t size,
                                       const ::ssize_t offset) {
+  if (file->direct_io())
+    return DirectRead(file, ret, size, offset);
+
   // Move file pointer to (beginning + offset)
   // auto what = lseek(file->fd(), offset, SEEK_SET); // For test
   lseek(file->fd(), offset, SEEK_SET);
@@ -91,6 +94,133 @@ Status SequentialReader::InternalRead(DBFile* file, std::string& ret,
                              " bytes.");
 }
 
+Status SequentialReader::DirectRead(DBFile* file, std::string& ret,
+                                    const uint64_t size,
+                                    const ::ssize_t offset) {
+  uint64_t begin = AlignedBuffer::RoundDown(offset);
+  uint64_t end = AlignedBuffer::RoundUp(offset + size);
+
+  std::unique_ptr<AlignedBuffer> buffer;
+  if (aligned_buffer_pool_ != nullptr)
+    buffer = aligned_buffer_pool_->Acquire(end - begin);
+  else
+    buffer.reset(new AlignedBuffer(end - begin));
+  if (buffer == nullptr || buffer->data() == nullptr) {
+    // Fall back to the buffered I/O
+    if (!file->SetDirectIO(false))
+      return Status::FileIOError("Unable to read " + file->file_name());
+    return InternalRead(file, ret, size, offset);
+  }
+
+  // The last block of the file is read short
+  uint64_t read_bytes = 0;
+  while (begin + read_bytes < end) {
+    ::ssize_t n = pread(file->fd(), buffer->data() + read_bytes,
+                        end - begin - read_bytes, begin + read_bytes);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    read_bytes += n;
+  }
+
+  Status ret_status;
+  if (begin + read_bytes >= offset + size) {
+    ret.assign(buffer->data() + (offset - begin), size);
+  } else {
+    ret = "";
+    ret_status = Status::FileIOError("Unable to read all " +
+                                     std::to_string(size) + " bytes.");
+  }
+
+  if (aligned_buffer_pool_ != nullptr)
+    aligned_buffer_pool_->Release(std::move(buffer));
+
+  return ret_status;
+}
+
+constexpr uint64_t ReadaheadReader::kMinReadaheadSize;
+
+ReadaheadReader::ReadaheadReader(
+    const std::string& file_name, const uint64_t max_readahead_size,
+    const bool direct_io,
+    const std::shared_ptr<AlignedBufferPool>& aligned_buffer_pool)
+    : file_(file_name),
+      max_readahead_size_(std::max(max_readahead_size, kMinReadaheadSize)),
+      aligned_buffer_pool_(aligned_buffer_pool) {
+  if (direct_io)
+    file_.SetDirectIO(true);  // Stay buffered if not supported
+}
+
+ReadaheadReader::~ReadaheadReader() {
+  if (aligned_buffer_pool_ != nullptr)
+    aligned_buffer_pool_->Release(std::move(buffer_));
+}
+
+Status ReadaheadReader::Read(std::string& ret, const uint64_t size,
+                             const ::ssize_t offset) {
+  if (!file_.IsOpened())
+    return Status::FileIOError("Unable to open " + file_.file_name());
+
+  if (offset < window_offset_ || offset + size > window_offset_ + window_size_) {
+    // Grow the window while the reads follow the previous window
+    bool sequential = window_size_ > 0 && offset >= window_offset_ &&
+                      offset <= window_offset_ + window_size_;
+    readahead_size_ = sequential
+                          ? std::min(readahead_size_ * 2, max_readahead_size_)
+                          : kMinReadaheadSize;
+
+    Status ret_status = ReadWindow(size, offset);
+    if (!ret_status.StatusNoError()) {
+      ret = "";
+      return ret_status;
+    }
+  }
+
+  ret.assign(buffer_->data() + (offset - window_offset_), size);
+  return Status::NoError();
+}
+
+Status ReadaheadReader::ReadWindow(const uint64_t size,
+                                   const ::ssize_t offset) {
+  uint64_t begin = AlignedBuffer::RoundDown(offset);
+  uint64_t end =
+      AlignedBuffer::RoundUp(std::max(offset + size, begin + readahead_size_));
+
+  window_size_ = 0;
+  if (buffer_ == nullptr || buffer_->capacity() < end - begin) {
+    if (aligned_buffer_pool_ != nullptr) {
+      aligned_buffer_pool_->Release(std::move(buffer_));
+      buffer_ = aligned_buffer_pool_->Acquire(end - begin);
+    } else {
+      buffer_.reset(new AlignedBuffer(end - begin));
+    }
+    if (buffer_ == nullptr || buffer_->data() == nullptr) {
+      buffer_.reset();
+      return Status::FileIOError("Unable to allocate the readahead buffer.");
+    }
+  }
+
+  // The last block of the file is read short
+  uint64_t read_bytes = 0;
+  while (begin + read_bytes < end) {
+    ::ssize_t n = pread(file_.fd(), buffer_->data() + read_bytes,
+                        end - begin - read_bytes, begin + read_bytes);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    read_bytes += n;
+  }
+  if (begin + read_bytes < offset + size)
+    return Status::FileIOError("Unable to read all " + std::to_string(size) +
+                               " bytes.");
+
+  window_offset_ = begin;
+  window_size_ = read_bytes;
+  return Status::NoError();
+}
+
 RandomReader::~RandomReader() {}
 
 Status RandomReader::Read(DBFile* file, std::string& ret, const uint64_t size,
@@ -0,0 +1,153 @@
+#include "table_builder.h"
+
+#include <chrono>
+
+#include "crc32c.h"
+#include "internal_entry.h"
+
+TCTableBuilder::TCTableBuilder(WritableFile* file,
+                               const Compression::Type compression,
+                               const std::shared_ptr<Filter>& filter,
+                               const size_t max_entries)
+    : file_(file), compression_(compression), filter_(filter) {
+  if (filter_ != nullptr)
+    filter_->StartFilter(max_entries, filter_content_);
+
+  data_blk_offset_.reserve(DataFileFormat::kApproximateSSTFileSize /
+                           DataFileFormat::kDefaultDataBlkSize);
+}
+
+Status TCTableBuilder::Add(const Sequence& entry) {
+  if (props_.num_entries == 0)
+    smallest_ = entry;
+  largest_ = entry;
+
+  props_.AddEntry(entry.data());
+  if (filter_ != nullptr)
+    filter_->AddEntry(entry.data(), filter_content_);
+
+  // The entry exceeding kDefaultDataBlkSize closes the block
+  block_entries_.push_back(entry);
+  block_size_ += entry.size();
+  if (block_size_ > DataFileFormat::kDefaultDataBlkSize)
+    return FlushDataBlock();
+
+  return Status::NoError();
+}
+
+Status TCTableBuilder::Finish() {
+  Status ret;
+
+  if (props_.num_entries == 0)
+    return Status::BadArgumentError("No entry to build an SST file");
+
+  if (!block_entries_.empty()) {
+    ret = FlushDataBlock();
+    if (!ret.StatusNoError())
+      return ret;
+  }
+
+  DataFileFormat::Footer footer;
+  footer.data_blk_size = file_->size();
+
+  // The first field of the IndexBlock is the number of the DataBlocks
+  uint64_t data_blk_count = data_blk_offset_.size();
+  std::string index_block(reinterpret_cast<const char*>(&data_blk_count),
+                          sizeof(data_blk_count));
+  index_block.append(reinterpret_cast<const char*>(data_blk_offset_.data()),
+                     data_blk_count * sizeof(uint64_t));
+  ret = WriteMetaBlock(index_block, footer.index);
+  if (!ret.StatusNoError())
+    return ret;
+
+  // Write the meta blocks
+  props_.creation_time =
+      std::chrono::duration_cast<std::chrono::seconds>(
+          std::chrono::system_clock::now().time_since_epoch())
+          .count();
+  ret = WriteMetaBlock(
+      DataFileFormat::EncodeProperties(props_),
+      footer.meta_blocks[DataFileFormat::kPropertiesBlockName]);
+  if (!ret.StatusNoError())
+    return ret;
+
+  if (filter_ != nullptr) {
+    ret = WriteMetaBlock(filter_content_,
+                         footer.meta_blocks[DataFileFormat::kFilterBlockName]);
+    if (!ret.StatusNoError())
+      return ret;
+  }
+
+  // Write the smallest and the largest entries uncompressed, so that the
+  // boundaries are read without a DataBlock
+  footer.min_key = DataFileFormat::BlockHandle(file_->size(), smallest_.size());
+  footer.max_key =
+      DataFileFormat::BlockHandle(footer.min_key.end(), largest_.size());
+  ret = file_->Append(smallest_.data(), smallest_.size());
+  if (ret.StatusNoError())
+    ret = file_->Append(largest_.data(), largest_.size());
+  if (!ret.StatusNoError())
+    return ret;
+
+  // Write MetaindexBlock
+  ret = WriteMetaBlock(DataFileFormat::EncodeMetaindex(footer.meta_blocks),
+                       footer.metaindex);
+  if (!ret.StatusNoError())
+    return ret;
+
+  return file_->Append(DataFileFormat::EncodeFooter(footer));
+}
+
+Status TCTableBuilder::FlushDataBlock() {
+  Status ret;
+  data_blk_offset_.push_back(file_->size());  // Record block start address
+
+  Compression::Type type = compression_;
+  if (type != Compression::kNoCompression) {
+    block_.clear();
+    for (auto& entry : block_entries_)
+      block_.append(entry.data(), entry.size());
+    if (Compression::Compress(type, block_.data(), block_.size(),
+                              compressed_)) {
+      compressed_.push_back(static_cast<char>(type));
+      AppendChecksum(compressed_);
+      ret = file_->Append(compressed_);
+    } else {
+      type = Compression::kNoCompression;  // Not worth it
+    }
+  }
+
+  if (type == Compression::kNoCompression) {
+    char trailer[DataFileFormat::kBlockTrailerSize];
+    trailer[0] = static_cast<char>(Compression::kNoCompression);
+    uint32_t crc = 0;
+    for (auto& entry : block_entries_)
+      crc = crc32c::Extend(crc, entry.data(), entry.size());
+    crc = crc32c::Mask(crc32c::Extend(crc, trailer, 1));
+    std::memcpy(trailer + 1, &crc, sizeof(crc));
+
+    ret = file_->Append(block_entries_);
+    if (ret.StatusNoError())
+      ret = file_->Append(trailer, sizeof(trailer));
+  }
+
+  block_entries_.clear();
+  block_size_ = 0;
+
+  return ret;
+}
+
+Status TCTableBuilder::WriteMetaBlock(const std::string& content,
+                                      DataFileFormat::BlockHandle& handle) {
+  std::string meta_block(content);
+  AppendChecksum(meta_block);
+
+  handle = DataFileFormat::BlockHandle(file_->size(), meta_block.size());
+
+  return file_->Append(meta_block);
+}
+
+void TCTableBuilder::AppendChecksum(std::string& block) {
+  uint32_t crc = crc32c::Mask(crc32c::Value(block.data(), block.size()));
+  block.append(reinterpret_cast<const char*>(&crc), sizeof(crc));
+}
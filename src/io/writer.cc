@@ -1,5 +1,7 @@
 #include "writer.h"
 
+#include <climits>
+
 BaseWriter::BaseWriter(DBFile* dbf_ptr, const int max_buffer_size)
     : kMaxBufferSize(max_buffer_size),
       // kDeviceIndentifier(Device::kUbuntu),
@@ -40,6 +42,8 @@ Status BaseWriter::WriteNewFile() {
     }
   }
 
+  RateLimit();
+
   const int kMaxRetry = 5;
   int written_bytes = 0, retry = 0;
   while (written_bytes < pos_) {
@@ -72,6 +76,8 @@ Status BaseWriter::WriteAppendFile() {
     return Status::FileIOError("Cannot open dbfile.");
   }
 
+  RateLimit();
+
   // Write until succeed
   int written_bytes = 0;
   while (written_bytes < pos_) {
@@ -148,4 +154,280 @@ Status SequentialWriter::WriteFragment(const char* fragment,
       break;
   }
   return ret;
+}
+
+WritableFile::WritableFile(
+    DBFile* dbf_ptr, const size_t buffer_size,
+    const std::shared_ptr<AlignedBufferPool>& aligned_buffer_pool)
+    : dbfile_(dbf_ptr),
+      buffer_size_(
+          dbf_ptr->direct_io()
+              ? AlignedBuffer::RoundUp(std::max<size_t>(buffer_size, 1))
+              : std::max<size_t>(buffer_size, 1)),
+      aligned_buffer_pool_(aligned_buffer_pool) {
+  // A file opened to append is written from its end
+  if (dbfile_->IsOpened()) {
+    ::off_t end = lseek(dbfile_->fd(), 0, SEEK_END);
+    if (end > 0)
+      file_offset_ = preallocated_end_ = synced_end_ = end;
+  }
+
+  if (dbfile_->direct_io()) {
+    if (aligned_buffer_pool_ != nullptr)
+      aligned_buffer_ = aligned_buffer_pool_->Acquire(buffer_size_);
+    else
+      aligned_buffer_.reset(new AlignedBuffer(buffer_size_));
+
+    if (aligned_buffer_ != nullptr && aligned_buffer_->data() != nullptr) {
+      direct_io_ = true;
+      buffer_ = aligned_buffer_->data();
+      return;
+    }
+    aligned_buffer_.reset();
+    dbfile_->SetDirectIO(false);  // Fall back to the buffered I/O
+  }
+
+  heap_buffer_.reset(new char[buffer_size_]);
+  buffer_ = heap_buffer_.get();
+}
+
+WritableFile::~WritableFile() {
+  Close();
+  if (aligned_buffer_pool_ != nullptr)
+    aligned_buffer_pool_->Release(std::move(aligned_buffer_));
+}
+
+Status WritableFile::Append(const char* data, const size_t size) {
+  size_ += size;
+  if (size <= buffer_size_ - pos_) {
+    std::memcpy(buffer_ + pos_, data, size);
+    pos_ += size;
+    return Status::NoError();
+  }
+
+  // Large data is written along with the buffer without being copied, unless
+  // the direct I/O requires the aligned buffer
+  if (size >= buffer_size_ && !direct_io_) {
+    struct iovec iov[2] = {{buffer_, pos_}, {const_cast<char*>(data), size}};
+    pos_ = 0;
+    return WriteV(iov, 2);
+  }
+
+  // Fill up the buffer, write it and buffer the rest
+  Status ret;
+  size_t copied = 0;
+  while (copied < size) {
+    size_t n = std::min(size - copied, buffer_size_ - pos_);
+    std::memcpy(buffer_ + pos_, data + copied, n);
+    pos_ += n;
+    copied += n;
+    if (pos_ == buffer_size_) {
+      ret = Flush();
+      if (!ret.StatusNoError())
+        return ret;
+    }
+  }
+
+  return ret;
+}
+
+Status WritableFile::Append(const std::vector<Sequence>& entries) {
+  Status ret;
+  if (direct_io_) {
+    for (auto& entry : entries) {
+      ret = Append(entry.data(), entry.size());
+      if (!ret.StatusNoError())
+        return ret;
+    }
+    return ret;
+  }
+
+  std::vector<struct iovec> iov;
+  size_t i = 0;
+  while (i < entries.size()) {
+    if (entries[i].size() <= buffer_size_ - pos_) {
+      std::memcpy(buffer_ + pos_, entries[i].data(), entries[i].size());
+      pos_ += entries[i].size();
+      size_ += entries[i].size();
+      ++i;
+      continue;
+    }
+
+    // Gather the buffer and about a buffer size of the following entries
+    iov.assign(1, {buffer_, pos_});
+    size_t bytes = 0;
+    while (i < entries.size() && bytes < buffer_size_ && iov.size() < IOV_MAX) {
+      iov.push_back({const_cast<char*>(entries[i].data()), entries[i].size()});
+      bytes += entries[i].size();
+      ++i;
+    }
+    size_ += bytes;
+    pos_ = 0;
+    ret = WriteV(iov.data(), iov.size());
+    if (!ret.StatusNoError())
+      return ret;
+  }
+
+  return ret;
+}
+
+Status WritableFile::Flush() {
+  if (pos_ == 0)
+    return Status::NoError();
+
+  if (direct_io_) {
+    // Write the whole blocks and move the tail to the beginning
+    size_t aligned = AlignedBuffer::RoundDown(pos_);
+    if (aligned == 0)
+      return Status::NoError();
+    Status ret = WriteDirect(buffer_, aligned, direct_offset_);
+    if (!ret.StatusNoError())
+      return ret;
+    direct_offset_ += aligned;
+    pos_ -= aligned;
+    std::memmove(buffer_, buffer_ + aligned, pos_);
+    return ret;
+  }
+
+  struct iovec iov = {buffer_, pos_};
+  pos_ = 0;
+  return WriteV(&iov, 1);
+}
+
+Status WritableFile::Sync() {
+  Status ret = Flush();
+  if (ret.StatusNoError() && direct_io_)
+    ret = WriteDirectTail();
+  if (ret.StatusNoError() && fdatasync(dbfile_->fd()) != 0)
+    ret = Status::FileIOError("Failed to sync " + dbfile_->file_name());
+
+  return ret;
+}
+
+Status WritableFile::Close() {
+  if (!dbfile_->IsOpened())
+    return Status::NoError();
+
+  Status ret = Flush();
+  if (ret.StatusNoError() && direct_io_)
+    ret = WriteDirectTail();
+
+  // Release the preallocated space beyond the end of the file
+  struct stat file_stat;
+  if (ret.StatusNoError() && preallocated_end_ > file_offset_ &&
+      fstat(dbfile_->fd(), &file_stat) == 0 &&
+      static_cast<uint64_t>(file_stat.st_size) < preallocated_end_ &&
+      ftruncate(dbfile_->fd(), file_stat.st_size) != 0)
+    ret = Status::FileIOError("Failed to truncate " + dbfile_->file_name());
+
+  if (!dbfile_->Close() && ret.StatusNoError())
+    ret = Status::FileIOError("Failed to close " + dbfile_->file_name());
+
+  return ret;
+}
+
+Status WritableFile::WriteV(struct iovec* iov, int iovcnt) {
+  if (!dbfile_->IsOpened())
+    return Status::FileIOError("Cannot open " + dbfile_->file_name());
+
+  size_t bytes = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    bytes += iov[i].iov_len;
+  RateLimit(bytes);
+  PrepareWrite(file_offset_, bytes);
+
+  while (iovcnt > 0) {
+    ::ssize_t written = writev(dbfile_->fd(), iov, iovcnt);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return Status::FileIOError("Failed to write " + dbfile_->file_name());
+    }
+
+    // Skip the written bytes
+    while (iovcnt > 0 && static_cast<size_t>(written) >= iov->iov_len) {
+      written -= iov->iov_len;
+      ++iov;
+      --iovcnt;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base = static_cast<char*>(iov->iov_base) + written;
+      iov->iov_len -= written;
+    }
+  }
+
+  file_offset_ += bytes;
+  RangeSync(file_offset_);
+
+  return Status::NoError();
+}
+
+Status WritableFile::WriteDirect(const char* data, size_t size,
+                                 uint64_t offset) {
+  if (!dbfile_->IsOpened())
+    return Status::FileIOError("Cannot open " + dbfile_->file_name());
+
+  RateLimit(size);
+  PrepareWrite(offset, size);
+
+  while (size > 0) {
+    ::ssize_t written = pwrite(dbfile_->fd(), data, size, offset);
+    if (written < 0) {
+      if (errno == EINTR)
+        continue;
+      return Status::FileIOError("Failed to write " + dbfile_->file_name());
+    }
+    data += written;
+    size -= written;
+    offset += written;
+  }
+
+  return Status::NoError();
+}
+
+Status WritableFile::WriteDirectTail() {
+  if (pos_ > 0) {
+    size_t padded = AlignedBuffer::RoundUp(pos_);
+    std::memset(buffer_ + pos_, 0, padded - pos_);
+    Status ret = WriteDirect(buffer_, padded, direct_offset_);
+    if (!ret.StatusNoError())
+      return ret;
+  }
+
+  if (ftruncate(dbfile_->fd(), size_) != 0)
+    return Status::FileIOError("Failed to truncate " + dbfile_->file_name());
+
+  return Status::NoError();
+}
+
+void WritableFile::PrepareWrite(const uint64_t offset, const size_t size) {
+#ifdef __linux__
+  if (preallocation_block_size_ == 0 || offset + size <= preallocated_end_)
+    return;
+
+  uint64_t end = (offset + size + preallocation_block_size_ - 1) /
+                 preallocation_block_size_ * preallocation_block_size_;
+  if (fallocate(dbfile_->fd(), FALLOC_FL_KEEP_SIZE, preallocated_end_,
+                end - preallocated_end_) != 0) {
+    preallocation_block_size_ = 0;  // Not supported, stop trying
+    return;
+  }
+  preallocated_end_ = end;
+#endif
+}
+
+void WritableFile::RangeSync(const uint64_t end) {
+#ifdef __linux__
+  // The direct I/O does not leave dirty pages
+  if (bytes_per_sync_ == 0 || direct_io_ ||
+      end < synced_end_ + bytes_per_sync_)
+    return;
+
+  if (sync_file_range(dbfile_->fd(), synced_end_, end - synced_end_,
+                      SYNC_FILE_RANGE_WRITE) != 0) {
+    bytes_per_sync_ = 0;  // Not supported, stop trying
+    return;
+  }
+  synced_end_ = end;
+#endif
 }
\ No newline at end of file
@@ -15,7 +15,12 @@
 
 int main() {
   Config config;
-  TCDB db(config);
+  std::unique_ptr<TCDB> db;
+  Status ret = TCDB::Open(config, db);
+  if (!ret.StatusNoError()) {
+    std::cout << "Failed to open the database: " << ret.ErrMsg() << std::endl;
+    return 1;
+  }
 
   return 0;
 }
\ No newline at end of file
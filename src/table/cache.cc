@@ -46,4 +46,18 @@ bool TCCache::InsertOrUpdate(const Sequence& key, const Sequence& value) {
   cache_->Insert(key, value);
 
   return true;
-}
\ No newline at end of file
+}
+
+TCBlockCache::TCBlockCache(const uint32_t capacity) : cache_(capacity) {}
+
+bool TCBlockCache::Get(const std::string& file_abs_path, const uint64_t offset,
+                       Block& block) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return cache_.Get(BlockKey(file_abs_path, offset), block);
+}
+
+void TCBlockCache::Insert(const std::string& file_abs_path,
+                          const uint64_t offset, const Block& block) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  cache_.Insert(BlockKey(file_abs_path, offset), block);
+}
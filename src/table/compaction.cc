@@ -0,0 +1,908 @@
+#include "compaction.h"
+
+#include <limits>
+
+bool CompactionTask::IsBaseLevelForKey(const char* internal_entry) const {
+  // Compare the keys only
+  QueryComparator comparator;
+
+  for (auto& ranges : deeper_ranges) {
+    // Binary search the first file whose max key >= the key
+    int l = 0, r = static_cast<int>(ranges.size()) - 1, target = ranges.size();
+    while (l <= r) {
+      int mid = (l + r) / 2;
+      if (comparator.LessOrEquals(internal_entry, ranges[mid].second.c_str())) {
+        target = mid;
+        r = mid - 1;
+      } else {
+        l = mid + 1;
+      }
+    }
+
+    if (target < ranges.size() &&
+        comparator.GreaterOrEquals(internal_entry,
+                                   ranges[target].first.c_str()))
+      return false;
+  }
+
+  return true;
+}
+
+TCCompactionPicker::TCCompactionPicker(
+    TCIO& io, const std::shared_ptr<InternalEntryComparator>& comparator,
+    const LevelCompactionOptions& level, const uint64_t sst_file_size,
+    const CompactionPri pri, const CompactionStyle style,
+    const UniversalCompactionOptions& universal)
+    : io_(io),
+      comparator_(comparator),
+      level_(level),
+      level_max_bytes_(level.num_levels, 0),
+      sst_file_size_(sst_file_size),
+      pri_(pri),
+      style_(style),
+      universal_(universal),
+      compact_pointer_(level.num_levels) {
+  CalculateLevelTargets(Manifest());
+}
+
+bool TCCompactionPicker::PickCompaction(const Manifest& manifest,
+                                        CompactionTask& task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (style_ == kCompactionStyleUniversal) {
+    // The runs of a universal compaction are adjacent in age, a concurrent
+    // compaction would break the order of the runs
+    if (!running_.empty())
+      return false;
+
+    task = CompactionTask();
+    if (!PickUniversal(manifest, task))
+      return false;
+    RegisterTask(task);
+    return true;
+  }
+
+  CalculateLevelTargets(manifest);
+
+  // The last level can not be compacted any further
+  int level_num =
+      std::min<int>(manifest.data_files.size(), level_.num_levels - 1);
+
+  std::vector<std::pair<double, int>> scores;
+  for (int level = 0; level < level_num; ++level) {
+    double score = LevelScoreLocked(manifest, level);
+    if (score >= 1)
+      scores.emplace_back(score, level);
+  }
+  std::sort(scores.begin(), scores.end(),
+            [](const std::pair<double, int>& x,
+               const std::pair<double, int>& y) { return x.first > y.first; });
+
+  // Try the levels from the highest score until a compaction without conflicts
+  // is found
+  for (auto& score : scores) {
+    task = CompactionTask();
+    task.level = score.second;
+    task.output_level = task.level == 0 ? base_level_ : task.level + 1;
+    task.score = score.first;
+
+    bool picked = task.level == 0 ? PickLevel0(manifest, task)
+                                  : PickLevelN(manifest, task.level, task);
+    if (!picked)
+      continue;
+
+    RegisterTask(task);
+    compact_pointer_[task.level] = task.largest;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool TCCompactionPicker::PickRangeCompaction(const Manifest& manifest,
+                                             const int level,
+                                             const std::string& smallest,
+                                             const std::string& largest,
+                                             std::vector<CompactionTask>& tasks) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  tasks.clear();
+
+  auto in_range = [&](const FileMetaData* meta) {
+    return (smallest.empty() ||
+            !key_comparator_.Greater(smallest, meta->largest)) &&
+           (largest.empty() ||
+            !key_comparator_.Greater(meta->smallest, largest));
+  };
+
+  FileMetaData* meta = nullptr;
+  if (style_ == kCompactionStyleUniversal) {
+    if (!running_.empty())
+      return false;
+
+    std::vector<SortedRun> runs;
+    if (!SortedRuns(manifest, runs).StatusNoError())
+      return false;
+    if (runs.empty())
+      return true;
+
+    // Even a single run is rewritten, which drops its deletions
+    tasks.emplace_back();
+    if (!SetupUniversalInputs(manifest, runs, 0, runs.size() - 1,
+                              tasks.back())) {
+      tasks.clear();
+      return false;
+    }
+  } else if (level == 0) {
+    for (auto& running : running_) {
+      if (running.level == 0)
+        return false;
+    }
+    if (manifest.data_files.empty())
+      return true;
+
+    // Start from the files in the range
+    const auto& files = manifest.data_files[0];
+    std::vector<bool> picked(files.size(), false);
+    CalculateLevelTargets(manifest);
+    CompactionTask task;
+    task.output_level = base_level_;
+    for (int i = 0; i < files.size(); ++i) {
+      if (!GetFileMetaLocked(files[i], meta).StatusNoError())
+        return false;
+      if (!in_range(meta))
+        continue;
+
+      if (task.smallest.empty() ||
+          comparator_->Less(meta->smallest, task.smallest))
+        task.smallest = meta->smallest;
+      if (task.largest.empty() ||
+          comparator_->Greater(meta->largest, task.largest))
+        task.largest = meta->largest;
+      picked[i] = true;
+    }
+    if (task.smallest.empty())
+      return true;
+
+    if (!ExpandLevel0Inputs(manifest, picked, task) ||
+        BeingCompacted(task.level_inputs) ||
+        !SetupOtherInputs(manifest, task))
+      return false;
+    tasks.push_back(std::move(task));
+  } else {
+    if (level >= manifest.data_files.size())
+      return true;
+
+    // Group the adjacent files in the range. A file is grouped with the
+    // previous ones if they overlap the same file at the next level, or if
+    // the group is still small. A file overlapping nothing at the next level
+    // stays alone for a trivial move.
+    const uint64_t max_task_bytes = kMaxRangeCompactionFiles * sst_file_size_;
+    std::vector<std::vector<std::string>> groups;
+    uint64_t group_bytes = 0;
+    std::string last_overlapped;  // Last next level file of the last group
+    bool last_trivial = false;
+    for (auto& file : manifest.data_files[level]) {
+      if (!GetFileMetaLocked(file, meta).StatusNoError())
+        return false;
+      if (!in_range(meta))
+        continue;
+
+      std::vector<std::string> overlapped;
+      uint64_t overlapped_size = 0;
+      if (!GetOverlappingInputs(manifest, level + 1, meta->smallest,
+                                meta->largest, overlapped, overlapped_size)
+               .StatusNoError())
+        return false;
+
+      uint64_t file_bytes = meta->file_size + overlapped_size;
+      bool join = false;
+      if (!groups.empty() && !overlapped.empty() && !last_trivial) {
+        join = overlapped.front() == last_overlapped ||
+               group_bytes + file_bytes <= max_task_bytes;
+      }
+      if (join) {
+        groups.back().push_back(file);
+        group_bytes += file_bytes;
+      } else {
+        groups.push_back(std::vector<std::string>(1, file));
+        group_bytes = file_bytes;
+      }
+      last_trivial = overlapped.empty();
+      if (!overlapped.empty())
+        last_overlapped = overlapped.back();
+    }
+
+    for (auto& group : groups) {
+      CompactionTask task;
+      task.level = level;
+      task.output_level = level + 1;
+      task.level_inputs = std::move(group);
+
+      if (!GetFileMetaLocked(task.level_inputs.front(), meta).StatusNoError())
+        return false;
+      task.smallest = meta->smallest;
+      if (!GetFileMetaLocked(task.level_inputs.back(), meta).StatusNoError())
+        return false;
+      task.largest = meta->largest;
+
+      if (BeingCompacted(task.level_inputs) ||
+          !SetupOtherInputs(manifest, task)) {
+        tasks.clear();
+        return false;
+      }
+      tasks.push_back(std::move(task));
+    }
+  }
+
+  for (auto& task : tasks)
+    RegisterTask(task);
+
+  return true;
+}
+
+void TCCompactionPicker::ReleaseCompaction(const CompactionTask& task) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (auto& file : task.level_inputs)
+    being_compacted_.erase(file);
+  for (auto& file : task.next_level_inputs)
+    being_compacted_.erase(file);
+
+  for (auto it = running_.begin(); it != running_.end(); ++it) {
+    if (it->id == task.id) {
+      running_.erase(it);
+      break;
+    }
+  }
+}
+
+int TCCompactionPicker::RunningCompactions() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_.size();
+}
+
+Status TCCompactionPicker::GetFileMeta(const std::string& file_basename,
+                                       FileMetaData& meta) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  FileMetaData* cached = nullptr;
+  Status ret = GetFileMetaLocked(file_basename, cached);
+  if (ret.StatusNoError())
+    meta = *cached;
+
+  return ret;
+}
+
+Status TCCompactionPicker::GetFileProperties(const std::string& file_basename,
+                                             TableProperties& props) {
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  const TableProperties* cached = nullptr;
+  Status ret = GetFilePropertiesLocked(file_basename, cached);
+  if (ret.StatusNoError())
+    props = *cached;
+
+  return ret;
+}
+
+void TCCompactionPicker::AddFileMeta(const std::string& file_basename,
+                                     const FileMetaData& meta) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_meta_.emplace(file_basename, meta);
+}
+
+void TCCompactionPicker::EvictFileMeta(const std::string& file_basename) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  file_meta_.erase(file_basename);
+}
+
+double TCCompactionPicker::LevelScore(const Manifest& manifest,
+                                      const int level) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CalculateLevelTargets(manifest);
+  return LevelScoreLocked(manifest, level);
+}
+
+void TCCompactionPicker::LevelTargets(const Manifest& manifest,
+                                      std::vector<uint64_t>& level_max_bytes,
+                                      int& base_level) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  CalculateLevelTargets(manifest);
+  level_max_bytes = level_max_bytes_;
+  base_level = base_level_;
+}
+
+Status TCCompactionPicker::GetFileMetaLocked(const std::string& file_basename,
+                                             FileMetaData*& meta) {
+  Status ret;
+
+  auto it = file_meta_.find(file_basename);
+  if (it != file_meta_.end()) {
+    meta = &it->second;
+    return ret;
+  }
+
+  std::string file_abs_path =
+      neko_base::PathJoin(io_.kDatabaseDir, file_basename) +
+      io_.kSSTFilePostfix;
+
+  FileMetaData new_meta;
+  ret = io_.ReadSSTFooter(file_abs_path, new_meta.footer, new_meta.smallest,
+                          new_meta.largest);
+  if (!ret.StatusNoError())
+    return ret;
+
+  ::ssize_t file_size = BaseReader::FlieSize(file_abs_path.c_str());
+  if (file_size < 0)
+    return Status::FileIOError("Failed to stat the SST file.");
+  new_meta.file_size = file_size;
+
+  meta = &(file_meta_[file_basename] = std::move(new_meta));
+
+  return ret;
+}
+
+Status TCCompactionPicker::GetFilePropertiesLocked(
+    const std::string& file_basename, const TableProperties*& props) {
+  FileMetaData* meta = nullptr;
+  Status ret = GetFileMetaLocked(file_basename, meta);
+  if (!ret.StatusNoError())
+    return ret;
+
+  if (meta->properties == nullptr) {
+    std::string file_abs_path =
+        neko_base::PathJoin(io_.kDatabaseDir, file_basename) +
+        io_.kSSTFilePostfix;
+    if (meta->footer.metaindex.size == 0) {
+      ret = io_.ReadSSTFooter(file_abs_path, meta->footer);
+      if (!ret.StatusNoError())
+        return ret;
+    }
+
+    auto new_props = std::make_shared<TableProperties>();
+    ret = io_.ReadSSTProperties(file_abs_path, meta->footer, *new_props);
+    if (!ret.StatusNoError())
+      return ret;
+    meta->properties = new_props;
+  }
+  props = meta->properties.get();
+
+  return ret;
+}
+
+double TCCompactionPicker::LevelScoreLocked(const Manifest& manifest,
+                                            const int level) {
+  if (level >= manifest.data_files.size() || level >= level_.num_levels)
+    return 0;
+
+  // All sorted runs are scored together at level 0
+  if (style_ == kCompactionStyleUniversal) {
+    if (level != 0)
+      return 0;
+    std::vector<SortedRun> runs;
+    if (!SortedRuns(manifest, runs).StatusNoError())
+      return 0;
+    return static_cast<double>(runs.size()) /
+           std::max(universal_.max_sorted_runs, 1);
+  }
+
+  // The files being compacted will leave the level soon, so they are excluded
+  // from the score. Otherwise, the same level would be picked again and again.
+  if (level == 0) {
+    int file_num = 0;
+    for (auto& file : manifest.data_files[0])
+      file_num += being_compacted_.count(file) == 0;
+    return static_cast<double>(file_num) /
+           std::max(level_.level0_file_num_compaction_trigger, 1);
+  }
+
+  uint64_t level_bytes = 0;
+  for (auto& file : manifest.data_files[level]) {
+    if (being_compacted_.count(file) != 0)
+      continue;
+    FileMetaData* meta = nullptr;
+    if (GetFileMetaLocked(file, meta).StatusNoError())
+      level_bytes += meta->file_size;
+  }
+
+  // A level above the base level is left over from a smaller base level,
+  // drain it before all other levels
+  if (level_max_bytes_[level] == 0)
+    return level_bytes == 0 ? 0 : std::numeric_limits<double>::max();
+  return static_cast<double>(level_bytes) / level_max_bytes_[level];
+}
+
+void TCCompactionPicker::CalculateLevelTargets(const Manifest& manifest) {
+  const int last_level = level_.num_levels - 1;
+  const uint64_t base_bytes =
+      std::max<uint64_t>(level_.max_bytes_for_level_base, 1);
+  const uint64_t multiplier =
+      std::max(level_.max_bytes_for_level_multiplier, 1);
+
+  // Saturate instead of overflowing at the deep levels
+  auto times_multiplier = [multiplier](const uint64_t bytes) {
+    return bytes > UINT64_MAX / multiplier ? UINT64_MAX : bytes * multiplier;
+  };
+
+  uint64_t level_size = base_bytes;
+  if (!level_.dynamic_level_bytes) {
+    base_level_ = 1;
+    for (int level = 1; level <= last_level; ++level) {
+      level_max_bytes_[level] = level_size;
+      level_size = times_multiplier(level_size);
+    }
+    return;
+  }
+
+  // Size of the largest level, and the first non-empty level below level 0.
+  // Level 0 goes to the last level directly if all levels are empty.
+  uint64_t max_level_bytes = 0;
+  int first_non_empty = last_level;
+  int level_num = std::min<int>(manifest.data_files.size(), level_.num_levels);
+  for (int level = level_num - 1; level >= 1; --level) {
+    uint64_t level_bytes = 0;
+    FileMetaData* meta = nullptr;
+    for (auto& file : manifest.data_files[level]) {
+      if (GetFileMetaLocked(file, meta).StatusNoError())
+        level_bytes += meta->file_size;
+    }
+    if (!manifest.data_files[level].empty())
+      first_non_empty = level;
+    max_level_bytes = std::max(max_level_bytes, level_bytes);
+  }
+
+  // Derive the target of the first non-empty level from the largest level,
+  // then move the base level up while its target exceeds the base bytes.
+  // The base level is never below a non-empty level, otherwise level 0 would
+  // skip the older versions of its keys at the levels above.
+  level_size = max_level_bytes;
+  for (int level = last_level; level > first_non_empty; --level)
+    level_size /= multiplier;
+  base_level_ = first_non_empty;
+  while (base_level_ > 1 && level_size > base_bytes) {
+    --base_level_;
+    level_size /= multiplier;
+  }
+
+  for (int level = 1; level <= last_level; ++level) {
+    if (level < base_level_) {
+      level_max_bytes_[level] = 0;
+      continue;
+    }
+    if (level > base_level_)
+      level_size = times_multiplier(level_size);
+    // No target below the base bytes, otherwise the small levels would be
+    // scored before a level 0 filling up
+    level_max_bytes_[level] = std::max(level_size, base_bytes);
+  }
+}
+
+bool TCCompactionPicker::PickLevel0(const Manifest& manifest,
+                                    CompactionTask& task) {
+  for (auto& running : running_) {
+    if (running.level == 0)
+      return false;
+  }
+
+  const auto& files = manifest.data_files[0];
+  if (files.empty() || being_compacted_.count(files[0]) != 0)
+    return false;
+
+  // Start from the oldest file, and include all level 0 files overlapped with
+  // the range transitively. Any newer file left at level 0 is disjoint with
+  // the compaction, so that a key never has a newer version at a lower level
+  // than an older one.
+  std::vector<bool> picked(files.size(), false);
+  FileMetaData* meta = nullptr;
+  if (!GetFileMetaLocked(files[0], meta).StatusNoError())
+    return false;
+  picked[0] = true;
+  task.smallest = meta->smallest;
+  task.largest = meta->largest;
+
+  if (!ExpandLevel0Inputs(manifest, picked, task) ||
+      BeingCompacted(task.level_inputs))
+    return false;
+
+  return SetupOtherInputs(manifest, task);
+}
+
+bool TCCompactionPicker::ExpandLevel0Inputs(const Manifest& manifest,
+                                            std::vector<bool>& picked,
+                                            CompactionTask& task) {
+  const auto& files = manifest.data_files[0];
+  FileMetaData* meta = nullptr;
+
+  bool expanded = true;
+  while (expanded) {
+    expanded = false;
+    for (int i = 1; i < files.size(); ++i) {
+      if (picked[i])
+        continue;
+      if (!GetFileMetaLocked(files[i], meta).StatusNoError())
+        return false;
+      if (key_comparator_.Greater(meta->smallest, task.largest) ||
+          key_comparator_.Greater(task.smallest, meta->largest))
+        continue;
+
+      picked[i] = expanded = true;
+      if (comparator_->Less(meta->smallest, task.smallest))
+        task.smallest = meta->smallest;
+      if (comparator_->Greater(meta->largest, task.largest))
+        task.largest = meta->largest;
+    }
+  }
+
+  for (int i = 0; i < files.size(); ++i) {
+    if (picked[i])
+      task.level_inputs.push_back(files[i]);
+  }
+
+  return true;
+}
+
+bool TCCompactionPicker::PickLevelN(const Manifest& manifest, const int level,
+                                    CompactionTask& task) {
+  const auto& files = manifest.data_files[level];
+
+  // Candidate file numbers in the order of preference
+  std::vector<int> candidates;
+  FileMetaData* meta = nullptr;
+  if (pri_ == kRoundRobin) {
+    // Files above level 0 are ordered, start from the first file after the
+    // compact pointer and wrap around
+    int start = 0;
+    if (!compact_pointer_[level].empty()) {
+      start = files.size();
+      for (int i = 0; i < files.size(); ++i) {
+        if (!GetFileMetaLocked(files[i], meta).StatusNoError())
+          return false;
+        if (comparator_->Greater(meta->smallest, compact_pointer_[level])) {
+          start = i;
+          break;
+        }
+      }
+    }
+    for (int i = 0; i < files.size(); ++i)
+      candidates.push_back((start + i) % files.size());
+  } else {
+    std::vector<std::pair<double, int>> ratios;
+    for (int i = 0; i < files.size(); ++i) {
+      if (being_compacted_.count(files[i]) != 0)
+        continue;
+      if (!GetFileMetaLocked(files[i], meta).StatusNoError())
+        return false;
+
+      std::vector<std::string> overlapped;
+      uint64_t overlapped_size = 0;
+      if (!GetOverlappingInputs(manifest, level + 1, meta->smallest,
+                                meta->largest, overlapped, overlapped_size)
+               .StatusNoError())
+        return false;
+      ratios.emplace_back(
+          static_cast<double>(overlapped_size) / std::max<uint64_t>(meta->file_size, 1),
+          i);
+    }
+    std::stable_sort(ratios.begin(), ratios.end(),
+                     [](const std::pair<double, int>& x,
+                        const std::pair<double, int>& y) {
+                       return x.first < y.first;
+                     });
+    for (auto& ratio : ratios)
+      candidates.push_back(ratio.second);
+  }
+
+  if (level_.tombstone_ratio_threshold > 0) {
+    std::vector<std::pair<double, int>> dense;
+    std::vector<int> others;
+    const TableProperties* props = nullptr;
+    for (auto i : candidates) {
+      if (being_compacted_.count(files[i]) == 0 &&
+          GetFilePropertiesLocked(files[i], props).StatusNoError() &&
+          props->DeletionRatio() >= level_.tombstone_ratio_threshold)
+        dense.emplace_back(props->DeletionRatio(), i);
+      else
+        others.push_back(i);
+    }
+    std::stable_sort(dense.begin(), dense.end(),
+                     [](const std::pair<double, int>& x,
+                        const std::pair<double, int>& y) {
+                       return x.first > y.first;
+                     });
+    candidates.clear();
+    for (auto& d : dense)
+      candidates.push_back(d.second);
+    candidates.insert(candidates.end(), others.begin(), others.end());
+  }
+
+  for (auto i : candidates) {
+    if (being_compacted_.count(files[i]) != 0)
+      continue;
+    if (!GetFileMetaLocked(files[i], meta).StatusNoError())
+      return false;
+
+    task.level_inputs.assign(1, files[i]);
+    task.smallest = meta->smallest;
+    task.largest = meta->largest;
+    if (SetupOtherInputs(manifest, task))
+      return true;
+  }
+
+  return false;
+}
+
+Status TCCompactionPicker::GetOverlappingInputs(
+    const Manifest& manifest, const int level, const std::string& smallest,
+    const std::string& largest, std::vector<std::string>& inputs,
+    uint64_t& inputs_size) {
+  Status ret;
+
+  inputs.clear();
+  inputs_size = 0;
+  if (level >= manifest.data_files.size())
+    return ret;
+
+  FileMetaData* meta = nullptr;
+  for (auto& file : manifest.data_files[level]) {
+    ret = GetFileMetaLocked(file, meta);
+    if (!ret.StatusNoError())
+      return ret;
+
+    if (key_comparator_.Greater(smallest, meta->largest)) {
+      // Not reached the range yet
+      continue;
+    } else if (key_comparator_.Greater(meta->smallest, largest)) {
+      // Files above level 0 are ordered, skipped the range
+      break;
+    }
+    inputs.push_back(file);
+    inputs_size += meta->file_size;
+  }
+
+  return ret;
+}
+
+bool TCCompactionPicker::SetupOtherInputs(const Manifest& manifest,
+                                          CompactionTask& task) {
+  uint64_t inputs_size = 0;
+  if (!GetOverlappingInputs(manifest, task.output_level, task.smallest,
+                            task.largest, task.next_level_inputs, inputs_size)
+           .StatusNoError())
+    return false;
+  if (BeingCompacted(task.next_level_inputs))
+    return false;
+
+  // The outputs cover the range of all inputs
+  FileMetaData* meta = nullptr;
+  for (auto& file : task.next_level_inputs) {
+    if (!GetFileMetaLocked(file, meta).StatusNoError())
+      return false;
+    if (comparator_->Less(meta->smallest, task.smallest))
+      task.smallest = meta->smallest;
+    if (comparator_->Greater(meta->largest, task.largest))
+      task.largest = meta->largest;
+  }
+
+  // The outputs must not overlap with the outputs of a running compaction at
+  // the same level
+  for (auto& running : running_) {
+    if (running.output_level != task.output_level)
+      continue;
+    if (!key_comparator_.Greater(running.smallest, task.largest) &&
+        !key_comparator_.Greater(task.smallest, running.largest))
+      return false;
+  }
+
+  // Record the deeper files in the range. They will not change during the
+  // compaction: the data of the range can only move down through the output
+  // level, whose files in the range are the inputs of this task.
+  task.deeper_ranges.clear();
+  for (int level = task.output_level + 1;
+       level < manifest.data_files.size(); ++level) {
+    std::vector<std::string> overlapped;
+    uint64_t overlapped_size = 0;
+    if (!GetOverlappingInputs(manifest, level, task.smallest, task.largest,
+                              overlapped, overlapped_size)
+             .StatusNoError())
+      return false;
+
+    task.deeper_ranges.emplace_back();
+    for (auto& file : overlapped) {
+      if (!GetFileMetaLocked(file, meta).StatusNoError())
+        return false;
+      task.deeper_ranges.back().emplace_back(meta->smallest, meta->largest);
+    }
+  }
+
+  return true;
+}
+
+Status TCCompactionPicker::SortedRuns(const Manifest& manifest,
+                                      std::vector<SortedRun>& runs) {
+  Status ret;
+
+  runs.clear();
+  FileMetaData* meta = nullptr;
+
+  // Level 0 files are appended by the flushes, the newest one is the last
+  if (!manifest.data_files.empty()) {
+    const auto& files = manifest.data_files[0];
+    for (int i = static_cast<int>(files.size()) - 1; i >= 0; --i) {
+      ret = GetFileMetaLocked(files[i], meta);
+      if (!ret.StatusNoError())
+        return ret;
+      runs.push_back({0, files[i], meta->file_size});
+    }
+  }
+
+  for (int level = 1; level < manifest.data_files.size(); ++level) {
+    if (manifest.data_files[level].empty())
+      continue;
+
+    uint64_t level_bytes = 0;
+    for (auto& file : manifest.data_files[level]) {
+      ret = GetFileMetaLocked(file, meta);
+      if (!ret.StatusNoError())
+        return ret;
+      level_bytes += meta->file_size;
+    }
+    runs.push_back({level, std::string(), level_bytes});
+  }
+
+  return ret;
+}
+
+bool TCCompactionPicker::PickUniversal(const Manifest& manifest,
+                                       CompactionTask& task) {
+  std::vector<SortedRun> runs;
+  if (!SortedRuns(manifest, runs).StatusNoError())
+    return false;
+
+  const int max_runs = std::max(universal_.max_sorted_runs, 1);
+  const int run_num = runs.size();
+  if (run_num <= max_runs)
+    return false;
+  task.score = static_cast<double>(run_num) / max_runs;
+
+  // 1. Size amplification: the newer runs are too large compared with the
+  //    oldest run, which holds most of the live data. Merge all runs.
+  uint64_t newer_bytes = 0;
+  for (int i = 0; i < run_num - 1; ++i)
+    newer_bytes += runs[i].size;
+  if (newer_bytes * 100 >=
+      runs.back().size * universal_.max_size_amplification_percent)
+    return SetupUniversalInputs(manifest, runs, 0, run_num - 1, task);
+
+  // 2. Size ratio: starting from the newest run, merge the following runs
+  //    that are not much larger than all the candidates before them
+  const int min_width = std::max(universal_.min_merge_width, 2);
+  for (int first = 0; first + min_width <= run_num; ++first) {
+    uint64_t candidate_bytes = runs[first].size;
+    int last = first;
+    while (last + 1 < run_num &&
+           runs[last + 1].size * 100 <=
+               candidate_bytes * (100 + universal_.size_ratio))
+      candidate_bytes += runs[++last].size;
+
+    if (last - first + 1 >= min_width)
+      return SetupUniversalInputs(manifest, runs, first, last, task);
+  }
+
+  // 3. Number of runs: merge the newest runs to reduce the number of runs to
+  //    max_runs
+  return SetupUniversalInputs(manifest, runs, 0, run_num - max_runs, task);
+}
+
+bool TCCompactionPicker::SetupUniversalInputs(
+    const Manifest& manifest, const std::vector<SortedRun>& runs,
+    const int first, int last, CompactionTask& task) {
+  // The outputs are cut into files of about sst_file_size_, so they must not
+  // stay at level 0, where every file counts as a run. Otherwise, a merge of
+  // large runs would not reduce the number of runs, and the same data would
+  // be picked again and again. The older level 0 runs are merged as well,
+  // and the outputs go to the empty level right above the next older run,
+  // or into level 1 if that run is level 1.
+  while (runs[last].level == 0 && last + 1 < runs.size() &&
+         runs[last + 1].level == 0)
+    ++last;
+  bool into_next_run = false;
+  task.level = runs[first].level;
+  task.output_level = runs[last].level;
+  if (task.output_level == 0) {
+    if (last + 1 == runs.size())
+      task.output_level = level_.num_levels - 1;
+    else if (runs[last + 1].level == 1) {
+      task.output_level = 1;
+      into_next_run = true;
+    } else
+      task.output_level = runs[last + 1].level - 1;
+  }
+
+  // From the oldest run to the newest, so the level 0 files are in the
+  // MANIFEST order
+  for (int i = last; i >= first; --i) {
+    if (runs[i].level == 0) {
+      task.level_inputs.push_back(runs[i].file);
+    } else {
+      const auto& files = manifest.data_files[runs[i].level];
+      task.next_level_inputs.insert(task.next_level_inputs.end(),
+                                    files.begin(), files.end());
+    }
+  }
+
+  FileMetaData* meta = nullptr;
+  bool range_set = false;
+  for (auto inputs : {&task.level_inputs, &task.next_level_inputs}) {
+    for (auto& file : *inputs) {
+      if (!GetFileMetaLocked(file, meta).StatusNoError())
+        return false;
+      if (!range_set || comparator_->Less(meta->smallest, task.smallest))
+        task.smallest = meta->smallest;
+      if (!range_set || comparator_->Greater(meta->largest, task.largest))
+        task.largest = meta->largest;
+      range_set = true;
+    }
+  }
+
+  // Merge the level 1 files in the range, so that the outputs do not overlap
+  // the rest of level 1
+  if (into_next_run) {
+    uint64_t overlapped_size = 0;
+    if (!GetOverlappingInputs(manifest, 1, task.smallest, task.largest,
+                              task.next_level_inputs, overlapped_size)
+             .StatusNoError())
+      return false;
+    for (auto& file : task.next_level_inputs) {
+      if (!GetFileMetaLocked(file, meta).StatusNoError())
+        return false;
+      if (comparator_->Less(meta->smallest, task.smallest))
+        task.smallest = meta->smallest;
+      if (comparator_->Greater(meta->largest, task.largest))
+        task.largest = meta->largest;
+    }
+    ++last;
+  }
+
+  // Record the files of the older runs in the range
+  task.deeper_ranges.clear();
+  for (int i = last + 1; i < runs.size(); ++i) {
+    std::vector<std::string> overlapped;
+    if (runs[i].level == 0) {
+      overlapped.push_back(runs[i].file);
+    } else {
+      uint64_t overlapped_size = 0;
+      if (!GetOverlappingInputs(manifest, runs[i].level, task.smallest,
+                                task.largest, overlapped, overlapped_size)
+               .StatusNoError())
+        return false;
+    }
+
+    task.deeper_ranges.emplace_back();
+    for (auto& file : overlapped) {
+      if (!GetFileMetaLocked(file, meta).StatusNoError())
+        return false;
+      task.deeper_ranges.back().emplace_back(meta->smallest, meta->largest);
+    }
+  }
+
+  return true;
+}
+
+void TCCompactionPicker::RegisterTask(CompactionTask& task) {
+  task.id = next_task_id_++;
+  being_compacted_.insert(task.level_inputs.begin(), task.level_inputs.end());
+  being_compacted_.insert(task.next_level_inputs.begin(),
+                          task.next_level_inputs.end());
+  running_.push_back(task);
+}
+
+bool TCCompactionPicker::BeingCompacted(
+    const std::vector<std::string>& files) const {
+  for (auto& file : files) {
+    if (being_compacted_.count(file) != 0)
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,37 @@
+#include "compaction_filter.h"
+
+#include <chrono>
+#include <cstring>
+
+CompactionFilter::Decision TTLCompactionFilter::Filter(
+    const int level, const Sequence& key, const Sequence& value,
+    std::string& new_value) const {
+  // Not written by AppendTimestamp(), keep it
+  if (value.size() < kTimestampSize)
+    return kKeep;
+
+  uint64_t timestamp;
+  memcpy(&timestamp, value.data() + value.size() - kTimestampSize,
+         kTimestampSize);
+  uint64_t now = NowSeconds();
+  return timestamp <= now && now - timestamp >= ttl_seconds_ ? kRemove : kKeep;
+}
+
+std::string TTLCompactionFilter::AppendTimestamp(const Sequence& value) {
+  uint64_t now = NowSeconds();
+  std::string ret(value.data(), value.size());
+  ret.append(reinterpret_cast<const char*>(&now), kTimestampSize);
+  return ret;
+}
+
+Sequence TTLCompactionFilter::StripTimestamp(const Sequence& value) {
+  if (value.size() < kTimestampSize)
+    return value;
+  return Sequence(value.data(), value.size() - kTimestampSize);
+}
+
+uint64_t TTLCompactionFilter::NowSeconds() {
+  return std::chrono::duration_cast<std::chrono::seconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
@@ -1,20 +1,75 @@
 #include "db.h"
 
-TCDB::TCDB(const Config& config)
+TCDB::TCDB(const Config& config,
+           const std::shared_ptr<CompactionFilter>& compaction_filter,
+           const std::shared_ptr<MergeOperator>& merge_operator)
     : global_lock_(mutex_),
       mmt_lock_(mmt_mutex_),
+      mem_filter_size_(std::stoul(config.GetConfig("memtable_filter_size"))),
+      max_subcompactions_(std::stoi(config.GetConfig("max_subcompactions"))),
+      max_background_compactions_(
+          std::stoi(config.GetConfig("max_background_compactions"))),
+      compaction_io_class_(
+          config.GetConfig("compaction_io_priority") == "idle"
+              ? ThreadIOPriority::kIdle
+              : (config.GetConfig("compaction_io_priority") == "best_effort"
+                     ? ThreadIOPriority::kBestEffort
+                     : ThreadIOPriority::kNone)),
       io_(config.GetConfig("database_dir")) {
-  // TODO: If the database already exists, read manifest and update file_id_
-  //       and entry_id_.
+  // Recover the files, the next file number and the last entry id from the
+  // MANIFEST
+  ManifestFormat::VersionEdit recovered;
+  Status ret = io_.RecoverManifest(recovered);
+  if (!ret.StatusNoError()) {
+    // An empty version would let the flushes reuse the numbers of the live
+    // files, stop before anything is written
+    io_.Log("Failed to recover the MANIFEST " + ret.ErrMsg(),
+            TCLogger::kError);
+    open_status_ = ret;
+    return;
+  }
 
   comparator_ = std::make_shared<InternalEntryComparator>();
 
-  mem_table_ = new TCTable(mmt_lock_, comparator_, 0);
+  merge_operator_ = merge_operator;
+  if (merge_operator_ == nullptr) {
+    if (config.GetConfig("merge_operator") == "uint64_add")
+      merge_operator_ = std::make_shared<UInt64AddOperator>();
+    else if (config.GetConfig("merge_operator") == "string_append")
+      merge_operator_ = std::make_shared<StringAppendOperator>();
+  }
+
+  mem_table_ = new TCTable(
+      mmt_lock_, comparator_,
+      recovered.has_last_entry_id ? recovered.last_entry_id + 1 : 0,
+      mem_filter_size_, merge_operator_);
 
   filter_ = std::make_shared<TCBloomFilter>();
 
+  compaction_filter_ = compaction_filter;
+  uint64_t ttl_seconds = std::stoull(config.GetConfig("compaction_filter_ttl"));
+  if (compaction_filter_ == nullptr && ttl_seconds > 0)
+    compaction_filter_ = std::make_shared<TTLCompactionFilter>(ttl_seconds);
+
+  int64_t rate_bytes_per_sec =
+      std::stoll(config.GetConfig("rate_limiter_bytes_per_sec"));
+  if (rate_bytes_per_sec > 0)
+    io_.SetRateLimiter(std::make_shared<TCRateLimiter>(rate_bytes_per_sec));
+
+  io_.SetCompression(Compression::FromName(config.GetConfig("compression")));
+  io_.SetVerifyChecksums(config.GetConfig("verify_checksums") != "false");
+  io_.SetWriterBufferSize(std::stoull(config.GetConfig("writer_buffer_size")));
+  io_.SetLogLevel(TCLogger::LevelFromName(config.GetConfig("log_level")));
+  io_.SetBytesPerSync(std::stoull(config.GetConfig("bytes_per_sync")));
+  io_.SetUseDirectIO(
+      config.GetConfig("use_direct_io_for_flush_and_compaction") == "true");
+  uint64_t block_cache_size = std::stoull(config.GetConfig("block_cache_size"));
+  if (block_cache_size > 0)
+    io_.SetBlockCache(std::make_shared<TCBlockCache>(
+        block_cache_size / DataFileFormat::kDefaultDataBlkSize));
+
   Manifest manifest;
-  io_.ReadManifest(manifest);  // Assuming always returns StatusNoError
+  ManifestFormat::Apply(recovered, manifest);
   version_ctrl_.AppendVersion(TCVersion(manifest));  // Init version
 
   thread_pool_ = std::make_shared<TCThreadPool>(
@@ -22,6 +77,70 @@ TCDB::TCDB(const Config& config)
       std::stoi(config.GetConfig("max_task_queue_size")));
   thread_pool_->Start();
 
+  LevelCompactionOptions level;
+  level.num_levels = std::stoi(config.GetConfig("num_levels"));
+  level.level0_file_num_compaction_trigger =
+      std::stoi(config.GetConfig("level0_file_num_compaction_trigger"));
+  level.max_bytes_for_level_base =
+      std::stoull(config.GetConfig("max_bytes_for_level_base"));
+  level.max_bytes_for_level_multiplier =
+      std::stoi(config.GetConfig("max_bytes_for_level_multiplier"));
+  level.dynamic_level_bytes =
+      config.GetConfig("level_compaction_dynamic_level_bytes") == "true";
+  level.tombstone_ratio_threshold =
+      std::stod(config.GetConfig("tombstone_ratio_threshold"));
+
+  UniversalCompactionOptions universal;
+  universal.size_ratio = std::stoi(config.GetConfig("universal_size_ratio"));
+  universal.min_merge_width =
+      std::stoi(config.GetConfig("universal_min_merge_width"));
+  universal.max_sorted_runs =
+      std::stoi(config.GetConfig("universal_max_sorted_runs"));
+  universal.max_size_amplification_percent =
+      std::stoi(config.GetConfig("universal_max_size_amplification_percent"));
+
+  compaction_picker_ = std::make_shared<TCCompactionPicker>(
+      io_, comparator_, level, kDefaultSSTFileSize,
+      config.GetConfig("compaction_pri") == "round_robin"
+          ? TCCompactionPicker::kRoundRobin
+          : TCCompactionPicker::kMinOverlappingRatio,
+      config.GetConfig("compaction_style") == "universal"
+          ? TCCompactionPicker::kCompactionStyleUniversal
+          : TCCompactionPicker::kCompactionStyleLevel,
+      universal);
+
+  // The files are not read until they are compacted or their properties are
+  // needed
+  for (auto& file : recovered.new_files) {
+    if (file.smallest.empty())
+      continue;  // No metadata recorded
+    FileMetaData meta;
+    meta.file_size = file.file_size;
+    meta.smallest = file.smallest;
+    meta.largest = file.largest;
+    compaction_picker_->AddFileMeta(file.name, meta);
+  }
+
+  file_gc_ = std::make_shared<TCFileGC>(
+      io_,
+      [this](std::set<std::string>& live_files) {
+        version_ctrl_.LiveFiles(live_files);
+      },
+      std::stoull(config.GetConfig("file_deletion_rate")));
+
+  // The SST files in no version are the outputs of the compactions that
+  // failed or were interrupted by a crash, delete them
+  std::vector<std::string> sst_files, orphan_files;
+  std::set<std::string> live_files;
+  if (io_.ListSSTFiles(sst_files).StatusNoError()) {
+    version_ctrl_.LiveFiles(live_files);
+    for (auto& file : sst_files) {
+      if (live_files.count(file) == 0)
+        orphan_files.push_back(file);
+    }
+    file_gc_->AddCandidates(orphan_files);
+  }
+
   query_cache_ = std::make_shared<TCCache>();  // Default cache size
 
   // TODO: Unnecessary?
@@ -29,11 +148,39 @@ TCDB::TCDB(const Config& config)
 }
 
 TCDB::~TCDB() {
+  if (!open_status_.StatusNoError())
+    return;  // Nothing was started
+
+  // Wait for the last flush and all scheduled compactions
+  if (compact_future_.valid())
+    compact_future_.wait();
+  {
+    std::unique_lock<std::mutex> lock(compact_mutex_);
+    shutting_down_ = true;
+    compact_cv_.wait(lock, [this]() { return scheduled_compactions_ == 0; });
+  }
+
+  // Run the queued tasks while the members are alive, and join the threads
+  thread_pool_->Shutdown();
+
   if (mem_table_ != nullptr)
     delete mem_table_;
 }
 
+Status TCDB::Open(const Config& config, std::unique_ptr<TCDB>& db,
+                  const std::shared_ptr<CompactionFilter>& compaction_filter,
+                  const std::shared_ptr<MergeOperator>& merge_operator) {
+  db.reset(new TCDB(config, compaction_filter, merge_operator));
+  Status ret = db->status();
+  if (!ret.StatusNoError())
+    db.reset();
+  return ret;
+}
+
 std::string TCDB::Get(const Sequence& key) {
+  if (!open_status_.StatusNoError())
+    return std::string();
+
   // Try to get the value from the cache
   std::string v_cache;
   if (query_cache_->Get(key, v_cache)) {
@@ -51,31 +198,63 @@ std::string TCDB::Get(const Sequence& key) {
   if (!enc.StatusNoError())
     return std::string();
 
-  // Try to find the entry in mem_table_
+  // Merge operands of the key, from the newest to the oldest
+  std::vector<std::string> operands;
+
+  // Try to find the entry in mem_table_. A deletion in the mem_table_ shadows
+  // all older versions in the SST files.
   // Sequence result = mem_table_->Get(key);
-  Sequence result = mem_table_->Get(internal_entry);
-  if (result.size() != 0) {
-    return std::string(result.data(), result.size());
+  const char* mem_entry = mem_table_->GetEntry(internal_entry);
+  if (mem_entry != nullptr) {
+    if (InternalEntry::EntryOpType(mem_entry) == InternalEntry::kDelete)
+      return std::string();
+    if (InternalEntry::EntryOpType(mem_entry) == InternalEntry::kInsert) {
+      Sequence value = InternalEntry::EntryValue(mem_entry);
+      return std::string(value.data(), value.size());
+    }
+
+    // Collect the operands down to an insertion or a deletion, which may be
+    // in the SST files
+    std::vector<const char*> versions;
+    mem_table_->GetVersions(key, versions);
+    for (auto it = versions.rbegin(); it != versions.rend(); ++it) {
+      if (InternalEntry::EntryOpType(*it) != InternalEntry::kMerge)
+        return ApplyOperands(key, *it, operands);
+      Sequence operand = InternalEntry::EntryValue(*it);
+      operands.emplace_back(operand.data(), operand.size());
+    }
   }
+  Sequence result;
 
   // Not found in the memory, search in the SST files
-  // Manifest manifest;
-  // Status ret;
-  // ret = io_.ReadManifest(manifest);
-  // if (!ret.StatusNoError()) {
-  //   // Log the error message
-  //   return std::string();
-  // }
   Status ret;
-  Manifest manifest = version_ctrl_.LatestVersion()->manifest();
+
+  // Hold the version until the search finishes, so that its SST files will
+  // not be deleted
+  auto version_it = version_ctrl_.LatestVersion();
+  Manifest manifest = version_it->manifest();
 
   int level = 0;
   Sequence query_key(internal_entry, entry_size);
-  while (result.size() == 0 && level < manifest.data_files.size()) {
-    ret = SearchLevel(query_key, result, manifest, level++);
+  while (ret.StatusNoError() && result.size() == 0 &&
+         level < manifest.data_files.size()) {
+    ret = SearchLevel(query_key, result, manifest, level++, operands);
   }
 
-  if (result.size() == 0)
+  version_ctrl_.UnrefVersion(version_it);
+
+  // Do not fall back to an older version behind a corrupted block
+  if (!ret.StatusNoError()) {
+    io_.Log("Get failed: " + ret.ErrMsg(), TCLogger::kError);
+    return std::string();
+  }
+
+  if (!operands.empty())
+    return ApplyOperands(key, result.size() != 0 ? result.data() : nullptr,
+                         operands);
+
+  if (result.size() == 0 ||
+      InternalEntry::EntryOpType(result.data()) == InternalEntry::kDelete)
     return std::string();
   else {
     result = InternalEntry::EntryValue(result.data());
@@ -83,7 +262,29 @@ std::string TCDB::Get(const Sequence& key) {
   }
 }
 
+std::string TCDB::ApplyOperands(const Sequence& key, const char* base_entry,
+                                const std::vector<std::string>& operands) {
+  if (merge_operator_ == nullptr)
+    return std::string();
+
+  Sequence existing_value;
+  bool has_value =
+      base_entry != nullptr &&
+      InternalEntry::EntryOpType(base_entry) == InternalEntry::kInsert;
+  if (has_value)
+    existing_value = InternalEntry::EntryValue(base_entry);
+
+  std::vector<Sequence> ordered_operands(operands.rbegin(), operands.rend());
+  std::string value;
+  merge_operator_->FullMerge(key, has_value ? &existing_value : nullptr,
+                             ordered_operands, value);
+  return value;
+}
+
 Status TCDB::ConcurrentInsert(const Sequence& key, const Sequence& value) {
+  if (!open_status_.StatusNoError())
+    return open_status_;
+
   // TODO: Concurrent unsafe in cache. Why?
 
   auto insert_bind = std::bind(&TCDB::Insert, this, key, value);
@@ -95,9 +296,11 @@ Status TCDB::ConcurrentInsert(const Sequence& key, const Sequence& value) {
 }
 
 Status TCDB::Insert(const Sequence& key, const Sequence& value) {
+  if (!open_status_.StatusNoError())
+    return open_status_;
+
   Status ret;
 
-  std::string cur_key(key.data(), key.size());
   // {
   //   // TODO: Cache module is not concurrently safe yet.
   //   std::lock_guard<std::mutex> lock(mutex_);
@@ -107,51 +310,109 @@ Status TCDB::Insert(const Sequence& key, const Sequence& value) {
   //   }
   // }
 
-  const TCTable* immutable = nullptr;
+  ret = MakeRoomForWrite(key);
+  if (!ret.StatusNoError())
+    return ret;
+
+  mmt_trans_lock_.ReadLock();
+  ret = mem_table_->Insert(key, value);
+  mmt_trans_lock_.ReadUnlock();
+  return ret;
+
+  // return mem_table_->Insert(key, value);
+}
+
+Status TCDB::Merge(const Sequence& key, const Sequence& operand) {
+  if (!open_status_.StatusNoError())
+    return open_status_;
+
+  Status ret;
+
+  if (merge_operator_ == nullptr)
+    return Status::BadArgumentError("No merge operator.");
+
+  // The cached value is stale after the merge
+  if (!query_cache_->Delete(key)) {
+    return Status::UndefinedError("Cache deletion operation failed");
+  }
+
+  ret = MakeRoomForWrite(key);
+  if (!ret.StatusNoError())
+    return ret;
+
+  mmt_trans_lock_.ReadLock();
+  ret = mem_table_->Merge(key, operand);
+  mmt_trans_lock_.ReadUnlock();
+  return ret;
+}
+
+Status TCDB::MakeRoomForWrite(const Sequence& key) {
+  Status ret;
+
+  std::string cur_key(key.data(), key.size());
+
   if (mem_table_->MemUsage() >= kDefaultSSTFileSize) {
     mmt_trans_lock_.WriteLock();
 
     // Double check for the condition
     if (mem_table_->MemUsage() >= kDefaultSSTFileSize) {
-      // If there has been previous background compaction, block here until the
-      // last compaction finishes.
-      if (compact_future_.valid()) {
-        ret = compact_future_.get();
-        if (!ret.StatusNoError())
-          return ret;
-      }
-
       // For test
-      Log("Triggered table transferring and MVCCWriteLevel0 at " + cur_key);
+      if (io_.LogEnabled())
+        Log("Triggered table transferring and MVCCWriteLevel0 at " + cur_key);
 
-      // Transfer table
-      immutable = mem_table_;
-      mem_table_ =
-          new TCTable(mmt_lock_, comparator_, immutable->GetNextEntryID());
+      ret = SwitchMemTable();
+    }
 
-      // // Submit background compaction task
-      // Log("Triggered MVCCWriteLevel0 at " + cur_key);
+    mmt_trans_lock_.WriteUnlock();
+  }
 
-      // Bind pointer-to-member function with this pointer
-      auto background_compact_task =
-          std::bind(&TCDB::MVCCWriteLevel0, this, std::placeholders::_1);
+  return ret;
+}
 
-      compact_future_ =
-          thread_pool_->SubmitTask(background_compact_task, immutable);
-    }
+Status TCDB::SwitchMemTable() {
+  Status ret;
 
-    mmt_trans_lock_.WriteUnlock();
+  // If there has been previous background compaction, block here until the
+  // last compaction finishes.
+  if (compact_future_.valid()) {
+    ret = compact_future_.get();
+    if (!ret.StatusNoError())
+      return ret;
   }
 
-  mmt_trans_lock_.ReadLock();
-  ret = mem_table_->Insert(key, value);
-  mmt_trans_lock_.ReadUnlock();
+  // Transfer table
+  const TCTable* immutable = mem_table_;
+  mem_table_ = new TCTable(mmt_lock_, comparator_, immutable->GetNextEntryID(),
+                           mem_filter_size_, merge_operator_);
+
+  // Bind pointer-to-member function with this pointer
+  auto background_compact_task =
+      std::bind(&TCDB::MVCCWriteLevel0, this, std::placeholders::_1);
+
+  // Under mmt_trans_lock_, which the tasks of the pool may wait for
+  compact_future_ =
+      thread_pool_->SubmitTaskNoWait(background_compact_task, immutable);
+
   return ret;
+}
 
-  // return mem_table_->Insert(key, value);
+Status TCDB::FlushMemTable() {
+  Status ret;
+
+  mmt_trans_lock_.WriteLock();
+  if (mem_table_->NumEntries() > 0)
+    ret = SwitchMemTable();
+  if (ret.StatusNoError() && compact_future_.valid())
+    ret = compact_future_.get();
+  mmt_trans_lock_.WriteUnlock();
+
+  return ret;
 }
 
 Status TCDB::Delete(const Sequence& key) {
+  if (!open_status_.StatusNoError())
+    return open_status_;
+
   // TODO
 
   // First delete the k-v pair from the cache
@@ -163,45 +424,111 @@ Status TCDB::Delete(const Sequence& key) {
 }
 
 bool TCDB::ContainsKey(const Sequence& key) {
+  if (!open_status_.StatusNoError())
+    return false;
+
   // TODO
   return mem_table_->ContainsKey(key);
 }
 
-Status TCDB::TransferTable(const TCTable** immutable) {
-  // global_lock_.Lock();
-  *immutable = mem_table_;
-  mem_table_ =
-      new TCTable(mmt_lock_, comparator_, (*immutable)->GetNextEntryID());
+Status TCDB::CompactRange(
+    const Sequence& begin, const Sequence& end, const int target_level,
+    CompactionStats& stats,
+    const std::function<void(int, const CompactionStats&)>& progress) {
+  Status ret;
 
-  return *immutable != nullptr ? Status::NoError() : Status::UndefinedError();
-}
+  stats = CompactionStats();
+  if (!open_status_.StatusNoError())
+    return open_status_;
 
-Status TCDB::WriteLevel0() {
-  Status ret;
-  const TCTable* immutable = nullptr;
+  // The deletions still in the mem_table_ would escape the compactions
+  ret = FlushMemTable();
+  if (!ret.StatusNoError())
+    return ret;
 
-  if (!TransferTable(&immutable).StatusNoError()) {
-    // The mem_table_ object failed to be transfered
-    return Status::UndefinedError();
+  // Bounds of the range as InternalEntries, which cover all versions of the
+  // begin and end keys
+  auto encode_bound = [](const Sequence& key, const uint64_t id,
+                         std::string& bound) {
+    bound.assign(coding::SizeOfVarint(key.size()) + key.size() + 9, 0);
+    return InternalEntry::EncodeInternal(key, Sequence(), id,
+                                         InternalEntry::kDelete,
+                                         const_cast<char*>(bound.c_str()));
+  };
+  std::string smallest, largest;
+  if (begin.size() != 0) {
+    ret = encode_bound(begin, 0, smallest);
+    if (!ret.StatusNoError())
+      return ret;
   }
-
-  // Read from manifest
-  Manifest manifest;
-  ret = io_.ReadManifest(manifest);
-
-  // If level0 file num reaches default level0 file num, push level0 to level1
-  if (manifest.path_to_manifest.empty())
-    return Status::FileIOError("Failed to read MANIFEST file.");
-  if (!manifest.data_files.empty() &&
-      manifest.data_files[0].size() >= kDefaultLevelSize[0]) {
-    ret = BackgroundCompact(manifest);
+  if (end.size() != 0) {
+    ret = encode_bound(end, UINT64_MAX, largest);
     if (!ret.StatusNoError())
       return ret;
   }
 
-  ret = io_.WriteLevel0File(immutable, manifest, filter_);
+  int last_level = target_level;
+  if (compaction_picker_->style() ==
+      TCCompactionPicker::kCompactionStyleUniversal) {
+    last_level = 1;  // A single pass merges all runs
+  } else if (last_level <= 0) {
+    Manifest manifest = version_ctrl_.LatestManifest();
+    last_level = 1;
+    for (int level = 1; level < manifest.data_files.size(); ++level) {
+      if (!manifest.data_files[level].empty())
+        last_level = level;
+    }
+  }
+  last_level = std::min(last_level, compaction_picker_->num_levels() - 1);
+
+  for (int level = 0; level < last_level; ++level) {
+    // Wait until the inputs are not being compacted by the background
+    std::vector<CompactionTask> tasks;
+    while (true) {
+      Manifest manifest;
+      {
+        std::lock_guard<std::mutex> lock(version_mutex_);
+        manifest = version_ctrl_.LatestManifest();
+      }
+      if (compaction_picker_->PickRangeCompaction(manifest, level, smallest,
+                                                  largest, tasks))
+        break;
 
-  delete immutable;
+      std::unique_lock<std::mutex> lock(compact_mutex_);
+      compact_cv_.wait_for(
+          lock, std::chrono::milliseconds(kCompactRangeRetryIntervalMs));
+    }
+
+    std::vector<Status> rets(tasks.size());
+    std::vector<CompactionStats> task_stats(tasks.size());
+    thread_pool_->ParallelFor(tasks.size(), [&](const int i) {
+      rets[i] = CompactSST(tasks[i], &task_stats[i]);
+      compaction_picker_->ReleaseCompaction(tasks[i]);
+    });
+    {
+      std::lock_guard<std::mutex> lock(compact_mutex_);
+      compact_cv_.notify_all();
+    }
+
+    for (int i = 0; i < tasks.size(); ++i) {
+      stats.Add(task_stats[i]);
+      if (ret.StatusNoError() && !rets[i].StatusNoError())
+        ret = rets[i];
+    }
+    if (!ret.StatusNoError())
+      break;
+
+    io_.Log("CompactRange: level " + std::to_string(level) + " done, " +
+                std::to_string(tasks.size()) + " tasks, " +
+                std::to_string(stats.bytes_read) + " bytes read, " +
+                std::to_string(stats.bytes_written) + " bytes written",
+            TCLogger::kInfo);
+    if (progress)
+      progress(level, stats);
+  }
+
+  // The outputs may make the deeper levels exceed their targets
+  MaybeScheduleCompaction();
 
   return ret;
 }
@@ -209,487 +536,676 @@ Status TCDB::WriteLevel0() {
 Status TCDB::MVCCWriteLevel0(const TCTable* immutable) {
   Status ret;
 
-  // Get latest version from the version list instead of reading manifest file
-  auto version_it = version_ctrl_.LatestVersion();
-  Manifest manifest = version_it->manifest();
+  // The flush never waits for compactions. The new file is appended to level 0
+  // of the latest version, which may have been changed by the compactions
+  // since the flush started.
+  std::string file_basename;
+  ret = io_.WriteLevel0File(immutable, file_basename, filter_);
 
-  // If level0 file num reaches default level0 file num, push level0 to level1
-  if (!manifest.data_files.empty() &&
-      manifest.data_files[0].size() >= kDefaultLevelSize[0]) {
-    ret = BackgroundCompact(manifest);
-    if (!ret.StatusNoError())
-      return ret;
-  }
+  uint64_t next_entry_id = immutable->GetNextEntryID();
+  delete immutable;
 
-  ret = io_.WriteLevel0File(immutable, manifest, filter_);
+  if (!ret.StatusNoError())
+    return ret;
 
-  delete immutable;
+  {
+    std::lock_guard<std::mutex> lock(version_mutex_);
 
-  // Update version
-  TCVersion new_version(manifest);
-  new_version.UnRef();  // Unref the newly written version
-  if (!version_ctrl_.AppendVersion(new_version)) {
-    return Status::UndefinedError("The new version already exists");
+    Manifest manifest = version_ctrl_.LatestManifest();
+    ManifestFormat::VersionEdit edit;
+    ret = AddFileToEdit(
+        0, manifest.data_files.empty() ? 0 : manifest.data_files[0].size(),
+        file_basename, edit);
+    if (!ret.StatusNoError())
+      return ret;
+    // All the entries of the immutable table are persisted with the file
+    if (next_entry_id > 0)
+      edit.SetLastEntryID(next_entry_id - 1);
+
+    ret = InstallVersion(edit);
+    if (!ret.StatusNoError())
+      return ret;
   }
-  version_ctrl_.UnrefVersion(*version_it);  // Unref the old version and evict
-                                            // it if the ref_ decreased to 0
+
+  MaybeScheduleCompaction();
 
   return ret;
 }
 
-Status TCDB::BackgroundCompact(Manifest& manifest) {
-  Status ret;
+void TCDB::MaybeScheduleCompaction() {
+  std::lock_guard<std::mutex> lock(compact_mutex_);
 
-  assert(manifest.data_files.size() > 0);
-  io_.Log("Starting BackgroundCompact.");
+  while (!shutting_down_ &&
+         scheduled_compactions_ < max_background_compactions_) {
+    Manifest manifest;
+    {
+      std::lock_guard<std::mutex> v_lock(version_mutex_);
+      manifest = version_ctrl_.LatestManifest();
+    }
 
-  // Compact the first level 0 SST file by default
-  ret = CompactSST(manifest, 0, 0);
-  if (!ret.StatusNoError()) {
-    return ret;
+    CompactionTask task;
+    if (!compaction_picker_->PickCompaction(manifest, task))
+      break;
+
+    ++scheduled_compactions_;
+    // Under compact_mutex_, which the running compactions wait for to finish
+    thread_pool_->SubmitTaskNoWait(
+        std::bind(&TCDB::ScheduledCompact, this, std::move(task)));
   }
+}
 
-  // If the current SST files size exceeds limits, start a new Compaction
-  for (int i = 0; i < manifest.data_files.size();) {
-    if (manifest.data_files[i].size() >= kDefaultLevelSize[i]) {
-      // ret = CompactSST(manifest, i, 0);  // TODO: Each compaction should compact
-      //                                    // all files that exceed the limit.
-      int exceed_files =
-          manifest.data_files[i].size() - kDefaultLevelSize[i] + 1;
-      std::vector<int> file_nums(exceed_files);
-      for (int i = 0; i < exceed_files; ++i)
-        file_nums[i] = i;
-      ret = CompactSST(manifest, i, file_nums);
-      if (!ret.StatusNoError()) {
-        return ret;
-      }
-      // i = 0;  // Iterate from the beginning
-    } else {
-      ++i;
-    }
+Status TCDB::ScheduledCompact(const CompactionTask& task) {
+  Status ret = CompactSST(task);
+  if (!ret.StatusNoError())
+    io_.Log("Compaction failed at level " + std::to_string(task.level) + ": " +
+                ret.ErrMsg(),
+            TCLogger::kError);
+
+  compaction_picker_->ReleaseCompaction(task);
+  {
+    std::lock_guard<std::mutex> lock(compact_mutex_);
+    --scheduled_compactions_;
+    compact_cv_.notify_all();
   }
 
+  // The finished compaction may unblock others, or make the next level exceed
+  // its target. A failed one would be picked again at once and fail the same
+  // way, so it waits for the next flush.
+  if (ret.StatusNoError())
+    MaybeScheduleCompaction();
+
   return ret;
 }
 
-Status TCDB::CompactSST(Manifest& manifest, const int current_level,
-                        const int compact_file_num) {
+Status TCDB::CompactSST(const CompactionTask& task, CompactionStats* stats) {
   Status ret;
 
-  std::vector<std::pair<int, int>> compact_file_index{
-      std::make_pair(current_level, compact_file_num)};  // Index in manifest
-  DataFileFormat::Footer footer;
-  std::string min_internal_entry, max_internal_entry;
-
-  // Read the specific file's metadata
-  ret = io_.ReadSSTFooter(
-      neko_base::PathJoin(
-          io_.kDatabaseDir,
-          manifest.data_files[current_level][compact_file_num]) +
-          io_.kSSTFilePostfix,
-      footer, min_internal_entry, max_internal_entry);
+  // Nothing to merge with, relink the file to the output level. Deletions in
+  // the file are kept until it is really compacted.
+  if (task.IsTrivialMove()) {
+    io_.Log("Trivial move " + task.level_inputs.front() + " to level " +
+                std::to_string(task.output_level),
+            TCLogger::kInfo);
+    if (stats != nullptr)
+      ++stats->moved_files;
+    return InstallCompaction(task, task.level_inputs);
+  }
+
+  std::vector<std::string> compact_file_abs_path;
+  for (auto inputs : {&task.level_inputs, &task.next_level_inputs}) {
+    for (auto& file : *inputs)
+      compact_file_abs_path.push_back(
+          neko_base::PathJoin(io_.kDatabaseDir, file) + io_.kSSTFilePostfix);
+  }
+
+  // Found all overlaped SST files, start multi-way merging
+  std::vector<std::string> new_files;
+  ret = MultiwayMerge(compact_file_abs_path, task, new_files);
   if (!ret.StatusNoError()) {
+    // The files written before the failure are in no version
+    file_gc_->AddCandidates(new_files);
     return ret;
   }
 
-  std::string iter_min_entry, iter_max_entry;
-  // Iterate level 0 SST files and find all overlapped SST files
-  // Note: if the Compaction starts from above level 0, no need to iterate
-  //       level <current_level> files since all SST files are ordered.
-  if (current_level == 0) {
-    for (int i = 0; i < manifest.data_files[current_level].size(); ++i) {
-      if (compact_file_num == i)
-        continue;
-      ret = io_.ReadSSTFooter(
-          neko_base::PathJoin(io_.kDatabaseDir,
-                              manifest.data_files[current_level][i]) +
-              io_.kSSTFilePostfix,
-          footer, iter_min_entry, iter_max_entry);
-      if (!ret.StatusNoError()) {
-        return ret;
-      }
-
-      // If interval (iter_min,iter_max) does not overlap with (min, max)
-      if (comparator_->Greater(iter_min_entry, max_internal_entry) ||
-          comparator_->Greater(min_internal_entry, iter_max_entry)) {
-        continue;
-      } else {
-        compact_file_index.push_back(std::make_pair(current_level, i));
+  if (stats != nullptr) {
+    FileMetaData meta;
+    for (auto inputs : {&task.level_inputs, &task.next_level_inputs}) {
+      for (auto& file : *inputs) {
+        if (compaction_picker_->GetFileMeta(file, meta).StatusNoError())
+          stats->bytes_read += meta.file_size;
       }
+      stats->input_files += inputs->size();
+    }
+    for (auto& file : new_files) {
+      if (compaction_picker_->GetFileMeta(file, meta).StatusNoError())
+        stats->bytes_written += meta.file_size;
     }
+    stats->output_files += new_files.size();
   }
 
-  // Record where the new files will be inserted
-  // auto file_num = manifest.data_files[current_level + 1].size();
-  auto file_num = 0;
-  int insert_from_index = file_num;
-
-  // If level <current_level + 1> not empty
-  if (current_level + 1 < manifest.data_files.size()) {
-    file_num = manifest.data_files[current_level + 1].size();
-    insert_from_index = file_num;
-    // Iterate level <current_level + 1> SST files. Since all SST files above
-    // level 0 are ordered, the search should stop when reaches the max entry.
-    for (int i = 0; i < manifest.data_files[current_level + 1].size(); ++i) {
-      ret = io_.ReadSSTFooter(
-          neko_base::PathJoin(io_.kDatabaseDir,
-                              manifest.data_files[current_level + 1][i]) +
-              io_.kSSTFilePostfix,
-          footer, iter_min_entry, iter_max_entry);
-      if (!ret.StatusNoError()) {
-        return ret;
-      }
+  return InstallCompaction(task, new_files);
+}
+
+Status TCDB::GetLevelProperties(std::vector<TableProperties>& level_props) {
+  if (!open_status_.StatusNoError())
+    return open_status_;
+
+  Status ret;
+
+  // Hold the version, so that its SST files will not be deleted
+  auto version_it = version_ctrl_.LatestVersion();
+  Manifest manifest = version_it->manifest();
 
-      if (comparator_->Greater(min_internal_entry, iter_max_entry)) {
-        // Not reached the range yet, ++i
-        continue;
-      } else if (comparator_->Greater(iter_min_entry, max_internal_entry)) {
-        // Skipped the range [min_internal_entry, max_internal_entry]
-        if (i == 0)  // All existed files are larger than the new file
-          insert_from_index = 0;
+  level_props.assign(manifest.data_files.size(), TableProperties());
+  TableProperties props;
+  for (int level = 0; ret.StatusNoError() && level < level_props.size();
+       ++level) {
+    for (auto& file : manifest.data_files[level]) {
+      ret = compaction_picker_->GetFileProperties(file, props);
+      if (!ret.StatusNoError())
         break;
-      } else {
-        if (insert_from_index == file_num)  // sfsi not set
-          insert_from_index = i;
-        // Interval overlapped
-        compact_file_index.push_back(std::make_pair(current_level + 1, i));
-      }
+      level_props[level].Add(props);
     }
   }
 
-  // Found all overlaped SST files, start multi-way merging
-  std::vector<std::string> new_files;
-  std::vector<std::string> compact_file_abs_path;
-
-  // Make a vector of abs path of the compact files
-  for (int i = 0; i < compact_file_index.size(); ++i)
-    compact_file_abs_path.push_back(
-        neko_base::PathJoin(io_.kDatabaseDir,
-                            manifest.data_files[compact_file_index[i].first]
-                                               [compact_file_index[i].second]) +
-        io_.kSSTFilePostfix);
-  ret = MultiwayMerge(compact_file_abs_path, new_files);
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
+  version_ctrl_.UnrefVersion(version_it);
 
-  // Update Manifest file
-  return io_.UpdateManifest(manifest, compact_file_index, new_files,
-                            current_level, insert_from_index);
-  // TODO: A background thread should scan the folder and clean old SST files.
+  return ret;
 }
 
-Status TCDB::CompactSST(Manifest& manifest, const int current_level,
-                        const std::vector<int>& compact_file_num) {
+Status TCDB::InstallCompaction(const CompactionTask& task,
+                               const std::vector<std::string>& new_files) {
   Status ret;
 
-  std::vector<std::pair<int, int>> compact_file_index;
-  std::vector<std::string> compact_file_abs_path;
-  std::vector<std::pair<std::string, std::string>> min_max_internal_entries;
-  std::string min_internal_entry, max_internal_entry;
+  std::lock_guard<std::mutex> lock(version_mutex_);
 
-  assert(!compact_file_num.empty());
-  int min_level = compact_file_num[0];
-  for (auto& file_pos : compact_file_num) {
-    compact_file_index.emplace_back(current_level, file_pos);
-    compact_file_abs_path.push_back(
-        neko_base::PathJoin(io_.kDatabaseDir,
-                            manifest.data_files[current_level][file_pos]) +
-        io_.kSSTFilePostfix);
-  }
+  Manifest manifest = version_ctrl_.LatestManifest();
 
-  // Read the specific files' metadata
-  ret =
-      io_.ReadSSTGroupBoundary(compact_file_abs_path, min_max_internal_entries);
-  if (!ret.StatusNoError()) {
-    return ret;
-  }
-
-  // Find the boundary of the group of SST files
-  // Note: all files MUST be continuous!
-  min_internal_entry = min_max_internal_entries[0].first;
-  max_internal_entry = min_max_internal_entries[0].second;
-  for (int i = 1; i < min_max_internal_entries.size(); ++i) {
-    if (comparator_->Less(min_max_internal_entries[i].first,
-                          min_internal_entry)) {
-      // Update the left boundary
-      min_internal_entry = min_max_internal_entries[i].first;
-    }
-    if (comparator_->Greater(min_max_internal_entries[i].second,
-                             max_internal_entry)) {
-      // Update the right boundary
-      max_internal_entry = min_max_internal_entries[i].second;
+  // Remove the compacted files by name, their positions may have changed
+  std::set<std::string> compacted(task.level_inputs.begin(),
+                                  task.level_inputs.end());
+  compacted.insert(task.next_level_inputs.begin(),
+                   task.next_level_inputs.end());
+  ManifestFormat::VersionEdit edit;
+  for (int level = task.level; level <= task.output_level; ++level) {
+    if (level >= manifest.data_files.size())
+      continue;
+    for (auto& file : manifest.data_files[level]) {
+      if (compacted.count(file) != 0)
+        edit.DeleteFile(level, file);
     }
   }
-
-  std::string iter_min_entry, iter_max_entry;
-  // Iterate level 0 SST files and find all overlapped SST files
-  // Note: if the Compaction starts from above level 0, no need to iterate
-  //       level <current_level> files since all SST files are ordered.
-  if (current_level == 0) {
-    for (int i = 0; i < manifest.data_files[current_level].size(); ++i) {
-      // TODO: Time complexity O(n^2), need optimization?
-      bool in_cfn = false;
-      for (auto cfn : compact_file_num) {
-        // If i in compact_file_num
-        if (cfn == i) {
-          in_cfn = true;
-          break;
-        }
-      }
-      if (in_cfn)
-        continue;
-
-      ret = io_.ReadSSTBoundary(
-          neko_base::PathJoin(io_.kDatabaseDir,
-                              manifest.data_files[current_level][i]) +
-              io_.kSSTFilePostfix,
-          iter_min_entry, iter_max_entry);
-      if (!ret.StatusNoError()) {
+  ManifestFormat::Apply(edit, manifest);
+
+  // Insert the new files before the first file larger than the compaction
+  // range. No remaining file overlaps the range.
+  int insert_index = 0;
+  if (task.output_level < manifest.data_files.size()) {
+    const auto& files = manifest.data_files[task.output_level];
+    insert_index = files.size();
+    FileMetaData meta;
+    for (int i = 0; i < files.size(); ++i) {
+      ret = compaction_picker_->GetFileMeta(files[i], meta);
+      if (!ret.StatusNoError())
         return ret;
-      }
-
-      // If interval (iter_min,iter_max) does not overlap with (min, max)
-      if (comparator_->Greater(iter_min_entry, max_internal_entry) ||
-          comparator_->Greater(min_internal_entry, iter_max_entry)) {
-        continue;
-      } else {
-        compact_file_index.push_back(std::make_pair(current_level, i));
-        compact_file_abs_path.push_back(
-            neko_base::PathJoin(io_.kDatabaseDir,
-                                manifest.data_files[current_level][i]) +
-            io_.kSSTFilePostfix);
+      if (comparator_->Greater(meta.smallest, task.largest)) {
+        insert_index = i;
+        break;
       }
     }
   }
+  for (int i = 0; i < new_files.size(); ++i) {
+    ret = AddFileToEdit(task.output_level, insert_index + i, new_files[i],
+                        edit);
+    if (!ret.StatusNoError())
+      return ret;
+  }
 
-  // Record where the new files will be inserted
-  // auto file_num = manifest.data_files[current_level + 1].size();
-  auto file_num = 0;
-  int insert_from_index = file_num;
-
-  // If level <current_level + 1> not empty
-  if (current_level + 1 < manifest.data_files.size()) {
-    file_num = manifest.data_files[current_level + 1].size();
-    insert_from_index = file_num;
-    // Iterate level <current_level + 1> SST files. Since all SST files above
-    // level 0 are ordered, the search should stop when reaches the max entry.
-    for (int i = 0; i < manifest.data_files[current_level + 1].size(); ++i) {
-      ret = io_.ReadSSTBoundary(
-          neko_base::PathJoin(io_.kDatabaseDir,
-                              manifest.data_files[current_level + 1][i]) +
-              io_.kSSTFilePostfix,
-          iter_min_entry, iter_max_entry);
-      if (!ret.StatusNoError()) {
-        return ret;
-      }
+  ret = InstallVersion(edit);
+  if (!ret.StatusNoError())
+    return ret;
 
-      if (comparator_->Greater(min_internal_entry, iter_max_entry)) {
-        // Not reached the range yet, ++i
-        continue;
-      } else if (comparator_->Greater(iter_min_entry, max_internal_entry)) {
-        // Skipped the range [min_internal_entry, max_internal_entry]
-        if (i == 0)  // All existed files are larger than the new file
-          insert_from_index = 0;
-        break;
-      } else {
-        if (insert_from_index == file_num)  // sfsi not set
-          insert_from_index = i;
-        // Interval overlapped
-        compact_file_index.push_back(std::make_pair(current_level + 1, i));
-        compact_file_abs_path.push_back(
-            neko_base::PathJoin(io_.kDatabaseDir,
-                                manifest.data_files[current_level + 1][i]) +
-            io_.kSSTFilePostfix);
+  // A moved file is still alive at the output level
+  for (auto& file : new_files)
+    compacted.erase(file);
+  for (auto& file : compacted)
+    compaction_picker_->EvictFileMeta(file);
+
+  // The compacted files will be deleted once the older versions referencing
+  // them are released
+  file_gc_->AddCandidates(
+      std::vector<std::string>(compacted.begin(), compacted.end()));
+
+  return ret;
+}
+
+Status TCDB::InstallVersion(ManifestFormat::VersionEdit& edit) {
+  Status ret;
+
+  Manifest manifest = version_ctrl_.LatestManifest();
+  ManifestFormat::Apply(edit, manifest);
+
+  if (io_.ManifestSnapshotDue()) {
+    // The metadata of the live files is usually cached
+    ManifestFormat::VersionEdit snapshot;
+    snapshot.has_last_entry_id = edit.has_last_entry_id;
+    snapshot.last_entry_id = edit.last_entry_id;
+    for (int level = 0; level < manifest.data_files.size(); ++level) {
+      const auto& files = manifest.data_files[level];
+      for (int i = 0; i < files.size(); ++i) {
+        ret = AddFileToEdit(level, i, files[i], snapshot);
+        if (!ret.StatusNoError())
+          return ret;
       }
     }
+    ret = io_.WriteManifest(snapshot);
+  } else {
+    ret = io_.LogManifestEdit(edit);
   }
+  if (!ret.StatusNoError())
+    return ret;
 
-  // Found all overlaped SST files, start multi-way merging
-  std::vector<std::string> new_files;
+  // Update version. The old version is unreferenced by the version_ctrl_, and
+  // evicted if no reader holds it.
+  if (!version_ctrl_.AppendVersion(TCVersion(manifest))) {
+    return Status::UndefinedError("The new version already exists");
+  }
 
-  ret = MultiwayMerge(compact_file_abs_path, new_files);
-  if (!ret.StatusNoError()) {
+  return ret;
+}
+
+Status TCDB::AddFileToEdit(const int level, const int index,
+                           const std::string& file_basename,
+                           ManifestFormat::VersionEdit& edit) {
+  FileMetaData meta;
+  Status ret = compaction_picker_->GetFileMeta(file_basename, meta);
+  if (ret.StatusNoError())
+    edit.AddFile(level, index, file_basename, meta.file_size, meta.smallest,
+                 meta.largest);
+
+  return ret;
+}
+
+Status TCDB::MultiwayMerge(
+    const std::vector<std::string>& compact_file_abs_path,
+    const CompactionTask& task, std::vector<std::string>& new_files) {
+  Status ret;
+
+  // Split the compaction into several disjoint key ranges, each of them is
+  // merged by a subcompaction on the thread pool. Small compactions are not
+  // worth splitting.
+  std::vector<std::string> boundaries;
+  ret = SubcompactionBoundaries(compact_file_abs_path, boundaries);
+  if (!ret.StatusNoError())
     return ret;
+
+  if (boundaries.empty())
+    return MultiwayMerge(compact_file_abs_path, task, std::string(),
+                         std::string(), new_files);
+
+  // Subcompaction i merges the range [boundaries[i - 1], boundaries[i]), where
+  // the first lower bound and the last upper bound are unbounded.
+  int subcompaction_num = boundaries.size() + 1;
+  std::vector<std::vector<std::string>> sub_new_files(subcompaction_num);
+  std::vector<Status> sub_ret(subcompaction_num);
+
+  thread_pool_->ParallelFor(subcompaction_num, [&](const int i) {
+    sub_ret[i] = MultiwayMerge(
+        compact_file_abs_path, task, i > 0 ? boundaries[i - 1] : std::string(),
+        i < subcompaction_num - 1 ? boundaries[i] : std::string(),
+        sub_new_files[i]);
+  });
+
+  // The ranges are ascending, so are the new files of the subcompactions.
+  // The files of all the subcompactions are returned even if one fails, so
+  // that the caller deletes them.
+  for (int i = 0; i < subcompaction_num; ++i) {
+    if (ret.StatusNoError())
+      ret = sub_ret[i];
+    for (auto& file_basename : sub_new_files[i])
+      new_files.push_back(std::move(file_basename));
   }
 
-  // Update Manifest file
-  return io_.UpdateManifest(manifest, compact_file_index, new_files,
-                            current_level, insert_from_index);
-  // TODO: A background thread should scan the folder and clean old SST files.
+  return ret;
 }
 
 Status TCDB::MultiwayMerge(
     const std::vector<std::string>& compact_file_abs_path,
-    std::vector<std::string>& new_files) {
+    const CompactionTask& task, const std::string& lower_bound,
+    const std::string& upper_bound, std::vector<std::string>& new_files) {
   Status ret;
 
-  // TODO: Set max size for the priority_queue to avoid OOM
-  std::priority_queue<std::tuple<Sequence, int, int>,
-                      std::vector<std::tuple<Sequence, int, int>>,
-                      MergeComparator>
-      priority_queue;  // The elements of the priority_queue are std::tuples.
-                       // The data <Sequence, int, int> can be interpreted as
-                       // Sequence: the internal entry data;
-                       // first int: the file number, starts from 0;
-                       // second int: the Sequence's block_id in MergeAllocator.
-
-  std::vector<int> file_entry_in_queue;  // Record how many entries of file[i]
-                                         // are in the priority_queue now
-  std::vector<Sequence> entry_set;
-  // std::vector<DataFileFormat::Footer> footer_list;
-  std::vector<std::vector<uint32_t>> index_list;
-  std::vector<uint32_t> index_block;
-  DataFileFormat::Footer footer;
+  // Let the foreground IOs go first in the IO scheduler, in whichever thread
+  // the subcompaction runs
+  ThreadIOPriority io_priority(compaction_io_class_);
 
-  // Build a memory pool to store the entries. The MergeAllocator does not need
-  // the attribute `default block size` because each time we allocate a block in
-  // the pool, the block size is equal to the size of the corresponding SST DataBlock.
-  // We hope to manage the memory pool in units of DataBlock.
+  // Build a memory pool to store the entries. The MergeAllocator does not
+  // need the attribute `default block size` because each time we allocate a
+  // block in the pool, the block size is equal to the size of the
+  // corresponding SST DataBlock. We hope to manage the memory pool in units of
+  // DataBlock.
+  // Note: the MergeAllocator is not thread safe, every subcompaction owns one.
   std::shared_ptr<MemAllocator> merge_allocator =
       std::make_shared<MergeAllocator>();
 
-  // Initialize merging, read IndexBlocks
-  for (int i = 0; i < compact_file_abs_path.size(); ++i) {
-    ret = io_.ReadSSTFooter(compact_file_abs_path[i], footer);
-    if (!ret.StatusNoError())
-      return ret;
-    // footer_list.push_back(footer);
+  // One SSTBlockIterator for each file. Each iterator keeps only one
+  // DataBlock of its file in the memory pool at a time.
+  std::vector<std::shared_ptr<SSTBlockIterator>> children;
+  children.reserve(compact_file_abs_path.size());
+  for (auto& file_abs_path : compact_file_abs_path) {
+    children.push_back(std::make_shared<SSTBlockIterator>(
+        io_, file_abs_path, merge_allocator, comparator_, lower_bound,
+        upper_bound));
+  }
 
-    // Read IndexBlock into the memory
-    ret = io_.ReadSSTIndex(compact_file_abs_path[i], footer, index_block);
-    if (!ret.StatusNoError())
-      return ret;
-    // For conveniently calculating the size of the last block
-    index_block.push_back(footer.data_blk_size);
-    index_list.push_back(index_block);
+  MergingIterator merger(std::move(children), comparator_);
+  ret = merger.Init();
+  if (!ret.StatusNoError())
+    return ret;
 
-    // Read first DataBlock into the memory
-    ret = io_.ReadSSTDataBlock(compact_file_abs_path[i], merge_allocator,
-                               entry_set, index_block[1] - index_block[0], 0);
-    if (!ret.StatusNoError())
-      return ret;
+  // Iterately merge the files, return new file vector by reference
+  return IterMerge(merger, merge_allocator, task, new_files);
+}
 
-    // Push the DataBlock to the priority queue
-    for (auto& e : entry_set) {
-      // priority_queue.push(std::make_pair(e, i));
-      priority_queue.push(std::make_tuple(e, i, i + 1));
-    }
-    file_entry_in_queue.push_back(entry_set.size());
+Status TCDB::SubcompactionBoundaries(
+    const std::vector<std::string>& compact_file_abs_path,
+    std::vector<std::string>& boundaries) {
+  Status ret;
 
-    // Clear the buffers
-    index_block.clear();
-    entry_set.clear();
+  boundaries.clear();
+
+  // Each subcompaction should output at least about two SST files
+  ::ssize_t input_size = 0;
+  for (auto& file_abs_path : compact_file_abs_path) {
+    ::ssize_t file_size = BaseReader::FlieSize(file_abs_path.c_str());
+    if (file_size > 0)
+      input_size += file_size;
   }
+  int subcompaction_num =
+      std::min(static_cast<::ssize_t>(max_subcompactions_),
+               input_size / (2 * static_cast<::ssize_t>(kDefaultSSTFileSize)));
+  if (subcompaction_num <= 1)
+    return ret;
 
-  // Iterately merge the files, return new file vector by reference
-  return IterMerge(compact_file_abs_path, priority_queue, merge_allocator,
-                   file_entry_in_queue, index_list, new_files);
+  // Candidate boundaries are the min/max keys of the input files. All versions
+  // of a key must fall into the same subcompaction, so every boundary is an
+  // InternalEntry with the smallest id 0, which is less than any real version.
+  std::vector<std::pair<std::string, std::string>> min_max_internal_entries;
+  ret =
+      io_.ReadSSTGroupBoundary(compact_file_abs_path, min_max_internal_entries);
+  if (!ret.StatusNoError())
+    return ret;
+
+  std::vector<std::string> candidates;
+  candidates.reserve(min_max_internal_entries.size() * 2);
+  for (auto& min_max : min_max_internal_entries) {
+    for (auto entry : {&min_max.first, &min_max.second}) {
+      Sequence key = InternalEntry::EntryKey(entry->c_str());
+      std::string boundary(coding::SizeOfVarint(key.size()) + key.size() + 9,
+                           0);
+      ret = InternalEntry::EncodeInternal(key, Sequence(), 0,
+                                          InternalEntry::kDelete,
+                                          const_cast<char*>(boundary.c_str()));
+      if (!ret.StatusNoError())
+        return ret;
+      candidates.push_back(std::move(boundary));
+    }
+  }
+
+  std::sort(candidates.begin(), candidates.end(),
+            [this](const std::string& x, const std::string& y) {
+              return comparator_->Less(x.c_str(), y.c_str());
+            });
+  candidates.erase(std::unique(candidates.begin(), candidates.end(),
+                               [this](const std::string& x,
+                                      const std::string& y) {
+                                 return comparator_->Equal(x.c_str(),
+                                                           y.c_str());
+                               }),
+                   candidates.end());
+
+  // The smallest candidate never splits anything. Pick the boundaries evenly
+  // from the rest of the candidates.
+  int candidate_num = static_cast<int>(candidates.size()) - 1;
+  subcompaction_num = std::min(subcompaction_num, candidate_num + 1);
+  for (int i = 1; i < subcompaction_num; ++i)
+    boundaries.push_back(
+        std::move(candidates[1 + i * candidate_num / subcompaction_num]));
+
+  return ret;
 }
 
-Status TCDB::IterMerge(
-    const std::vector<std::string>& compact_files_abs_path,
-    std::priority_queue<std::tuple<Sequence, int, int>,
-                        std::vector<std::tuple<Sequence, int, int>>,
-                        MergeComparator>& priority_queue,
-    std::shared_ptr<MemAllocator>& merge_allocator,
-    std::vector<int>& file_entry_in_queue,
-    const std::vector<std::vector<uint32_t>>& index_list,
-    std::vector<std::string>& new_files) {
+Status TCDB::IterMerge(MergingIterator& merger,
+                       std::shared_ptr<MemAllocator>& merge_allocator,
+                       const CompactionTask& task,
+                       std::vector<std::string>& new_files) {
   Status ret;
 
-  std::vector<int> index_block_ptr(index_list.size(), 1);  // IndexBlock ptrs
   std::vector<std::tuple<Sequence, int, int>> output_buffer;
-  output_buffer.reserve(kDefaultSSTFileSize);
   int current_sst_size = 0;
 
-  while (!priority_queue.empty()) {
-    auto pq_item = priority_queue.top();  // std::tuple<Sequence, int, int>
+  // Double buffering: a full output_buffer is handed to a writer thread, and
+  // the merge goes on with the next buffer while the SST file is written.
+  // The entries being written keep their blocks referenced. They are
+  // unreferenced by this thread after the write, because the merge_allocator
+  // is not thread-safe.
+  std::vector<std::tuple<Sequence, int, int>> pending_buffer;
+  std::string pending_file;
+  std::future<Status> pending_write;  // Joined before the buffers destructed
+  // Nothing to overlap with a single hardware thread, write in this thread
+  const bool overlap_write = std::thread::hardware_concurrency() > 1;
+
+  // Wait for the pending write, and release the entries written
+  auto finish_pending_write = [&]() -> Status {
+    if (!pending_write.valid())
+      return Status::NoError();
+
+    Status write_ret = pending_write.get();
+    for (auto& item : pending_buffer)
+      merge_allocator->Unref(std::get<2>(item));
+    merge_allocator->ReleaseIdleSpace();
+    pending_buffer.clear();
+    if (write_ret.StatusNoError())
+      new_files.push_back(std::move(pending_file));
+    return write_ret;
+  };
+
+  // Wait for the pending write before failing the merge, so that its file is
+  // also returned by new_files
+  auto abort_merge = [&](const Status& error) -> Status {
+    finish_pending_write();
+    return error;
+  };
+
+  // Hand the output_buffer to the writer thread, at most one write is pending
+  auto start_write = [&]() -> Status {
+    Status write_ret = finish_pending_write();
+    if (!write_ret.StatusNoError())
+      return write_ret;
+
+    pending_buffer.swap(output_buffer);
+    current_sst_size = 0;
+    auto policy = overlap_write ? std::launch::async : std::launch::deferred;
+    pending_write = std::async(policy, [&]() -> Status {
+      ThreadIOPriority io_priority(compaction_io_class_);
 
-    current_sst_size += std::get<0>(pq_item).size();
-    if (current_sst_size >= kDefaultSSTFileSize) {
-      std::string file_basename;
-      ret = io_.WriteMergeSSTFile(output_buffer, file_basename, merge_allocator,
-                                  filter_);  // Unref from the mem pool Here.
-      if (!ret.StatusNoError()) {
-        return ret;
-      }
-      new_files.push_back(std::move(file_basename));
-      // Release memory resources
-      merge_allocator->ReleaseIdleSpace();
-      output_buffer.clear();
-      current_sst_size = 0;
-      continue;
+      std::vector<Sequence> entry_set;
+      entry_set.reserve(pending_buffer.size());
+      for (auto& item : pending_buffer)
+        entry_set.push_back(std::get<0>(item));
+      return io_.WriteNewSSTFile(entry_set, pending_file, filter_);
+    });
+    return overlap_write ? write_ret : finish_pending_write();
+  };
+
+  // Replace the last entry of the output_buffer with a new entry of its key,
+  // which is allocated in a block of its own
+  auto replace_last_entry = [&](const InternalEntry::OpType op_type,
+                                const Sequence& value, const uint64_t id) {
+    auto& last = output_buffer.back();
+    Sequence key = InternalEntry::EntryKey(std::get<0>(last).data());
+    uint64_t entry_size = coding::SizeOfVarint(key.size()) + key.size() + 9;
+    if (op_type != InternalEntry::kDelete)
+      entry_size += coding::SizeOfVarint(value.size()) + value.size();
+    char* new_entry = merge_allocator->AllocateFullBlock(entry_size);
+    InternalEntry::EncodeInternal(key, value, id, op_type, new_entry);
+
+    current_sst_size -= std::get<0>(last).size();
+    current_sst_size += entry_size;
+    merge_allocator->Unref(std::get<2>(last));
+    last = std::make_tuple(Sequence(new_entry, entry_size), std::get<1>(last),
+                           merge_allocator->BlockCount() - 1);
+  };
+
+  // Apply the merge operand in the entry to the last entry of the
+  // output_buffer, which is an older version of the same key. The result
+  // takes the ID of the operand.
+  auto merge_into_last_entry = [&](const Sequence& entry) {
+    const char* older = std::get<0>(output_buffer.back()).data();
+    Sequence key = InternalEntry::EntryKey(entry.data());
+    Sequence operand = InternalEntry::EntryValue(entry.data());
+    InternalEntry::OpType op_type = InternalEntry::EntryOpType(older);
+
+    std::string value;
+    if (op_type == InternalEntry::kMerge) {
+      merge_operator_->PartialMerge(key, InternalEntry::EntryValue(older),
+                                    operand, value);
+    } else {
+      Sequence existing_value;
+      if (op_type == InternalEntry::kInsert)
+        existing_value = InternalEntry::EntryValue(older);
+      merge_operator_->FullMerge(
+          key, op_type == InternalEntry::kInsert ? &existing_value : nullptr,
+          std::vector<Sequence>(1, operand), value);
+      op_type = InternalEntry::kInsert;
     }
-    priority_queue.pop();
-
-    // TODO: Compact kDelete
-    // Compact entries with the same key.
-    // Since all entries are in ascending order, we keep the last one only.
+    replace_last_entry(op_type, value, InternalEntry::EntryID(entry.data()));
+  };
+
+  // Resolve the last entry of the output_buffer to an insertion if it is a
+  // merge operand and no deeper level may contain its key.
+  // REQUIRES: all versions of the key have been merged
+  auto resolve_last_merge = [&]() {
+    if (merge_operator_ == nullptr || output_buffer.empty())
+      return;
+    const char* last = std::get<0>(output_buffer.back()).data();
+    if (InternalEntry::EntryOpType(last) != InternalEntry::kMerge ||
+        !task.IsBaseLevelForKey(last))
+      return;
+
+    std::string value;
+    merge_operator_->FullMerge(
+        InternalEntry::EntryKey(last), nullptr,
+        std::vector<Sequence>(1, InternalEntry::EntryValue(last)), value);
+    replace_last_entry(InternalEntry::kInsert, value,
+                       InternalEntry::EntryID(last));
+  };
+
+  // Pass the last entry of the output_buffer to the compaction_filter_ if it
+  // is an insertion. A removed entry is replaced with a deletion of the key,
+  // which is dropped by drop_obsolete_deletion() if it shadows nothing. The
+  // new entry keeps the ID.
+  // REQUIRES: all versions of the key have been merged
+  auto filter_last_entry = [&]() {
+    if (compaction_filter_ == nullptr || output_buffer.empty())
+      return;
+    const char* last = std::get<0>(output_buffer.back()).data();
+    if (InternalEntry::EntryOpType(last) != InternalEntry::kInsert)
+      return;
+
+    std::string new_value;
+    CompactionFilter::Decision decision = compaction_filter_->Filter(
+        task.output_level, InternalEntry::EntryKey(last),
+        InternalEntry::EntryValue(last), new_value);
+    if (decision == CompactionFilter::kKeep)
+      return;
+
+    replace_last_entry(decision == CompactionFilter::kRemove
+                           ? InternalEntry::kDelete
+                           : InternalEntry::kInsert,
+                       new_value, InternalEntry::EntryID(last));
+  };
+
+  // Drop the last entry of the output_buffer if it is a deletion and no deeper
+  // level may contain its key: the deletion shadows nothing any more.
+  // REQUIRES: all versions of the key have been merged
+  auto drop_obsolete_deletion = [&]() {
+    if (output_buffer.empty())
+      return;
+    const Sequence& last = std::get<0>(output_buffer.back());
+    if (InternalEntry::EntryOpType(last.data()) == InternalEntry::kDelete &&
+        task.IsBaseLevelForKey(last.data())) {
+      current_sst_size -= last.size();
+      merge_allocator->Unref(std::get<2>(output_buffer.back()));
+      output_buffer.pop_back();
+    }
+  };
+
+  // REQUIRES: all versions of the key have been merged
+  auto finish_last_key = [&]() {
+    resolve_last_merge();
+    filter_last_entry();
+    drop_obsolete_deletion();
+  };
+
+  while (merger.Valid()) {
+    const Sequence& entry = merger.entry();
+
+    // Without the merge operator that wrote it (e.g. the DB is reopened
+    // without the "merge_operator" config), an operand can neither be applied
+    // nor replace the older versions of its key. Fail the compaction rather
+    // than drop the base value.
+    if (merge_operator_ == nullptr &&
+        InternalEntry::EntryOpType(entry.data()) == InternalEntry::kMerge)
+      return abort_merge(Status::BadArgumentError(
+          "Merge operand found without a merge operator."));
+
+    // Compact entries with the same key inline. Since all entries are in
+    // ascending order, the shadowed versions come first and we keep the last
+    // one only. The check is done before splitting the output, so that all
+    // versions of a key always fall into the same SST file.
     if (!output_buffer.empty() &&
         comparator_->Equal(std::get<0>(output_buffer.back()).data(),
-                           std::get<0>(pq_item).data())) {
-      // Current entry has the same key as the previous one. Replace the last
-      // entry in the output_buffer with the current entry because the current
-      // one has a larger id.
-      merge_allocator->Unref(std::get<2>(output_buffer.back()));  // Unref
-      output_buffer.back() = pq_item;
-    } else {
-      output_buffer.push_back(pq_item);
-    }
-
-    // If a DataBlock read has finished, read the next DataBlock
-    if (--file_entry_in_queue[std::get<1>(pq_item)] == 0) {
-      int current_file_num = std::get<1>(pq_item);
-
-      // If there are no more SSTDataBlocks in the current_file, continue;
-      if (index_block_ptr[current_file_num] >=
-          index_list[current_file_num].size() - 1) {
-        continue;
+                           entry.data())) {
+      if (InternalEntry::EntryOpType(entry.data()) == InternalEntry::kMerge) {
+        // The operand is combined with the last entry, not kept
+        merge_into_last_entry(entry);
+        merge_allocator->Unref(merger.block_id());
+      } else {
+        // Current entry has the same key as the previous one. Replace the
+        // last entry in the output_buffer with the current entry because the
+        // current one has a larger id.
+        current_sst_size -= std::get<0>(output_buffer.back()).size();
+        merge_allocator->Unref(std::get<2>(output_buffer.back()));  // Unref
+        output_buffer.back() =
+            std::make_tuple(entry, merger.source(), merger.block_id());
+        current_sst_size += entry.size();
       }
-
-      int block_size =
-          index_list[current_file_num][index_block_ptr[current_file_num] + 1] -
-          index_list[current_file_num][index_block_ptr[current_file_num]];
-      int block_offset =
-          index_list[current_file_num][index_block_ptr[current_file_num]];
-      std::vector<Sequence> entry_set;
-
-      ret = io_.ReadSSTDataBlock(compact_files_abs_path[current_file_num],
-                                 merge_allocator, entry_set, block_size,
-                                 block_offset);  // Do not reuse block
-      if (!ret.StatusNoError()) {
-        return ret;
+    } else {
+      finish_last_key();
+      if (!output_buffer.empty() &&
+          current_sst_size + entry.size() >= kDefaultSSTFileSize) {
+        ret = start_write();
+        if (!ret.StatusNoError()) {
+          return ret;
+        }
       }
+      output_buffer.emplace_back(entry, merger.source(), merger.block_id());
+      current_sst_size += entry.size();
+    }
 
-      ++index_block_ptr[current_file_num];  // Move index_block pointer
-      file_entry_in_queue[current_file_num] += entry_set.size();
-
-      for (auto& e : entry_set) {
-        priority_queue.push(std::make_tuple(e, current_file_num,
-                                            merge_allocator->BlockCount() - 1));
-      }
+    ret = merger.Next();
+    if (!ret.StatusNoError()) {
+      return abort_merge(ret);
     }
   }
 
-  // TODO: Compact redundant entries.
   // If output_buffer not empty, flush the last entries to an SST file even if
   // the new SST file does not reach the kDefaultSSTFileSize limit.
+  finish_last_key();
   if (!output_buffer.empty()) {
-    std::string file_basename;
-    ret = io_.WriteMergeSSTFile(output_buffer, file_basename, merge_allocator,
-                                filter_);  // Unref from the mem pool
+    ret = start_write();
     if (!ret.StatusNoError()) {
       return ret;
     }
-    new_files.push_back(std::move(file_basename));
   }
 
-  return ret;
+  return finish_pending_write();
+}
+
+bool TCDB::TakeOperand(Sequence& entry, std::vector<std::string>& operands) {
+  if (InternalEntry::EntryOpType(entry.data()) != InternalEntry::kMerge)
+    return false;
+
+  Sequence operand = InternalEntry::EntryValue(entry.data());
+  operands.emplace_back(operand.data(), operand.size());
+  entry = Sequence();
+  return true;
 }
 
 Status TCDB::SearchLevel(const Sequence& query_key, Sequence& ret_entry,
-                         const Manifest& manifest, const int level) {
+                         const Manifest& manifest, const int level,
+                         std::vector<std::string>& operands) {
   Status ret;
 
   assert(level < manifest.data_files.size());
@@ -703,8 +1219,9 @@ Status TCDB::SearchLevel(const Sequence& query_key, Sequence& ret_entry,
 
   std::shared_ptr<QueryComparator> comp = std::make_shared<QueryComparator>();
   if (level == 0) {
-    // Search all level 0 files
-    for (int i = 0; i < manifest.data_files[level].size(); ++i) {
+    // Search all level 0 files, from the newest to the oldest, since level 0
+    // files may overlap each other
+    for (int i = manifest.data_files[level].size() - 1; i >= 0; --i) {
       file_abs_path =
           neko_base::PathJoin(io_.kDatabaseDir, manifest.data_files[level][i]) +
           io_.kSSTFilePostfix;
@@ -719,9 +1236,10 @@ Status TCDB::SearchLevel(const Sequence& query_key, Sequence& ret_entry,
         // The query_key may be in the SST file
         ret = GetFromSST(query_key, ret_entry, file_abs_path, footer);
         // ret = GetFromSSTv2(query_key, ret_entry, file_abs_path, footer);
-        if (!ret.StatusNoError() || ret_entry.size() != 0)  // Error occured or
-                                                            // found one record
+        if (!ret.StatusNoError())
           return ret;
+        if (ret_entry.size() != 0 && !TakeOperand(ret_entry, operands))
+          return ret;  // Found one record
       }  // Else not in the range, continue.
     }
   } else {
@@ -739,8 +1257,11 @@ Status TCDB::SearchLevel(const Sequence& query_key, Sequence& ret_entry,
       if (comp->LessOrEquals(query_key.data(), iter_max_entry.c_str()) &&
           comp->GreaterOrEquals(query_key.data(), iter_min_entry.c_str())) {
         // The key may be in the range of [iter_min_entry, iter_max_entry]
-        return GetFromSST(query_key, ret_entry, file_abs_path, footer);
-        // return GetFromSSTv2(query_key, ret_entry, file_abs_path, footer);
+        ret = GetFromSST(query_key, ret_entry, file_abs_path, footer);
+        // ret = GetFromSSTv2(query_key, ret_entry, file_abs_path, footer);
+        if (ret.StatusNoError() && ret_entry.size() != 0)
+          TakeOperand(ret_entry, operands);
+        return ret;
       }  // Else not in the range, continue.
     }
   }
@@ -755,11 +1276,12 @@ Status TCDB::GetFromSST(const Sequence& query_key, Sequence& ret_entry,
 
   auto query_key_value = InternalEntry::EntryKey(query_key.data());
   std::string filter;
-  ret = io_.ReadSSTFlexible(file_abs_path, footer, filter);
-  if (!ret.StatusNoError() || !filter_->ContainsKey(query_key_value, filter))
+  ret = io_.ReadSSTFilter(file_abs_path, footer, filter);
+  if (!ret.StatusNoError() ||
+      (!filter.empty() && !filter_->ContainsKey(query_key_value, filter)))
     return ret;
 
-  std::vector<uint32_t> index_block;
+  std::vector<uint64_t> index_block;
   ret = io_.ReadSSTIndex(file_abs_path, footer, index_block);
   if (!ret.StatusNoError())
     return ret;
@@ -817,11 +1339,12 @@ Status TCDB::GetFromSSTv2(const Sequence& query_key, Sequence& ret_entry,
   // Search in the bloom filter
   auto query_key_value = InternalEntry::EntryKey(query_key.data());
   std::string filter;
-  ret = io_.ReadSSTFlexible(file_abs_path, footer, filter);
-  if (!ret.StatusNoError() || !filter_->ContainsKey(query_key_value, filter))
+  ret = io_.ReadSSTFilter(file_abs_path, footer, filter);
+  if (!ret.StatusNoError() ||
+      (!filter.empty() && !filter_->ContainsKey(query_key_value, filter)))
     return ret;
 
-  std::vector<uint32_t> index_block;
+  std::vector<uint64_t> index_block;
   ret = io_.ReadSSTIndex(file_abs_path, footer, index_block);
   if (!ret.StatusNoError())
     return ret;
@@ -835,7 +1358,7 @@ Status TCDB::GetFromSSTv2(const Sequence& query_key, Sequence& ret_entry,
   Sequence candidate;
 
   ret = io_.ReadSSTDataAll(file_abs_path, query_allocator, entry_set,
-                           footer.data_blk_size, 0);
+                           index_block);
   if (!ret.StatusNoError())
     return ret;
 
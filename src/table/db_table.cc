@@ -2,11 +2,17 @@
 
 TCTable::TCTable(RAIILock& lock,
                  const std::shared_ptr<InternalEntryComparator>& comparator,
-                 const uint64_t first_entry_id)
-    : invalid_key_(new char(0)),
+                 const uint64_t first_entry_id, const uint32_t filter_bytes,
+                 const std::shared_ptr<MergeOperator>& merge_operator)
+    : comparator_(comparator),
+      invalid_key_(new char(0)),
       table_(comparator, invalid_key_),
       mem_allocator_(std::make_shared<MemAllocator>()),
       query_allocator_(std::make_shared<MemAllocator>()),
+      mem_filter_(filter_bytes > 0
+                      ? std::make_shared<TCDynamicBloomFilter>(filter_bytes)
+                      : nullptr),
+      merge_operator_(merge_operator),
       table_lock_(lock)
 // entry_id_(first_entry_id) {}
 {
@@ -19,6 +25,9 @@ TCTable::~TCTable() {
 }
 
 const Sequence TCTable::Get(const Sequence& key) const {
+  if (!MayContain(key))
+    return Sequence();
+
   uint64_t entry_size = coding::SizeOfVarint(key.size()) + key.size() + 9;
 
   table_lock_.Lock();
@@ -49,6 +58,9 @@ const Sequence TCTable::Get(const Sequence& key) const {
 }
 
 const Sequence TCTable::Get(const char* internal_entry) const {
+  if (!MayContain(InternalEntry::EntryKey(internal_entry)))
+    return Sequence();
+
   table_lock_.Lock();
   // const SkipListNode<const char*>* the_node = table_.Get(internal_entry);
   auto the_node = table_.Get(internal_entry);
@@ -64,7 +76,150 @@ const Sequence TCTable::Get(const char* internal_entry) const {
   return Sequence();
 }
 
+const char* TCTable::GetEntry(const char* internal_entry) const {
+  if (!MayContain(InternalEntry::EntryKey(internal_entry)))
+    return nullptr;
+
+  table_lock_.Lock();
+  auto the_node = table_.Get(internal_entry);
+  table_lock_.Unlock();
+
+  return the_node != nullptr ? the_node->key_ : nullptr;
+}
+
+void TCTable::GetVersions(const Sequence& key,
+                          std::vector<const char*>& versions) const {
+  versions.clear();
+  if (!MayContain(key))
+    return;
+
+  // The smallest InternalEntry of the key
+  std::string query_entry(coding::SizeOfVarint(key.size()) + key.size() + 9,
+                          0);
+  const char* internal_entry = query_entry.c_str();
+  InternalEntry::EncodeInternal(key, Sequence(), 0, InternalEntry::kDelete,
+                                const_cast<char*>(internal_entry));
+
+  table_lock_.Lock();
+  for (auto node = table_.Seek(internal_entry);
+       node != nullptr && node != table_.tail() &&
+       comparator_->Equal(node->key_, internal_entry);
+       node = node->next_[0])
+    versions.push_back(node->key_);
+  table_lock_.Unlock();
+}
+
+const std::vector<const char*> TCTable::LatestEntrySet() const {
+  std::vector<const char*> entry_set = table_.EntrySet();
+
+  // Versions of a key are ascending by id, keep the last one. The group of a
+  // key is read before its slot is overwritten, since kept <= first.
+  std::vector<const char*>::size_type kept = 0;
+  std::vector<const char*>::size_type first = 0;
+  for (std::vector<const char*>::size_type i = 0; i < entry_set.size(); ++i) {
+    if (i + 1 < entry_set.size() &&
+        comparator_->Equal(entry_set[i], entry_set[i + 1]))
+      continue;
+    entry_set[kept++] = CollapseVersions(entry_set, first, i);
+    first = i + 1;
+  }
+  entry_set.resize(kept);
+
+  return entry_set;
+}
+
+TCTable::LatestIterator::LatestIterator(const TCTable* table)
+    : table_(table), node_(table->table_.First()) {
+  Next();
+}
+
+void TCTable::LatestIterator::Next() {
+  if (node_ == nullptr) {
+    entry_ = nullptr;
+    return;
+  }
+
+  // Versions of a key are ascending by id, the group ends at the next key
+  versions_.clear();
+  const auto* tail = table_->table_.tail();
+  do {
+    versions_.push_back(node_->key_);
+    node_ = node_->next_[0];
+  } while (node_ != tail &&
+           table_->comparator_->Equal(versions_.back(), node_->key_));
+  if (node_ == tail)
+    node_ = nullptr;
+
+  entry_ = table_->CollapseVersions(versions_, 0, versions_.size() - 1);
+}
+
+const char* TCTable::CollapseVersions(const std::vector<const char*>& versions,
+                                      const int first, const int last) const {
+  const char* newest = versions[last];
+  if (merge_operator_ == nullptr ||
+      InternalEntry::EntryOpType(newest) != InternalEntry::kMerge)
+    return newest;
+
+  // Find the newest insertion or deletion below the operands
+  int base = last;
+  while (base >= first &&
+         InternalEntry::EntryOpType(versions[base]) == InternalEntry::kMerge)
+    --base;
+  if (base < first && first == last)
+    return newest;  // A single operand
+
+  Sequence key = InternalEntry::EntryKey(newest);
+  std::vector<Sequence> operands;
+  for (int i = base + 1; i <= last; ++i)
+    operands.push_back(InternalEntry::EntryValue(versions[i]));
+
+  std::string value;
+  InternalEntry::OpType op_type = InternalEntry::kInsert;
+  if (base >= first) {
+    // Apply the operands to the value, a deletion leaves no value
+    Sequence existing_value;
+    bool has_value =
+        InternalEntry::EntryOpType(versions[base]) == InternalEntry::kInsert;
+    if (has_value)
+      existing_value = InternalEntry::EntryValue(versions[base]);
+    merge_operator_->FullMerge(key, has_value ? &existing_value : nullptr,
+                               operands, value);
+  } else {
+    // The value is in the older tables, combine the operands only
+    op_type = InternalEntry::kMerge;
+    value.assign(operands[0].data(), operands[0].size());
+    std::string combined;
+    for (int i = 1; i < operands.size(); ++i) {
+      merge_operator_->PartialMerge(key, value, operands[i], combined);
+      value.swap(combined);
+    }
+  }
+
+  // The collapsed entry takes the place of the newest version
+  uint64_t entry_size = coding::SizeOfVarint(key.size()) + key.size() + 9 +
+                        coding::SizeOfVarint(value.size()) + value.size();
+  table_lock_.Lock();
+  char* internal_entry = mem_allocator_->Allocate(entry_size);
+  table_lock_.Unlock();
+  InternalEntry::EncodeInternal(key, value, InternalEntry::EntryID(newest),
+                                op_type, internal_entry);
+
+  return internal_entry;
+}
+
 Status TCTable::Insert(const Sequence& key, const Sequence& value) {
+  return Add(key, value, InternalEntry::OpType::kInsert);
+}
+
+Status TCTable::Merge(const Sequence& key, const Sequence& operand) {
+  if (merge_operator_ == nullptr)
+    return Status::BadArgumentError("No merge operator.");
+
+  return Add(key, operand, InternalEntry::OpType::kMerge);
+}
+
+Status TCTable::Add(const Sequence& key, const Sequence& value,
+                    const InternalEntry::OpType op_type) {
   // See InternalEntry.h for format info
   uint64_t entry_size = coding::SizeOfVarint(key.size()) + key.size() + 9 +
                         coding::SizeOfVarint(value.size()) + value.size();
@@ -75,9 +230,13 @@ Status TCTable::Insert(const Sequence& key, const Sequence& value) {
   char* internal_entry = mem_allocator_->Allocate(entry_size);
   table_lock_.Unlock();
 
-  Status enc = InternalEntry::EncodeInternal(
-      key, value, entry_id_++, InternalEntry::OpType::kInsert, internal_entry);
+  Status enc = InternalEntry::EncodeInternal(key, value, entry_id_++, op_type,
+                                             internal_entry);
   if (enc.StatusNoError()) {
+    // Add the key to the filter before it becomes visible in the table_
+    if (mem_filter_ != nullptr)
+      mem_filter_->AddKey(key);
+
     table_lock_.Lock();
     table_.Insert(internal_entry);
     table_lock_.Unlock();
@@ -116,6 +275,10 @@ Status TCTable::Delete(const Sequence& key) {
                                              internal_entry);
 
   if (enc.StatusNoError()) {
+    // The tombstone should also be found by the lookups
+    if (mem_filter_ != nullptr)
+      mem_filter_->AddKey(key);
+
     table_lock_.Lock();
     table_.Insert(internal_entry);
     table_lock_.Unlock();
@@ -125,6 +288,9 @@ Status TCTable::Delete(const Sequence& key) {
 }
 
 bool TCTable::ContainsKey(const Sequence& key) const {
+  if (!MayContain(key))
+    return false;
+
   uint64_t entry_size = coding::SizeOfVarint(key.size()) + key.size() + 9;
 
   table_lock_.Lock();
@@ -143,8 +309,9 @@ bool TCTable::ContainsKey(const Sequence& key) const {
     auto the_node = table_.Get(internal_entry);
     table_lock_.Unlock();
 
+    // A merge operand also makes the key exist
     if (the_node != nullptr) {
-      if (InternalEntry::EntryOpType(the_node->key_) == InternalEntry::kInsert)
+      if (InternalEntry::EntryOpType(the_node->key_) != InternalEntry::kDelete)
         return true;
     }
   }
@@ -0,0 +1,186 @@
+#include "merge_iterator.h"
+
+SSTBlockIterator::SSTBlockIterator(
+    TCIO& io, const std::string& file_abs_path,
+    const std::shared_ptr<MemAllocator>& merge_allocator)
+    : io_(io),
+      file_abs_path_(file_abs_path),
+      merge_allocator_(merge_allocator) {}
+
+SSTBlockIterator::SSTBlockIterator(
+    TCIO& io, const std::string& file_abs_path,
+    const std::shared_ptr<MemAllocator>& merge_allocator,
+    const std::shared_ptr<InternalEntryComparator>& comparator,
+    const std::string& lower_bound, const std::string& upper_bound)
+    : io_(io),
+      file_abs_path_(file_abs_path),
+      merge_allocator_(merge_allocator),
+      comparator_(comparator),
+      lower_bound_(lower_bound),
+      upper_bound_(upper_bound) {}
+
+Status SSTBlockIterator::Init() {
+  Status ret;
+  DataFileFormat::Footer footer;
+
+  ret = io_.ReadSSTFooter(file_abs_path_, footer);
+  if (!ret.StatusNoError())
+    return ret;
+
+  ret = io_.ReadSSTIndex(file_abs_path_, footer, index_block_);
+  if (!ret.StatusNoError())
+    return ret;
+  // For conveniently calculating the size of the last block
+  index_block_.push_back(footer.data_blk_size);
+
+  // The DataBlocks are read in order through one open file
+  input_ = io_.NewCompactionInput(file_abs_path_);
+
+  next_block_ = 0;
+  if (!lower_bound_.empty())
+    ret = Seek();
+  else if (index_block_.size() > 1)
+    ret = ReadBlock(next_block_++);
+  if (!ret.StatusNoError())
+    return ret;
+
+  CheckUpperBound();
+
+  return ret;
+}
+
+Status SSTBlockIterator::Next() {
+  Status ret;
+
+  if (++pos_ >= entry_set_.size() &&
+      next_block_ < static_cast<int>(index_block_.size()) - 1) {
+    // The current DataBlock is finished. The entries of the block are still
+    // referenced by the consumer, so the block is not released here.
+    ret = ReadBlock(next_block_++);
+  }
+
+  CheckUpperBound();
+
+  return ret;
+}
+
+Status SSTBlockIterator::Seek() {
+  Status ret;
+
+  // Binary search the first DataBlock whose last entry >= lower_bound_
+  int block_count = static_cast<int>(index_block_.size()) - 1;
+  int l = 0, r = block_count - 1, target = block_count;
+  while (l <= r) {
+    int mid = (l + r) / 2;
+    ret = ReadBlock(mid);
+    if (!ret.StatusNoError())
+      return ret;
+
+    if (comparator_->Less(entry_set_.back().data(), lower_bound_.c_str())) {
+      l = mid + 1;
+    } else {
+      target = mid;
+      r = mid - 1;
+    }
+
+    if (r >= l || target != mid) {
+      // The probed block is not the result, release it at once
+      Exhaust();
+    }
+  }
+
+  if (target == block_count) {
+    // All entries are less than the lower_bound_
+    Exhaust();
+    return ret;
+  }
+
+  if (Valid()) {
+    next_block_ = target + 1;
+  } else {
+    ret = ReadBlock(target);
+    if (!ret.StatusNoError())
+      return ret;
+    next_block_ = target + 1;
+  }
+
+  // Skip the entries less than the lower_bound_ in the target block
+  while (Valid() &&
+         comparator_->Less(entry().data(), lower_bound_.c_str())) {
+    merge_allocator_->Unref(block_id_);
+    ++pos_;
+  }
+
+  return ret;
+}
+
+void SSTBlockIterator::Exhaust() {
+  if (block_id_ >= 0 && pos_ < entry_set_.size()) {
+    for (auto i = pos_; i < entry_set_.size(); ++i)
+      merge_allocator_->Unref(block_id_);
+    if (pos_ == 0)
+      merge_allocator_->ReleaseIdleSpace(block_id_);
+  }
+
+  entry_set_.clear();
+  pos_ = 0;
+  next_block_ = static_cast<int>(index_block_.size()) - 1;
+}
+
+Status SSTBlockIterator::ReadBlock(const int block_num) {
+  entry_set_.clear();
+  pos_ = 0;
+
+  // The iterator only serves the compactions, which read each block once and
+  // do not fill the block cache
+  uint32_t block_size = index_block_[block_num + 1] - index_block_[block_num];
+  io_.RequestIO(block_size, TCRateLimiter::kIOLow);
+
+  Status ret = io_.ReadSSTDataBlock(file_abs_path_, merge_allocator_,
+                                    entry_set_, block_size,
+                                    index_block_[block_num],
+                                    -1,  // Do not reuse block
+                                    false, input_);
+  if (!ret.StatusNoError()) {
+    entry_set_.clear();
+    return ret;
+  }
+
+  // The MergeAllocator allocates one memory block for each DataBlock
+  block_id_ = merge_allocator_->BlockCount() - 1;
+
+  return ret;
+}
+
+MergingIterator::MergingIterator(
+    std::vector<std::shared_ptr<SSTBlockIterator>>&& children,
+    const std::shared_ptr<InternalEntryComparator>& comparator)
+    : children_(std::move(children)),
+      comparator_(comparator),
+      tree_(children_.size(), ChildBeats{this}) {}
+
+Status MergingIterator::Init() {
+  Status ret;
+
+  for (auto& child : children_) {
+    ret = child->Init();
+    if (!ret.StatusNoError())
+      return ret;
+  }
+
+  tree_.Build();
+
+  return ret;
+}
+
+Status MergingIterator::Next() {
+  int winner = tree_.Winner();
+
+  Status ret = children_[winner]->Next();
+  if (!ret.StatusNoError())
+    return ret;
+
+  tree_.Replay(winner);
+
+  return ret;
+}
@@ -0,0 +1,56 @@
+#include "merge_operator.h"
+
+#include <cstring>
+
+void UInt64AddOperator::FullMerge(const Sequence& key,
+                                  const Sequence* existing_value,
+                                  const std::vector<Sequence>& operands,
+                                  std::string& new_value) const {
+  uint64_t sum = existing_value != nullptr ? Decode(*existing_value) : 0;
+  for (auto& operand : operands)
+    sum += Decode(operand);
+  new_value = Encode(sum);
+}
+
+void UInt64AddOperator::PartialMerge(const Sequence& key,
+                                     const Sequence& older,
+                                     const Sequence& newer,
+                                     std::string& new_operand) const {
+  new_operand = Encode(Decode(older) + Decode(newer));
+}
+
+std::string UInt64AddOperator::Encode(const uint64_t number) {
+  return std::string(reinterpret_cast<const char*>(&number), sizeof(number));
+}
+
+uint64_t UInt64AddOperator::Decode(const Sequence& value) {
+  uint64_t number = 0;
+  if (value.size() == sizeof(number))
+    memcpy(&number, value.data(), sizeof(number));
+  return number;
+}
+
+void StringAppendOperator::FullMerge(const Sequence& key,
+                                     const Sequence* existing_value,
+                                     const std::vector<Sequence>& operands,
+                                     std::string& new_value) const {
+  new_value.clear();
+  bool first = existing_value == nullptr;
+  if (!first)
+    new_value.assign(existing_value->data(), existing_value->size());
+  for (auto& operand : operands) {
+    if (!first)
+      new_value.push_back(delimiter_);
+    new_value.append(operand.data(), operand.size());
+    first = false;
+  }
+}
+
+void StringAppendOperator::PartialMerge(const Sequence& key,
+                                        const Sequence& older,
+                                        const Sequence& newer,
+                                        std::string& new_operand) const {
+  new_operand.assign(older.data(), older.size());
+  new_operand.push_back(delimiter_);
+  new_operand.append(newer.data(), newer.size());
+}
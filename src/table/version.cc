@@ -3,58 +3,74 @@
 std::atomic<uint64_t> TCVersion::inc_id_;  // Call default constructor
 
 bool TCVersionCtrl::AppendVersion(const TCVersion& version) {
-  auto manifest_str = version.ManifestStr();
-
   std::lock_guard<std::mutex> lock(v_mutex_);
 
   if (!ExistVersion(version)) {
+    auto prev_latest = version_list_.end();
+    if (!version_list_.empty())
+      --prev_latest;
+
     // Insert the version into the version_list_
     version_list_.push_back(version);
 
-    // Insert serialized manifest of the version as the key,
-    // the last element in the version_list_ as the value
-    version_map_[manifest_str] = --version_list_.end();
+    // Insert the version id as the key, the last element in the
+    // version_list_ as the value
+    version_map_[version.version_id()] = --version_list_.end();
+
+    // The previous latest version is no longer referenced by the
+    // TCVersionCtrl
+    if (prev_latest != version_list_.end())
+      UnrefLocked(prev_latest);
 
     return true;
   } else {
-    version_map_[manifest_str]->Ref();
+    version_map_[version.version_id()]->Ref();
     return false;
   }
 }
 
 Status TCVersionCtrl::UnrefVersion(const TCVersion& version) {
-  auto manifest_str = version.ManifestStr();
-
   {
     std::lock_guard<std::mutex> lock(v_mutex_);
 
-    if (!ExistVersion(manifest_str)) {
+    auto it = version_map_.find(version.version_id());
+    if (it == version_map_.end()) {
       return Status::BadArgumentError("The version does not exist");
     }
 
-    version_map_[manifest_str]->UnRef();
-    if (version_map_[manifest_str]->Evictable()) {
-      // Evict from the version_list_
-      version_list_.erase(version_map_[manifest_str]);
-
-      // Evict from the version_map_
-      version_map_.erase(manifest_str);
-    }
+    UnrefLocked(it->second);
   }
 
   return Status::NoError();
 }
 
-bool TCVersionCtrl::ExistVersion(const TCVersion& version) const {
-  // No check
-  std::string manifest_str = version.ManifestStr();
+Status TCVersionCtrl::UnrefVersion(
+    std::list<TCVersion>::const_iterator version_it) {
+  std::lock_guard<std::mutex> lock(v_mutex_);
+
+  // Erasing nothing converts the const_iterator to an iterator
+  UnrefLocked(version_list_.erase(version_it, version_it));
+
+  return Status::NoError();
+}
+
+void TCVersionCtrl::LiveFiles(std::set<std::string>& live_files) {
+  std::lock_guard<std::mutex> lock(v_mutex_);
 
-  return version_map_.find(manifest_str) != version_map_.end();
+  for (auto& version : version_list_) {
+    Manifest manifest = version.manifest();
+    for (auto& level : manifest.data_files)
+      live_files.insert(level.begin(), level.end());
+  }
 }
 
-bool TCVersionCtrl::ExistVersion(const Manifest& manifest) const {
-  // No check
-  std::string manifest_str = ManifestFormat::Encode(manifest);
+void TCVersionCtrl::UnrefLocked(std::list<TCVersion>::iterator version_it) {
+  version_it->UnRef();
+  if (version_it->Evictable()) {
+    // Evict from the version_map_
+    version_map_.erase(version_it->version_id());
 
-  return version_map_.find(manifest_str) != version_map_.end();
-}
\ No newline at end of file
+    // Evict from the version_list_
+    version_list_.erase(version_it);
+  }
+}
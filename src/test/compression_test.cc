@@ -0,0 +1,204 @@
+/**
+ * @file compression_test.cc
+ * @brief Test for the codecs of the SST DataBlocks: the compressed blocks are
+ * uncompressed to the input, the incompressible and empty inputs are handled,
+ * and the truncated or garbled blocks are rejected without reading or
+ * writing out of bounds.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <cstdio>
+#include <random>
+#include "compression.h"
+
+namespace {
+
+const int kRoundTrips = 2000;
+const size_t kMaxInputSize = 64 * 1024;
+
+// Text of words from a small vocabulary, which the codecs compress well
+std::string CompressibleInput(std::mt19937& rng, const size_t size) {
+  static const char* const kWords[] = {"tomcat", "key_", "value", "0000",
+                                       "sst", "level", "manifest", " "};
+  std::string input;
+  while (input.size() < size)
+    input += kWords[rng() % (sizeof(kWords) / sizeof(kWords[0]))];
+  input.resize(size);
+  return input;
+}
+
+std::string RandomInput(std::mt19937& rng, const size_t size) {
+  std::string input(size, '\0');
+  for (auto& c : input)
+    c = static_cast<char>(rng());
+  return input;
+}
+
+// The codecs available in this build, besides kNoCompression
+std::vector<Compression::Type> Codecs() {
+  std::vector<Compression::Type> codecs;
+  for (auto type :
+       {Compression::kTCLZCompression, Compression::kZlibCompression}) {
+    if (Compression::Supported(type))
+      codecs.push_back(type);
+  }
+  return codecs;
+}
+
+bool RoundTrip(const Compression::Type type, const std::string& input,
+               bool& compressed) {
+  std::string output, uncompressed;
+  compressed =
+      Compression::Compress(type, input.data(), input.size(), output);
+  return Compression::Uncompress(type, output.data(), output.size(),
+                                 uncompressed)
+             .StatusNoError() &&
+         uncompressed == input;
+}
+
+// Compressible inputs of random sizes and mixes with random bytes
+bool TestRoundTrip() {
+  printf("<< Round trip >>\n");
+  std::mt19937 rng(301);
+  int failed = 0, compressed_num = 0;
+  for (int i = 0; i < kRoundTrips; ++i) {
+    std::string input = CompressibleInput(rng, rng() % kMaxInputSize);
+    if (i % 2 == 1)
+      input += RandomInput(rng, rng() % 256);
+    for (auto type : Codecs()) {
+      bool compressed = false;
+      failed += !RoundTrip(type, input, compressed);
+      compressed_num += compressed;
+    }
+  }
+
+  printf("  %d codecs, %d compressed, %d failed\n",
+         static_cast<int>(Codecs().size()), compressed_num, failed);
+  return failed == 0 && compressed_num > 0;
+}
+
+// Random bytes save nothing, so Compress() tells the caller to store them
+// uncompressed. The TCLZ output is still valid.
+bool TestIncompressibleInput() {
+  printf("<< Incompressible input >>\n");
+  std::mt19937 rng(302);
+  std::string input = RandomInput(rng, kMaxInputSize);
+  bool passed = true;
+  for (auto type : Codecs()) {
+    std::string output;
+    passed = passed &&
+             !Compression::Compress(type, input.data(), input.size(), output);
+  }
+
+  std::string output, uncompressed;
+  TCLZ::Compress(input.data(), input.size(), output);
+  return passed && TCLZ::Uncompress(output.data(), output.size(),
+                                    uncompressed) &&
+         uncompressed == input;
+}
+
+bool TestEmptyInput() {
+  printf("<< Empty input >>\n");
+  bool passed = true;
+  for (auto type : Codecs()) {
+    bool compressed = true;
+    passed = passed && RoundTrip(type, std::string(), compressed) &&
+             !compressed;
+  }
+
+  std::string uncompressed("stale");
+  passed = passed && Compression::Uncompress(Compression::kNoCompression, "",
+                                             0, uncompressed)
+                         .StatusNoError() &&
+           uncompressed.empty();
+  return passed;
+}
+
+// Every proper prefix of a compressed block is rejected
+bool TestTruncatedInput() {
+  printf("<< Truncated input >>\n");
+  std::mt19937 rng(304);
+  std::string input = CompressibleInput(rng, 4096);
+  int accepted = 0;
+  for (auto type : Codecs()) {
+    std::string output, uncompressed;
+    if (!Compression::Compress(type, input.data(), input.size(), output))
+      return false;
+    for (size_t size = 0; size < output.size(); ++size) {
+      Status ret =
+          Compression::Uncompress(type, output.data(), size, uncompressed);
+      accepted += ret.StatusNoError() || !ret.IsCorruption();
+    }
+  }
+
+  printf("  %d prefixes accepted\n", accepted);
+  return accepted == 0;
+}
+
+// Hand-made TCLZ blocks that point out of the output are rejected. Random
+// damage of real blocks must never crash the decoders, but it may decode to
+// other bytes, which the checksum of the block catches.
+bool TestGarbledInput() {
+  printf("<< Garbled input >>\n");
+  std::string uncompressed;
+  // raw size | token | literals | offset | ...
+  const std::string kBadBlocks[] = {
+      // The offset 2 of the match is before the first literal
+      std::string("\x08\x10" "a\x02\x00", 5),
+      // The offset 0 matches nothing
+      std::string("\x08\x10" "a\x00\x00", 5),
+      // 5 literals overrun the raw size 2
+      std::string("\x02\x50" "abcde", 7),
+      // 5 literals overrun the input
+      std::string("\x0a\x50" "ab", 4),
+      // The match of 4 bytes overruns the raw size 4
+      std::string("\x04\x10" "a\x01\x00", 5),
+      // The literal length extension runs out of the input
+      std::string("\x20\xf0\xff", 3),
+      // The output is shorter than the raw size
+      std::string("\x08\x20" "ab", 4),
+      // The raw size is a truncated varint
+      std::string("\x80", 1)};
+  int accepted = 0;
+  for (auto& block : kBadBlocks)
+    accepted += TCLZ::Uncompress(block.data(), block.size(), uncompressed);
+
+  std::mt19937 rng(305);
+  int damaged_rejected = 0;
+  for (auto type : Codecs()) {
+    std::string input = CompressibleInput(rng, 8192), output;
+    Compression::Compress(type, input.data(), input.size(), output);
+    for (int i = 0; i < kRoundTrips; ++i) {
+      std::string damaged = output;
+      for (int j = 0; j <= i % 4; ++j)
+        damaged[1 + rng() % (damaged.size() - 1)] ^= 1 << (rng() % 8);
+      Status ret = Compression::Uncompress(type, damaged.data(),
+                                           damaged.size(), uncompressed);
+      damaged_rejected += !ret.StatusNoError();
+    }
+  }
+
+  Status ret = Compression::Uncompress(static_cast<Compression::Type>(9), "",
+                                       0, uncompressed);
+  printf("  %d bad blocks accepted, %d of %d damaged blocks rejected\n",
+         accepted, damaged_rejected,
+         kRoundTrips * static_cast<int>(Codecs().size()));
+  return accepted == 0 && !ret.StatusNoError() && !ret.IsCorruption();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test : {TestRoundTrip, TestIncompressibleInput, TestEmptyInput,
+                    TestTruncatedInput, TestGarbledInput}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,176 @@
+/**
+ * @file crc32c_test.cc
+ * @brief Test for the crc32c of the SST blocks: the standard check values,
+ * Extend() over split data of any alignment, the masking of the stored CRCs,
+ * and a corrupt DataBlock read as Corruption.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include "crc32c.h"
+#include "io.h"
+
+namespace {
+
+// The check value of the CRC-32C, and the vectors of RFC 3720 B.4
+bool TestStandardVectors() {
+  printf("<< Standard vectors >>\n");
+  printf("  hardware accelerated: %d\n", crc32c::IsHardwareAccelerated());
+
+  char buf[32];
+  bool passed = crc32c::Value("123456789", 9) == 0xE3069283u;
+
+  std::memset(buf, 0, sizeof(buf));
+  passed = passed && crc32c::Value(buf, sizeof(buf)) == 0x8A9136AAu;
+
+  std::memset(buf, 0xff, sizeof(buf));
+  passed = passed && crc32c::Value(buf, sizeof(buf)) == 0x62A8AB43u;
+
+  for (int i = 0; i < 32; ++i)
+    buf[i] = i;
+  passed = passed && crc32c::Value(buf, sizeof(buf)) == 0x46DD794Eu;
+
+  for (int i = 0; i < 32; ++i)
+    buf[i] = 31 - i;
+  passed = passed && crc32c::Value(buf, sizeof(buf)) == 0x113FDB5Cu;
+
+  return passed && crc32c::Value(buf, 0) == 0;
+}
+
+// The crc32c extended by the rest of the data equals the crc32c of the
+// whole, wherever the data is split and however it is aligned
+bool TestExtend() {
+  printf("<< Extend >>\n");
+  std::mt19937 rng(411);
+  std::string data(256 + 8, '\0');
+  for (auto& c : data)
+    c = static_cast<char>(rng());
+
+  int failed = 0;
+  for (int align = 0; align < 8; ++align) {
+    for (size_t size = 0; size <= 256; size += 1 + size / 16) {
+      const char* p = data.data() + align;
+      uint32_t whole = crc32c::Value(p, size);
+      for (size_t split = 0; split <= size; ++split)
+        failed += crc32c::Extend(crc32c::Value(p, split), p + split,
+                                 size - split) != whole;
+    }
+  }
+
+  printf("  %d mismatches\n", failed);
+  return failed == 0 &&
+         crc32c::Value("hello world", 11) != crc32c::Value("hello", 5);
+}
+
+bool TestMask() {
+  printf("<< Mask >>\n");
+  bool passed = true;
+  for (uint32_t crc : {0u, 1u, 0xE3069283u, 0xffffffffu}) {
+    passed = passed && crc32c::Mask(crc) != crc &&
+             crc32c::Mask(crc32c::Mask(crc)) != crc32c::Mask(crc) &&
+             crc32c::Unmask(crc32c::Mask(crc)) == crc;
+  }
+  return passed;
+}
+
+// A DataBlock damaged on the disk is read as Corruption instead of being
+// decoded
+bool TestBlockCorruption() {
+  printf("<< Block corruption >>\n");
+  const std::string kDatabaseDir = "/tmp/tcdb_crc32c_test";
+  const int kEntryNum = 1000;
+  std::system(("rm -rf " + kDatabaseDir).c_str());
+
+  std::string value(100, 'v');
+  std::vector<std::string> buffers(kEntryNum);
+  std::vector<Sequence> entries;
+  for (int i = 0; i < kEntryNum; ++i) {
+    char key[16];
+    snprintf(key, sizeof(key), "key_%06d", i);
+    buffers[i].resize(32 + value.size());
+    InternalEntry::EncodeInternal(Sequence(key, strlen(key)),
+                                  Sequence(value.data(), value.size()), i,
+                                  InternalEntry::kInsert, &buffers[i][0]);
+    entries.push_back(InternalEntry::EntryData(buffers[i].data()));
+  }
+
+  std::string file_abs_path;
+  Status ret;
+  {
+    TCIO io(kDatabaseDir);
+    std::string file_basename;
+    ret = io.WriteNewSSTFile(entries, file_basename);
+    file_abs_path = neko_base::PathJoin(kDatabaseDir, file_basename) +
+                    io.kSSTFilePostfix;
+  }
+  if (!ret.StatusNoError())
+    return false;
+
+  // Read the second DataBlock, before and after a byte in its middle is
+  // flipped. Each read is by a new TCIO, which caches nothing.
+  auto read_block = [&]() -> Status {
+    TCIO io(kDatabaseDir);
+    DataFileFormat::Footer footer;
+    std::vector<uint64_t> index_block;
+    Status ret = io.ReadSSTFooter(file_abs_path, footer);
+    if (ret.StatusNoError())
+      ret = io.ReadSSTIndex(file_abs_path, footer, index_block);
+    if (!ret.StatusNoError())
+      return ret;
+    if (index_block.size() < 2)
+      return Status::UndefinedError("Too few DataBlocks");
+    index_block.push_back(footer.data_blk_size);
+
+    std::shared_ptr<MemAllocator> allocator =
+        std::make_shared<MergeAllocator>();
+    std::vector<Sequence> entry_set;
+    return io.ReadSSTDataBlock(file_abs_path, allocator, entry_set,
+                               index_block[2] - index_block[1],
+                               index_block[1]);
+  };
+
+  Status intact = read_block();
+
+  TCIO io(kDatabaseDir);
+  DataFileFormat::Footer footer;
+  std::vector<uint64_t> index_block;
+  io.ReadSSTFooter(file_abs_path, footer);
+  io.ReadSSTIndex(file_abs_path, footer, index_block);
+  if (index_block.size() < 2)
+    return false;
+  std::fstream file(file_abs_path,
+                    std::ios::in | std::ios::out | std::ios::binary);
+  uint64_t offset = (index_block[1] + index_block[2]) / 2;
+  file.seekg(offset);
+  char byte = file.get();
+  file.seekp(offset);
+  file.put(~byte);
+  file.close();
+
+  Status corrupt = read_block();
+  printf("  intact: %s, corrupt: %s\n",
+         intact.StatusNoError() ? "ok" : intact.ErrMsg().c_str(),
+         corrupt.ErrMsg().c_str());
+  return intact.StatusNoError() && corrupt.IsCorruption();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test :
+       {TestStandardVectors, TestExtend, TestMask, TestBlockCorruption}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
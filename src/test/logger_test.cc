@@ -0,0 +1,218 @@
+/**
+ * @file logger_test.cc
+ * @brief Multi-producer test for the MPSCRing and the async TCLogger: the
+ * values of each producer are popped in order, nothing is lost or duplicated
+ * while the queue has room, and the messages dropped by a full queue are
+ * counted in the LOG.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <unistd.h>
+#include <cstdio>
+#include <fstream>
+#include "logger.h"
+
+namespace {
+
+const int kProducers = 8;
+const std::string kLogPath = "/tmp/tcdb_logger_test.LOG";
+
+// Value of the i-th push of the producer
+uint64_t RingValue(const int producer, const int i) {
+  return static_cast<uint64_t>(producer) << 32 | i;
+}
+
+// Producers push until every value is queued, while the consumer pops. Each
+// producer's values must be popped in order, each exactly once.
+bool TestRingMultiProducer() {
+  printf("<< MPSCRing multiple producers >>\n");
+  const int kPushes = 200000;
+  MPSCRing<uint64_t> ring(1024);
+
+  std::atomic<uint64_t> full_num{0};
+  std::vector<std::thread> producers;
+  for (int t = 0; t < kProducers; ++t) {
+    producers.emplace_back([&, t]() {
+      for (int i = 0; i < kPushes; ++i) {
+        uint64_t value = RingValue(t, i);
+        while (!ring.TryPush(std::move(value))) {
+          ++full_num;
+          std::this_thread::yield();
+        }
+      }
+    });
+  }
+
+  std::vector<int> next(kProducers, 0);
+  int popped = 0, out_of_order = 0;
+  uint64_t value = 0;
+  while (popped < kProducers * kPushes) {
+    if (!ring.TryPop(value)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int producer = value >> 32;
+    out_of_order += static_cast<int>(value & 0xffffffff) != next[producer];
+    next[producer] = (value & 0xffffffff) + 1;
+    ++popped;
+  }
+  for (auto& producer : producers)
+    producer.join();
+
+  printf("  popped %d, out of order %d, full %lu times, head %zu\n", popped,
+         out_of_order, full_num.load(), ring.head());
+  return out_of_order == 0 && !ring.TryPop(value) &&
+         ring.head() == static_cast<size_t>(popped);
+}
+
+// A full ring fails the push and leaves the value to the caller. The
+// positions of the pushes are consecutive.
+bool TestRingFull() {
+  printf("<< MPSCRing full >>\n");
+  MPSCRing<std::string> ring(5);  // Rounded up to 8
+
+  bool passed = true;
+  size_t position = 0;
+  for (size_t i = 0; i < 8; ++i) {
+    std::string value = std::to_string(i);
+    passed = passed && ring.TryPush(std::move(value), &position) &&
+             position == i;
+  }
+
+  std::string value = "rejected";
+  passed = passed && !ring.TryPush(std::move(value)) && value == "rejected";
+
+  std::string popped;
+  passed = passed && ring.TryPop(popped) && popped == "0" && ring.head() == 1;
+  passed = passed && ring.TryPush(std::move(value), &position) &&
+           position == 8 && !ring.TryPush(std::string("more"));
+
+  for (size_t i = 1; passed && i <= 8; ++i)
+    passed = ring.TryPop(popped) && popped == (i < 8 ? std::to_string(i)
+                                                      : "rejected");
+  return passed && !ring.TryPop(popped);
+}
+
+struct LogContent {
+  int messages = 0;
+  int errors = 0;  // Messages of kError
+  int out_of_order = 0;
+  uint64_t reported_dropped = 0;  // Sum of the "Dropped N messages" lines
+  int other_lines = 0;
+};
+
+// Read the messages "p<producer>_<i>" of the LOG
+LogContent ReadLog() {
+  LogContent content;
+  std::vector<int> last(kProducers, -1);
+  std::ifstream log(kLogPath);
+  std::string line;
+  const std::string kDropped = "[Warn] - Dropped ";
+  while (std::getline(log, line)) {
+    if (line.compare(0, kDropped.size(), kDropped) == 0) {
+      content.reported_dropped += std::stoull(line.substr(kDropped.size()));
+      continue;
+    }
+    size_t begin = line.find(" - p"), separator = line.find('_');
+    if (begin == std::string::npos || separator == std::string::npos) {
+      ++content.other_lines;
+      continue;
+    }
+    int producer = std::stoi(line.substr(begin + 4, separator - begin - 4));
+    int i = std::stoi(line.substr(separator + 1));
+    content.out_of_order += i <= last[producer];
+    last[producer] = i;
+    content.errors += line.compare(0, 7, "[Error]") == 0;
+    ++content.messages;
+  }
+  return content;
+}
+
+// Every producer logs the messages, every 100th one at kError. Return the
+// number of the failed Log() calls.
+int LogMessages(TCLogger& logger, const int messages) {
+  std::atomic<int> failed{0};
+  std::vector<std::thread> producers;
+  for (int t = 0; t < kProducers; ++t) {
+    producers.emplace_back([&, t]() {
+      for (int i = 0; i < messages; ++i) {
+        std::string msg = "p" + std::to_string(t) + "_" + std::to_string(i);
+        Status ret = i % 100 == 0 ? logger.Error(msg) : logger.Info(msg);
+        failed += !ret.StatusNoError();
+        logger.Debug("filtered");
+      }
+    });
+  }
+  for (auto& producer : producers)
+    producer.join();
+  return failed;
+}
+
+// With room for all the messages, the LOG has all of them in the order of
+// each producer
+bool TestLoggerNotFull() {
+  printf("<< TCLogger not full >>\n");
+  const int kMessages = 2000;
+  unlink(kLogPath.c_str());
+  int failed = 0;
+  uint64_t dropped = 0;
+  {
+    TCLogger logger(kLogPath, true, kProducers * kMessages);
+    logger.SetLevel(TCLogger::kInfo);
+    failed = LogMessages(logger, kMessages);
+    dropped = logger.dropped();
+  }
+
+  LogContent content = ReadLog();
+  printf("  %d messages, out of order %d, dropped %lu, other lines %d\n",
+         content.messages, content.out_of_order, dropped,
+         content.other_lines);
+  return failed == 0 && dropped == 0 &&
+         content.messages == kProducers * kMessages &&
+         content.out_of_order == 0 && content.reported_dropped == 0 &&
+         content.other_lines == 0;
+}
+
+// A tiny queue drops the messages it has no room for. The Log() calls of
+// the dropped messages fail, and the LOG reports their number. The kError
+// messages are never dropped.
+bool TestLoggerFull() {
+  printf("<< TCLogger full >>\n");
+  const int kMessages = 20000;
+  unlink(kLogPath.c_str());
+  int failed = 0;
+  uint64_t dropped = 0;
+  {
+    TCLogger logger(kLogPath, true, 8);
+    logger.SetLevel(TCLogger::kInfo);
+    failed = LogMessages(logger, kMessages);
+    dropped = logger.dropped();
+  }
+
+  LogContent content = ReadLog();
+  printf("  %d messages, out of order %d, dropped %lu, reported %lu\n",
+         content.messages, content.out_of_order, dropped,
+         content.reported_dropped);
+  return dropped > 0 && failed == static_cast<int>(dropped) &&
+         content.reported_dropped == dropped &&
+         content.messages + dropped == kProducers * kMessages &&
+         content.out_of_order == 0 && content.other_lines == 0 &&
+         content.errors == kProducers * kMessages / 100;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test : {TestRingMultiProducer, TestRingFull, TestLoggerNotFull,
+                    TestLoggerFull}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
@@ -80,6 +80,5 @@ int main() {
   // auto val2 = db.Get(std::string("3895911"));
   // auto val3 = db.Get(std::string("13911206"));
 
-  // db.TestEntryPoint();
   return 0;
 }
\ No newline at end of file
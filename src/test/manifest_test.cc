@@ -0,0 +1,256 @@
+/**
+ * @file manifest_test.cc
+ * @brief Test for the MANIFEST recovery: the snapshot and the edits after it
+ * are replayed, a torn last record is truncated with a warning, a corrupt
+ * record in the middle fails the recovery and the opening of the DB, and the
+ * last entry id and the next file number survive a reopen.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <sys/stat.h>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include "db.h"
+
+namespace {
+
+const std::string kDatabaseDir = "/tmp/tcdb_manifest_test";
+
+// Start every test with an empty database dir
+void ResetDatabaseDir() {
+  std::system(("rm -rf " + kDatabaseDir).c_str());
+}
+
+std::string ManifestPath() {
+  return neko_base::PathJoin(kDatabaseDir, "MANIFEST");
+}
+
+uint64_t ManifestSize() {
+  struct stat file_stat;
+  return stat(ManifestPath().c_str(), &file_stat) == 0 ? file_stat.st_size : 0;
+}
+
+std::string ReadLog() {
+  std::ifstream log(neko_base::PathJoin(kDatabaseDir, "LOG"));
+  std::stringstream content;
+  content << log.rdbuf();
+  return content.str();
+}
+
+// Overwrite the byte at the offset of the MANIFEST with its complement
+void FlipManifestByte(const uint64_t offset) {
+  std::fstream manifest(ManifestPath(),
+                        std::ios::in | std::ios::out | std::ios::binary);
+  manifest.seekg(offset);
+  char byte = manifest.get();
+  manifest.seekp(offset);
+  manifest.put(~byte);
+}
+
+ManifestFormat::VersionEdit Snapshot() {
+  ManifestFormat::VersionEdit snapshot;
+  snapshot.AddFile(1, 0, "A", 1000, "a_min", "a_max");
+  snapshot.AddFile(1, 1, "B", 2000, "b_min", "b_max");
+  snapshot.SetLastEntryID(10);
+  return snapshot;
+}
+
+// Levels 0, 1 and 2 hold D, B and C after the edits
+std::vector<ManifestFormat::VersionEdit> Edits() {
+  std::vector<ManifestFormat::VersionEdit> edits(2);
+  edits[0].DeleteFile(1, "A");
+  edits[0].AddFile(2, 0, "C", 3000, "c_min", "c_max");
+  edits[0].SetLastEntryID(20);
+  edits[1].AddFile(0, 0, "D", 4000, "d_min", "d_max");
+  return edits;
+}
+
+// Write the snapshot and the edits to a new MANIFEST. Return the offsets of
+// the records by reference.
+Status WriteManifest(std::vector<uint64_t>& record_offsets) {
+  TCIO io(kDatabaseDir);
+  record_offsets.clear();
+
+  auto snapshot = Snapshot();
+  record_offsets.push_back(0);
+  Status ret = io.WriteManifest(snapshot);
+  for (auto& edit : Edits()) {
+    if (!ret.StatusNoError())
+      break;
+    record_offsets.push_back(ManifestSize());
+    ret = io.LogManifestEdit(edit);
+  }
+
+  return ret;
+}
+
+// Return true if the recovered files of the level are the names, and the
+// metadata of each file is derived from its name
+bool HasFiles(const ManifestFormat::VersionEdit& snapshot, const int level,
+              const std::vector<std::string>& names) {
+  std::vector<std::string> files;
+  for (auto& file : snapshot.new_files) {
+    if (file.level != level)
+      continue;
+    std::string prefix(1, std::tolower(file.name[0]));
+    if (file.smallest != prefix + "_min" || file.largest != prefix + "_max" ||
+        file.file_size != 1000 * (file.name[0] - 'A' + 1))
+      return false;
+    files.push_back(file.name);
+  }
+  return files == names;
+}
+
+// The snapshot and the edits appended after it are replayed in order
+bool TestSnapshotAndEdits() {
+  printf("<< Snapshot and edits >>\n");
+  ResetDatabaseDir();
+  std::vector<uint64_t> record_offsets;
+  if (!WriteManifest(record_offsets).StatusNoError())
+    return false;
+
+  TCIO io(kDatabaseDir);
+  ManifestFormat::VersionEdit snapshot;
+  Status ret = io.RecoverManifest(snapshot);
+  printf("  recovered %zu files, last entry id %lu\n",
+         snapshot.new_files.size(), snapshot.last_entry_id);
+  return ret.StatusNoError() && snapshot.new_files.size() == 3 &&
+         HasFiles(snapshot, 0, {"D"}) && HasFiles(snapshot, 1, {"B"}) &&
+         HasFiles(snapshot, 2, {"C"}) && snapshot.has_last_entry_id &&
+         snapshot.last_entry_id == 20;
+}
+
+// A crash in the middle of an append leaves a torn last record, which is
+// truncated with a warning. The edits before it are kept, and the next edit
+// is appended after them.
+bool TestTornLastRecord() {
+  printf("<< Torn last record >>\n");
+  ResetDatabaseDir();
+  std::vector<uint64_t> record_offsets;
+  if (!WriteManifest(record_offsets).StatusNoError())
+    return false;
+  if (truncate(ManifestPath().c_str(), ManifestSize() - 3) != 0)
+    return false;
+
+  bool passed = true;
+  {
+    TCIO io(kDatabaseDir);
+    ManifestFormat::VersionEdit snapshot;
+    Status ret = io.RecoverManifest(snapshot);
+    printf("  recovered %zu files, MANIFEST size %lu\n",
+           snapshot.new_files.size(), ManifestSize());
+    passed = ret.StatusNoError() && snapshot.new_files.size() == 2 &&
+             HasFiles(snapshot, 0, {}) && HasFiles(snapshot, 1, {"B"}) &&
+             HasFiles(snapshot, 2, {"C"}) &&
+             ManifestSize() == record_offsets.back();
+
+    ManifestFormat::VersionEdit edit;
+    edit.AddFile(0, 0, "E", 5000, "e_min", "e_max");
+    passed = passed && io.LogManifestEdit(edit).StatusNoError();
+  }
+  passed = passed && ReadLog().find("Truncated the torn MANIFEST record") !=
+                         std::string::npos;
+
+  TCIO io(kDatabaseDir);
+  ManifestFormat::VersionEdit snapshot;
+  Status ret = io.RecoverManifest(snapshot);
+  return passed && ret.StatusNoError() && HasFiles(snapshot, 0, {"E"});
+}
+
+// A corrupt record before the last one is not a torn append. The recovery
+// fails without touching the MANIFEST, and so does the opening of the DB.
+bool TestCorruptMiddleRecord() {
+  printf("<< Corrupt middle record >>\n");
+  ResetDatabaseDir();
+  std::vector<uint64_t> record_offsets;
+  if (!WriteManifest(record_offsets).StatusNoError())
+    return false;
+  uint64_t manifest_size = ManifestSize();
+  FlipManifestByte(record_offsets[1] + ManifestFormat::kRecordHeaderSize);
+
+  Status ret;
+  {
+    TCIO io(kDatabaseDir);
+    ManifestFormat::VersionEdit snapshot;
+    ret = io.RecoverManifest(snapshot);
+    printf("  RecoverManifest: %s\n", ret.ErrMsg().c_str());
+  }
+  bool passed = !ret.StatusNoError() && ret.IsCorruption() &&
+                ret.ErrMsg().find("checksum mismatch") != std::string::npos;
+
+  Config config;
+  config.AddOrUpdateConfig("database_dir", kDatabaseDir);
+  std::unique_ptr<TCDB> db;
+  ret = TCDB::Open(config, db);
+  printf("  TCDB::Open: %s\n", ret.ErrMsg().c_str());
+  return passed && !ret.StatusNoError() && db == nullptr &&
+         ret.ErrMsg().find("checksum mismatch") != std::string::npos &&
+         ManifestSize() == manifest_size;
+}
+
+// The last entry id is the largest one of the edits, and the file numbers
+// allocated after a reopen are not smaller than the recorded next file
+// number, even if the files of the numbers are gone
+bool TestEntryIDAndFileNumber() {
+  printf("<< Last entry id and next file number >>\n");
+  ResetDatabaseDir();
+  const int kFileNum = 5;
+  std::string entry_buffer(64, '\0');
+  InternalEntry::EncodeInternal(Sequence("key", 3), Sequence("value", 5), 0,
+                                InternalEntry::kInsert, &entry_buffer[0]);
+  std::vector<Sequence> entries(
+      1, InternalEntry::EntryData(entry_buffer.data()));
+  {
+    TCIO io(kDatabaseDir);
+    std::string file_basename;
+    uint64_t file_size = 0;
+    for (int i = 0; i < kFileNum; ++i) {
+      if (!io.WriteNewSSTFile(entries, file_basename).StatusNoError() ||
+          !io.DeleteSSTFile(file_basename, file_size).StatusNoError())
+        return false;
+    }
+
+    ManifestFormat::VersionEdit edit;
+    edit.SetLastEntryID(41);
+    if (!io.LogManifestEdit(edit).StatusNoError())
+      return false;
+    edit = ManifestFormat::VersionEdit();
+    edit.SetLastEntryID(7);  // An older flush finishing late
+    if (!io.LogManifestEdit(edit).StatusNoError())
+      return false;
+  }
+
+  TCIO io(kDatabaseDir);
+  ManifestFormat::VersionEdit snapshot;
+  Status ret = io.RecoverManifest(snapshot);
+  std::string file_basename;
+  if (ret.StatusNoError())
+    ret = io.WriteNewSSTFile(entries, file_basename);
+  printf("  last entry id %lu, next file number %lu, new file %s\n",
+         snapshot.last_entry_id, snapshot.next_file_number,
+         file_basename.c_str());
+  return ret.StatusNoError() && snapshot.has_last_entry_id &&
+         snapshot.last_entry_id == 41 &&
+         snapshot.next_file_number == kFileNum &&
+         std::strtoull(file_basename.c_str(), nullptr, 16) == kFileNum;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test : {TestSnapshotAndEdits, TestTornLastRecord,
+                    TestCorruptMiddleRecord, TestEntryIDAndFileNumber}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
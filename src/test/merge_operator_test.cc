@@ -0,0 +1,265 @@
+/**
+ * @file merge_operator_test.cc
+ * @brief Test for the merge operators and the merge operands in the DB: the
+ * built-in operators, the operands of a key spread over the mem_table_ and
+ * the levels, merges after a deletion, and the compactions failing on an
+ * operand when the DB is reopened without its operator.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <cstdio>
+#include <cstdlib>
+#include "db.h"
+
+namespace {
+
+const std::string kDatabaseDir = "/tmp/tcdb_merge_operator_test";
+
+// Start every test with an empty database dir
+void ResetDatabaseDir() {
+  std::system(("rm -rf " + kDatabaseDir).c_str());
+}
+
+Status OpenDB(const std::string& merge_operator, std::unique_ptr<TCDB>& db) {
+  Config config;
+  config.AddOrUpdateConfig("database_dir", kDatabaseDir);
+  config.AddOrUpdateConfig("merge_operator", merge_operator);
+  return TCDB::Open(config, db);
+}
+
+// Flush the mem_table_ to level 0 without compacting any file, since no file
+// overlaps the range
+Status Flush(TCDB& db) {
+  CompactionStats stats;
+  return db.CompactRange(Sequence("~", 1), Sequence("~~", 2), 1, stats);
+}
+
+// Flush the mem_table_ and compact all files down to the level
+Status CompactTo(TCDB& db, const int level) {
+  CompactionStats stats;
+  return db.CompactRange(Sequence(), Sequence(), level, stats);
+}
+
+// Return the number of entries of each level, the empty deeper levels are
+// omitted
+std::vector<uint64_t> LevelEntries(TCDB& db) {
+  std::vector<TableProperties> level_props;
+  std::vector<uint64_t> entries;
+  if (!db.GetLevelProperties(level_props).StatusNoError())
+    return entries;
+  for (auto& props : level_props)
+    entries.push_back(props.num_entries);
+  while (!entries.empty() && entries.back() == 0)
+    entries.pop_back();
+  return entries;
+}
+
+std::string Join(const std::vector<uint64_t>& numbers) {
+  std::string joined;
+  for (auto number : numbers)
+    joined += (joined.empty() ? "" : " ") + std::to_string(number);
+  return joined;
+}
+
+// The built-in operators, and PartialMerge() followed by FullMerge() giving
+// the result of FullMerge() on all operands
+bool TestBuiltinOperators() {
+  printf("<< Built-in operators >>\n");
+  Sequence key("key", 3);
+  std::string value, operand;
+
+  UInt64AddOperator add;
+  std::string base = UInt64AddOperator::Encode(10);
+  std::vector<std::string> numbers = {UInt64AddOperator::Encode(1),
+                                      UInt64AddOperator::Encode(2),
+                                      UInt64AddOperator::Encode(3)};
+  std::vector<Sequence> add_operands(numbers.begin(), numbers.end());
+  Sequence existing(base);
+
+  add.FullMerge(key, &existing, add_operands, value);
+  bool passed = UInt64AddOperator::Decode(value) == 16;
+  add.FullMerge(key, nullptr, add_operands, value);
+  passed = passed && UInt64AddOperator::Decode(value) == 6;
+  add.PartialMerge(key, add_operands[0], add_operands[1], operand);
+  add.FullMerge(key, &existing, {Sequence(operand), add_operands[2]}, value);
+  passed = passed && UInt64AddOperator::Decode(value) == 16;
+
+  // An invalid operand counts as 0
+  add.FullMerge(key, &existing, {Sequence("bad", 3), add_operands[0]}, value);
+  passed = passed && UInt64AddOperator::Decode(value) == 11 &&
+           UInt64AddOperator::Decode(Sequence("bad", 3)) == 0;
+
+  StringAppendOperator append;
+  std::vector<Sequence> append_operands = {Sequence("x", 1), Sequence("y", 1),
+                                           Sequence("z", 1)};
+  Sequence list("a", 1);
+  append.FullMerge(key, &list, append_operands, value);
+  passed = passed && value == "a,x,y,z";
+  append.FullMerge(key, nullptr, append_operands, value);
+  passed = passed && value == "x,y,z";
+  append.PartialMerge(key, append_operands[1], append_operands[2], operand);
+  append.FullMerge(key, &list, {append_operands[0], Sequence(operand)}, value);
+  passed = passed && operand == "y,z" && value == "a,x,y,z";
+
+  StringAppendOperator append_semicolon(';');
+  append_semicolon.FullMerge(key, &list, append_operands, value);
+  return passed && value == "a;x;y;z";
+}
+
+// The operands of a counter in the mem_table_ and at levels 0, 1 and 2 are
+// applied to its value at level 3, and collapsed into the value when all
+// files are compacted
+bool TestOperandsAcrossLevels() {
+  printf("<< Operands across flushes and levels >>\n");
+  ResetDatabaseDir();
+  std::unique_ptr<TCDB> db;
+  if (!OpenDB("uint64_add", db).StatusNoError())
+    return false;
+
+  Sequence key("counter", 7);
+  Status ret = db->Insert(key, UInt64AddOperator::Encode(10));
+  if (ret.StatusNoError())
+    ret = CompactTo(*db, 3);
+  uint64_t expected = 10;
+  for (int level = 2; ret.StatusNoError() && level >= -1; --level) {
+    expected += level + 10;
+    ret = db->Merge(key, UInt64AddOperator::Encode(level + 10));
+    // Leave the last operand in the mem_table_
+    if (ret.StatusNoError() && level > 0)
+      ret = CompactTo(*db, level);
+    else if (ret.StatusNoError() && level == 0)
+      ret = Flush(*db);
+  }
+  if (!ret.StatusNoError())
+    return false;
+
+  uint64_t value = UInt64AddOperator::Decode(db->Get(key));
+  std::string layout = Join(LevelEntries(*db));
+  printf("  value %lu, entries of levels %s\n", value, layout.c_str());
+  bool passed = value == expected && layout == "1 1 1 1";
+
+  ret = CompactTo(*db, 0);
+  value = UInt64AddOperator::Decode(db->Get(key));
+  layout = Join(LevelEntries(*db));
+  printf("  after the full compaction: value %lu, entries of levels %s\n",
+         value, layout.c_str());
+  passed = passed && ret.StatusNoError() && value == expected &&
+           layout == "0 0 0 1";
+
+  // The operands survive a reopen
+  db.reset();
+  return passed && OpenDB("uint64_add", db).StatusNoError() &&
+         UInt64AddOperator::Decode(db->Get(key)) == expected;
+}
+
+// The merges after a deletion start from no value, wherever the deletion and
+// the older value are
+bool TestMergeAfterDelete() {
+  printf("<< Merges after a deletion >>\n");
+  ResetDatabaseDir();
+  std::unique_ptr<TCDB> db;
+  if (!OpenDB("string_append", db).StatusNoError())
+    return false;
+
+  // All in the mem_table_
+  Sequence key("list", 4);
+  Status ret = db->Insert(key, std::string("old"));
+  if (ret.StatusNoError())
+    ret = db->Delete(key);
+  if (ret.StatusNoError())
+    ret = db->Merge(key, std::string("a"));
+  if (ret.StatusNoError())
+    ret = db->Merge(key, std::string("b"));
+  std::string in_memory = db->Get(key);
+
+  // The older value at level 2, the deletion at level 1, the operands at
+  // level 0 and in the mem_table_
+  Sequence other_key("list2", 5);
+  if (ret.StatusNoError())
+    ret = db->Insert(other_key, std::string("old"));
+  if (ret.StatusNoError())
+    ret = db->Merge(other_key, std::string("x"));
+  if (ret.StatusNoError())
+    ret = CompactTo(*db, 2);
+  if (ret.StatusNoError())
+    ret = db->Delete(other_key);
+  if (ret.StatusNoError())
+    ret = CompactTo(*db, 1);
+  if (ret.StatusNoError())
+    ret = db->Merge(other_key, std::string("a"));
+  if (ret.StatusNoError())
+    ret = Flush(*db);
+  if (ret.StatusNoError())
+    ret = db->Merge(other_key, std::string("b"));
+  if (!ret.StatusNoError())
+    return false;
+  std::string in_levels = db->Get(other_key);
+  std::string layout = Join(LevelEntries(*db));
+
+  ret = CompactTo(*db, 0);
+  std::string compacted = db->Get(other_key);
+  printf("  in memory \"%s\", in levels \"%s\" (entries of levels %s), "
+         "compacted \"%s\"\n",
+         in_memory.c_str(), in_levels.c_str(), layout.c_str(),
+         compacted.c_str());
+  return ret.StatusNoError() && in_memory == "a,b" && in_levels == "a,b" &&
+         compacted == "a,b" && db->Get(key) == "a,b";
+}
+
+// A DB reopened without the operator refuses the new merges, and its
+// compactions fail on the old operands instead of dropping the older values.
+// Reopened with the operator, nothing is lost.
+bool TestMissingOperator() {
+  printf("<< Operand without an operator >>\n");
+  ResetDatabaseDir();
+  std::unique_ptr<TCDB> db;
+  if (!OpenDB("string_append", db).StatusNoError())
+    return false;
+
+  Sequence key("list", 4);
+  Status ret = db->Insert(key, std::string("a"));
+  if (ret.StatusNoError())
+    ret = CompactTo(*db, 1);
+  if (ret.StatusNoError())
+    ret = db->Merge(key, std::string("b"));
+  if (ret.StatusNoError())
+    ret = Flush(*db);
+  db.reset();
+  if (!ret.StatusNoError() || !OpenDB("none", db).StatusNoError())
+    return false;
+
+  Status merge_ret = db->Merge(key, std::string("c"));
+  ret = CompactTo(*db, 0);
+  std::string layout = Join(LevelEntries(*db));
+  printf("  Merge: %s\n  CompactRange: %s\n  entries of levels %s\n",
+         merge_ret.ErrMsg().c_str(), ret.ErrMsg().c_str(), layout.c_str());
+  bool passed = !merge_ret.StatusNoError() && !ret.StatusNoError() &&
+                ret.ErrMsg().find("without a merge operator") !=
+                    std::string::npos &&
+                layout == "1 1";
+
+  db.reset();
+  if (!OpenDB("string_append", db).StatusNoError())
+    return false;
+  ret = CompactTo(*db, 0);
+  std::string value = db->Get(key);
+  printf("  reopened with the operator: \"%s\"\n", value.c_str());
+  return passed && ret.StatusNoError() && value == "a,b";
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test : {TestBuiltinOperators, TestOperandsAcrossLevels,
+                    TestMergeAfterDelete, TestMissingOperator}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
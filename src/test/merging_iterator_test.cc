@@ -0,0 +1,251 @@
+/**
+ * @file merging_iterator_test.cc
+ * @brief Test for the k-way merge of the compactions: the LoserTree merges
+ * sorted runs with duplicates stably, and the MergingIterator over the
+ * SSTBlockIterators outputs the entries of several SST files in the global
+ * order, the versions of a key from the oldest to the newest, and equal
+ * entries by the child number (ChildBeats). The ranges of the subcompactions
+ * are covered too.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <tuple>
+#include "merge_iterator.h"
+
+namespace {
+
+const std::string kDatabaseDir = "/tmp/tcdb_merging_iterator_test";
+
+// Beats functor over sorted runs of ints. Equal values are output by the
+// run number, as ChildBeats does.
+struct RunBeats {
+  const std::vector<std::vector<int>>* runs;
+  const std::vector<size_t>* pos;
+
+  bool operator()(const int x, const int y) const {
+    bool x_valid = (*pos)[x] < (*runs)[x].size();
+    bool y_valid = (*pos)[y] < (*runs)[y].size();
+    if (!x_valid || !y_valid)
+      return x_valid;
+    int x_value = (*runs)[x][(*pos)[x]], y_value = (*runs)[y][(*pos)[y]];
+    return x_value < y_value || (x_value == y_value && x < y);
+  }
+};
+
+// Merge k runs of random lengths, including the empty ones, for k of the
+// powers of 2 and the others
+bool TestLoserTree() {
+  printf("<< LoserTree >>\n");
+  std::mt19937 rng(271);
+  int failed = 0;
+  for (int k : {1, 2, 3, 5, 8, 13, 64}) {
+    std::vector<std::vector<int>> runs(k);
+    std::vector<std::pair<int, int>> expected;  // (value, run)
+    for (int i = 0; i < k; ++i) {
+      runs[i].resize(i % 4 == 3 ? 0 : rng() % 200 + 1);
+      for (auto& value : runs[i])
+        value = rng() % 100;  // Many duplicates
+      std::sort(runs[i].begin(), runs[i].end());
+      for (auto value : runs[i])
+        expected.emplace_back(value, i);
+    }
+    std::sort(expected.begin(), expected.end());
+
+    std::vector<size_t> pos(k, 0);
+    LoserTree<RunBeats> tree(k, RunBeats{&runs, &pos});
+    tree.Build();
+    std::vector<std::pair<int, int>> merged;
+    while (pos[tree.Winner()] < runs[tree.Winner()].size()) {
+      int winner = tree.Winner();
+      merged.emplace_back(runs[winner][pos[winner]++], winner);
+      tree.Replay(winner);
+    }
+
+    failed += merged != expected;
+    printf("  k = %d: %zu values\n", k, merged.size());
+  }
+
+  return failed == 0;
+}
+
+// Version of a key in an SST file. The value of the entry names the file.
+struct Version {
+  int key;
+  uint64_t id;
+  int file;
+
+  bool operator<(const Version& other) const {
+    return std::tie(key, id, file) <
+           std::tie(other.key, other.id, other.file);
+  }
+  bool operator==(const Version& other) const {
+    return key == other.key && id == other.id && file == other.file;
+  }
+};
+
+std::string Key(const int key) {
+  char buf[16];
+  snprintf(buf, sizeof(buf), "key_%06d", key);
+  return buf;
+}
+
+// The InternalEntry of the key and the id, as a range bound
+std::string Bound(const int key, const uint64_t id) {
+  std::string key_str = Key(key);
+  std::string buffer(64, '\0');
+  InternalEntry::EncodeInternal(Sequence(key_str), Sequence(), id,
+                                InternalEntry::kDelete, &buffer[0]);
+  Sequence entry = InternalEntry::EntryData(buffer.data());
+  return std::string(entry.data(), entry.size());
+}
+
+class MergingIteratorTest {
+ public:
+  // Write the files of random versions. Some keys have several versions in a
+  // file and in several files. Some versions are written to two files, the
+  // same key with the same id, to exercise the tie-break of the children.
+  explicit MergingIteratorTest(const int file_num)
+      : io_(kDatabaseDir), comparator_(new InternalEntryComparator()) {
+    std::mt19937 rng(272);
+    std::vector<std::vector<Version>> files(file_num);
+    uint64_t next_id = 1;
+    for (int i = 0; i < kVersions; ++i) {
+      Version version{static_cast<int>(rng() % kKeys), next_id++,
+                      static_cast<int>(rng() % file_num)};
+      files[version.file].push_back(version);
+      if (i % 50 == 0 && file_num > 1) {
+        version.file = (version.file + 1 + rng() % (file_num - 1)) % file_num;
+        files[version.file].push_back(version);
+      }
+    }
+
+    for (auto& file : files) {
+      std::sort(file.begin(), file.end());
+      versions_.insert(versions_.end(), file.begin(), file.end());
+      if (write_status_.StatusNoError())
+        write_status_ = WriteFile(file);
+    }
+    std::sort(versions_.begin(), versions_.end());
+  }
+
+  // Merge the files in the range [lower, upper) of InternalEntries, and
+  // compare the output with the sorted versions in the range
+  bool Merge(const std::string& lower, const std::string& upper) {
+    if (!write_status_.StatusNoError())
+      return false;
+
+    std::shared_ptr<MemAllocator> merge_allocator =
+        std::make_shared<MergeAllocator>();
+    std::vector<std::shared_ptr<SSTBlockIterator>> children;
+    for (auto& file_abs_path : file_abs_paths_)
+      children.push_back(std::make_shared<SSTBlockIterator>(
+          io_, file_abs_path, merge_allocator, comparator_, lower, upper));
+    MergingIterator merger(std::move(children), comparator_);
+    Status ret = merger.Init();
+
+    std::vector<Version> merged;
+    int wrong_source = 0;
+    while (ret.StatusNoError() && merger.Valid()) {
+      const char* entry = merger.entry().data();
+      Sequence key = InternalEntry::EntryKey(entry);
+      Sequence value = InternalEntry::EntryValue(entry);
+      Version version{std::atoi(std::string(key.data() + 4, key.size() - 4)
+                                    .c_str()),
+                      InternalEntry::EntryID(entry),
+                      std::atoi(std::string(value.data(), value.size())
+                                    .c_str())};
+      wrong_source += version.file != merger.source();
+      merged.push_back(version);
+
+      // The consumer releases the entry, as the compactions do
+      merge_allocator->Unref(merger.block_id());
+      ret = merger.Next();
+    }
+
+    std::vector<Version> expected;
+    for (auto& version : versions_) {
+      std::string entry = Bound(version.key, version.id);
+      if ((lower.empty() || !comparator_->Less(entry, lower)) &&
+          (upper.empty() || comparator_->Less(entry, upper)))
+        expected.push_back(version);
+    }
+
+    printf("  %zu files, %zu of %zu entries merged, wrong source %d\n",
+           file_abs_paths_.size(), merged.size(), versions_.size(),
+           wrong_source);
+    return ret.StatusNoError() && wrong_source == 0 && merged == expected;
+  }
+
+ private:
+  static const int kKeys = 3000;
+  static const int kVersions = 20000;
+
+  Status WriteFile(const std::vector<Version>& file) {
+    std::vector<std::string> buffers(file.size());
+    std::vector<Sequence> entries;
+    for (int i = 0; i < file.size(); ++i) {
+      std::string key = Key(file[i].key);
+      std::string value = std::to_string(file[i].file);
+      buffers[i].resize(64);
+      InternalEntry::EncodeInternal(Sequence(key), Sequence(value),
+                                    file[i].id, InternalEntry::kInsert,
+                                    &buffers[i][0]);
+      entries.push_back(InternalEntry::EntryData(buffers[i].data()));
+    }
+
+    std::string file_basename;
+    Status ret = io_.WriteNewSSTFile(entries, file_basename);
+    file_abs_paths_.push_back(neko_base::PathJoin(kDatabaseDir, file_basename) +
+                              io_.kSSTFilePostfix);
+    return ret;
+  }
+
+  TCIO io_;
+
+  std::shared_ptr<InternalEntryComparator> comparator_;
+
+  std::vector<std::string> file_abs_paths_;
+
+  Status write_status_;
+
+  // All versions of all files, sorted by key, id and file
+  std::vector<Version> versions_;
+};
+
+// The whole files, and the ranges of the subcompactions, split between the
+// versions of a key and at a key
+bool TestMergingIterator() {
+  printf("<< MergingIterator >>\n");
+  std::system(("rm -rf " + kDatabaseDir).c_str());
+
+  bool passed = true;
+  for (int file_num : {1, 2, 7}) {
+    MergingIteratorTest test(file_num);
+    passed = passed && test.Merge("", "") &&
+             test.Merge(Bound(1000, 0), Bound(2000, 0)) &&
+             test.Merge("", Bound(1500, 10000)) &&
+             test.Merge(Bound(1500, 10000), "");
+  }
+  return passed;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test : {TestLoserTree, TestMergingIterator}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
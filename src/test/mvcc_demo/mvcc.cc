@@ -9,8 +9,10 @@ int main(int argc, char* argv[]) {
   RAIILock lock(mtx);
   TCIO mvcc_io(config.GetConfig("database_dir"));
 
+  ManifestFormat::VersionEdit snapshot;
+  mvcc_io.RecoverManifest(snapshot);
   Manifest manifest;
-  mvcc_io.ReadManifest(manifest);
+  ManifestFormat::Apply(snapshot, manifest);
 
   TCVersion ver1(manifest);
   TCVersion ver2(manifest);
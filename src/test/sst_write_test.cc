@@ -0,0 +1,77 @@
+/**
+ * @file sst_write_test.cc
+ * @brief Write performance test of the SST files, with and without the
+ * incremental writeback of bytes_per_sync. Each file is synced before it is
+ * closed, as the flushes and compactions do.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include "io.h"
+
+namespace {
+
+const int kEntryNum = 400000;
+const int kFileNum = 5;
+const size_t kValueSize = 100;
+
+// Return the write throughput in MB/s
+double SSTWriteTest(TCIO& io, const std::vector<Sequence>& entries,
+                    const uint64_t bytes_per_sync) {
+  io.SetBytesPerSync(bytes_per_sync);
+
+  uint64_t bytes = 0, file_size = 0;
+  std::vector<std::string> files(kFileNum);
+  auto begin = std::chrono::steady_clock::now();
+  for (auto& file : files) {
+    Status ret = io.WriteNewSSTFile(entries, file);
+    if (!ret.StatusNoError()) {
+      std::cout << "Write failed: " << ret.ErrMsg() << "\n";
+      return 0;
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  for (auto& file : files) {
+    io.DeleteSSTFile(file, file_size);
+    bytes += file_size;
+  }
+  return bytes / std::chrono::duration<double>(end - begin).count() / 1e6;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  TCIO io("/tmp/tcdb_sst_write_test");
+
+  std::cout << "<< Running SST write test >>\n";
+
+  // The entries are encoded once and shared by all the files
+  std::string value(kValueSize, 'v');
+  std::vector<std::string> buffers(kEntryNum);
+  std::vector<Sequence> entries;
+  for (int i = 0; i < kEntryNum; ++i) {
+    char key[16];
+    snprintf(key, sizeof(key), "key_%08d", i);
+    buffers[i].resize(32 + kValueSize);
+    InternalEntry::EncodeInternal(Sequence(key, strlen(key)),
+                                  Sequence(value.data(), value.size()), i,
+                                  InternalEntry::kInsert, &buffers[i][0]);
+    entries.push_back(InternalEntry::EntryData(buffers[i].data()));
+  }
+
+  for (uint64_t bytes_per_sync : {0, 1 << 20}) {
+    double throughput = SSTWriteTest(io, entries, bytes_per_sync);
+    std::cout << "Write throughput: " << throughput
+              << " MB/s (bytes_per_sync = " << bytes_per_sync
+              << ", file_num = " << kFileNum << ")\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+/**
+ * @file thread_pool_test.cc
+ * @brief Stress test for the TCThreadPool: the back-pressure of
+ * kMaxTaskQueueSize, ParallelFor() nested in the tasks of the pool,
+ * SubmitTaskNoWait() on a full pool, and Shutdown() running the queued tasks.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <chrono>
+#include <cstdio>
+#include "thread_pool.h"
+
+namespace {
+
+// Block the tasks that wait on it until Open() is called
+class Gate {
+ public:
+  void Wait() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    cv_.wait(lock, [this]() { return open_; });
+  }
+
+  void Open() {
+    std::lock_guard<std::mutex> lock(mtx_);
+    open_ = true;
+    cv_.notify_all();
+  }
+
+ private:
+  std::mutex mtx_;
+  std::condition_variable cv_;
+  bool open_ = false;
+};
+
+const int kQueueSize = 64;
+const auto kBlockedTime = std::chrono::milliseconds(200);
+
+// Futures of many external submitters return the results of their tasks
+bool TestSubmitTask() {
+  printf("<< SubmitTask >>\n");
+  const int kSubmitters = 4, kTasks = 20000;
+  TCThreadPool pool(4, kQueueSize);
+  pool.Start();
+
+  std::atomic<long> sum{0};
+  std::atomic<int> bad{0};
+  std::vector<std::thread> submitters;
+  for (int t = 0; t < kSubmitters; ++t) {
+    submitters.emplace_back([&]() {
+      std::vector<std::future<int>> results;
+      for (int i = 0; i < kTasks; ++i)
+        results.push_back(pool.SubmitTask(
+            [&sum](const int x) {
+              sum += x;
+              return x * 2;
+            },
+            i));
+      for (int i = 0; i < kTasks; ++i)
+        bad += results[i].get() != i * 2;
+    });
+  }
+  for (auto& submitter : submitters)
+    submitter.join();
+  pool.Shutdown();
+
+  printf("  sum %ld, wrong results %d\n", sum.load(), bad.load());
+  return bad == 0 && sum == 1L * kSubmitters * kTasks * (kTasks - 1) / 2;
+}
+
+// A submission to a full pool blocks until a task is started, while
+// SubmitTaskNoWait() returns at once
+bool TestBackPressure() {
+  printf("<< Back-pressure >>\n");
+  TCThreadPool pool(1, kQueueSize);
+  pool.Start();
+
+  // Occupy the only thread, then fill the queue
+  Gate gate;
+  std::atomic<int> ran{0};
+  std::atomic<bool> started{false};
+  pool.SubmitTask([&]() {
+    started = true;
+    gate.Wait();
+  });
+  while (!started)
+    std::this_thread::yield();
+  for (int i = 0; i < kQueueSize; ++i)
+    pool.SubmitTask([&]() { ++ran; });
+
+  std::atomic<bool> submitted{false};
+  std::thread submitter([&]() {
+    pool.SubmitTask([&]() { ++ran; });
+    submitted = true;
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  auto no_wait = pool.SubmitTaskNoWait([&]() { ++ran; });
+  bool no_wait_blocked = std::chrono::steady_clock::now() - start >=
+                         kBlockedTime;
+
+  std::this_thread::sleep_for(kBlockedTime);
+  bool blocked = !submitted;
+
+  gate.Open();
+  submitter.join();
+  no_wait.get();
+  pool.Shutdown();
+
+  printf("  blocked %d, no-wait blocked %d, ran %d\n", blocked,
+         no_wait_blocked, ran.load());
+  return blocked && !no_wait_blocked && ran == kQueueSize + 2;
+}
+
+// ParallelFor() called from every thread of the pool at once, whose
+// functions submit further tasks, must not deadlock on the full pool
+bool TestNestedParallelFor() {
+  printf("<< Nested ParallelFor >>\n");
+  const int kOuter = 64, kInner = 32;
+  TCThreadPool pool(4, kQueueSize / 8);
+  pool.Start();
+
+  std::atomic<int> count{0};
+  std::vector<std::future<void>> results;
+  for (int i = 0; i < kOuter; ++i) {
+    results.push_back(pool.SubmitTask([&]() {
+      pool.ParallelFor(kInner, [&](const int) {
+        ++count;
+        pool.SubmitTask([&]() { ++count; });
+      });
+    }));
+  }
+  for (auto& result : results)
+    result.get();
+  pool.Shutdown();
+
+  printf("  count %d\n", count.load());
+  return count == kOuter * kInner * 2;
+}
+
+// Shutdown() runs every task queued before it, also from the destructor
+bool TestShutdownDrain() {
+  printf("<< Shutdown drain >>\n");
+  const int kTasks = 1000;
+  std::atomic<int> ran{0};
+  {
+    TCThreadPool pool(2, 0);
+    pool.Start();
+    for (int i = 0; i < kTasks; ++i) {
+      pool.SubmitTaskNoWait([&]() {
+        std::this_thread::sleep_for(std::chrono::microseconds(10));
+        ++ran;
+      });
+    }
+    pool.Shutdown();
+  }
+  int ran_by_shutdown = ran;
+
+  {
+    TCThreadPool pool(2, 0);
+    pool.Start();
+    for (int i = 0; i < kTasks; ++i)
+      pool.SubmitTask([&]() { ++ran; });
+  }
+
+  printf("  ran by Shutdown() %d, by the destructor %d\n", ran_by_shutdown,
+         ran - ran_by_shutdown);
+  return ran_by_shutdown == kTasks && ran == 2 * kTasks;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int failed = 0;
+  for (auto test : {TestSubmitTask, TestBackPressure, TestNestedParallelFor,
+                    TestShutdownDrain}) {
+    bool passed = test();
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file universal_compaction_test.cc
+ * @brief Test for the universal compaction picker: every picked compaction
+ * must reduce the number of sorted runs, however many files its outputs are
+ * cut into. The compactions are applied to the MANIFEST by the test, the SST
+ * files are never written.
+ * @version 0.1
+ * @date 2026-10-19
+ *
+ * @copyright Copyright (c) 2026
+ *
+ */
+#include <cstdio>
+#include <cstring>
+#include "compaction.h"
+
+namespace {
+
+const uint64_t kSSTFileSize = DataFileFormat::kApproximateSSTFileSize;
+
+// The InternalEntry of the key "key_<k>"
+std::string Entry(const int k) {
+  char key[16];
+  snprintf(key, sizeof(key), "key_%06d", k);
+  std::string buffer(64, '\0');
+  InternalEntry::EncodeInternal(Sequence(key, strlen(key)), Sequence(), 0,
+                                InternalEntry::kInsert, &buffer[0]);
+  Sequence entry = InternalEntry::EntryData(buffer.data());
+  return std::string(entry.data(), entry.size());
+}
+
+class UniversalCompactionTest {
+ public:
+  UniversalCompactionTest(TCIO& io, const UniversalCompactionOptions& options)
+      : picker_(io, std::make_shared<InternalEntryComparator>(),
+                LevelCompactionOptions(), kSSTFileSize,
+                TCCompactionPicker::kMinOverlappingRatio,
+                TCCompactionPicker::kCompactionStyleUniversal, options) {
+    manifest_.data_files.resize(LevelCompactionOptions().num_levels);
+  }
+
+  // Append a file of the keys [lo, hi] to the level, level 0 files from the
+  // oldest to the newest and other files ordered by key
+  void AddFile(const int level, const int lo, const int hi,
+               const uint64_t file_size) {
+    std::string name = std::to_string(next_file_++);
+    FileMetaData meta;
+    meta.file_size = file_size;
+    meta.smallest = Entry(lo);
+    meta.largest = Entry(hi);
+    picker_.AddFileMeta(name, meta);
+    manifest_.data_files[level].push_back(name);
+    ranges_[name] = std::make_pair(lo, hi);
+  }
+
+  int SortedRunNum() const {
+    int runs = manifest_.data_files[0].size();
+    for (int level = 1; level < manifest_.data_files.size(); ++level)
+      runs += !manifest_.data_files[level].empty();
+    return runs;
+  }
+
+  // Pick and apply the compactions until none is picked. Return false if a
+  // compaction does not reduce the number of runs.
+  bool CompactAll() {
+    for (int round = 0; round < kMaxRounds; ++round) {
+      CompactionTask task;
+      if (!picker_.PickCompaction(manifest_, task))
+        return true;
+
+      int runs_before = SortedRunNum();
+      Apply(task);
+      picker_.ReleaseCompaction(task);
+      printf("  round %d: level %d -> level %d, runs %d -> %d\n", round,
+             task.level, task.output_level, runs_before, SortedRunNum());
+      if (SortedRunNum() >= runs_before)
+        return false;
+    }
+    return false;
+  }
+
+  bool HasFile(const int level, const std::string& name) const {
+    const auto& files = manifest_.data_files[level];
+    return std::find(files.begin(), files.end(), name) != files.end();
+  }
+
+ private:
+  static constexpr int kMaxRounds = 16;
+
+  // Replace the inputs by outputs of kSSTFileSize each at the output level,
+  // as TCDB::InstallCompaction() does
+  void Apply(const CompactionTask& task) {
+    int lo = std::numeric_limits<int>::max(), hi = 0;
+    uint64_t bytes = 0;
+    for (auto inputs : {&task.level_inputs, &task.next_level_inputs}) {
+      for (auto& file : *inputs) {
+        FileMetaData meta;
+        picker_.GetFileMeta(file, meta);
+        bytes += meta.file_size;
+        lo = std::min(lo, ranges_[file].first);
+        hi = std::max(hi, ranges_[file].second);
+        for (auto& files : manifest_.data_files)
+          files.erase(std::remove(files.begin(), files.end(), file),
+                      files.end());
+        picker_.EvictFileMeta(file);
+      }
+    }
+
+    int output_num = (bytes + kSSTFileSize - 1) / kSSTFileSize;
+    auto& files = manifest_.data_files[task.output_level];
+    std::vector<std::string> outputs;
+    for (int i = 0; i < output_num; ++i) {
+      int out_lo = lo + (hi - lo + 1) * i / output_num;
+      int out_hi = lo + (hi - lo + 1) * (i + 1) / output_num - 1;
+      AddFile(task.output_level, out_lo, out_hi,
+              std::min(bytes - i * kSSTFileSize, kSSTFileSize));
+      outputs.push_back(files.back());
+      files.pop_back();
+    }
+
+    // Keep the files above level 0 ordered by key
+    int insert_index = 0;
+    while (insert_index < files.size() &&
+           ranges_[files[insert_index]].second < lo)
+      ++insert_index;
+    files.insert(files.begin() + insert_index, outputs.begin(), outputs.end());
+  }
+
+  TCCompactionPicker picker_;
+  Manifest manifest_;
+  std::unordered_map<std::string, std::pair<int, int>> ranges_;
+  int next_file_ = 1;
+};
+
+UniversalCompactionOptions CountOnlyOptions(const int max_sorted_runs) {
+  // Neither the size amplification nor the size ratio picks anything below,
+  // the newest runs are merged by the number of runs
+  UniversalCompactionOptions options;
+  options.max_sorted_runs = max_sorted_runs;
+  options.max_size_amplification_percent = 1000000;
+  return options;
+}
+
+// The newest level 0 runs are merged, and an older level 0 run is next
+bool TestOlderLevel0Run(TCIO& io) {
+  printf("<< Older level 0 run >>\n");
+  UniversalCompactionTest test(io, CountOnlyOptions(2));
+  test.AddFile(0, 0, 999, 4 * kSSTFileSize);
+  test.AddFile(0, 0, 999, 3 * kSSTFileSize);
+  test.AddFile(0, 0, 999, kSSTFileSize);
+  return test.CompactAll() && test.SortedRunNum() <= 2;
+}
+
+// The newest level 0 runs are merged, and level 1 is next
+bool TestLevel1Run(TCIO& io) {
+  printf("<< Level 1 run >>\n");
+  UniversalCompactionTest test(io, CountOnlyOptions(3));
+  test.AddFile(5, 0, 9999, 64 * kSSTFileSize);
+  test.AddFile(1, 0, 999, 8 * kSSTFileSize);
+  test.AddFile(1, 5000, 5999, 8 * kSSTFileSize);
+  test.AddFile(0, 100, 899, 3 * kSSTFileSize);
+  test.AddFile(0, 200, 799, kSSTFileSize);
+  // The level 1 file out of the range of level 0 is not rewritten
+  return test.CompactAll() && test.SortedRunNum() <= 3 &&
+         test.HasFile(1, "3");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  TCIO io("/tmp/tcdb_universal_compaction_test");
+
+  int failed = 0;
+  for (auto test : {TestOlderLevel0Run, TestLevel1Run}) {
+    bool passed = test(io);
+    printf("%s\n", passed ? "PASSED" : "FAILED");
+    failed += !passed;
+  }
+
+  return failed == 0 ? 0 : 1;
+}
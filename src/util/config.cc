@@ -4,6 +4,43 @@ Config::Config() {
   AddOrUpdateConfig("database_dir", kDefaultDatabaseDir);
   AddOrUpdateConfig("default_core_thread_num", kDefaultThreadPoolCoreNum);
   AddOrUpdateConfig("max_task_queue_size", kDefaultMaxTaskQueueSize);
+  AddOrUpdateConfig("memtable_filter_size", kDefaultMemTableFilterSize);
+  AddOrUpdateConfig("max_subcompactions", kDefaultMaxSubcompactions);
+  AddOrUpdateConfig("max_background_compactions",
+                    kDefaultMaxBackgroundCompactions);
+  AddOrUpdateConfig("compaction_pri", kDefaultCompactionPri);
+  AddOrUpdateConfig("compaction_style", kDefaultCompactionStyle);
+  AddOrUpdateConfig("num_levels", kDefaultNumLevels);
+  AddOrUpdateConfig("level0_file_num_compaction_trigger",
+                    kDefaultLevel0FileNumCompactionTrigger);
+  AddOrUpdateConfig("max_bytes_for_level_base", kDefaultMaxBytesForLevelBase);
+  AddOrUpdateConfig("max_bytes_for_level_multiplier",
+                    kDefaultMaxBytesForLevelMultiplier);
+  AddOrUpdateConfig("level_compaction_dynamic_level_bytes",
+                    kDefaultLevelCompactionDynamicLevelBytes);
+  AddOrUpdateConfig("tombstone_ratio_threshold",
+                    kDefaultTombstoneRatioThreshold);
+  AddOrUpdateConfig("universal_size_ratio", kDefaultUniversalSizeRatio);
+  AddOrUpdateConfig("universal_min_merge_width",
+                    kDefaultUniversalMinMergeWidth);
+  AddOrUpdateConfig("universal_max_sorted_runs",
+                    kDefaultUniversalMaxSortedRuns);
+  AddOrUpdateConfig("universal_max_size_amplification_percent",
+                    kDefaultUniversalMaxSizeAmplificationPercent);
+  AddOrUpdateConfig("rate_limiter_bytes_per_sec",
+                    kDefaultRateLimiterBytesPerSec);
+  AddOrUpdateConfig("compaction_io_priority", kDefaultCompactionIOPriority);
+  AddOrUpdateConfig("file_deletion_rate", kDefaultFileDeletionRate);
+  AddOrUpdateConfig("compaction_filter_ttl", kDefaultCompactionFilterTTL);
+  AddOrUpdateConfig("merge_operator", kDefaultMergeOperator);
+  AddOrUpdateConfig("compression", kDefaultCompression);
+  AddOrUpdateConfig("block_cache_size", kDefaultBlockCacheSize);
+  AddOrUpdateConfig("verify_checksums", kDefaultVerifyChecksums);
+  AddOrUpdateConfig("writer_buffer_size", kDefaultWriterBufferSize);
+  AddOrUpdateConfig("bytes_per_sync", kDefaultBytesPerSync);
+  AddOrUpdateConfig("log_level", kDefaultLogLevel);
+  AddOrUpdateConfig("use_direct_io_for_flush_and_compaction",
+                    kDefaultUseDirectIOForFlushAndCompaction);
 }
 
 Config::~Config() {}
@@ -1,40 +1,129 @@
 #include "logger.h"
 
-TCLogger::TCLogger(const std::string& log_path) {
-  log_writer_ = std::make_shared<SequentialWriter>(
-      new DBFile(log_path, DBFile::Mode::kAppend));
+TCLogger::TCLogger(const std::string& log_path, const bool async_log,
+                   const size_t queue_capacity)
+    : log_path_(log_path),
+      async_log_(async_log),
+      queue_(async_log ? queue_capacity : 1) {
+  log_writer_ = std::make_shared<WritableFile>(
+      new DBFile(log_path, DBFile::Mode::kAppend), kLogBufferSize);
+  log_writer_->SetPreallocationBlockSize(kLogPreallocationBlockSize);
+
+  if (async_log_)
+    flush_thread_ = std::thread(&TCLogger::BackgroundFlush, this);
+}
+
+TCLogger::~TCLogger() {
+  if (flush_thread_.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(flush_mutex_);
+      stop_ = true;
+    }
+    flush_cv_.notify_one();
+    flush_thread_.join();
+  }
+}
+
+TCLogger::LogLevel TCLogger::LevelFromName(const std::string& name) {
+  if (name == "info")
+    return kInfo;
+  if (name == "warn")
+    return kWarn;
+  if (name == "error")
+    return kError;
+  if (name == "fatal")
+    return kFatal;
+  return kDebug;
 }
 
-Status TCLogger::Debug(const std::string& msg) {
-  Status ret;
+Status TCLogger::Debug(const std::string& msg) { return Log(kDebug, msg); }
+
+Status TCLogger::Info(const std::string& msg) { return Log(kInfo, msg); }
+
+Status TCLogger::Warn(const std::string& msg) { return Log(kWarn, msg); }
+
+Status TCLogger::Error(const std::string& msg) { return Log(kError, msg); }
+
+Status TCLogger::Fatal(const std::string& msg) { return Log(kFatal, msg); }
+
+Status TCLogger::Log(const LogLevel level, const std::string& msg) {
+  if (!Enabled(level))
+    return Status::NoError();
 
-  auto log_msg = FormatMsg(msg, kDebug);
+  auto log_msg = FormatMsg(msg, level);
 
   if (!async_log_) {
-    ret = log_writer_->WriteFragment(log_msg);
+    // The message is flushed at once, so that it survives a crash
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    Status ret = log_writer_->Append(log_msg);
+    if (ret.StatusNoError())
+      ret = log_writer_->Flush();
+    return ret;
   }
 
-  return ret;
-}
+  if (level >= kError) {
+    // Write the queue up to the message at once, so that it survives a crash
+    // and follows the older messages. The pushes before it are finishing. A
+    // full queue is drained until the message finds room.
+    size_t position = 0;
+    bool queued = queue_.TryPush(std::move(log_msg), &position);
+    std::lock_guard<std::mutex> lock(log_mutex_);
+    while (!queued || queue_.head() <= position) {
+      Drain();
+      if (!queued)
+        queued = queue_.TryPush(std::move(log_msg), &position);
+      else
+        std::this_thread::yield();
+    }
+    return Status::NoError();
+  }
 
-Status TCLogger::Info(const std::string& msg) {
-  // TODO
-  return Debug(msg);
-}
+  if (!queue_.TryPush(std::move(log_msg))) {
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    return Status::UndefinedError("Log queue is full, the message is dropped");
+  }
 
-Status TCLogger::Warn(const std::string& msg) {
-  // TODO
-  return Debug(msg);
+  return Status::NoError();
 }
 
-Status TCLogger::Error(const std::string& msg) {
-  // TODO
-  return Debug(msg);
+void TCLogger::BackgroundFlush() {
+  std::unique_lock<std::mutex> lock(flush_mutex_);
+  while (!stop_) {
+    flush_cv_.wait_for(lock, std::chrono::milliseconds(kFlushIntervalMs));
+    lock.unlock();
+    {
+      std::lock_guard<std::mutex> log_lock(log_mutex_);
+      Drain();
+    }
+    lock.lock();
+  }
+  lock.unlock();
+
+  // The messages queued before stop_
+  std::lock_guard<std::mutex> log_lock(log_mutex_);
+  Drain();
 }
 
-Status TCLogger::Fatal(const std::string& msg) {
-  // TODO
-  return Debug(msg);
+void TCLogger::Drain() {
+  std::string log_msg;
+  bool written = false;
+  while (queue_.TryPop(log_msg)) {
+    log_writer_->Append(log_msg);
+    written = true;
+  }
+
+  uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+  if (dropped != reported_dropped_) {
+    log_writer_->Append(FormatMsg(
+        "Dropped " + std::to_string(dropped - reported_dropped_) +
+            " messages of the full log queue",
+        kWarn));
+    reported_dropped_ = dropped;
+    written = true;
+  }
+
+  if (written)
+    log_writer_->Flush();
 }
 
 std::string TCLogger::FormatMsg(const std::string& msg, const LogLevel& level) {
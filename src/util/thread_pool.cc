@@ -68,13 +68,20 @@ void ThreadPool::BackgroundThreadTask() {
   }
 }
 
+thread_local const TCThreadPool* TCThreadPool::current_pool_ = nullptr;
+thread_local int TCThreadPool::current_worker_ = -1;
+
 TCThreadPool::TCThreadPool() : TCThreadPool(0, 0) {}
 
 TCThreadPool::TCThreadPool(const int default_core_thread_num,
                            const int max_task_queue_size)
     : kDefaultCoreThreadNum(default_core_thread_num),
       kMaxTaskQueueSize(max_task_queue_size),
-      is_thread_pool_running_(false) {}
+      is_thread_pool_running_(false) {
+  // The tasks submitted before Start() wait in the queues
+  for (int i = 0; i < std::max(kDefaultCoreThreadNum, 1); ++i)
+    queues_.emplace_back(new WorkerQueue());
+}
 
 TCThreadPool::~TCThreadPool() {
   Shutdown();
@@ -82,37 +89,144 @@ TCThreadPool::~TCThreadPool() {
 
 void TCThreadPool::Start() {
   std::unique_lock<std::mutex> lock(mtx_);
+  if (is_shut_down_.load())
+    return;
 
   // Set flag
   is_thread_pool_running_.store(true);
 
-  while (thread_queue_.size() < kDefaultCoreThreadNum) {
-    thread_queue_.emplace_back(&TCThreadPool::BackgroundThreadTask, this);
-    thread_queue_.back().detach();
-  }
-
-  cv_.notify_all();
+  while (thread_queue_.size() < kDefaultCoreThreadNum)
+    thread_queue_.emplace_back(&TCThreadPool::BackgroundThreadTask, this,
+                               static_cast<int>(thread_queue_.size()));
 }
 
 void TCThreadPool::Shutdown() {
-  // Reset flag
-  is_thread_pool_running_.store(false);
+  {
+    std::lock_guard<std::mutex> lock(mtx_);
+    if (is_shut_down_.exchange(true))
+      return;
+    // Reset flag
+    is_thread_pool_running_.store(false);
+  }
 
-  // Wake up all threads
+  // Wake up all threads and blocked submitters
   cv_.notify_all();
+  space_cv_.notify_all();
+
+  for (auto& thread : thread_queue_) {
+    if (thread.get_id() == std::this_thread::get_id())
+      thread.detach();  // Shut down by its own task
+    else
+      thread.join();
+  }
+  thread_queue_.clear();
 }
 
-void TCThreadPool::BackgroundThreadTask() {
-  while (is_thread_pool_running_.load()) {
+void TCThreadPool::Schedule(TCTask&& task, const bool wait_for_space) {
+  int worker = CurrentWorker();
+
+  if (wait_for_space && !HasSpace() && worker < 0 &&
+      is_thread_pool_running_.load()) {
+    // Back-pressure on the submitters from the outside
     std::unique_lock<std::mutex> lock(mtx_);
-    while (is_thread_pool_running_.load() && task_queue_.empty()) {
-      cv_.wait(lock);
+    ++blocked_submitters_;
+    space_cv_.wait(lock, [this]() {
+      return HasSpace() || !is_thread_pool_running_.load();
+    });
+    --blocked_submitters_;
+  }
+
+  // A thread of the pool runs the task itself rather than waiting for its
+  // own pool, and nothing runs the tasks after Shutdown()
+  if ((wait_for_space && !HasSpace() && worker >= 0) ||
+      is_shut_down_.load()) {
+    task();
+    return;
+  }
+
+  WorkerQueue& queue =
+      *queues_[worker >= 0 ? worker : next_queue_++ % queues_.size()];
+  {
+    std::lock_guard<std::mutex> lock(queue.mtx);
+    queue.tasks.push_back(std::move(task));
+  }
+
+  // Counted after the push, so that a thread woken by the count finds it
+  ++pending_tasks_;
+  if (idle_threads_.load() > 0) {
+    // Taking mtx_ makes sure that the idle thread is waiting or will see the
+    // count. Notify out of it, so that the woken thread does not block on it.
+    { std::lock_guard<std::mutex> lock(mtx_); }
+    cv_.notify_one();
+  }
+}
+
+bool TCThreadPool::PopOrSteal(const int worker, TCTask& task) {
+  bool found = false;
+  {
+    WorkerQueue& own = *queues_[worker];
+    std::lock_guard<std::mutex> lock(own.mtx);
+    if (!own.tasks.empty()) {
+      task = std::move(own.tasks.back());
+      own.tasks.pop_back();
+      found = true;
     }
+  }
+
+  for (int i = 1; !found && i < queues_.size(); ++i) {
+    WorkerQueue& victim = *queues_[(worker + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mtx);
+    if (!victim.tasks.empty()) {
+      task = std::move(victim.tasks.front());
+      victim.tasks.pop_front();
+      found = true;
+    }
+  }
 
-    std::function<void()> task;
+  if (found) {
+    --pending_tasks_;
+    if (blocked_submitters_.load() > 0) {
+      { std::lock_guard<std::mutex> lock(mtx_); }
+      space_cv_.notify_all();
+    }
+  }
+
+  return found;
+}
 
-    if (task_queue_.Dequeue(task)) {
+void TCThreadPool::BackgroundThreadTask(const int worker) {
+  current_pool_ = this;
+  current_worker_ = worker;
+
+  TCTask task;
+  int spins = 0;
+  while (true) {
+    if (PopOrSteal(worker, task)) {
+      // Execute the task without holding any lock, and release what it
+      // holds at once
       task();
+      task = TCTask();
+      spins = 0;
+      continue;
+    }
+
+    // A task often follows shortly, catch it without a sleep and a wakeup
+    if (pending_tasks_.load() > 0 || ++spins < kSpinRounds) {
+      std::this_thread::yield();
+      continue;
     }
+    spins = 0;
+
+    // Sleep until a task is counted, the queues are drained before exiting
+    std::unique_lock<std::mutex> lock(mtx_);
+    ++idle_threads_;
+    cv_.wait(lock, [this]() {
+      return pending_tasks_.load() > 0 || !is_thread_pool_running_.load();
+    });
+    --idle_threads_;
+    if (!is_thread_pool_running_.load() && pending_tasks_.load() == 0)
+      break;
   }
-}
\ No newline at end of file
+
+  current_pool_ = nullptr;
+}